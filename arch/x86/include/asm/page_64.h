@@ -54,6 +54,9 @@ static inline void clear_page(void *page)
 			   : "cc", "memory", "rax", "rcx");
 }
 
+void clear_page_nocache(void *page);
+#define clear_page_nocache clear_page_nocache
+
 void copy_page(void *to, void *from);
 
 #endif	/* !__ASSEMBLY__ */
@@ -1173,6 +1173,10 @@ void do_user_addr_fault(struct pt_regs *regs,
 	struct mm_struct *mm;
 	vm_fault_t fault, major = 0;
 	unsigned int flags = FAULT_FLAG_DEFAULT;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	struct vm_area_struct pvma;
+	unsigned long seq;
+#endif
 
 	tsk = current;
 	mm = tsk->mm;
@@ -1252,6 +1256,31 @@ void do_user_addr_fault(struct pt_regs *regs,
 	}
 #endif
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	/*
+	 * Try to handle user faults without mmap_lock first. Anything the
+	 * speculative path can't handle, including bad accesses, is retried
+	 * below with mmap_lock held.
+	 */
+	if (user_mode(regs)) {
+		if (!get_vma_speculative(mm, address, &pvma, &seq))
+			goto spf_abort;
+		if (unlikely(access_error(hw_error_code, &pvma))) {
+			put_vma_speculative(&pvma);
+			goto spf_abort;
+		}
+		fault = handle_speculative_fault(&pvma, address, flags, seq);
+		put_vma_speculative(&pvma);
+		if (!(fault & VM_FAULT_RETRY)) {
+			count_vm_event(SPF_SUCCESS);
+			major |= fault & VM_FAULT_MAJOR;
+			goto done;
+		}
+spf_abort:
+		count_vm_event(SPF_ABORT);
+	}
+#endif
+
 	/*
 	 * Kernel-mode access to the user address space should only occur
 	 * on well-defined single instructions listed in the exception
@@ -1351,6 +1380,9 @@ void do_user_addr_fault(struct pt_regs *regs,
 		return;
 	}
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+done:
+#endif
 	/*
 	 * Major/minor page fault accounting. If any of the events
 	 * returned VM_FAULT_MAJOR, we account it as a major fault.
@@ -392,6 +392,70 @@ static ssize_t writeback_limit_show(struct device *dev,
 	return scnprintf(buf, PAGE_SIZE, "%llu\n", val);
 }
 
+static ssize_t writeback_batch_size_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	unsigned int val;
+
+	if (kstrtouint(buf, 10, &val))
+		return -EINVAL;
+
+	if (!val || val > BIO_MAX_PAGES)
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	zram->wb_batch_size = val;
+	up_write(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t writeback_batch_size_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	unsigned int val;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	val = zram->wb_batch_size;
+	up_read(&zram->init_lock);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n", val);
+}
+
+static ssize_t writeback_max_inflight_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	unsigned int val;
+
+	if (kstrtouint(buf, 10, &val))
+		return -EINVAL;
+
+	if (!val || val > ZRAM_WB_MAX_INFLIGHT)
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	zram->wb_max_inflight = val;
+	up_write(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t writeback_max_inflight_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	unsigned int val;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	val = zram->wb_max_inflight;
+	up_read(&zram->init_lock);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n", val);
+}
+
 static void reset_bdev(struct zram *zram)
 {
 	struct block_device *bdev;
@@ -553,19 +617,39 @@ static ssize_t backing_dev_store(struct device *dev,
 	return err;
 }
 
-static unsigned long alloc_block_bdev(struct zram *zram)
+/*
+ * Reserve up to *@nr contiguous blocks on the backing device. A run of the
+ * full requested length is preferred so that writeback can issue large
+ * bios; otherwise the first free run is taken. On return *@nr holds the
+ * number of blocks actually reserved. Returns 0 if the device is full.
+ */
+static unsigned long alloc_block_bdev(struct zram *zram, unsigned int *nr)
 {
-	unsigned long blk_idx = 1;
-retry:
+	unsigned long blk_idx, end, i;
+
 	/* skip 0 bit to confuse zram.handle = 0 */
+	blk_idx = bitmap_find_next_zero_area(zram->bitmap, zram->nr_pages,
+					     1, *nr, 0);
+	if (blk_idx >= zram->nr_pages)
+		blk_idx = 1;
+retry:
 	blk_idx = find_next_zero_bit(zram->bitmap, zram->nr_pages, blk_idx);
-	if (blk_idx == zram->nr_pages)
+	if (blk_idx >= zram->nr_pages)
 		return 0;
 
-	if (test_and_set_bit(blk_idx, zram->bitmap))
-		goto retry;
+	end = find_next_bit(zram->bitmap,
+			    min(zram->nr_pages, blk_idx + *nr), blk_idx);
+	for (i = blk_idx; i < end; i++) {
+		if (test_and_set_bit(i, zram->bitmap)) {
+			/* Lost a race; give back what we took and rescan */
+			while (i-- > blk_idx)
+				clear_bit(i, zram->bitmap);
+			goto retry;
+		}
+	}
 
-	atomic64_inc(&zram->stats.bd_count);
+	*nr = end - blk_idx;
+	atomic64_add(*nr, &zram->stats.bd_count);
 	return blk_idx;
 }
 
@@ -621,18 +705,283 @@ static int read_from_bdev_async(struct zram *zram, struct bio_vec *bvec,
 #define HUGE_WRITEBACK 1
 #define IDLE_WRITEBACK 2
 
+/*
+ * A writeback request gathers up to wb_batch_size pages destined for a
+ * contiguous run of backing blocks and writes them with a single bio.
+ * Up to wb_max_inflight requests are in flight at any time; completions
+ * are collected on ctl->done_reqs and finished by the writeback_store()
+ * caller, since updating slots needs zram_slot_lock.
+ */
+struct zram_wb_ctl;
+
+struct zram_wb_req {
+	struct list_head entry;
+	struct zram_wb_ctl *ctl;
+	struct bio *bio;
+	blk_status_t status;
+	unsigned long blk_idx;		/* first reserved backing block */
+	unsigned int nr_blks;		/* no. of reserved backing blocks */
+	unsigned int nr_pages;		/* no. of pages gathered */
+	unsigned long *index;		/* zram slot of each gathered page */
+	struct page **pages;
+};
+
+struct zram_wb_ctl {
+	struct zram *zram;
+	unsigned int batch_size;
+	unsigned int max_inflight;
+	unsigned int nr_reqs;		/* no. of allocated requests */
+	unsigned int nr_inflight;
+	struct list_head idle_reqs;
+	spinlock_t done_lock;
+	struct list_head done_reqs;
+	wait_queue_head_t done_wait;
+};
+
+static void zram_wb_free_req(struct zram_wb_req *req)
+{
+	unsigned int i;
+
+	for (i = 0; i < req->ctl->batch_size; i++) {
+		if (req->pages[i])
+			__free_page(req->pages[i]);
+	}
+	kfree(req->pages);
+	kfree(req->index);
+	kfree(req);
+}
+
+static struct zram_wb_req *zram_wb_alloc_req(struct zram_wb_ctl *ctl)
+{
+	struct zram_wb_req *req;
+	unsigned int i;
+
+	req = kzalloc(sizeof(*req), GFP_KERNEL | __GFP_NOWARN);
+	if (!req)
+		return NULL;
+
+	req->ctl = ctl;
+	req->index = kcalloc(ctl->batch_size, sizeof(*req->index),
+			     GFP_KERNEL | __GFP_NOWARN);
+	req->pages = kcalloc(ctl->batch_size, sizeof(*req->pages),
+			     GFP_KERNEL | __GFP_NOWARN);
+	if (!req->index || !req->pages)
+		goto fail;
+
+	for (i = 0; i < ctl->batch_size; i++) {
+		req->pages[i] = alloc_page(GFP_KERNEL | __GFP_NOWARN);
+		if (!req->pages[i])
+			goto fail;
+	}
+
+	return req;
+fail:
+	zram_wb_free_req(req);
+	return NULL;
+}
+
+static void zram_wb_end_io(struct bio *bio)
+{
+	struct zram_wb_req *req = bio->bi_private;
+	struct zram_wb_ctl *ctl = req->ctl;
+	unsigned long flags;
+
+	req->status = bio->bi_status;
+	/*
+	 * Wake up under done_lock: once the waiter has taken the request
+	 * off done_reqs it may free ctl.
+	 */
+	spin_lock_irqsave(&ctl->done_lock, flags);
+	list_add_tail(&req->entry, &ctl->done_reqs);
+	wake_up(&ctl->done_wait);
+	spin_unlock_irqrestore(&ctl->done_lock, flags);
+}
+
+static void zram_wb_limit_charge(struct zram *zram)
+{
+	spin_lock(&zram->wb_limit_lock);
+	if (zram->wb_limit_enable && zram->bd_wb_limit > 0)
+		zram->bd_wb_limit -= 1UL << (PAGE_SHIFT - 12);
+	spin_unlock(&zram->wb_limit_lock);
+}
+
+static void zram_wb_limit_uncharge(struct zram *zram)
+{
+	spin_lock(&zram->wb_limit_lock);
+	if (zram->wb_limit_enable)
+		zram->bd_wb_limit += 1UL << (PAGE_SHIFT - 12);
+	spin_unlock(&zram->wb_limit_lock);
+}
+
+static void zram_wb_release_blocks(struct zram *zram, unsigned long blk_idx,
+				   unsigned int nr)
+{
+	while (nr--)
+		free_block_bdev(zram, blk_idx++);
+}
+
+/*
+ * Finish a completed request: on success, the slots whose data is now on
+ * the backing device are switched over to ZRAM_WB; slots that failed or
+ * raced with a free give their backing block (and writeback budget) back.
+ */
+static int zram_wb_finish_req(struct zram *zram, struct zram_wb_req *req)
+{
+	int err = blk_status_to_errno(req->status);
+	unsigned int i;
+
+	if (!err)
+		atomic64_add(req->nr_pages, &zram->stats.bd_writes);
+
+	for (i = 0; i < req->nr_pages; i++) {
+		unsigned long index = req->index[i];
+		unsigned long blk_idx = req->blk_idx + i;
+
+		/*
+		 * We released zram_slot_lock so need to check if the slot was
+		 * changed. If there is freeing for the slot, we can catch it
+		 * easily by zram_allocated.
+		 * A subtle case is the slot is freed/reallocated/marked as
+		 * ZRAM_IDLE again. To close the race, idle_store doesn't
+		 * mark ZRAM_IDLE once it found the slot was ZRAM_UNDER_WB.
+		 * Thus, we could close the race by checking ZRAM_IDLE bit.
+		 */
+		zram_slot_lock(zram, index);
+		if (err || !zram_allocated(zram, index) ||
+			  !zram_test_flag(zram, index, ZRAM_IDLE)) {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			zram_clear_flag(zram, index, ZRAM_IDLE);
+			zram_slot_unlock(zram, index);
+			free_block_bdev(zram, blk_idx);
+			zram_wb_limit_uncharge(zram);
+			continue;
+		}
+
+		zram_free_page(zram, index);
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram_set_element(zram, index, blk_idx);
+		atomic64_inc(&zram->stats.pages_stored);
+		zram_slot_unlock(zram, index);
+	}
+
+	bio_put(req->bio);
+	req->bio = NULL;
+	req->nr_pages = 0;
+	req->nr_blks = 0;
+
+	return err;
+}
+
+/*
+ * Finish all completed requests, optionally waiting for at least one.
+ * Returns the first I/O error seen, or 0.
+ */
+static int zram_wb_reap(struct zram_wb_ctl *ctl, bool wait)
+{
+	struct zram_wb_req *req, *tmp;
+	LIST_HEAD(done);
+	int ret = 0, err;
+
+	if (wait)
+		wait_event(ctl->done_wait, !list_empty(&ctl->done_reqs));
+
+	spin_lock_irq(&ctl->done_lock);
+	list_splice_init(&ctl->done_reqs, &done);
+	spin_unlock_irq(&ctl->done_lock);
+
+	list_for_each_entry_safe(req, tmp, &done, entry) {
+		err = zram_wb_finish_req(ctl->zram, req);
+		if (err && !ret)
+			ret = err;
+		ctl->nr_inflight--;
+		list_move(&req->entry, &ctl->idle_reqs);
+	}
+
+	return ret;
+}
+
+/*
+ * Get an idle request, allocating a new one while below the in-flight
+ * limit and otherwise waiting for a completion. Returns the request or
+ * NULL if nothing is in flight and no request could be allocated.
+ */
+static struct zram_wb_req *zram_wb_get_req(struct zram_wb_ctl *ctl, int *err)
+{
+	struct zram_wb_req *req;
+	int ret;
+
+	ret = zram_wb_reap(ctl, false);
+	if (ret && !*err)
+		*err = ret;
+
+	while (list_empty(&ctl->idle_reqs)) {
+		if (ctl->nr_reqs < ctl->max_inflight) {
+			req = zram_wb_alloc_req(ctl);
+			if (req) {
+				ctl->nr_reqs++;
+				return req;
+			}
+		}
+		if (!ctl->nr_inflight)
+			return NULL;
+		ret = zram_wb_reap(ctl, true);
+		if (ret && !*err)
+			*err = ret;
+	}
+
+	req = list_first_entry(&ctl->idle_reqs, struct zram_wb_req, entry);
+	list_del(&req->entry);
+	return req;
+}
+
+static void zram_wb_submit_req(struct zram_wb_ctl *ctl,
+			       struct zram_wb_req *req)
+{
+	struct zram *zram = ctl->zram;
+	struct bio *bio;
+	unsigned int i;
+
+	/* Give back the reserved blocks we did not fill */
+	zram_wb_release_blocks(zram, req->blk_idx + req->nr_pages,
+			       req->nr_blks - req->nr_pages);
+	req->nr_blks = req->nr_pages;
+
+	bio = bio_alloc(GFP_KERNEL, req->nr_pages);
+	bio_set_dev(bio, zram->bdev);
+	bio->bi_iter.bi_sector = req->blk_idx * (PAGE_SIZE >> 9);
+	bio->bi_opf = REQ_OP_WRITE | REQ_SYNC;
+	bio->bi_private = req;
+	bio->bi_end_io = zram_wb_end_io;
+	for (i = 0; i < req->nr_pages; i++)
+		bio_add_page(bio, req->pages[i], PAGE_SIZE, 0);
+
+	req->bio = bio;
+	req->status = BLK_STS_OK;
+	ctl->nr_inflight++;
+	atomic64_inc(&zram->stats.bd_wb_ios);
+	submit_bio(bio);
+}
+
+/* Drop a request that was never submitted */
+static void zram_wb_put_req(struct zram_wb_ctl *ctl, struct zram_wb_req *req)
+{
+	zram_wb_release_blocks(ctl->zram, req->blk_idx, req->nr_blks);
+	req->nr_blks = 0;
+	list_add(&req->entry, &ctl->idle_reqs);
+}
+
 static ssize_t writeback_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
 	struct zram *zram = dev_to_zram(dev);
 	unsigned long nr_pages = zram->disksize >> PAGE_SHIFT;
 	unsigned long index;
-	struct bio bio;
-	struct bio_vec bio_vec;
-	struct page *page;
+	struct zram_wb_ctl *ctl;
+	struct zram_wb_req *req = NULL, *tmp;
+	ktime_t start;
 	ssize_t ret = len;
-	int mode;
-	unsigned long blk_idx = 0;
+	int mode, err = 0;
 
 	if (sysfs_streq(buf, "idle"))
 		mode = IDLE_WRITEBACK;
@@ -652,19 +1001,23 @@ static ssize_t writeback_store(struct device *dev,
 		goto release_init_lock;
 	}
 
-	page = alloc_page(GFP_KERNEL);
-	if (!page) {
+	ctl = kzalloc(sizeof(*ctl), GFP_KERNEL);
+	if (!ctl) {
 		ret = -ENOMEM;
 		goto release_init_lock;
 	}
-
+	ctl->zram = zram;
+	ctl->batch_size = zram->wb_batch_size;
+	ctl->max_inflight = zram->wb_max_inflight;
+	INIT_LIST_HEAD(&ctl->idle_reqs);
+	INIT_LIST_HEAD(&ctl->done_reqs);
+	spin_lock_init(&ctl->done_lock);
+	init_waitqueue_head(&ctl->done_wait);
+
+	start = ktime_get();
 	for (index = 0; index < nr_pages; index++) {
 		struct bio_vec bvec;
 
-		bvec.bv_page = page;
-		bvec.bv_len = PAGE_SIZE;
-		bvec.bv_offset = 0;
-
 		spin_lock(&zram->wb_limit_lock);
 		if (zram->wb_limit_enable && !zram->bd_wb_limit) {
 			spin_unlock(&zram->wb_limit_lock);
@@ -673,9 +1026,19 @@ static ssize_t writeback_store(struct device *dev,
 		}
 		spin_unlock(&zram->wb_limit_lock);
 
-		if (!blk_idx) {
-			blk_idx = alloc_block_bdev(zram);
-			if (!blk_idx) {
+		if (!req) {
+			req = zram_wb_get_req(ctl, &err);
+			if (!req) {
+				ret = -ENOMEM;
+				break;
+			}
+		}
+
+		if (!req->nr_blks) {
+			req->nr_blks = ctl->batch_size;
+			req->blk_idx = alloc_block_bdev(zram, &req->nr_blks);
+			if (!req->blk_idx) {
+				req->nr_blks = 0;
 				ret = -ENOSPC;
 				break;
 			}
@@ -704,27 +1067,11 @@ static ssize_t writeback_store(struct device *dev,
 		/* Need for hugepage writeback racing */
 		zram_set_flag(zram, index, ZRAM_IDLE);
 		zram_slot_unlock(zram, index);
-		if (zram_bvec_read(zram, &bvec, index, 0, NULL)) {
-			zram_slot_lock(zram, index);
-			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-			zram_clear_flag(zram, index, ZRAM_IDLE);
-			zram_slot_unlock(zram, index);
-			continue;
-		}
-
-		bio_init(&bio, &bio_vec, 1);
-		bio_set_dev(&bio, zram->bdev);
-		bio.bi_iter.bi_sector = blk_idx * (PAGE_SIZE >> 9);
-		bio.bi_opf = REQ_OP_WRITE | REQ_SYNC;
 
-		bio_add_page(&bio, bvec.bv_page, bvec.bv_len,
-				bvec.bv_offset);
-		/*
-		 * XXX: A single page IO would be inefficient for write
-		 * but it would be not bad as starter.
-		 */
-		ret = submit_bio_wait(&bio);
-		if (ret) {
+		bvec.bv_page = req->pages[req->nr_pages];
+		bvec.bv_len = PAGE_SIZE;
+		bvec.bv_offset = 0;
+		if (zram_bvec_read(zram, &bvec, index, 0, NULL)) {
 			zram_slot_lock(zram, index);
 			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
 			zram_clear_flag(zram, index, ZRAM_IDLE);
@@ -732,41 +1079,40 @@ static ssize_t writeback_store(struct device *dev,
 			continue;
 		}
 
-		atomic64_inc(&zram->stats.bd_writes);
-		/*
-		 * We released zram_slot_lock so need to check if the slot was
-		 * changed. If there is freeing for the slot, we can catch it
-		 * easily by zram_allocated.
-		 * A subtle case is the slot is freed/reallocated/marked as
-		 * ZRAM_IDLE again. To close the race, idle_store doesn't
-		 * mark ZRAM_IDLE once it found the slot was ZRAM_UNDER_WB.
-		 * Thus, we could close the race by checking ZRAM_IDLE bit.
-		 */
-		zram_slot_lock(zram, index);
-		if (!zram_allocated(zram, index) ||
-			  !zram_test_flag(zram, index, ZRAM_IDLE)) {
-			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-			zram_clear_flag(zram, index, ZRAM_IDLE);
-			goto next;
+		/* Uncharged again if the slot does not make it to the disk */
+		zram_wb_limit_charge(zram);
+		req->index[req->nr_pages++] = index;
+		if (req->nr_pages == req->nr_blks) {
+			zram_wb_submit_req(ctl, req);
+			req = NULL;
 		}
-
-		zram_free_page(zram, index);
-		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-		zram_set_flag(zram, index, ZRAM_WB);
-		zram_set_element(zram, index, blk_idx);
-		blk_idx = 0;
-		atomic64_inc(&zram->stats.pages_stored);
-		spin_lock(&zram->wb_limit_lock);
-		if (zram->wb_limit_enable && zram->bd_wb_limit > 0)
-			zram->bd_wb_limit -=  1UL << (PAGE_SHIFT - 12);
-		spin_unlock(&zram->wb_limit_lock);
+		continue;
 next:
 		zram_slot_unlock(zram, index);
 	}
 
-	if (blk_idx)
-		free_block_bdev(zram, blk_idx);
-	__free_page(page);
+	if (req) {
+		if (req->nr_pages)
+			zram_wb_submit_req(ctl, req);
+		else
+			zram_wb_put_req(ctl, req);
+	}
+
+	while (ctl->nr_inflight) {
+		int ret2 = zram_wb_reap(ctl, true);
+
+		if (ret2 && !err)
+			err = ret2;
+	}
+
+	list_for_each_entry_safe(req, tmp, &ctl->idle_reqs, entry)
+		zram_wb_free_req(req);
+	kfree(ctl);
+
+	atomic64_add(ktime_ms_delta(ktime_get(), start),
+		     &zram->stats.bd_wb_time);
+	if (err && ret == len)
+		ret = err;
 release_init_lock:
 	up_read(&zram->init_lock);
 
@@ -1093,10 +1439,12 @@ static ssize_t bd_stat_show(struct device *dev,
 
 	down_read(&zram->init_lock);
 	ret = scnprintf(buf, PAGE_SIZE,
-		"%8llu %8llu %8llu\n",
+		"%8llu %8llu %8llu %8llu %8llu\n",
 			FOUR_K((u64)atomic64_read(&zram->stats.bd_count)),
 			FOUR_K((u64)atomic64_read(&zram->stats.bd_reads)),
-			FOUR_K((u64)atomic64_read(&zram->stats.bd_writes)));
+			FOUR_K((u64)atomic64_read(&zram->stats.bd_writes)),
+			(u64)atomic64_read(&zram->stats.bd_wb_ios),
+			(u64)atomic64_read(&zram->stats.bd_wb_time));
 	up_read(&zram->init_lock);
 
 	return ret;
@@ -1832,6 +2180,8 @@ static DEVICE_ATTR_RW(backing_dev);
 static DEVICE_ATTR_WO(writeback);
 static DEVICE_ATTR_RW(writeback_limit);
 static DEVICE_ATTR_RW(writeback_limit_enable);
+static DEVICE_ATTR_RW(writeback_batch_size);
+static DEVICE_ATTR_RW(writeback_max_inflight);
 #endif
 
 static struct attribute *zram_disk_attrs[] = {
@@ -1849,6 +2199,8 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_writeback.attr,
 	&dev_attr_writeback_limit.attr,
 	&dev_attr_writeback_limit_enable.attr,
+	&dev_attr_writeback_batch_size.attr,
+	&dev_attr_writeback_max_inflight.attr,
 #endif
 	&dev_attr_io_stat.attr,
 	&dev_attr_mm_stat.attr,
@@ -1890,6 +2242,8 @@ static int zram_add(void)
 	init_rwsem(&zram->init_lock);
 #ifdef CONFIG_ZRAM_WRITEBACK
 	spin_lock_init(&zram->wb_limit_lock);
+	zram->wb_batch_size = ZRAM_WB_BATCH_SIZE;
+	zram->wb_max_inflight = ZRAM_WB_INFLIGHT;
 #endif
 	queue = blk_alloc_queue(zram_make_request, NUMA_NO_NODE);
 	if (!queue) {
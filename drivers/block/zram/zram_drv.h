@@ -28,6 +28,11 @@
 #define ZRAM_SECTOR_PER_LOGICAL_BLOCK	\
 	(1 << (ZRAM_LOGICAL_BLOCK_SHIFT - SECTOR_SHIFT))
 
+/* Writeback: default pages per bio and bios in flight */
+#define ZRAM_WB_BATCH_SIZE	32
+#define ZRAM_WB_INFLIGHT	8
+#define ZRAM_WB_MAX_INFLIGHT	64
+
 
 /*
  * The lower ZRAM_FLAG_SHIFT bits of table.flags is for
@@ -86,6 +91,8 @@ struct zram_stats {
 	atomic64_t bd_count;		/* no. of pages in backing device */
 	atomic64_t bd_reads;		/* no. of reads from backing device */
 	atomic64_t bd_writes;		/* no. of writes from backing device */
+	atomic64_t bd_wb_ios;		/* no. of writeback bios submitted */
+	atomic64_t bd_wb_time;		/* time spent in writeback (msec) */
 #endif
 };
 
@@ -117,6 +124,8 @@ struct zram {
 	spinlock_t wb_limit_lock;
 	bool wb_limit_enable;
 	u64 bd_wb_limit;
+	unsigned int wb_batch_size;
+	unsigned int wb_max_inflight;
 	struct block_device *bdev;
 	unsigned int old_block_size;
 	unsigned long *bitmap;
@@ -18,6 +18,8 @@
 #include <linux/poll.h>
 #include <linux/string.h>
 #include <linux/list.h>
+#include <linux/llist.h>
+#include <linux/percpu.h>
 #include <linux/hash.h>
 #include <linux/spinlock.h>
 #include <linux/syscalls.h>
@@ -147,9 +149,13 @@ struct epitem {
 
 	/*
 	 * Works together "struct eventpoll"->ovflist in keeping the
-	 * single linked chain of items.
+	 * single linked chain of items. EPOLL_PERCPU instances never use
+	 * ->ovflist, and chain the item on a per-CPU ready list instead.
 	 */
-	struct epitem *next;
+	union {
+		struct epitem *next;
+		struct llist_node pcp_llink;
+	};
 
 	/* The file descriptor information this item refers to */
 	struct epoll_filefd ffd;
@@ -199,6 +205,13 @@ struct eventpoll {
 	/* Lock which protects rdllist and ovflist */
 	rwlock_t lock;
 
+	/*
+	 * With EPOLL_PERCPU, the poll callback queues ready items here,
+	 * without taking ->lock. They are moved to ->rdllist in batches,
+	 * by whoever is about to scan it.
+	 */
+	struct llist_head __percpu *pcp_rdllist;
+
 	/* RB tree root used to store monitored fd structs */
 	struct rb_root_cached rbr;
 
@@ -366,6 +379,24 @@ static void ep_nested_calls_init(struct nested_calls *ncalls)
 	spin_lock_init(&ncalls->lock);
 }
 
+static inline bool ep_is_percpu(struct eventpoll *ep)
+{
+	return ep->pcp_rdllist != NULL;
+}
+
+static bool ep_pcp_events_available(struct eventpoll *ep)
+{
+	int cpu;
+
+	if (!ep_is_percpu(ep))
+		return false;
+
+	for_each_possible_cpu(cpu)
+		if (!llist_empty(per_cpu_ptr(ep->pcp_rdllist, cpu)))
+			return true;
+	return false;
+}
+
 /**
  * ep_events_available - Checks if ready events might be available.
  *
@@ -377,7 +408,8 @@ static void ep_nested_calls_init(struct nested_calls *ncalls)
 static inline int ep_events_available(struct eventpoll *ep)
 {
 	return !list_empty_careful(&ep->rdllist) ||
-		READ_ONCE(ep->ovflist) != EP_UNACTIVE_PTR;
+		READ_ONCE(ep->ovflist) != EP_UNACTIVE_PTR ||
+		ep_pcp_events_available(ep);
 }
 
 #ifdef CONFIG_NET_RX_BUSY_POLL
@@ -663,6 +695,39 @@ static inline void ep_pm_stay_awake_rcu(struct epitem *epi)
 	rcu_read_unlock();
 }
 
+/*
+ * Moves all the items queued on the per-CPU ready lists of an EPOLL_PERCPU
+ * eventpoll to ->rdllist, in a single ->lock hold. Must be called with
+ * ->lock held for writing.
+ */
+static void ep_pcp_harvest(struct eventpoll *ep)
+{
+	struct llist_head *head;
+	struct llist_node *first;
+	struct epitem *epi, *nepi;
+	int cpu;
+
+	if (!ep_is_percpu(ep))
+		return;
+
+	for_each_possible_cpu(cpu) {
+		head = per_cpu_ptr(ep->pcp_rdllist, cpu);
+		if (llist_empty(head))
+			continue;
+
+		/* The per-CPU lists are LIFO, reverse to keep FIFO */
+		first = llist_reverse_order(llist_del_all(head));
+		llist_for_each_entry_safe(epi, nepi, first, pcp_llink) {
+			/* Pairs with the cmpxchg() in ep_pcp_add_lockless() */
+			WRITE_ONCE(epi->next, EP_UNACTIVE_PTR);
+			if (!ep_is_linked(epi)) {
+				list_add_tail(&epi->rdllink, &ep->rdllist);
+				ep_pm_stay_awake(epi);
+			}
+		}
+	}
+}
+
 /**
  * ep_scan_ready_list - Scans the ready list in a way that makes possible for
  *                      the scan code, to call f_op->poll(). Also allows for
@@ -704,6 +769,7 @@ static __poll_t ep_scan_ready_list(struct eventpoll *ep,
 	 * in a lockless way.
 	 */
 	write_lock_irq(&ep->lock);
+	ep_pcp_harvest(ep);
 	list_splice_init(&ep->rdllist, &txlist);
 	WRITE_ONCE(ep->ovflist, NULL);
 	write_unlock_irq(&ep->lock);
@@ -785,6 +851,9 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 	rb_erase_cached(&epi->rbn, &ep->rbr);
 
 	write_lock_irq(&ep->lock);
+	/* Still queued on a per-CPU ready list, flush it to ->rdllist first */
+	if (epi->next != EP_UNACTIVE_PTR)
+		ep_pcp_harvest(ep);
 	if (ep_is_linked(epi))
 		list_del_init(&epi->rdllink);
 	write_unlock_irq(&ep->lock);
@@ -853,6 +922,7 @@ static void ep_free(struct eventpoll *ep)
 	mutex_destroy(&ep->mtx);
 	free_uid(ep->user);
 	wakeup_source_unregister(ep->ws);
+	free_percpu(ep->pcp_rdllist);
 	kfree(ep);
 }
 
@@ -1005,7 +1075,7 @@ void eventpoll_release_file(struct file *file)
 	mutex_unlock(&epmutex);
 }
 
-static int ep_alloc(struct eventpoll **pep)
+static int ep_alloc(struct eventpoll **pep, int flags)
 {
 	int error;
 	struct user_struct *user;
@@ -1017,6 +1087,12 @@ static int ep_alloc(struct eventpoll **pep)
 	if (unlikely(!ep))
 		goto free_uid;
 
+	if (flags & EPOLL_PERCPU) {
+		ep->pcp_rdllist = alloc_percpu(struct llist_head);
+		if (unlikely(!ep->pcp_rdllist))
+			goto free_ep;
+	}
+
 	mutex_init(&ep->mtx);
 	rwlock_init(&ep->lock);
 	init_waitqueue_head(&ep->wq);
@@ -1030,6 +1106,8 @@ static int ep_alloc(struct eventpoll **pep)
 
 	return 0;
 
+free_ep:
+	kfree(ep);
 free_uid:
 	free_uid(user);
 	return error;
@@ -1185,6 +1263,34 @@ static inline bool chain_epi_lockless(struct epitem *epi)
 	return true;
 }
 
+/**
+ * Queues a new epi entry on the current CPU's ready list of an EPOLL_PERCPU
+ * eventpoll, in a lockless way. Like for chain_epi_lockless(), epi->next
+ * tells whether the item is queued already, and the winner of the cmpxchg()
+ * queues it.
+ *
+ * Returns %false if epi element has been already queued, %true otherwise.
+ */
+static inline bool ep_pcp_add_lockless(struct epitem *epi)
+{
+	struct eventpoll *ep = epi->ep;
+
+	/* Fast preliminary check */
+	if (READ_ONCE(epi->next) != EP_UNACTIVE_PTR)
+		return false;
+
+	if (cmpxchg(&epi->next, EP_UNACTIVE_PTR, NULL) != EP_UNACTIVE_PTR)
+		return false;
+
+	/*
+	 * We may have migrated since picking the list, that only costs a
+	 * remote cacheline, llist_add() is safe against any other CPU.
+	 */
+	llist_add(&epi->pcp_llink, raw_cpu_ptr(ep->pcp_rdllist));
+
+	return true;
+}
+
 /*
  * This is the callback that is passed to the wait queue wakeup
  * mechanism. It is called by the stored file descriptors when they
@@ -1202,6 +1308,10 @@ static inline bool chain_epi_lockless(struct epitem *epi)
  * single wait queue is serialized by wq.lock, but the case when multiple wait
  * queues are used should be detected accordingly.  This is detected using
  * cmpxchg() operation.
+ *
+ * EPOLL_PERCPU instances don't take ->lock at all, even for reading, so that
+ * producers on many CPUs don't bounce its cacheline. The item is queued on a
+ * per-CPU ready list instead, see ep_pcp_add_lockless().
  */
 static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, void *key)
 {
@@ -1209,10 +1319,12 @@ static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, v
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
 	__poll_t pollflags = key_to_poll(key);
+	bool percpu = ep_is_percpu(ep);
 	unsigned long flags;
 	int ewake = 0;
 
-	read_lock_irqsave(&ep->lock, flags);
+	if (!percpu)
+		read_lock_irqsave(&ep->lock, flags);
 
 	ep_set_busy_poll_napi_id(epi);
 
@@ -1240,7 +1352,10 @@ static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, v
 	 * semantics). All the events that happen during that period of time are
 	 * chained in ep->ovflist and requeued later on.
 	 */
-	if (READ_ONCE(ep->ovflist) != EP_UNACTIVE_PTR) {
+	if (percpu) {
+		if (ep_pcp_add_lockless(epi))
+			ep_pm_stay_awake_rcu(epi);
+	} else if (READ_ONCE(ep->ovflist) != EP_UNACTIVE_PTR) {
 		if (chain_epi_lockless(epi))
 			ep_pm_stay_awake_rcu(epi);
 	} else if (!ep_is_linked(epi)) {
@@ -1276,7 +1391,8 @@ static int ep_poll_callback(wait_queue_entry_t *wait, unsigned mode, int sync, v
 		pwake++;
 
 out_unlock:
-	read_unlock_irqrestore(&ep->lock, flags);
+	if (!percpu)
+		read_unlock_irqrestore(&ep->lock, flags);
 
 	/* We have to call this outside the lock */
 	if (pwake)
@@ -1605,6 +1721,8 @@ static int ep_insert(struct eventpoll *ep, const struct epoll_event *event,
 	 * And ep_insert() is called with "mtx" held.
 	 */
 	write_lock_irq(&ep->lock);
+	if (epi->next != EP_UNACTIVE_PTR)
+		ep_pcp_harvest(ep);
 	if (ep_is_linked(epi))
 		list_del_init(&epi->rdllink);
 	write_unlock_irq(&ep->lock);
@@ -1789,15 +1907,30 @@ static int ep_send_events(struct eventpoll *ep,
 	return esed.res;
 }
 
-static inline struct timespec64 ep_set_mstimeout(long ms)
+/*
+ * Converts a millisecond timeout of epoll_wait() and epoll_pwait() to the
+ * absolute end time ep_poll() works with. A negative @ms means to wait
+ * forever, and returns NULL.
+ */
+static struct timespec64 *ep_timeout_to_timespec(struct timespec64 *to, long ms)
 {
-	struct timespec64 now, ts = {
-		.tv_sec = ms / MSEC_PER_SEC,
-		.tv_nsec = NSEC_PER_MSEC * (ms % MSEC_PER_SEC),
-	};
+	struct timespec64 now;
+
+	if (ms < 0)
+		return NULL;
+
+	if (!ms) {
+		to->tv_sec = 0;
+		to->tv_nsec = 0;
+		return to;
+	}
+
+	to->tv_sec = ms / MSEC_PER_SEC;
+	to->tv_nsec = NSEC_PER_MSEC * (ms % MSEC_PER_SEC);
 
 	ktime_get_ts64(&now);
-	return timespec64_add_safe(now, ts);
+	*to = timespec64_add_safe(now, *to);
+	return to;
 }
 
 /**
@@ -1808,17 +1941,16 @@ static inline struct timespec64 ep_set_mstimeout(long ms)
  * @events: Pointer to the userspace buffer where the ready events should be
  *          stored.
  * @maxevents: Size (in terms of number of events) of the caller event buffer.
- * @timeout: Maximum timeout for the ready events fetch operation, in
- *           milliseconds. If the @timeout is zero, the function will not block,
- *           while if the @timeout is less than zero, the function will block
- *           until at least one event has been retrieved (or an error
- *           occurred).
+ * @timeout: Absolute end time of the ready events fetch operation. If the
+ *           @timeout is zero, the function will not block, while if the
+ *           @timeout is NULL, the function will block until at least one
+ *           event has been retrieved (or an error occurred).
  *
  * Returns: Returns the number of ready events which have been fetched, or an
  *          error code, in case of error.
  */
 static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
-		   int maxevents, long timeout)
+		   int maxevents, struct timespec64 *timeout)
 {
 	int res = 0, eavail, timed_out = 0;
 	u64 slack = 0;
@@ -1827,13 +1959,11 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 
 	lockdep_assert_irqs_enabled();
 
-	if (timeout > 0) {
-		struct timespec64 end_time = ep_set_mstimeout(timeout);
-
-		slack = select_estimate_accuracy(&end_time);
+	if (timeout && (timeout->tv_sec | timeout->tv_nsec)) {
+		slack = select_estimate_accuracy(timeout);
 		to = &expires;
-		*to = timespec64_to_ktime(end_time);
-	} else if (timeout == 0) {
+		*to = timespec64_to_ktime(*timeout);
+	} else if (timeout) {
 		/*
 		 * Avoid the unnecessary trip to the wait queue loop, if the
 		 * caller specified a non blocking operation. We still need
@@ -1888,6 +2018,20 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		 */
 		__set_current_state(TASK_INTERRUPTIBLE);
 
+		/*
+		 * EPOLL_PERCPU callbacks don't take ->lock, so the above
+		 * doesn't hold for them. Get on the wait queue first, under
+		 * its own lock which the wakeup side takes as well, and
+		 * check for events only then.
+		 */
+		if (ep_is_percpu(ep)) {
+			spin_lock(&ep->wq.lock);
+			__add_wait_queue_exclusive(&ep->wq, &wait);
+			spin_unlock(&ep->wq.lock);
+			/* pairs with the cmpxchg() in ep_pcp_add_lockless() */
+			smp_mb();
+		}
+
 		/*
 		 * Do the final check under the lock. ep_scan_ready_list()
 		 * plays with two lists (->rdllist and ->ovflist) and there
@@ -1899,7 +2043,7 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		if (!eavail) {
 			if (signal_pending(current))
 				res = -EINTR;
-			else
+			else if (!ep_is_percpu(ep))
 				__add_wait_queue_exclusive(&ep->wq, &wait);
 		}
 		write_unlock_irq(&ep->lock);
@@ -1921,7 +2065,10 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 
 	if (!list_empty_careful(&wait.entry)) {
 		write_lock_irq(&ep->lock);
-		__remove_wait_queue(&ep->wq, &wait);
+		if (ep_is_percpu(ep))
+			remove_wait_queue(&ep->wq, &wait);
+		else
+			__remove_wait_queue(&ep->wq, &wait);
 		write_unlock_irq(&ep->lock);
 	}
 
@@ -2055,13 +2202,14 @@ static int do_epoll_create(int flags)
 
 	/* Check the EPOLL_* constant for consistency.  */
 	BUILD_BUG_ON(EPOLL_CLOEXEC != O_CLOEXEC);
+	BUILD_BUG_ON(EPOLL_PERCPU & EPOLL_CLOEXEC);
 
-	if (flags & ~EPOLL_CLOEXEC)
+	if (flags & ~(EPOLL_CLOEXEC | EPOLL_PERCPU))
 		return -EINVAL;
 	/*
 	 * Create the internal data structure ("struct eventpoll").
 	 */
-	error = ep_alloc(&ep);
+	error = ep_alloc(&ep, flags);
 	if (error < 0)
 		return error;
 	/*
@@ -2296,7 +2444,7 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
  * part of the user space epoll_wait(2).
  */
 static int do_epoll_wait(int epfd, struct epoll_event __user *events,
-			 int maxevents, int timeout)
+			 int maxevents, struct timespec64 *to)
 {
 	int error;
 	struct fd f;
@@ -2330,7 +2478,7 @@ static int do_epoll_wait(int epfd, struct epoll_event __user *events,
 	ep = f.file->private_data;
 
 	/* Time to fish for events ... */
-	error = ep_poll(ep, events, maxevents, timeout);
+	error = ep_poll(ep, events, maxevents, to);
 
 error_fput:
 	fdput(f);
@@ -2340,16 +2488,19 @@ static int do_epoll_wait(int epfd, struct epoll_event __user *events,
 SYSCALL_DEFINE4(epoll_wait, int, epfd, struct epoll_event __user *, events,
 		int, maxevents, int, timeout)
 {
-	return do_epoll_wait(epfd, events, maxevents, timeout);
+	struct timespec64 to;
+
+	return do_epoll_wait(epfd, events, maxevents,
+			     ep_timeout_to_timespec(&to, timeout));
 }
 
 /*
  * Implement the event wait interface for the eventpoll file. It is the kernel
- * part of the user space epoll_pwait(2).
+ * part of the user space epoll_pwait(2) and epoll_pwait2(2).
  */
-SYSCALL_DEFINE6(epoll_pwait, int, epfd, struct epoll_event __user *, events,
-		int, maxevents, int, timeout, const sigset_t __user *, sigmask,
-		size_t, sigsetsize)
+static int do_epoll_pwait(int epfd, struct epoll_event __user *events,
+			  int maxevents, struct timespec64 *to,
+			  const sigset_t __user *sigmask, size_t sigsetsize)
 {
 	int error;
 
@@ -2361,18 +2512,51 @@ SYSCALL_DEFINE6(epoll_pwait, int, epfd, struct epoll_event __user *, events,
 	if (error)
 		return error;
 
-	error = do_epoll_wait(epfd, events, maxevents, timeout);
+	error = do_epoll_wait(epfd, events, maxevents, to);
 	restore_saved_sigmask_unless(error == -EINTR);
 
 	return error;
 }
 
+SYSCALL_DEFINE6(epoll_pwait, int, epfd, struct epoll_event __user *, events,
+		int, maxevents, int, timeout, const sigset_t __user *, sigmask,
+		size_t, sigsetsize)
+{
+	struct timespec64 to;
+
+	return do_epoll_pwait(epfd, events, maxevents,
+			      ep_timeout_to_timespec(&to, timeout),
+			      sigmask, sigsetsize);
+}
+
+/*
+ * Same as epoll_pwait(), with the timeout given as a timespec, for callers
+ * that need finer than millisecond granularity. A NULL @timeout blocks
+ * until an event arrives, a zero one doesn't block at all.
+ */
+SYSCALL_DEFINE6(epoll_pwait2, int, epfd, struct epoll_event __user *, events,
+		int, maxevents, const struct __kernel_timespec __user *, timeout,
+		const sigset_t __user *, sigmask, size_t, sigsetsize)
+{
+	struct timespec64 ts, *to = NULL;
+
+	if (timeout) {
+		if (get_timespec64(&ts, timeout))
+			return -EFAULT;
+		to = &ts;
+		if (poll_select_set_timeout(to, ts.tv_sec, ts.tv_nsec))
+			return -EINVAL;
+	}
+
+	return do_epoll_pwait(epfd, events, maxevents, to,
+			      sigmask, sigsetsize);
+}
+
 #ifdef CONFIG_COMPAT
-COMPAT_SYSCALL_DEFINE6(epoll_pwait, int, epfd,
-			struct epoll_event __user *, events,
-			int, maxevents, int, timeout,
-			const compat_sigset_t __user *, sigmask,
-			compat_size_t, sigsetsize)
+static int do_compat_epoll_pwait(int epfd, struct epoll_event __user *events,
+				 int maxevents, struct timespec64 *timeout,
+				 const compat_sigset_t __user *sigmask,
+				 compat_size_t sigsetsize)
 {
 	long err;
 
@@ -2389,6 +2573,40 @@ COMPAT_SYSCALL_DEFINE6(epoll_pwait, int, epfd,
 
 	return err;
 }
+
+COMPAT_SYSCALL_DEFINE6(epoll_pwait, int, epfd,
+			struct epoll_event __user *, events,
+			int, maxevents, int, timeout,
+			const compat_sigset_t __user *, sigmask,
+			compat_size_t, sigsetsize)
+{
+	struct timespec64 to;
+
+	return do_compat_epoll_pwait(epfd, events, maxevents,
+				     ep_timeout_to_timespec(&to, timeout),
+				     sigmask, sigsetsize);
+}
+
+COMPAT_SYSCALL_DEFINE6(epoll_pwait2, int, epfd,
+			struct epoll_event __user *, events,
+			int, maxevents,
+			const struct __kernel_timespec __user *, timeout,
+			const compat_sigset_t __user *, sigmask,
+			compat_size_t, sigsetsize)
+{
+	struct timespec64 ts, *to = NULL;
+
+	if (timeout) {
+		if (get_timespec64(&ts, timeout))
+			return -EFAULT;
+		to = &ts;
+		if (poll_select_set_timeout(to, ts.tv_sec, ts.tv_nsec))
+			return -EINVAL;
+	}
+
+	return do_compat_epoll_pwait(epfd, events, maxevents, to,
+				     sigmask, sigsetsize);
+}
 #endif
 
 static int __init eventpoll_init(void)
@@ -17,6 +17,7 @@
 #include <linux/rculist_nulls.h>
 #include <linux/fs_struct.h>
 #include <linux/task_work.h>
+#include <linux/sched/isolation.h>
 
 #include "io-wq.h"
 
@@ -61,6 +62,8 @@ struct io_worker {
 	const struct cred *saved_creds;
 	struct files_struct *restore_files;
 	struct fs_struct *restore_fs;
+
+	unsigned int affinity_seq;
 };
 
 #if BITS_PER_LONG == 64
@@ -75,6 +78,9 @@ struct io_wqe_acct {
 	unsigned nr_workers;
 	unsigned max_workers;
 	atomic_t nr_running;
+	/* work on the wqe list, refused once it reaches max_queued */
+	atomic_t nr_queued;
+	unsigned max_queued;
 };
 
 enum {
@@ -101,6 +107,9 @@ struct io_wqe {
 
 	struct io_wq *wq;
 	struct io_wq_work *hash_tail[IO_WQ_NR_HASH_BUCKETS];
+
+	/* CPUs this node's workers may run on, under wq->affinity_lock */
+	cpumask_var_t cpu_mask;
 };
 
 /*
@@ -119,6 +128,13 @@ struct io_wq {
 	struct completion done;
 
 	refcount_t use_refs;
+
+	/*
+	 * Bumped on every affinity change, workers compare it against their
+	 * own copy and move themselves. Zero means never set.
+	 */
+	unsigned int affinity_seq;
+	struct mutex affinity_lock;
 };
 
 static bool io_worker_get(struct io_worker *worker)
@@ -196,6 +212,29 @@ static inline struct io_wqe_acct *io_wqe_get_acct(struct io_wqe *wqe,
 	return &wqe->acct[IO_WQ_ACCT_UNBOUND];
 }
 
+static inline void io_wqe_dequeued(struct io_wqe *wqe, struct io_wq_work *work)
+{
+	atomic_dec(&io_work_get_acct(wqe, work)->nr_queued);
+}
+
+/*
+ * Move the worker to the CPUs set with io_wq_cpu_affinity(). Called by the
+ * worker itself, as set_cpus_allowed_ptr() may sleep.
+ */
+static void io_worker_update_affinity(struct io_worker *worker)
+{
+	struct io_wqe *wqe = worker->wqe;
+	struct io_wq *wq = wqe->wq;
+
+	if (likely(worker->affinity_seq == READ_ONCE(wq->affinity_seq)))
+		return;
+
+	mutex_lock(&wq->affinity_lock);
+	worker->affinity_seq = wq->affinity_seq;
+	set_cpus_allowed_ptr(current, wqe->cpu_mask);
+	mutex_unlock(&wq->affinity_lock);
+}
+
 static void io_worker_exit(struct io_worker *worker)
 {
 	struct io_wqe *wqe = worker->wqe;
@@ -396,6 +435,7 @@ static struct io_wq_work *io_get_next_work(struct io_wqe *wqe)
 		/* not hashed, can run anytime */
 		if (!io_wq_is_hashed(work)) {
 			wq_list_del(&wqe->work_list, node, prev);
+			io_wqe_dequeued(wqe, work);
 			return work;
 		}
 
@@ -407,6 +447,8 @@ static struct io_wq_work *io_get_next_work(struct io_wqe *wqe)
 			tail = wqe->hash_tail[hash];
 			wqe->hash_tail[hash] = NULL;
 			wq_list_cut(&wqe->work_list, &tail->list, prev);
+			/* the rest of the chain is dequeued as it's run */
+			io_wqe_dequeued(wqe, work);
 			return work;
 		}
 	}
@@ -507,6 +549,7 @@ static void io_worker_handle_work(struct io_worker *worker)
 		spin_unlock_irq(&wqe->lock);
 		if (!work)
 			break;
+		io_worker_update_affinity(worker);
 		io_assign_current_work(worker, work);
 
 		/* handle a whole dependent link */
@@ -528,6 +571,8 @@ static void io_worker_handle_work(struct io_worker *worker)
 			linked = (old_work == linked) ? NULL : linked;
 
 			work = next_hashed;
+			if (work)
+				io_wqe_dequeued(wqe, work);
 			if (!work && linked && !io_wq_is_hashed(linked)) {
 				work = linked;
 				linked = NULL;
@@ -564,6 +609,7 @@ static int io_wqe_worker(void *data)
 	io_worker_start(wqe, worker);
 
 	while (!test_bit(IO_WQ_BIT_EXIT, &wq->state)) {
+		io_worker_update_affinity(worker);
 		set_current_state(TASK_INTERRUPTIBLE);
 loop:
 		spin_lock_irq(&wqe->lock);
@@ -755,6 +801,15 @@ static bool io_wq_can_queue(struct io_wqe *wqe, struct io_wqe_acct *acct,
 {
 	bool free_worker;
 
+	/*
+	 * Queue depth backpressure: once this many items are waiting for a
+	 * worker, refuse more rather than letting the backlog grow without
+	 * bound behind a capped number of workers.
+	 */
+	if ((unsigned int) atomic_read(&acct->nr_queued) >=
+	    READ_ONCE(acct->max_queued))
+		return false;
+
 	if (!(work->flags & IO_WQ_WORK_UNBOUND))
 		return true;
 	if (atomic_read(&acct->nr_running))
@@ -825,6 +880,7 @@ static void io_wqe_enqueue(struct io_wqe *wqe, struct io_wq_work *work)
 	}
 
 	work_flags = work->flags;
+	atomic_inc(&acct->nr_queued);
 	spin_lock_irqsave(&wqe->lock, flags);
 	io_wqe_insert_work(wqe, work);
 	wqe->flags &= ~IO_WQE_FLAG_STALLED;
@@ -944,6 +1000,7 @@ static void io_wqe_cancel_pending_work(struct io_wqe *wqe,
 			continue;
 
 		wq_list_del(&wqe->work_list, node, prev);
+		io_wqe_dequeued(wqe, work);
 		spin_unlock_irqrestore(&wqe->lock, flags);
 		io_run_cancel(work, wqe);
 		match->nr_pending++;
@@ -1018,6 +1075,21 @@ enum io_wq_cancel io_wq_cancel_work(struct io_wq *wq, struct io_wq_work *cwork)
 	return io_wq_cancel_cb(wq, io_wq_io_cb_cancel_data, (void *)cwork, false);
 }
 
+static void io_wq_free_wqes(struct io_wq *wq)
+{
+	int node;
+
+	for_each_node(node) {
+		struct io_wqe *wqe = wq->wqes[node];
+
+		if (!wqe)
+			continue;
+		free_cpumask_var(wqe->cpu_mask);
+		kfree(wqe);
+	}
+	kfree(wq->wqes);
+}
+
 struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 {
 	int ret = -ENOMEM, node;
@@ -1052,14 +1124,21 @@ struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 		if (!wqe)
 			goto err;
 		wq->wqes[node] = wqe;
+		if (!zalloc_cpumask_var_node(&wqe->cpu_mask, GFP_KERNEL,
+					     alloc_node))
+			goto err;
 		wqe->node = alloc_node;
 		wqe->acct[IO_WQ_ACCT_BOUND].max_workers = bounded;
+		wqe->acct[IO_WQ_ACCT_BOUND].max_queued = UINT_MAX;
 		atomic_set(&wqe->acct[IO_WQ_ACCT_BOUND].nr_running, 0);
+		atomic_set(&wqe->acct[IO_WQ_ACCT_BOUND].nr_queued, 0);
 		if (wq->user) {
 			wqe->acct[IO_WQ_ACCT_UNBOUND].max_workers =
 					task_rlimit(current, RLIMIT_NPROC);
 		}
+		wqe->acct[IO_WQ_ACCT_UNBOUND].max_queued = UINT_MAX;
 		atomic_set(&wqe->acct[IO_WQ_ACCT_UNBOUND].nr_running, 0);
+		atomic_set(&wqe->acct[IO_WQ_ACCT_UNBOUND].nr_queued, 0);
 		wqe->wq = wq;
 		spin_lock_init(&wqe->lock);
 		INIT_WQ_LIST(&wqe->work_list);
@@ -1068,6 +1147,7 @@ struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 	}
 
 	init_completion(&wq->done);
+	mutex_init(&wq->affinity_lock);
 
 	wq->manager = kthread_create(io_wq_manager, wq, "io_wq_manager");
 	if (!IS_ERR(wq->manager)) {
@@ -1085,9 +1165,7 @@ struct io_wq *io_wq_create(unsigned bounded, struct io_wq_data *data)
 	ret = PTR_ERR(wq->manager);
 	complete(&wq->done);
 err:
-	for_each_node(node)
-		kfree(wq->wqes[node]);
-	kfree(wq->wqes);
+	io_wq_free_wqes(wq);
 	kfree(wq);
 	return ERR_PTR(ret);
 }
@@ -1121,9 +1199,7 @@ static void __io_wq_destroy(struct io_wq *wq)
 
 	wait_for_completion(&wq->done);
 
-	for_each_node(node)
-		kfree(wq->wqes[node]);
-	kfree(wq->wqes);
+	io_wq_free_wqes(wq);
 	kfree(wq);
 }
 
@@ -1137,3 +1213,81 @@ struct task_struct *io_wq_get_task(struct io_wq *wq)
 {
 	return wq->manager;
 }
+
+/*
+ * Restrict workers to the CPUs in @mask, or drop a previous restriction if
+ * @mask is NULL. Each node's workers stick to the part of @mask on that
+ * node, and only fall back to all of @mask if that part is empty.
+ */
+int io_wq_cpu_affinity(struct io_wq *wq, const struct cpumask *mask)
+{
+	int node;
+
+	if (mask && !cpumask_intersects(mask, cpu_online_mask))
+		return -EINVAL;
+
+	mutex_lock(&wq->affinity_lock);
+	for_each_node(node) {
+		struct io_wqe *wqe = wq->wqes[node];
+
+		if (!mask)
+			cpumask_copy(wqe->cpu_mask,
+				     housekeeping_cpumask(HK_FLAG_KTHREAD));
+		else if (!cpumask_and(wqe->cpu_mask, mask,
+				      cpumask_of_node(node)))
+			cpumask_copy(wqe->cpu_mask, mask);
+	}
+	if (!++wq->affinity_seq)
+		wq->affinity_seq = 1;
+	mutex_unlock(&wq->affinity_lock);
+
+	/* idle workers pick up the new mask when woken, busy ones between work */
+	rcu_read_lock();
+	for_each_node(node)
+		io_wq_for_each_worker(wq->wqes[node], io_wq_worker_wake, NULL);
+	rcu_read_unlock();
+	return 0;
+}
+
+/*
+ * Set per-node limits on the number of workers and on the number of work
+ * items waiting for one, index 0 for bounded and 1 for unbounded work. A
+ * value of 0 leaves that limit alone. The previous limits are passed back
+ * in the same arrays.
+ */
+int io_wq_set_limits(struct io_wq *wq, unsigned int *max_workers,
+		     unsigned int *max_queued)
+{
+	unsigned int prev_workers[2], prev_queued[2];
+	unsigned long rlimit = task_rlimit(current, RLIMIT_NPROC);
+	int acct[2] = { IO_WQ_ACCT_BOUND, IO_WQ_ACCT_UNBOUND };
+	int node, i;
+
+	for (i = 0; i < 2; i++) {
+		if (max_workers[i] > rlimit)
+			max_workers[i] = rlimit;
+	}
+
+	for_each_node(node) {
+		struct io_wqe *wqe = wq->wqes[node];
+
+		spin_lock_irq(&wqe->lock);
+		for (i = 0; i < 2; i++) {
+			struct io_wqe_acct *a = &wqe->acct[acct[i]];
+
+			prev_workers[i] = a->max_workers;
+			prev_queued[i] = a->max_queued;
+			if (max_workers[i])
+				a->max_workers = max_workers[i];
+			if (max_queued[i])
+				WRITE_ONCE(a->max_queued, max_queued[i]);
+		}
+		spin_unlock_irq(&wqe->lock);
+	}
+
+	for (i = 0; i < 2; i++) {
+		max_workers[i] = prev_workers[i];
+		max_queued[i] = prev_queued[i];
+	}
+	return 0;
+}
@@ -132,6 +132,10 @@ enum io_wq_cancel io_wq_cancel_cb(struct io_wq *wq, work_cancel_fn *cancel,
 
 struct task_struct *io_wq_get_task(struct io_wq *wq);
 
+int io_wq_cpu_affinity(struct io_wq *wq, const struct cpumask *mask);
+int io_wq_set_limits(struct io_wq *wq, unsigned int *max_workers,
+		     unsigned int *max_queued);
+
 #if defined(CONFIG_IO_WQ)
 extern void io_wq_worker_sleeping(struct task_struct *);
 extern void io_wq_worker_running(struct task_struct *);
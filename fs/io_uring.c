@@ -71,6 +71,8 @@
 #include <linux/sizes.h>
 #include <linux/hugetlb.h>
 #include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/vmalloc.h>
 #include <linux/namei.h>
 #include <linux/fsnotify.h>
 #include <linux/fadvise.h>
@@ -78,6 +80,7 @@
 #include <linux/fs_struct.h>
 #include <linux/splice.h>
 #include <linux/task_work.h>
+#include <linux/io_uring.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/io_uring.h>
@@ -218,6 +221,51 @@ struct io_buffer {
 	__u16 bid;
 };
 
+/*
+ * Ring-mapped provided buffers for one buffer group. Userspace owns the
+ * tail in the shared ring, the kernel only ever advances its private head.
+ */
+struct io_buffer_ring {
+	struct io_uring_buf_ring	*ring;
+	struct page			**pages;
+	unsigned int			nr_pages;
+	__u16				head;
+	__u16				mask;
+};
+
+#define IO_RINGFD_REG_MAX	16
+
+struct io_ringfd_reg {
+	struct file		*file;
+	/* fd the ring was registered through, see io_grab_files() */
+	int			fd;
+};
+
+/*
+ * SQPOLL thread, shared by all rings set up with IORING_SETUP_ATTACH_WQ
+ * against the ring that created it. The ring list is only changed with the
+ * thread parked.
+ */
+struct io_sq_data {
+	refcount_t		refs;
+	struct mutex		lock;
+	struct list_head	ctx_list;
+
+	struct task_struct	*thread;
+	wait_queue_head_t	wait;
+	struct completion	startup;
+	pid_t			task_tgid;
+
+	/* thread private, creds of the ring being served */
+	const struct cred	*cur_creds;
+	const struct cred	*old_creds;
+};
+
+/* per-task io_uring state, hangs off task_struct->io_uring */
+struct io_uring_task {
+	struct io_ringfd_reg	registered_rings[IO_RINGFD_REG_MAX];
+};
+
 struct io_ring_ctx {
 	struct {
 		struct percpu_ref	refs;
@@ -263,9 +311,13 @@ struct io_ring_ctx {
 
 	/* IO offload */
 	struct io_wq		*io_wq;
-	struct task_struct	*sqo_thread;	/* if using sq thread polling */
 	struct mm_struct	*sqo_mm;
-	wait_queue_head_t	sqo_wait;
+
+	/* if using sq thread polling */
+	struct io_sq_data	*sq_data;
+	wait_queue_head_t	*sqo_wait;
+	struct list_head	sqd_list;
+	unsigned long		sq_idle_end;
 
 	/*
 	 * If used, fixed file set. Writers must ensure that ->refs is dead,
@@ -276,6 +328,7 @@ struct io_ring_ctx {
 	unsigned		nr_user_files;
 	int 			ring_fd;
 	struct file 		*ring_file;
+	bool			ring_registered;
 
 	/* if used, fixed mapped user buffers */
 	unsigned		nr_user_bufs;
@@ -286,7 +339,6 @@ struct io_ring_ctx {
 	const struct cred	*creds;
 
 	struct completion	ref_comp;
-	struct completion	sq_thread_comp;
 
 	/* if all else fails... */
 	struct io_kiocb		*fallback_req;
@@ -296,11 +348,14 @@ struct io_ring_ctx {
 #endif
 
 	struct idr		io_buffer_idr;
+	struct idr		io_buf_ring_idr;
 
 	struct idr		personality_idr;
 
 	struct {
 		unsigned		cached_cq_tail;
+		/* CQEs posted beyond the one per SQE, by multishot requests */
+		unsigned		cq_extra;
 		unsigned		cq_entries;
 		unsigned		cq_mask;
 		atomic_t		cq_timeouts;
@@ -313,6 +368,8 @@ struct io_ring_ctx {
 	struct {
 		struct mutex		uring_lock;
 		wait_queue_head_t	wait;
+		/* fewest CQEs any ->wait sleeper needs, 0 if unknown */
+		unsigned int		cq_wait_nr;
 	} ____cacheline_aligned_in_smp;
 
 	struct {
@@ -374,6 +431,7 @@ struct io_accept {
 	int __user			*addr_len;
 	int				flags;
 	unsigned long			nofile;
+	bool				multishot;
 };
 
 struct io_sync {
@@ -419,7 +477,23 @@ struct io_sr_msg {
 	int				msg_flags;
 	int				bgid;
 	size_t				len;
-	struct io_buffer		*kbuf;
+	union {
+		struct io_buffer	*kbuf;
+		/* with REQ_F_BUFFER_RING, the selected user buffer */
+		void __user		*ring_buf;
+		/* IORING_OP_SEND_ZC notification, until the send completes */
+		struct io_kiocb		*notif;
+	};
+};
+
+/*
+ * Zero-copy send notification. It's a request of its own, so that it can go
+ * on the CQ overflow list, and it lives as long as any skb references the
+ * buffer that was sent.
+ */
+struct io_notif {
+	struct file			*file;
+	struct ubuf_info		uarg;
 };
 
 struct io_open {
@@ -503,6 +577,10 @@ struct io_async_rw {
 	struct iovec			*iov;
 	ssize_t				nr_segs;
 	ssize_t				size;
+	/* buffered reads waiting for a page to be unlocked */
+	struct wait_page_queue		wpq;
+	/* ->work is overwritten by ->task_work while waiting */
+	struct io_wq_work		work;
 };
 
 struct io_async_ctx {
@@ -542,6 +620,7 @@ enum {
 	REQ_F_QUEUE_TIMEOUT_BIT,
 	REQ_F_WORK_INITIALIZED_BIT,
 	REQ_F_TASK_PINNED_BIT,
+	REQ_F_BUFFER_RING_BIT,
 
 	/* not a real bit, just to check we're not overflowing the space */
 	__REQ_F_LAST_BIT,
@@ -601,6 +680,8 @@ enum {
 	REQ_F_WORK_INITIALIZED	= BIT(REQ_F_WORK_INITIALIZED_BIT),
 	/* req->task is refcounted */
 	REQ_F_TASK_PINNED	= BIT(REQ_F_TASK_PINNED_BIT),
+	/* selected buffer came from a provided buffer ring */
+	REQ_F_BUFFER_RING	= BIT(REQ_F_BUFFER_RING_BIT),
 };
 
 struct async_poll {
@@ -634,6 +715,7 @@ struct io_kiocb {
 		struct io_splice	splice;
 		struct io_provide_buf	pbuf;
 		struct io_statx		statx;
+		struct io_notif		notif;
 	};
 
 	struct io_async_ctx		*io;
@@ -678,10 +760,26 @@ struct io_kiocb {
 
 #define IO_PLUG_THRESHOLD		2
 #define IO_IOPOLL_BATCH			8
+#define IO_COMPL_BATCH			32
+
+/*
+ * Completions posted inline by the submitting task, committed to the CQ
+ * ring under a single ->completion_lock hold.
+ */
+struct io_comp_state {
+	unsigned int		nr;
+	struct io_ring_ctx	*ctx;
+	struct io_kiocb		*reqs[IO_COMPL_BATCH];
+};
 
 struct io_submit_state {
 	struct blk_plug		plug;
 
+	/*
+	 * Batched completions
+	 */
+	struct io_comp_state	comp;
+
 	/*
 	 * io_kiocb alloc cache
 	 */
@@ -696,6 +794,13 @@ struct io_submit_state {
 	unsigned int		has_refs;
 	unsigned int		used_refs;
 	unsigned int		ios_left;
+
+	/*
+	 * Fixed file table reference cache
+	 */
+	struct percpu_ref	*fixed_refs;
+	unsigned int		fixed_has_refs;
+	unsigned int		fixed_used_refs;
 };
 
 struct io_op_def {
@@ -878,6 +983,11 @@ static const struct io_op_def io_op_defs[] = {
 		.hash_reg_file		= 1,
 		.unbound_nonreg_file	= 1,
 	},
+	[IORING_OP_SEND_ZC] = {
+		.needs_file		= 1,
+		.unbound_nonreg_file	= 1,
+		.pollout		= 1,
+	},
 };
 
 static void io_wq_submit_work(struct io_wq_work **workptr);
@@ -890,12 +1000,17 @@ static int __io_sqe_files_update(struct io_ring_ctx *ctx,
 				 struct io_uring_files_update *ip,
 				 unsigned nr_args);
 static int io_grab_files(struct io_kiocb *req);
-static void io_complete_rw_common(struct kiocb *kiocb, long res);
+static void io_complete_rw_common(struct kiocb *kiocb, long res,
+				  struct io_comp_state *cs);
 static void io_cleanup_req(struct io_kiocb *req);
 static int io_file_get(struct io_submit_state *state, struct io_kiocb *req,
 		       int fd, struct file **out_file, bool fixed);
 static void __io_queue_sqe(struct io_kiocb *req,
-			   const struct io_uring_sqe *sqe);
+			   const struct io_uring_sqe *sqe,
+			   struct io_comp_state *cs);
+static int io_req_task_work_add(struct io_kiocb *req, struct callback_head *cb);
+static int io_sq_thread_acquire_mm(struct io_ring_ctx *ctx,
+				   struct io_kiocb *req);
 
 static struct kmem_cache *req_cachep;
 
@@ -989,12 +1104,12 @@ static struct io_ring_ctx *io_ring_ctx_alloc(struct io_uring_params *p)
 		goto err;
 
 	ctx->flags = p->flags;
-	init_waitqueue_head(&ctx->sqo_wait);
 	init_waitqueue_head(&ctx->cq_wait);
 	INIT_LIST_HEAD(&ctx->cq_overflow_list);
+	INIT_LIST_HEAD(&ctx->sqd_list);
 	init_completion(&ctx->ref_comp);
-	init_completion(&ctx->sq_thread_comp);
 	idr_init(&ctx->io_buffer_idr);
+	idr_init(&ctx->io_buf_ring_idr);
 	idr_init(&ctx->personality_idr);
 	mutex_init(&ctx->uring_lock);
 	init_waitqueue_head(&ctx->wait);
@@ -1020,7 +1135,7 @@ static inline bool __req_need_defer(struct io_kiocb *req)
 {
 	struct io_ring_ctx *ctx = req->ctx;
 
-	return req->sequence != ctx->cached_cq_tail
+	return req->sequence + ctx->cq_extra != ctx->cached_cq_tail
 				+ atomic_read(&ctx->cached_cq_overflow);
 }
 
@@ -1221,8 +1336,8 @@ static void io_cqring_ev_posted(struct io_ring_ctx *ctx)
 {
 	if (waitqueue_active(&ctx->wait))
 		wake_up(&ctx->wait);
-	if (waitqueue_active(&ctx->sqo_wait))
-		wake_up(&ctx->sqo_wait);
+	if (ctx->sqo_wait && waitqueue_active(ctx->sqo_wait))
+		wake_up(ctx->sqo_wait);
 	if (io_should_trigger_evfd(ctx))
 		eventfd_signal(ctx->cq_ev_fd, 1);
 }
@@ -1325,6 +1440,42 @@ static void io_cqring_fill_event(struct io_kiocb *req, long res)
 	__io_cqring_fill_event(req, res, 0);
 }
 
+static bool io_cqring_can_fill_more(struct io_ring_ctx *ctx)
+{
+	struct io_rings *rings = ctx->rings;
+
+	/* keep ordering with CQEs that are already backlogged */
+	if (!list_empty(&ctx->cq_overflow_list))
+		return false;
+	return ctx->cached_cq_tail - READ_ONCE(rings->cq.head) !=
+		rings->cq_ring_entries;
+}
+
+/*
+ * Post an intermediate completion for a multishot request, flagged with
+ * IORING_CQE_F_MORE. The overflow list holds the request itself, so this
+ * can't overflow: if there is no free CQE, nothing is posted and false is
+ * returned, and the caller has to terminate the request with a regular
+ * completion instead. Must be called with ->completion_lock held.
+ */
+static bool io_cqring_fill_more(struct io_kiocb *req, long res, long cflags)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_uring_cqe *cqe;
+
+	if (!io_cqring_can_fill_more(ctx))
+		return false;
+
+	cqe = io_get_cqring(ctx);
+
+	trace_io_uring_complete(ctx, req->user_data, res);
+	WRITE_ONCE(cqe->user_data, req->user_data);
+	WRITE_ONCE(cqe->res, res);
+	WRITE_ONCE(cqe->flags, cflags | IORING_CQE_F_MORE);
+	ctx->cq_extra++;
+	return true;
+}
+
 static void __io_cqring_add_event(struct io_kiocb *req, long res, long cflags)
 {
 	struct io_ring_ctx *ctx = req->ctx;
@@ -1343,6 +1494,80 @@ static void io_cqring_add_event(struct io_kiocb *req, long res)
 	__io_cqring_add_event(req, res, 0);
 }
 
+/*
+ * Like io_cqring_ev_posted(), for a batch of completions. A sleeper in
+ * io_cqring_wait() that wants more CQEs than the ring now holds would go
+ * straight back to sleep, so skip the wake-up unless someone can be
+ * satisfied. A timeout firing, or a backlog that the waiter has to
+ * flush, always wakes.
+ */
+static void io_cqring_ev_posted_batch(struct io_ring_ctx *ctx,
+				      unsigned int nr_timeouts)
+{
+	/* pairs with smp_mb() in io_cqring_wait_nr_add() */
+	smp_mb();
+	if (waitqueue_active(&ctx->wait)) {
+		unsigned int events;
+
+		events = ctx->cached_cq_tail - READ_ONCE(ctx->rings->cq.head);
+		if (events >= READ_ONCE(ctx->cq_wait_nr) ||
+		    test_bit(0, &ctx->cq_check_overflow) ||
+		    atomic_read(&ctx->cq_timeouts) != nr_timeouts)
+			wake_up(&ctx->wait);
+	}
+	if (ctx->sqo_wait && waitqueue_active(ctx->sqo_wait))
+		wake_up(ctx->sqo_wait);
+	if (io_should_trigger_evfd(ctx))
+		eventfd_signal(ctx->cq_ev_fd, 1);
+}
+
+static void io_submit_flush_completions(struct io_comp_state *cs)
+{
+	struct io_ring_ctx *ctx = cs->ctx;
+	unsigned int i, nr_timeouts;
+
+	if (!cs->nr)
+		return;
+
+	nr_timeouts = atomic_read(&ctx->cq_timeouts);
+	spin_lock_irq(&ctx->completion_lock);
+	for (i = 0; i < cs->nr; i++) {
+		struct io_kiocb *req = cs->reqs[i];
+
+		__io_cqring_fill_event(req, (int) req->result, req->cflags);
+	}
+	io_commit_cqring(ctx);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	io_cqring_ev_posted_batch(ctx, nr_timeouts);
+
+	for (i = 0; i < cs->nr; i++)
+		io_put_req(cs->reqs[i]);
+	cs->nr = 0;
+}
+
+/*
+ * Post the completion of @req and drop the completion reference. With a
+ * @cs from the submitting task the CQE is only stashed, and gets posted
+ * along with the rest of the batch. Link heads are completed right away,
+ * so that the rest of the chain can still be issued inline.
+ */
+static void __io_req_complete(struct io_kiocb *req, long res,
+			      unsigned int cflags, struct io_comp_state *cs)
+{
+	if (!cs || (req->flags & REQ_F_LINK_HEAD)) {
+		__io_cqring_add_event(req, res, cflags);
+		io_put_req(req);
+		return;
+	}
+
+	req->result = res;
+	req->cflags = cflags;
+	cs->reqs[cs->nr++] = req;
+	if (cs->nr == IO_COMPL_BATCH)
+		io_submit_flush_completions(cs);
+}
+
 static inline bool io_is_fallback_req(struct io_kiocb *req)
 {
 	return req == (struct io_kiocb *)
@@ -1735,6 +1960,14 @@ static int io_put_kbuf(struct io_kiocb *req)
 	struct io_buffer *kbuf;
 	int cflags;
 
+	if (req->flags & REQ_F_BUFFER_RING) {
+		/* nothing to free, the application recycles it via the ring */
+		cflags = req->buf_index << IORING_CQE_BUFFER_SHIFT;
+		cflags |= IORING_CQE_F_BUFFER;
+		req->rw.addr = 0;
+		return cflags;
+	}
+
 	kbuf = (struct io_buffer *) (unsigned long) req->rw.addr;
 	cflags = kbuf->bid << IORING_CQE_BUFFER_SHIFT;
 	cflags |= IORING_CQE_F_BUFFER;
@@ -1753,8 +1986,7 @@ static void io_iopoll_queue(struct list_head *again)
 
 		/* shouldn't happen unless io_uring is dying, cancel reqs */
 		if (unlikely(!current->mm)) {
-			io_complete_rw_common(&req->rw.kiocb, -EAGAIN);
-			io_put_req(req);
+			io_complete_rw_common(&req->rw.kiocb, -EAGAIN, NULL);
 			continue;
 		}
 
@@ -1968,7 +2200,8 @@ static inline void req_set_fail_links(struct io_kiocb *req)
 		req->flags |= REQ_F_FAIL_LINK;
 }
 
-static void io_complete_rw_common(struct kiocb *kiocb, long res)
+static void io_complete_rw_common(struct kiocb *kiocb, long res,
+				  struct io_comp_state *cs)
 {
 	struct io_kiocb *req = container_of(kiocb, struct io_kiocb, rw.kiocb);
 	int cflags = 0;
@@ -1980,15 +2213,12 @@ static void io_complete_rw_common(struct kiocb *kiocb, long res)
 		req_set_fail_links(req);
 	if (req->flags & REQ_F_BUFFER_SELECTED)
 		cflags = io_put_kbuf(req);
-	__io_cqring_add_event(req, res, cflags);
+	__io_req_complete(req, res, cflags, cs);
 }
 
 static void io_complete_rw(struct kiocb *kiocb, long res, long res2)
 {
-	struct io_kiocb *req = container_of(kiocb, struct io_kiocb, rw.kiocb);
-
-	io_complete_rw_common(kiocb, res);
-	io_put_req(req);
+	io_complete_rw_common(kiocb, res, NULL);
 }
 
 static void io_complete_rw_iopoll(struct kiocb *kiocb, long res, long res2)
@@ -2043,8 +2273,8 @@ static void io_iopoll_req_issued(struct io_kiocb *req)
 		list_add_tail(&req->list, &ctx->poll_list);
 
 	if ((ctx->flags & IORING_SETUP_SQPOLL) &&
-	    wq_has_sleeper(&ctx->sqo_wait))
-		wake_up(&ctx->sqo_wait);
+	    wq_has_sleeper(ctx->sqo_wait))
+		wake_up(ctx->sqo_wait);
 }
 
 static void __io_state_file_put(struct io_submit_state *state)
@@ -2062,6 +2292,46 @@ static inline void io_state_file_put(struct io_submit_state *state)
 		__io_state_file_put(state);
 }
 
+static void io_state_fixed_refs_put(struct io_submit_state *state)
+{
+	int diff = state->fixed_has_refs - state->fixed_used_refs;
+
+	if (diff)
+		percpu_ref_put_many(state->fixed_refs, diff);
+	state->fixed_refs = NULL;
+}
+
+/*
+ * Like __io_file_get(), but for the fixed file table: take references to the
+ * current table node for all IOs left in this submission at once, and hand
+ * them out one per request. The node changes on a files update, in which
+ * case the leftovers are dropped and we start over on the new node.
+ */
+static struct percpu_ref *io_fixed_refs_get(struct io_submit_state *state,
+					    struct io_ring_ctx *ctx)
+{
+	struct percpu_ref *refs = ctx->file_data->cur_refs;
+
+	if (!state) {
+		percpu_ref_get(refs);
+		return refs;
+	}
+
+	if (state->fixed_refs == refs &&
+	    state->fixed_used_refs < state->fixed_has_refs) {
+		state->fixed_used_refs++;
+		return refs;
+	}
+	if (state->fixed_refs)
+		io_state_fixed_refs_put(state);
+
+	state->fixed_has_refs = max(state->ios_left, 1U);
+	percpu_ref_get_many(refs, state->fixed_has_refs);
+	state->fixed_refs = refs;
+	state->fixed_used_refs = 1;
+	return refs;
+}
+
 /*
  * Get as many references to a file as we have IOs left in this submission,
  * assuming most submissions are for one file, or at least that each file
@@ -2199,39 +2469,36 @@ static inline void io_rw_done(struct kiocb *kiocb, ssize_t ret)
 	}
 }
 
-static void kiocb_done(struct kiocb *kiocb, ssize_t ret)
+static void kiocb_done(struct kiocb *kiocb, ssize_t ret,
+		       struct io_comp_state *cs)
 {
 	struct io_kiocb *req = container_of(kiocb, struct io_kiocb, rw.kiocb);
 
 	if (req->flags & REQ_F_CUR_POS)
 		req->file->f_pos = kiocb->ki_pos;
 	if (ret >= 0 && kiocb->ki_complete == io_complete_rw)
-		io_complete_rw(kiocb, ret, 0);
+		io_complete_rw_common(kiocb, ret, cs);
 	else
 		io_rw_done(kiocb, ret);
 }
 
-static ssize_t io_import_fixed(struct io_kiocb *req, int rw,
-			       struct iov_iter *iter)
+static ssize_t __io_import_fixed(struct io_ring_ctx *ctx, int rw,
+				 struct iov_iter *iter, u16 buf_index,
+				 u64 buf_addr, size_t len)
 {
-	struct io_ring_ctx *ctx = req->ctx;
-	size_t len = req->rw.len;
 	struct io_mapped_ubuf *imu;
-	u16 index, buf_index;
 	size_t offset;
-	u64 buf_addr;
+	u16 index;
 
 	/* attempt to use fixed buffers without having provided iovecs */
 	if (unlikely(!ctx->user_bufs))
 		return -EFAULT;
 
-	buf_index = req->buf_index;
 	if (unlikely(buf_index >= ctx->nr_user_bufs))
 		return -EFAULT;
 
 	index = array_index_nospec(buf_index, ctx->nr_user_bufs);
 	imu = &ctx->user_bufs[index];
-	buf_addr = req->rw.addr;
 
 	/* overflow */
 	if (buf_addr + len < buf_addr)
@@ -2285,6 +2552,13 @@ static ssize_t io_import_fixed(struct io_kiocb *req, int rw,
 	return len;
 }
 
+static ssize_t io_import_fixed(struct io_kiocb *req, int rw,
+			       struct iov_iter *iter)
+{
+	return __io_import_fixed(req->ctx, rw, iter, req->buf_index,
+				 req->rw.addr, req->rw.len);
+}
+
 static void io_ring_submit_unlock(struct io_ring_ctx *ctx, bool needs_lock)
 {
 	if (needs_lock)
@@ -2303,54 +2577,100 @@ static void io_ring_submit_lock(struct io_ring_ctx *ctx, bool needs_lock)
 		mutex_lock(&ctx->uring_lock);
 }
 
-static struct io_buffer *io_buffer_select(struct io_kiocb *req, size_t *len,
-					  int bgid, struct io_buffer *kbuf,
-					  bool needs_lock)
+static void __user *io_ring_buffer_select(struct io_kiocb *req, size_t *len,
+					  struct io_buffer_ring *br)
 {
+	struct io_uring_buf_ring *ring = br->ring;
+	struct io_uring_buf *buf;
+	__u16 head = br->head;
+	__u32 buf_len;
+
+	/* pairs with the release store of the tail by the application */
+	if (smp_load_acquire(&ring->tail) == head)
+		return ERR_PTR(-ENOBUFS);
+
+	buf = &ring->bufs[head & br->mask];
+	buf_len = READ_ONCE(buf->len);
+	if (*len > buf_len)
+		*len = buf_len;
+	req->buf_index = READ_ONCE(buf->bid);
+	req->flags |= REQ_F_BUFFER_RING;
+	br->head = head + 1;
+	return u64_to_user_ptr(READ_ONCE(buf->addr));
+}
+
+/*
+ * Pick a buffer from group @bgid. For classic provided buffers, *kbuf is set
+ * to the buffer taken off the group's list, and the request owns it until
+ * it's freed. For a buffer ring, REQ_F_BUFFER_RING is set, the buffer ID is
+ * stored in req->buf_index and there's nothing to free.
+ */
+static void __user *io_buffer_select(struct io_kiocb *req, size_t *len,
+				     int bgid, struct io_buffer **kbuf,
+				     bool needs_lock)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_buffer_ring *br;
 	struct io_buffer *head;
+	void __user *buf;
 
-	if (req->flags & REQ_F_BUFFER_SELECTED)
-		return kbuf;
+	io_ring_submit_lock(ctx, needs_lock);
 
-	io_ring_submit_lock(req->ctx, needs_lock);
+	lockdep_assert_held(&ctx->uring_lock);
 
-	lockdep_assert_held(&req->ctx->uring_lock);
+	br = idr_find(&ctx->io_buf_ring_idr, bgid);
+	if (br) {
+		buf = io_ring_buffer_select(req, len, br);
+		goto out;
+	}
 
-	head = idr_find(&req->ctx->io_buffer_idr, bgid);
+	head = idr_find(&ctx->io_buffer_idr, bgid);
 	if (head) {
 		if (!list_empty(&head->list)) {
-			kbuf = list_last_entry(&head->list, struct io_buffer,
+			*kbuf = list_last_entry(&head->list, struct io_buffer,
 							list);
-			list_del(&kbuf->list);
+			list_del(&(*kbuf)->list);
 		} else {
-			kbuf = head;
-			idr_remove(&req->ctx->io_buffer_idr, bgid);
+			*kbuf = head;
+			idr_remove(&ctx->io_buffer_idr, bgid);
 		}
-		if (*len > kbuf->len)
-			*len = kbuf->len;
+		if (*len > (*kbuf)->len)
+			*len = (*kbuf)->len;
+		buf = u64_to_user_ptr((*kbuf)->addr);
 	} else {
-		kbuf = ERR_PTR(-ENOBUFS);
+		buf = ERR_PTR(-ENOBUFS);
 	}
+out:
+	io_ring_submit_unlock(ctx, needs_lock);
 
-	io_ring_submit_unlock(req->ctx, needs_lock);
-
-	return kbuf;
+	return buf;
 }
 
 static void __user *io_rw_buffer_select(struct io_kiocb *req, size_t *len,
 					bool needs_lock)
 {
 	struct io_buffer *kbuf;
-	u16 bgid;
+	void __user *buf;
 
-	kbuf = (struct io_buffer *) (unsigned long) req->rw.addr;
-	bgid = req->buf_index;
-	kbuf = io_buffer_select(req, len, bgid, kbuf, needs_lock);
-	if (IS_ERR(kbuf))
-		return kbuf;
-	req->rw.addr = (u64) (unsigned long) kbuf;
+	if (req->flags & REQ_F_BUFFER_SELECTED) {
+		if (req->flags & REQ_F_BUFFER_RING)
+			return u64_to_user_ptr(req->rw.addr);
+		kbuf = (struct io_buffer *) (unsigned long) req->rw.addr;
+		return u64_to_user_ptr(kbuf->addr);
+	}
+
+	buf = io_buffer_select(req, len, req->buf_index, &kbuf, needs_lock);
+	if (IS_ERR(buf))
+		return buf;
+	if (req->flags & REQ_F_BUFFER_RING) {
+		/* no kbuf to hold on to, remember the buffer itself */
+		req->rw.addr = (u64) (unsigned long) buf;
+		req->rw.len = *len;
+	} else {
+		req->rw.addr = (u64) (unsigned long) kbuf;
+	}
 	req->flags |= REQ_F_BUFFER_SELECTED;
-	return u64_to_user_ptr(kbuf->addr);
+	return buf;
 }
 
 #ifdef CONFIG_COMPAT
@@ -2407,6 +2727,11 @@ static ssize_t io_iov_buffer_select(struct io_kiocb *req, struct iovec *iov,
 	if (req->flags & REQ_F_BUFFER_SELECTED) {
 		struct io_buffer *kbuf;
 
+		if (req->flags & REQ_F_BUFFER_RING) {
+			iov[0].iov_base = u64_to_user_ptr(req->rw.addr);
+			iov[0].iov_len = req->rw.len;
+			return 0;
+		}
 		kbuf = (struct io_buffer *) (unsigned long) req->rw.addr;
 		iov[0].iov_base = u64_to_user_ptr(kbuf->addr);
 		iov[0].iov_len = kbuf->len;
@@ -2622,7 +2947,121 @@ static int io_read_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 	return 0;
 }
 
-static int io_read(struct io_kiocb *req, bool force_nonblock)
+static void io_async_buf_restore_work(struct io_kiocb *req)
+{
+	if (req->flags & REQ_F_WORK_INITIALIZED)
+		memcpy(&req->work, &req->io->rw.work, sizeof(req->work));
+}
+
+static void io_async_buf_cancel(struct callback_head *cb)
+{
+	struct io_kiocb *req = container_of(cb, struct io_kiocb, task_work);
+
+	io_async_buf_restore_work(req);
+	io_cqring_add_event(req, -ECANCELED);
+	req_set_fail_links(req);
+	io_double_put_req(req);
+}
+
+static void io_async_buf_retry(struct callback_head *cb)
+{
+	struct io_kiocb *req = container_of(cb, struct io_kiocb, task_work);
+	struct io_ring_ctx *ctx = req->ctx;
+
+	io_async_buf_restore_work(req);
+
+	__set_current_state(TASK_RUNNING);
+	if (io_sq_thread_acquire_mm(ctx, req)) {
+		io_cqring_add_event(req, -EFAULT);
+		req_set_fail_links(req);
+		io_double_put_req(req);
+		return;
+	}
+	mutex_lock(&ctx->uring_lock);
+	__io_queue_sqe(req, NULL, NULL);
+	mutex_unlock(&ctx->uring_lock);
+}
+
+static int io_async_buf_func(struct wait_queue_entry *wait, unsigned int mode,
+			     int sync, void *arg)
+{
+	struct wait_page_queue *wpq;
+	struct io_kiocb *req = wait->private;
+	struct wait_page_key *key = arg;
+	int ret;
+
+	wpq = container_of(wait, struct wait_page_queue, wait);
+
+	if (!wake_page_match(wpq, key))
+		return 0;
+
+	list_del_init(&wait->entry);
+
+	init_task_work(&req->task_work, io_async_buf_retry);
+	/* submit ref gets dropped, acquire a new one */
+	refcount_inc(&req->refs);
+	ret = io_req_task_work_add(req, &req->task_work);
+	if (unlikely(ret)) {
+		struct task_struct *tsk;
+
+		/* the task is exiting, queue just for cancellation */
+		init_task_work(&req->task_work, io_async_buf_cancel);
+		tsk = io_wq_get_task(req->ctx->io_wq);
+		task_work_add(tsk, &req->task_work, 0);
+		wake_up_process(tsk);
+	}
+	return 1;
+}
+
+/*
+ * A buffered read that would block on page cache IO doesn't need to be
+ * punted to io-wq: if the file supports it, arm a wait-page callback and let
+ * the read queue it on the page it has to wait for. When that page is
+ * unlocked, the read is retried from task_work. Returns true if armed.
+ */
+static bool io_rw_should_retry(struct io_kiocb *req)
+{
+	struct kiocb *kiocb = &req->rw.kiocb;
+	int ret;
+
+	/* never retry for NOWAIT, we just complete with -EAGAIN */
+	if (req->flags & REQ_F_NOWAIT)
+		return false;
+
+	/* Only for buffered IO */
+	if (kiocb->ki_flags & (IOCB_DIRECT | IOCB_HIPRI))
+		return false;
+	/*
+	 * just use poll if we can, and don't attempt if the fs doesn't
+	 * support callback based unlocks
+	 */
+	if (file_can_poll(req->file) || !(req->file->f_mode & FMODE_BUF_RASYNC))
+		return false;
+	/* the wait queue entry lives in ->io */
+	if (!req->io)
+		return false;
+
+	ret = kiocb_wait_page_queue_init(kiocb, &req->io->rw.wpq,
+					 io_async_buf_func, req);
+	if (ret)
+		return false;
+
+	io_get_req_task(req);
+	if (req->flags & REQ_F_WORK_INITIALIZED)
+		memcpy(&req->io->rw.work, &req->work, sizeof(req->work));
+	kiocb->ki_flags &= ~IOCB_NOWAIT;
+	return true;
+}
+
+static int io_iter_do_read(struct io_kiocb *req, struct iov_iter *iter)
+{
+	if (req->file->f_op->read_iter)
+		return call_read_iter(req->file, &req->rw.kiocb, iter);
+	return loop_rw_iter(READ, req->file, &req->rw.kiocb, iter);
+}
+
+static int io_read(struct io_kiocb *req, bool force_nonblock,
+		    struct io_comp_state *cs)
 {
 	struct iovec inline_vecs[UIO_FASTIOV], *iovec = inline_vecs;
 	struct kiocb *kiocb = &req->rw.kiocb;
@@ -2637,6 +3076,10 @@ static int io_read(struct io_kiocb *req, bool force_nonblock)
 	/* Ensure we clear previously set non-block flag */
 	if (!force_nonblock)
 		kiocb->ki_flags &= ~IOCB_NOWAIT;
+	else
+		kiocb->ki_flags |= IOCB_NOWAIT;
+	/* a wait-page callback is only armed for the attempt below */
+	kiocb->ki_flags &= ~IOCB_WAITQ;
 
 	req->result = 0;
 	io_size = ret;
@@ -2655,20 +3098,30 @@ static int io_read(struct io_kiocb *req, bool force_nonblock)
 	if (!ret) {
 		ssize_t ret2;
 
-		if (req->file->f_op->read_iter)
-			ret2 = call_read_iter(req->file, kiocb, &iter);
-		else
-			ret2 = loop_rw_iter(READ, req->file, kiocb, &iter);
+		ret2 = io_iter_do_read(req, &iter);
 
 		/* Catch -EAGAIN return for forced non-blocking submission */
 		if (!force_nonblock || ret2 != -EAGAIN) {
-			kiocb_done(kiocb, ret2);
+			kiocb_done(kiocb, ret2, cs);
 		} else {
 copy_iov:
 			ret = io_setup_async_rw(req, io_size, iovec,
 						inline_vecs, &iter);
 			if (ret)
 				goto out_free;
+			/* it's copied and will be cleaned with ->io */
+			iovec = NULL;
+			/* if we can retry, do so with the callbacks armed */
+			if (io_rw_should_retry(req)) {
+				ret2 = io_iter_do_read(req, &iter);
+				if (ret2 == -EIOCBQUEUED)
+					goto out_free;
+				if (ret2 != -EAGAIN) {
+					kiocb_done(kiocb, ret2, cs);
+					goto out_free;
+				}
+				kiocb->ki_flags &= ~IOCB_WAITQ;
+			}
 			/* any defer here is final, must blocking retry */
 			if (!(req->flags & REQ_F_NOWAIT) &&
 			    !file_can_poll(req->file))
@@ -2714,7 +3167,8 @@ static int io_write_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 	return 0;
 }
 
-static int io_write(struct io_kiocb *req, bool force_nonblock)
+static int io_write(struct io_kiocb *req, bool force_nonblock,
+		     struct io_comp_state *cs)
 {
 	struct iovec inline_vecs[UIO_FASTIOV], *iovec = inline_vecs;
 	struct kiocb *kiocb = &req->rw.kiocb;
@@ -2785,7 +3239,7 @@ static int io_write(struct io_kiocb *req, bool force_nonblock)
 		if (ret2 == -EOPNOTSUPP && (kiocb->ki_flags & IOCB_NOWAIT))
 			ret2 = -EAGAIN;
 		if (!force_nonblock || ret2 != -EAGAIN) {
-			kiocb_done(kiocb, ret2);
+			kiocb_done(kiocb, ret2, cs);
 		} else {
 copy_iov:
 			ret = io_setup_async_rw(req, io_size, iovec,
@@ -2913,15 +3367,14 @@ static int io_splice(struct io_kiocb *req, bool force_nonblock)
 /*
  * IORING_OP_NOP just posts a completion event, nothing else.
  */
-static int io_nop(struct io_kiocb *req)
+static int io_nop(struct io_kiocb *req, struct io_comp_state *cs)
 {
 	struct io_ring_ctx *ctx = req->ctx;
 
 	if (unlikely(ctx->flags & IORING_SETUP_IOPOLL))
 		return -EINVAL;
 
-	io_cqring_add_event(req, 0);
-	io_put_req(req);
+	__io_req_complete(req, 0, 0, cs);
 	return 0;
 }
 
@@ -3235,6 +3688,11 @@ static int io_provide_buffers(struct io_kiocb *req, bool force_nonblock)
 
 	lockdep_assert_held(&ctx->uring_lock);
 
+	/* group is already backed by a registered buffer ring */
+	ret = -EEXIST;
+	if (idr_find(&ctx->io_buf_ring_idr, p->bgid))
+		goto out;
+
 	list = head = idr_find(&ctx->io_buffer_idr, p->bgid);
 
 	ret = io_add_buffers(p, &head);
@@ -3559,7 +4017,8 @@ static int io_sendmsg_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 	return ret;
 }
 
-static int io_sendmsg(struct io_kiocb *req, bool force_nonblock)
+static int io_sendmsg(struct io_kiocb *req, bool force_nonblock,
+		       struct io_comp_state *cs)
 {
 	struct io_async_msghdr *kmsg = NULL;
 	struct socket *sock;
@@ -3606,14 +4065,14 @@ static int io_sendmsg(struct io_kiocb *req, bool force_nonblock)
 	if (kmsg && kmsg->iov != kmsg->fast_iov)
 		kfree(kmsg->iov);
 	req->flags &= ~REQ_F_NEED_CLEANUP;
-	io_cqring_add_event(req, ret);
 	if (ret < 0)
 		req_set_fail_links(req);
-	io_put_req(req);
+	__io_req_complete(req, ret, 0, cs);
 	return 0;
 }
 
-static int io_send(struct io_kiocb *req, bool force_nonblock)
+static int io_send(struct io_kiocb *req, bool force_nonblock,
+		    struct io_comp_state *cs)
 {
 	struct socket *sock;
 	int ret;
@@ -3634,6 +4093,7 @@ static int io_send(struct io_kiocb *req, bool force_nonblock)
 		msg.msg_control = NULL;
 		msg.msg_controllen = 0;
 		msg.msg_namelen = 0;
+		msg.msg_ubuf = NULL;
 
 		flags = req->sr_msg.msg_flags;
 		if (flags & MSG_DONTWAIT)
@@ -3649,45 +4109,186 @@ static int io_send(struct io_kiocb *req, bool force_nonblock)
 			ret = -EINTR;
 	}
 
-	io_cqring_add_event(req, ret);
 	if (ret < 0)
 		req_set_fail_links(req);
-	io_put_req(req);
+	__io_req_complete(req, ret, 0, cs);
 	return 0;
 }
 
-static int __io_recvmsg_copy_hdr(struct io_kiocb *req, struct io_async_ctx *io)
+static void io_notif_complete(struct ubuf_info *uarg, bool success)
 {
-	struct io_sr_msg *sr = &req->sr_msg;
-	struct iovec __user *uiov;
-	size_t iov_len;
-	int ret;
-
-	ret = __copy_msghdr_from_user(&io->msg.msg, sr->msg, &io->msg.uaddr,
-					&uiov, &iov_len);
-	if (ret)
-		return ret;
+	struct io_kiocb *notif = container_of(uarg, struct io_kiocb,
+					      notif.uarg);
+	struct io_ring_ctx *ctx = notif->ctx;
+	unsigned long flags;
 
-	if (req->flags & REQ_F_BUFFER_SELECT) {
-		if (iov_len > 1)
-			return -EINVAL;
-		if (copy_from_user(io->msg.iov, uiov, sizeof(*uiov)))
-			return -EFAULT;
-		sr->len = io->msg.iov[0].iov_len;
-		iov_iter_init(&io->msg.msg.msg_iter, READ, io->msg.iov, 1,
-				sr->len);
-		io->msg.iov = NULL;
-	} else {
-		ret = import_iovec(READ, uiov, iov_len, UIO_FASTIOV,
-					&io->msg.iov, &io->msg.msg.msg_iter);
-		if (ret > 0)
-			ret = 0;
-	}
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+	/* on top of the CQE of the send itself */
+	ctx->cq_extra++;
+	__io_cqring_fill_event(notif, success ? 0 : IORING_NOTIF_COPIED,
+			       IORING_CQE_F_NOTIF);
+	io_commit_cqring(ctx);
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
 
-	return ret;
+	io_cqring_ev_posted(ctx);
+	io_put_req(notif);
 }
 
-#ifdef CONFIG_COMPAT
+static struct io_kiocb *io_alloc_notif(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_kiocb *notif;
+	struct ubuf_info *uarg;
+
+	notif = kmem_cache_alloc(req_cachep, GFP_KERNEL | __GFP_NOWARN);
+	if (unlikely(!notif))
+		return NULL;
+
+	notif->opcode = IORING_OP_NOP;
+	notif->user_data = req->user_data;
+	notif->io = NULL;
+	notif->file = NULL;
+	notif->ctx = ctx;
+	notif->flags = 0;
+	refcount_set(&notif->refs, 1);
+	notif->task = NULL;
+	notif->result = 0;
+	notif->cflags = 0;
+	INIT_LIST_HEAD(&notif->link_list);
+	percpu_ref_get(&ctx->refs);
+
+	uarg = &notif->notif.uarg;
+	memset(uarg, 0, sizeof(*uarg));
+	uarg->callback = io_notif_complete;
+	uarg->zerocopy = 1;
+	uarg->flags = UBUF_F_SHARED;
+	/* dropped once the send is done, skbs hold their own references */
+	refcount_set(&uarg->refcnt, 1);
+	return notif;
+}
+
+static int io_sendzc_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+	struct io_sr_msg *sr = &req->sr_msg;
+
+	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
+		return -EINVAL;
+	if (sqe->ioprio)
+		return -EINVAL;
+
+	sr->buf = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	sr->len = READ_ONCE(sqe->len);
+	sr->msg_flags = READ_ONCE(sqe->msg_flags);
+	sr->notif = NULL;
+	req->buf_index = READ_ONCE(sqe->buf_index);
+	return 0;
+}
+
+/*
+ * Send from a registered buffer without copying it. The pages are attached
+ * to the skbs as frags, and once the stack has dropped the last of them, a
+ * notification CQE with IORING_CQE_F_NOTIF is posted. The CQE of the send
+ * itself carries IORING_CQE_F_MORE whenever a notification follows.
+ */
+static int io_sendzc(struct io_kiocb *req, bool force_nonblock)
+{
+	struct io_sr_msg *sr = &req->sr_msg;
+	struct io_kiocb *notif;
+	struct socket *sock;
+	struct msghdr msg;
+	unsigned int flags;
+	int ret;
+
+	sock = sock_from_file(req->file, &ret);
+	if (unlikely(!sock))
+		goto err;
+	/* only TCP attaches a caller's notification to its skbs */
+	ret = -EOPNOTSUPP;
+	if (sock->sk->sk_protocol != IPPROTO_TCP)
+		goto err;
+
+	ret = __io_import_fixed(req->ctx, WRITE, &msg.msg_iter, req->buf_index,
+				(u64)(unsigned long)sr->buf, sr->len);
+	if (unlikely(ret < 0))
+		goto err;
+
+	notif = sr->notif;
+	if (!notif) {
+		ret = -ENOMEM;
+		notif = io_alloc_notif(req);
+		if (unlikely(!notif))
+			goto err;
+		sr->notif = notif;
+		req->flags |= REQ_F_NEED_CLEANUP;
+	}
+
+	msg.msg_name = NULL;
+	msg.msg_control = NULL;
+	msg.msg_controllen = 0;
+	msg.msg_namelen = 0;
+	msg.msg_ubuf = &notif->notif.uarg;
+
+	flags = sr->msg_flags | MSG_ZEROCOPY;
+	if (flags & MSG_DONTWAIT)
+		req->flags |= REQ_F_NOWAIT;
+	else if (force_nonblock)
+		flags |= MSG_DONTWAIT;
+
+	msg.msg_flags = flags;
+	ret = sock_sendmsg(sock, &msg);
+	if (force_nonblock && ret == -EAGAIN)
+		return -EAGAIN;
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+
+	req->flags &= ~REQ_F_NEED_CLEANUP;
+	sr->notif = NULL;
+	if (ret < 0)
+		req_set_fail_links(req);
+	/* post our CQE before dropping the ref, the notification comes last */
+	__io_cqring_add_event(req, ret, IORING_CQE_F_MORE);
+	sock_zerocopy_put(&notif->notif.uarg);
+	io_put_req(req);
+	return 0;
+err:
+	req_set_fail_links(req);
+	io_cqring_add_event(req, ret);
+	io_put_req(req);
+	return 0;
+}
+
+static int __io_recvmsg_copy_hdr(struct io_kiocb *req, struct io_async_ctx *io)
+{
+	struct io_sr_msg *sr = &req->sr_msg;
+	struct iovec __user *uiov;
+	size_t iov_len;
+	int ret;
+
+	ret = __copy_msghdr_from_user(&io->msg.msg, sr->msg, &io->msg.uaddr,
+					&uiov, &iov_len);
+	if (ret)
+		return ret;
+
+	if (req->flags & REQ_F_BUFFER_SELECT) {
+		if (iov_len > 1)
+			return -EINVAL;
+		if (copy_from_user(io->msg.iov, uiov, sizeof(*uiov)))
+			return -EFAULT;
+		sr->len = io->msg.iov[0].iov_len;
+		iov_iter_init(&io->msg.msg.msg_iter, READ, io->msg.iov, 1,
+				sr->len);
+		io->msg.iov = NULL;
+	} else {
+		ret = import_iovec(READ, uiov, iov_len, UIO_FASTIOV,
+					&io->msg.iov, &io->msg.msg.msg_iter);
+		if (ret > 0)
+			ret = 0;
+	}
+
+	return ret;
+}
+
+#ifdef CONFIG_COMPAT
 static int __io_compat_recvmsg_copy_hdr(struct io_kiocb *req,
 					struct io_async_ctx *io)
 {
@@ -3742,25 +4343,44 @@ static int io_recvmsg_copy_hdr(struct io_kiocb *req, struct io_async_ctx *io)
 	return __io_recvmsg_copy_hdr(req, io);
 }
 
-static struct io_buffer *io_recv_buffer_select(struct io_kiocb *req,
-					       int *cflags, bool needs_lock)
+static void __user *io_recv_buffer_select(struct io_kiocb *req, int *cflags,
+					  bool needs_lock)
 {
 	struct io_sr_msg *sr = &req->sr_msg;
 	struct io_buffer *kbuf;
+	void __user *buf;
+	int bid;
 
 	if (!(req->flags & REQ_F_BUFFER_SELECT))
 		return NULL;
 
-	kbuf = io_buffer_select(req, &sr->len, sr->bgid, sr->kbuf, needs_lock);
-	if (IS_ERR(kbuf))
-		return kbuf;
+	if (req->flags & REQ_F_BUFFER_SELECTED) {
+		if (req->flags & REQ_F_BUFFER_RING) {
+			buf = sr->ring_buf;
+			bid = req->buf_index;
+		} else {
+			buf = u64_to_user_ptr(sr->kbuf->addr);
+			bid = sr->kbuf->bid;
+		}
+		goto done;
+	}
 
-	sr->kbuf = kbuf;
-	req->flags |= REQ_F_BUFFER_SELECTED;
+	buf = io_buffer_select(req, &sr->len, sr->bgid, &kbuf, needs_lock);
+	if (IS_ERR(buf))
+		return buf;
 
-	*cflags = kbuf->bid << IORING_CQE_BUFFER_SHIFT;
+	if (req->flags & REQ_F_BUFFER_RING) {
+		sr->ring_buf = buf;
+		bid = req->buf_index;
+	} else {
+		sr->kbuf = kbuf;
+		bid = kbuf->bid;
+	}
+	req->flags |= REQ_F_BUFFER_SELECTED;
+done:
+	*cflags = bid << IORING_CQE_BUFFER_SHIFT;
 	*cflags |= IORING_CQE_F_BUFFER;
-	return kbuf;
+	return buf;
 }
 
 static int io_recvmsg_prep(struct io_kiocb *req,
@@ -3795,7 +4415,8 @@ static int io_recvmsg_prep(struct io_kiocb *req,
 	return ret;
 }
 
-static int io_recvmsg(struct io_kiocb *req, bool force_nonblock)
+static int io_recvmsg(struct io_kiocb *req, bool force_nonblock,
+		       struct io_comp_state *cs)
 {
 	struct io_async_msghdr *kmsg = NULL;
 	struct socket *sock;
@@ -3803,8 +4424,8 @@ static int io_recvmsg(struct io_kiocb *req, bool force_nonblock)
 
 	sock = sock_from_file(req->file, &ret);
 	if (sock) {
-		struct io_buffer *kbuf;
 		struct io_async_ctx io;
+		void __user *buf;
 		unsigned flags;
 
 		if (req->io) {
@@ -3823,11 +4444,11 @@ static int io_recvmsg(struct io_kiocb *req, bool force_nonblock)
 				return ret;
 		}
 
-		kbuf = io_recv_buffer_select(req, &cflags, !force_nonblock);
-		if (IS_ERR(kbuf)) {
-			return PTR_ERR(kbuf);
-		} else if (kbuf) {
-			kmsg->fast_iov[0].iov_base = u64_to_user_ptr(kbuf->addr);
+		buf = io_recv_buffer_select(req, &cflags, !force_nonblock);
+		if (IS_ERR(buf)) {
+			return PTR_ERR(buf);
+		} else if (buf) {
+			kmsg->fast_iov[0].iov_base = buf;
 			iov_iter_init(&kmsg->msg.msg_iter, READ, kmsg->iov,
 					1, req->sr_msg.len);
 		}
@@ -3849,14 +4470,14 @@ static int io_recvmsg(struct io_kiocb *req, bool force_nonblock)
 	if (kmsg && kmsg->iov != kmsg->fast_iov)
 		kfree(kmsg->iov);
 	req->flags &= ~REQ_F_NEED_CLEANUP;
-	__io_cqring_add_event(req, ret, cflags);
 	if (ret < 0)
 		req_set_fail_links(req);
-	io_put_req(req);
+	__io_req_complete(req, ret, cflags, cs);
 	return 0;
 }
 
-static int io_recv(struct io_kiocb *req, bool force_nonblock)
+static int io_recv(struct io_kiocb *req, bool force_nonblock,
+		    struct io_comp_state *cs)
 {
 	struct io_buffer *kbuf = NULL;
 	struct socket *sock;
@@ -3865,16 +4486,18 @@ static int io_recv(struct io_kiocb *req, bool force_nonblock)
 	sock = sock_from_file(req->file, &ret);
 	if (sock) {
 		struct io_sr_msg *sr = &req->sr_msg;
-		void __user *buf = sr->buf;
 		struct msghdr msg;
 		struct iovec iov;
+		void __user *buf;
 		unsigned flags;
 
-		kbuf = io_recv_buffer_select(req, &cflags, !force_nonblock);
-		if (IS_ERR(kbuf))
-			return PTR_ERR(kbuf);
-		else if (kbuf)
-			buf = u64_to_user_ptr(kbuf->addr);
+		buf = io_recv_buffer_select(req, &cflags, !force_nonblock);
+		if (IS_ERR(buf))
+			return PTR_ERR(buf);
+		else if (!buf)
+			buf = sr->buf;
+		else if (!(req->flags & REQ_F_BUFFER_RING))
+			kbuf = sr->kbuf;
 
 		ret = import_single_range(READ, buf, sr->len, &iov,
 						&msg.msg_iter);
@@ -3906,10 +4529,9 @@ static int io_recv(struct io_kiocb *req, bool force_nonblock)
 
 	kfree(kbuf);
 	req->flags &= ~REQ_F_NEED_CLEANUP;
-	__io_cqring_add_event(req, ret, cflags);
 	if (ret < 0)
 		req_set_fail_links(req);
-	io_put_req(req);
+	__io_req_complete(req, ret, cflags, cs);
 	return 0;
 }
 
@@ -3919,13 +4541,16 @@ static int io_accept_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 
 	if (unlikely(req->ctx->flags & (IORING_SETUP_IOPOLL|IORING_SETUP_SQPOLL)))
 		return -EINVAL;
-	if (sqe->ioprio || sqe->len || sqe->buf_index)
+	if (sqe->len || sqe->buf_index)
+		return -EINVAL;
+	if (READ_ONCE(sqe->ioprio) & ~IORING_ACCEPT_MULTISHOT)
 		return -EINVAL;
 
 	accept->addr = u64_to_user_ptr(READ_ONCE(sqe->addr));
 	accept->addr_len = u64_to_user_ptr(READ_ONCE(sqe->addr2));
 	accept->flags = READ_ONCE(sqe->accept_flags);
 	accept->nofile = rlimit(RLIMIT_NOFILE);
+	accept->multishot = READ_ONCE(sqe->ioprio) & IORING_ACCEPT_MULTISHOT;
 	return 0;
 }
 
@@ -3933,16 +4558,45 @@ static int io_accept(struct io_kiocb *req, bool force_nonblock)
 {
 	struct io_accept *accept = &req->accept;
 	unsigned int file_flags = force_nonblock ? O_NONBLOCK : 0;
+	struct io_ring_ctx *ctx = req->ctx;
+	bool posted;
 	int ret;
 
-	if (req->file->f_flags & O_NONBLOCK)
+	/*
+	 * A multishot accept parks on the poll handler between connections,
+	 * it must not complete with -EAGAIN on a non-blocking socket.
+	 */
+	if ((req->file->f_flags & O_NONBLOCK) && !accept->multishot)
 		req->flags |= REQ_F_NOWAIT;
 
+retry:
 	ret = __sys_accept4_file(req->file, file_flags, accept->addr,
 					accept->addr_len, accept->flags,
 					accept->nofile);
-	if (ret == -EAGAIN && force_nonblock)
+	if (ret == -EAGAIN && force_nonblock) {
+		/* allow io_arm_poll_handler() to arm it again */
+		if (accept->multishot)
+			req->flags &= ~REQ_F_POLLED;
 		return -EAGAIN;
+	}
+
+	/*
+	 * Only the inline, non-blocking issue keeps a multishot accept
+	 * going. From io-wq, or on error, it completes like a normal
+	 * accept, without IORING_CQE_F_MORE.
+	 */
+	if (accept->multishot && force_nonblock && ret >= 0) {
+		spin_lock_irq(&ctx->completion_lock);
+		posted = io_cqring_fill_more(req, ret, 0);
+		if (posted)
+			io_commit_cqring(ctx);
+		spin_unlock_irq(&ctx->completion_lock);
+		if (posted) {
+			io_cqring_ev_posted(ctx);
+			goto retry;
+		}
+	}
+
 	if (ret < 0) {
 		if (ret == -ERESTARTSYS)
 			ret = -EINTR;
@@ -4019,12 +4673,24 @@ static int io_sendmsg_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 	return -EOPNOTSUPP;
 }
 
-static int io_sendmsg(struct io_kiocb *req, bool force_nonblock)
+static int io_sendmsg(struct io_kiocb *req, bool force_nonblock,
+		       struct io_comp_state *cs)
+{
+	return -EOPNOTSUPP;
+}
+
+static int io_send(struct io_kiocb *req, bool force_nonblock,
+		    struct io_comp_state *cs)
+{
+	return -EOPNOTSUPP;
+}
+
+static int io_sendzc_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 {
 	return -EOPNOTSUPP;
 }
 
-static int io_send(struct io_kiocb *req, bool force_nonblock)
+static int io_sendzc(struct io_kiocb *req, bool force_nonblock)
 {
 	return -EOPNOTSUPP;
 }
@@ -4035,12 +4701,14 @@ static int io_recvmsg_prep(struct io_kiocb *req,
 	return -EOPNOTSUPP;
 }
 
-static int io_recvmsg(struct io_kiocb *req, bool force_nonblock)
+static int io_recvmsg(struct io_kiocb *req, bool force_nonblock,
+		       struct io_comp_state *cs)
 {
 	return -EOPNOTSUPP;
 }
 
-static int io_recv(struct io_kiocb *req, bool force_nonblock)
+static int io_recv(struct io_kiocb *req, bool force_nonblock,
+		    struct io_comp_state *cs)
 {
 	return -EOPNOTSUPP;
 }
@@ -4179,16 +4847,31 @@ static void io_poll_complete(struct io_kiocb *req, __poll_t mask, int error)
 static void io_poll_task_handler(struct io_kiocb *req, struct io_kiocb **nxt)
 {
 	struct io_ring_ctx *ctx = req->ctx;
+	__poll_t mask;
 
 	if (io_poll_rewait(req, &req->poll)) {
 		spin_unlock_irq(&ctx->completion_lock);
 		return;
 	}
 
-	hash_del(&req->hash_node);
-	io_poll_complete(req, req->result, 0);
-	req->flags |= REQ_F_COMP_LOCKED;
-	io_put_req_find_next(req, nxt);
+	mask = req->result;
+	if (!(req->poll.events & EPOLLONESHOT) &&
+	    !READ_ONCE(req->poll.canceled) && io_cqring_can_fill_more(ctx)) {
+		/*
+		 * Multishot: re-arm before the CQE becomes visible, so that
+		 * no wakeup is lost between userspace consuming the event
+		 * and the poll being queued again.
+		 */
+		req->result = 0;
+		add_wait_queue(req->poll.head, &req->poll.wait);
+		io_cqring_fill_more(req, mangle_poll(mask), 0);
+		io_commit_cqring(ctx);
+	} else {
+		hash_del(&req->hash_node);
+		io_poll_complete(req, mask, 0);
+		req->flags |= REQ_F_COMP_LOCKED;
+		io_put_req_find_next(req, nxt);
+	}
 	spin_unlock_irq(&ctx->completion_lock);
 
 	io_cqring_ev_posted(ctx);
@@ -4204,7 +4887,7 @@ static void io_poll_task_func(struct callback_head *cb)
 		struct io_ring_ctx *ctx = nxt->ctx;
 
 		mutex_lock(&ctx->uring_lock);
-		__io_queue_sqe(nxt, NULL);
+		__io_queue_sqe(nxt, NULL, NULL);
 		mutex_unlock(&ctx->uring_lock);
 	}
 }
@@ -4267,6 +4950,13 @@ static void __io_queue_proc(struct io_poll_iocb *poll, struct io_poll_table *pt,
 			pt->error = -ENOMEM;
 			return;
 		}
+		/*
+		 * A wakeup on either queue takes both entries down, so
+		 * multishot poll isn't supported here; complete once, without
+		 * IORING_CQE_F_MORE, and let userspace re-arm it.
+		 */
+		if (req->opcode == IORING_OP_POLL_ADD)
+			req->poll.events |= EPOLLONESHOT;
 		io_init_poll_iocb(poll, req->poll.events, io_poll_double_wake);
 		refcount_inc(&req->refs);
 		poll->wait.private = req;
@@ -4286,7 +4976,7 @@ static void io_async_queue_proc(struct file *file, struct wait_queue_head *head,
 	__io_queue_proc(&pt->req->apoll->poll, pt, head);
 }
 
-static void io_sq_thread_drop_mm(struct io_ring_ctx *ctx)
+static void io_sq_thread_drop_mm(void)
 {
 	struct mm_struct *mm = current->mm;
 
@@ -4347,7 +5037,7 @@ static void io_async_task_func(struct callback_head *cb)
 			goto end_req;
 		}
 		mutex_lock(&ctx->uring_lock);
-		__io_queue_sqe(req, NULL);
+		__io_queue_sqe(req, NULL, NULL);
 		mutex_unlock(&ctx->uring_lock);
 	} else {
 		io_cqring_ev_posted(ctx);
@@ -4406,7 +5096,8 @@ static __poll_t __io_arm_poll_handler(struct io_kiocb *req,
 			ipt->error = 0;
 			mask = 0;
 		}
-		if (mask || ipt->error)
+		/* a multishot poll stays queued even if it fired already */
+		if ((mask && (poll->events & EPOLLONESHOT)) || ipt->error)
 			list_del_init(&poll->wait.entry);
 		else if (cancel)
 			WRITE_ONCE(poll->canceled, true);
@@ -4452,7 +5143,7 @@ static bool io_arm_poll_handler(struct io_kiocb *req)
 		mask |= POLLIN | POLLRDNORM;
 	if (def->pollout)
 		mask |= POLLOUT | POLLWRNORM;
-	mask |= POLLERR | POLLPRI;
+	mask |= POLLERR | POLLPRI | EPOLLONESHOT;
 
 	ipt.pt._qproc = io_async_queue_proc;
 
@@ -4619,17 +5310,23 @@ static void io_poll_queue_proc(struct file *file, struct wait_queue_head *head,
 static int io_poll_add_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 {
 	struct io_poll_iocb *poll = &req->poll;
+	u32 flags;
 	u16 events;
 
 	if (unlikely(req->ctx->flags & IORING_SETUP_IOPOLL))
 		return -EINVAL;
-	if (sqe->addr || sqe->ioprio || sqe->off || sqe->len || sqe->buf_index)
+	if (sqe->addr || sqe->ioprio || sqe->off || sqe->buf_index)
+		return -EINVAL;
+	flags = READ_ONCE(sqe->len);
+	if (flags & ~IORING_POLL_ADD_MULTI)
 		return -EINVAL;
 	if (!poll->file)
 		return -EBADF;
 
 	events = READ_ONCE(sqe->poll_events);
 	poll->events = demangle_poll(events) | EPOLLERR | EPOLLHUP;
+	if (!(flags & IORING_POLL_ADD_MULTI))
+		poll->events |= EPOLLONESHOT;
 
 	io_get_req_task(req);
 	return 0;
@@ -4640,6 +5337,7 @@ static int io_poll_add(struct io_kiocb *req)
 	struct io_poll_iocb *poll = &req->poll;
 	struct io_ring_ctx *ctx = req->ctx;
 	struct io_poll_table ipt;
+	bool done = false;
 	__poll_t mask;
 
 	INIT_HLIST_NODE(&req->hash_node);
@@ -4651,13 +5349,27 @@ static int io_poll_add(struct io_kiocb *req)
 
 	if (mask) { /* no async, we'd stolen it */
 		ipt.error = 0;
-		io_poll_complete(req, mask, 0);
+		if (poll->events & EPOLLONESHOT) {
+			io_poll_complete(req, mask, 0);
+			done = true;
+		} else if (io_cqring_fill_more(req, mangle_poll(mask), 0)) {
+			io_commit_cqring(ctx);
+		} else if (__io_poll_remove_one(req, poll)) {
+			/* multishot poll that can't stay armed */
+			io_poll_complete(req, mask, 0);
+			done = true;
+		}
+		/*
+		 * Otherwise a wakeup beat us to taking it down, and the
+		 * task_work it queued completes the request.
+		 */
 	}
 	spin_unlock_irq(&ctx->completion_lock);
 
 	if (mask) {
 		io_cqring_ev_posted(ctx);
-		io_put_req(req);
+		if (done)
+			io_put_req(req);
 	}
 	return ipt.error;
 }
@@ -4999,6 +5711,9 @@ static int io_req_defer_prep(struct io_kiocb *req,
 	case IORING_OP_SEND:
 		ret = io_sendmsg_prep(req, sqe);
 		break;
+	case IORING_OP_SEND_ZC:
+		ret = io_sendzc_prep(req, sqe);
+		break;
 	case IORING_OP_RECVMSG:
 	case IORING_OP_RECV:
 		ret = io_recvmsg_prep(req, sqe);
@@ -5107,7 +5822,8 @@ static void io_cleanup_req(struct io_kiocb *req)
 	case IORING_OP_READV:
 	case IORING_OP_READ_FIXED:
 	case IORING_OP_READ:
-		if (req->flags & REQ_F_BUFFER_SELECTED)
+		if ((req->flags & (REQ_F_BUFFER_SELECTED|REQ_F_BUFFER_RING)) ==
+		    REQ_F_BUFFER_SELECTED)
 			kfree((void *)(unsigned long)req->rw.addr);
 		/* fallthrough */
 	case IORING_OP_WRITEV:
@@ -5117,7 +5833,8 @@ static void io_cleanup_req(struct io_kiocb *req)
 			kfree(io->rw.iov);
 		break;
 	case IORING_OP_RECVMSG:
-		if (req->flags & REQ_F_BUFFER_SELECTED)
+		if ((req->flags & (REQ_F_BUFFER_SELECTED|REQ_F_BUFFER_RING)) ==
+		    REQ_F_BUFFER_SELECTED)
 			kfree(req->sr_msg.kbuf);
 		/* fallthrough */
 	case IORING_OP_SENDMSG:
@@ -5125,9 +5842,14 @@ static void io_cleanup_req(struct io_kiocb *req)
 			kfree(io->msg.iov);
 		break;
 	case IORING_OP_RECV:
-		if (req->flags & REQ_F_BUFFER_SELECTED)
+		if ((req->flags & (REQ_F_BUFFER_SELECTED|REQ_F_BUFFER_RING)) ==
+		    REQ_F_BUFFER_SELECTED)
 			kfree(req->sr_msg.kbuf);
 		break;
+	case IORING_OP_SEND_ZC:
+		/* never made it to the socket, so no skb references it */
+		io_put_req(req->sr_msg.notif);
+		break;
 	case IORING_OP_OPENAT:
 	case IORING_OP_OPENAT2:
 		break;
@@ -5142,14 +5864,14 @@ static void io_cleanup_req(struct io_kiocb *req)
 }
 
 static int io_issue_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe,
-			bool force_nonblock)
+			bool force_nonblock, struct io_comp_state *cs)
 {
 	struct io_ring_ctx *ctx = req->ctx;
 	int ret;
 
 	switch (req->opcode) {
 	case IORING_OP_NOP:
-		ret = io_nop(req);
+		ret = io_nop(req, cs);
 		break;
 	case IORING_OP_READV:
 	case IORING_OP_READ_FIXED:
@@ -5159,7 +5881,7 @@ static int io_issue_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 			if (ret < 0)
 				break;
 		}
-		ret = io_read(req, force_nonblock);
+		ret = io_read(req, force_nonblock, cs);
 		break;
 	case IORING_OP_WRITEV:
 	case IORING_OP_WRITE_FIXED:
@@ -5169,7 +5891,7 @@ static int io_issue_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 			if (ret < 0)
 				break;
 		}
-		ret = io_write(req, force_nonblock);
+		ret = io_write(req, force_nonblock, cs);
 		break;
 	case IORING_OP_FSYNC:
 		if (sqe) {
@@ -5211,9 +5933,17 @@ static int io_issue_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 				break;
 		}
 		if (req->opcode == IORING_OP_SENDMSG)
-			ret = io_sendmsg(req, force_nonblock);
+			ret = io_sendmsg(req, force_nonblock, cs);
 		else
-			ret = io_send(req, force_nonblock);
+			ret = io_send(req, force_nonblock, cs);
+		break;
+	case IORING_OP_SEND_ZC:
+		if (sqe) {
+			ret = io_sendzc_prep(req, sqe);
+			if (ret < 0)
+				break;
+		}
+		ret = io_sendzc(req, force_nonblock);
 		break;
 	case IORING_OP_RECVMSG:
 	case IORING_OP_RECV:
@@ -5223,9 +5953,9 @@ static int io_issue_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 				break;
 		}
 		if (req->opcode == IORING_OP_RECVMSG)
-			ret = io_recvmsg(req, force_nonblock);
+			ret = io_recvmsg(req, force_nonblock, cs);
 		else
-			ret = io_recv(req, force_nonblock);
+			ret = io_recv(req, force_nonblock, cs);
 		break;
 	case IORING_OP_TIMEOUT:
 		if (sqe) {
@@ -5424,7 +6154,7 @@ static void io_wq_submit_work(struct io_wq_work **workptr)
 
 	if (!ret) {
 		do {
-			ret = io_issue_sqe(req, NULL, false);
+			ret = io_issue_sqe(req, NULL, false, NULL);
 			/*
 			 * We can get EAGAIN for polled IO even though we're
 			 * forcing a sync submission from here, since we can't
@@ -5466,10 +6196,8 @@ static int io_file_get(struct io_submit_state *state, struct io_kiocb *req,
 			return -EBADF;
 		fd = array_index_nospec(fd, ctx->nr_user_files);
 		file = io_file_from_index(ctx, fd);
-		if (file) {
-			req->fixed_file_refs = ctx->file_data->cur_refs;
-			percpu_ref_get(req->fixed_file_refs);
-		}
+		if (file)
+			req->fixed_file_refs = io_fixed_refs_get(state, ctx);
 	} else {
 		trace_io_uring_file_get(ctx, fd);
 		file = __io_file_get(state, fd);
@@ -5510,9 +6238,10 @@ static int io_grab_files(struct io_kiocb *req)
 	 * We use the f_ops->flush() handler to ensure that we can flush
 	 * out work accessing these files if the fd is closed. Check if
 	 * the fd has changed since we started down this path, and disallow
-	 * this operation if it has.
+	 * this operation if it has. A registered ring has no fd to check,
+	 * its users are cancelled when it leaves the task's ring table.
 	 */
-	if (fcheck(ctx->ring_fd) == ctx->ring_file) {
+	if (ctx->ring_registered || fcheck(ctx->ring_fd) == ctx->ring_file) {
 		list_add(&req->inflight_entry, &ctx->inflight_list);
 		req->flags |= REQ_F_INFLIGHT;
 		req->work.files = current->files;
@@ -5603,7 +6332,8 @@ static struct io_kiocb *io_prep_linked_timeout(struct io_kiocb *req)
 	return nxt;
 }
 
-static void __io_queue_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+static void __io_queue_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+			   struct io_comp_state *cs)
 {
 	struct io_kiocb *linked_timeout;
 	struct io_kiocb *nxt;
@@ -5623,7 +6353,7 @@ static void __io_queue_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 			old_creds = override_creds(req->work.creds);
 	}
 
-	ret = io_issue_sqe(req, sqe, true);
+	ret = io_issue_sqe(req, sqe, true, cs);
 
 	/*
 	 * We async punt it if the file wasn't marked NOWAIT, or if the file
@@ -5683,7 +6413,8 @@ static void __io_queue_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 		revert_creds(old_creds);
 }
 
-static void io_queue_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+static void io_queue_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+			 struct io_comp_state *cs)
 {
 	int ret;
 
@@ -5712,21 +6443,22 @@ static void io_queue_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 		req->work.flags |= IO_WQ_WORK_CONCURRENT;
 		io_queue_async_work(req);
 	} else {
-		__io_queue_sqe(req, sqe);
+		__io_queue_sqe(req, sqe, cs);
 	}
 }
 
-static inline void io_queue_link_head(struct io_kiocb *req)
+static inline void io_queue_link_head(struct io_kiocb *req,
+				      struct io_comp_state *cs)
 {
 	if (unlikely(req->flags & REQ_F_FAIL_LINK)) {
 		io_cqring_add_event(req, -ECANCELED);
 		io_double_put_req(req);
 	} else
-		io_queue_sqe(req, NULL);
+		io_queue_sqe(req, NULL, cs);
 }
 
 static int io_submit_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe,
-			 struct io_kiocb **link)
+			 struct io_kiocb **link, struct io_comp_state *cs)
 {
 	struct io_ring_ctx *ctx = req->ctx;
 	int ret;
@@ -5766,7 +6498,7 @@ static int io_submit_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 
 		/* last request of a link, enqueue the link */
 		if (!(req->flags & (REQ_F_LINK | REQ_F_HARDLINK))) {
-			io_queue_link_head(head);
+			io_queue_link_head(head, cs);
 			*link = NULL;
 		}
 	} else {
@@ -5786,7 +6518,7 @@ static int io_submit_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 				req->flags |= REQ_F_FAIL_LINK;
 			*link = req;
 		} else {
-			io_queue_sqe(req, sqe);
+			io_queue_sqe(req, sqe, cs);
 		}
 	}
 
@@ -5798,8 +6530,11 @@ static int io_submit_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe,
  */
 static void io_submit_state_end(struct io_submit_state *state)
 {
+	io_submit_flush_completions(&state->comp);
 	blk_finish_plug(&state->plug);
 	io_state_file_put(state);
+	if (state->fixed_refs)
+		io_state_fixed_refs_put(state);
 	if (state->free_reqs)
 		kmem_cache_free_bulk(req_cachep, state->free_reqs, state->reqs);
 }
@@ -5808,11 +6543,14 @@ static void io_submit_state_end(struct io_submit_state *state)
  * Start submission side cache.
  */
 static void io_submit_state_start(struct io_submit_state *state,
-				  unsigned int max_ios)
+				  struct io_ring_ctx *ctx, unsigned int max_ios)
 {
 	blk_start_plug(&state->plug);
+	state->comp.nr = 0;
+	state->comp.ctx = ctx;
 	state->free_reqs = 0;
 	state->file = NULL;
+	state->fixed_refs = NULL;
 	state->ios_left = max_ios;
 }
 
@@ -5926,9 +6664,10 @@ static int io_init_req(struct io_ring_ctx *ctx, struct io_kiocb *req,
 }
 
 static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned int nr,
-			  struct file *ring_file, int ring_fd)
+			  struct file *ring_file, int ring_fd, bool registered)
 {
 	struct io_submit_state state, *statep = NULL;
+	struct io_comp_state *cs = NULL;
 	struct io_kiocb *link = NULL;
 	int i, submitted = 0;
 
@@ -5946,12 +6685,14 @@ static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned int nr,
 		return -EAGAIN;
 
 	if (nr > IO_PLUG_THRESHOLD) {
-		io_submit_state_start(&state, nr);
+		io_submit_state_start(&state, ctx, nr);
 		statep = &state;
+		cs = &state.comp;
 	}
 
 	ctx->ring_fd = ring_fd;
 	ctx->ring_file = ring_file;
+	ctx->ring_registered = registered;
 
 	for (i = 0; i < nr; i++) {
 		const struct io_uring_sqe *sqe;
@@ -5984,7 +6725,7 @@ static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned int nr,
 
 		trace_io_uring_submit_sqe(ctx, req->opcode, req->user_data,
 						true, io_async_submit(ctx));
-		err = io_submit_sqe(req, sqe, &link);
+		err = io_submit_sqe(req, sqe, &link, cs);
 		if (err)
 			goto fail_req;
 	}
@@ -5995,7 +6736,7 @@ static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned int nr,
 		percpu_ref_put_many(&ctx->refs, nr - ref_used);
 	}
 	if (link)
-		io_queue_link_head(link);
+		io_queue_link_head(link, cs);
 	if (statep)
 		io_submit_state_end(&state);
 
@@ -6005,125 +6746,184 @@ static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned int nr,
 	return submitted;
 }
 
-static int io_sq_thread(void *data)
+/* SQEs taken from one ring per round, once a thread serves several */
+#define IORING_SQPOLL_CAP_ENTRIES	8
+
+static void io_sq_thread_switch_creds(struct io_sq_data *sqd,
+				      struct io_ring_ctx *ctx)
 {
-	struct io_ring_ctx *ctx = data;
-	const struct cred *old_cred;
-	DEFINE_WAIT(wait);
-	unsigned long timeout;
-	int ret = 0;
+	if (sqd->cur_creds == ctx->creds)
+		return;
+	if (sqd->old_creds)
+		revert_creds(sqd->old_creds);
+	sqd->old_creds = override_creds(ctx->creds);
+	sqd->cur_creds = ctx->creds;
+}
 
-	complete(&ctx->sq_thread_comp);
+static void io_sq_thread_drop_creds(struct io_sq_data *sqd)
+{
+	if (sqd->old_creds) {
+		revert_creds(sqd->old_creds);
+		sqd->old_creds = NULL;
+		sqd->cur_creds = NULL;
+	}
+}
 
-	old_cred = override_creds(ctx->creds);
+/*
+ * One round of SQPOLL work for @ctx: reap polled IO and submit up to @cap
+ * SQEs, or all of them if @cap is 0. Returns true while the ring wants the
+ * thread to keep polling. Once it has been idle for its own sq_thread_idle,
+ * the ring is flagged IORING_SQ_NEED_WAKEUP and false is returned.
+ */
+static bool __io_sq_thread(struct io_sq_data *sqd, struct io_ring_ctx *ctx,
+			   unsigned int cap, bool *submitted)
+{
+	unsigned int to_submit;
+	bool active = false;
 
-	timeout = jiffies + ctx->sq_thread_idle;
-	while (!kthread_should_park()) {
-		unsigned int to_submit;
+	if (!list_empty(&ctx->poll_list)) {
+		unsigned int nr_events = 0;
 
-		if (!list_empty(&ctx->poll_list)) {
-			unsigned nr_events = 0;
+		mutex_lock(&ctx->uring_lock);
+		if (!list_empty(&ctx->poll_list))
+			io_iopoll_getevents(ctx, &nr_events, 0);
+		mutex_unlock(&ctx->uring_lock);
+		if (nr_events)
+			ctx->sq_idle_end = jiffies + ctx->sq_thread_idle;
+		active = !list_empty(&ctx->poll_list);
+	}
 
-			mutex_lock(&ctx->uring_lock);
-			if (!list_empty(&ctx->poll_list))
-				io_iopoll_getevents(ctx, &nr_events, 0);
-			else
-				timeout = jiffies + ctx->sq_thread_idle;
-			mutex_unlock(&ctx->uring_lock);
-		}
+	to_submit = io_sqring_entries(ctx);
 
-		to_submit = io_sqring_entries(ctx);
+	/*
+	 * With a CQ overflow backlog, submission fails with -EBUSY until the
+	 * application has reaped events and entered the kernel to flush the
+	 * backlog. Ask for that wakeup rather than spinning on the ring.
+	 */
+	if (to_submit && list_empty_careful(&ctx->cq_overflow_list) &&
+	    !percpu_ref_is_dying(&ctx->refs)) {
+		if (cap && to_submit > cap)
+			to_submit = cap;
 
+		/* never submit with another ring's mm or creds */
+		if (current->mm && current->mm != ctx->sqo_mm)
+			io_sq_thread_drop_mm();
+		io_sq_thread_switch_creds(sqd, ctx);
+
+		mutex_lock(&ctx->uring_lock);
+		io_submit_sqes(ctx, to_submit, NULL, -1, false);
+		mutex_unlock(&ctx->uring_lock);
+
+		if (ctx->rings->sq_flags & IORING_SQ_NEED_WAKEUP)
+			ctx->rings->sq_flags &= ~IORING_SQ_NEED_WAKEUP;
+		ctx->sq_idle_end = jiffies + ctx->sq_thread_idle;
+		*submitted = true;
+		return true;
+	}
+
+	if (active || (!to_submit && time_before(jiffies, ctx->sq_idle_end) &&
+		       !percpu_ref_is_dying(&ctx->refs)))
+		return true;
+
+	/* Tell userspace we may need a wakeup call */
+	if (!(ctx->rings->sq_flags & IORING_SQ_NEED_WAKEUP))
+		ctx->rings->sq_flags |= IORING_SQ_NEED_WAKEUP;
+	return false;
+}
+
+/* Check idle rings for work that raced with setting IORING_SQ_NEED_WAKEUP */
+static bool io_sq_thread_has_work(struct io_sq_data *sqd)
+{
+	struct io_ring_ctx *ctx;
+
+	list_for_each_entry(ctx, &sqd->ctx_list, sqd_list) {
+		if (percpu_ref_is_dying(&ctx->refs))
+			continue;
 		/*
-		 * If submit got -EBUSY, flag us as needing the application
-		 * to enter the kernel to reap and flush events.
+		 * While doing polled IO, reqs may have been punted to io worker
+		 * and added to poll_list later, hence check the poll_list too.
 		 */
-		if (!to_submit || ret == -EBUSY || need_resched()) {
-			/*
-			 * Drop cur_mm before scheduling, we can't hold it for
-			 * long periods (or over schedule()). Do this before
-			 * adding ourselves to the waitqueue, as the unuse/drop
-			 * may sleep.
-			 */
-			io_sq_thread_drop_mm(ctx);
+		if ((ctx->flags & IORING_SETUP_IOPOLL) &&
+		    !list_empty_careful(&ctx->poll_list))
+			return true;
+		if (io_sqring_entries(ctx) &&
+		    list_empty_careful(&ctx->cq_overflow_list))
+			return true;
+	}
+	return false;
+}
 
-			/*
-			 * We're polling. If we're within the defined idle
-			 * period, then let us spin without work before going
-			 * to sleep. The exception is if we got EBUSY doing
-			 * more IO, we should wait for the application to
-			 * reap events and wake us up.
-			 */
-			if (!list_empty(&ctx->poll_list) || need_resched() ||
-			    (!time_after(jiffies, timeout) && ret != -EBUSY &&
-			    !percpu_ref_is_dying(&ctx->refs))) {
-				if (current->task_works)
-					task_work_run();
-				cond_resched();
-				continue;
-			}
+static int io_sq_thread(void *data)
+{
+	struct io_sq_data *sqd = data;
+	struct io_ring_ctx *ctx;
+	DEFINE_WAIT(wait);
 
-			prepare_to_wait(&ctx->sqo_wait, &wait,
-						TASK_INTERRUPTIBLE);
+	complete_all(&sqd->startup);
 
-			/*
-			 * While doing polled IO, before going to sleep, we need
-			 * to check if there are new reqs added to poll_list, it
-			 * is because reqs may have been punted to io worker and
-			 * will be added to poll_list later, hence check the
-			 * poll_list again.
-			 */
-			if ((ctx->flags & IORING_SETUP_IOPOLL) &&
-			    !list_empty_careful(&ctx->poll_list)) {
-				finish_wait(&ctx->sqo_wait, &wait);
-				continue;
-			}
+	while (!kthread_should_stop()) {
+		bool active = false, submitted = false;
+		unsigned int cap = 0;
 
-			/* Tell userspace we may need a wakeup call */
-			ctx->rings->sq_flags |= IORING_SQ_NEED_WAKEUP;
-			/* make sure to read SQ tail after writing flags */
-			smp_mb();
+		if (kthread_should_park()) {
+			/* rings are being added or removed */
+			io_sq_thread_drop_mm();
+			io_sq_thread_drop_creds(sqd);
+			kthread_parkme();
+			continue;
+		}
 
-			to_submit = io_sqring_entries(ctx);
-			if (!to_submit || ret == -EBUSY) {
-				if (kthread_should_park()) {
-					finish_wait(&ctx->sqo_wait, &wait);
-					break;
-				}
-				if (current->task_works) {
-					task_work_run();
-					finish_wait(&ctx->sqo_wait, &wait);
-					continue;
-				}
-				if (signal_pending(current))
-					flush_signals(current);
-				schedule();
-				finish_wait(&ctx->sqo_wait, &wait);
+		/*
+		 * Serve the rings round-robin. With more than one ring, cap
+		 * what a single ring can submit per round and rotate the list,
+		 * so a busy ring can't starve the others.
+		 */
+		if (!list_is_singular(&sqd->ctx_list))
+			cap = IORING_SQPOLL_CAP_ENTRIES;
+		list_for_each_entry(ctx, &sqd->ctx_list, sqd_list)
+			active |= __io_sq_thread(sqd, ctx, cap, &submitted);
+		if (cap)
+			list_rotate_left(&sqd->ctx_list);
 
-				ctx->rings->sq_flags &= ~IORING_SQ_NEED_WAKEUP;
-				ret = 0;
-				continue;
-			}
-			finish_wait(&ctx->sqo_wait, &wait);
+		/*
+		 * Drop cur_mm before scheduling, we can't hold it for long
+		 * periods (or over schedule()). Do this before adding
+		 * ourselves to the waitqueue, as the unuse/drop may sleep.
+		 */
+		if (!submitted || need_resched())
+			io_sq_thread_drop_mm();
 
-			ctx->rings->sq_flags &= ~IORING_SQ_NEED_WAKEUP;
+		if (active || need_resched()) {
+			if (current->task_works)
+				task_work_run();
+			cond_resched();
+			continue;
 		}
 
-		mutex_lock(&ctx->uring_lock);
-		if (likely(!percpu_ref_is_dying(&ctx->refs)))
-			ret = io_submit_sqes(ctx, to_submit, NULL, -1);
-		mutex_unlock(&ctx->uring_lock);
-		timeout = jiffies + ctx->sq_thread_idle;
+		/* every ring is idle, sleep until one of them wakes us up */
+		prepare_to_wait(&sqd->wait, &wait, TASK_INTERRUPTIBLE);
+		/* make sure to read SQ tails after writing flags */
+		smp_mb();
+
+		if (!io_sq_thread_has_work(sqd) && !kthread_should_park() &&
+		    !kthread_should_stop()) {
+			if (current->task_works) {
+				task_work_run();
+				finish_wait(&sqd->wait, &wait);
+				continue;
+			}
+			if (signal_pending(current))
+				flush_signals(current);
+			schedule();
+		}
+		finish_wait(&sqd->wait, &wait);
 	}
 
 	if (current->task_works)
 		task_work_run();
 
-	io_sq_thread_drop_mm(ctx);
-	revert_creds(old_cred);
-
-	kthread_parkme();
-
+	io_sq_thread_drop_mm();
+	io_sq_thread_drop_creds(sqd);
 	return 0;
 }
 
@@ -6160,6 +6960,30 @@ static int io_wake_function(struct wait_queue_entry *curr, unsigned int mode,
 	return autoremove_wake_function(curr, mode, wake_flags, key);
 }
 
+/*
+ * Publish how many CQEs we're waiting for, so that batched completions can
+ * skip wake-ups that won't satisfy anyone. With several sleepers the
+ * smallest count wins, and it is only reset once ->wait is empty, so a
+ * stale value can only cause spurious wake-ups, never missed ones.
+ */
+static void io_cqring_wait_nr_add(struct io_ring_ctx *ctx, unsigned int nr)
+{
+	spin_lock_irq(&ctx->wait.lock);
+	if (!ctx->cq_wait_nr || nr < ctx->cq_wait_nr)
+		WRITE_ONCE(ctx->cq_wait_nr, nr);
+	spin_unlock_irq(&ctx->wait.lock);
+	/* pairs with smp_mb() in io_cqring_ev_posted_batch() */
+	smp_mb();
+}
+
+static void io_cqring_wait_nr_del(struct io_ring_ctx *ctx)
+{
+	spin_lock_irq(&ctx->wait.lock);
+	if (!waitqueue_active(&ctx->wait))
+		WRITE_ONCE(ctx->cq_wait_nr, 0);
+	spin_unlock_irq(&ctx->wait.lock);
+}
+
 /*
  * Wait until events become available, if we don't already have some. The
  * application must reap them itself, as they reside on the shared cq ring.
@@ -6205,6 +7029,7 @@ static int io_cqring_wait(struct io_ring_ctx *ctx, int min_events,
 	do {
 		prepare_to_wait_exclusive(&ctx->wait, &iowq.wq,
 						TASK_INTERRUPTIBLE);
+		io_cqring_wait_nr_add(ctx, min_events);
 		/* make sure we run task_work before checking for signals */
 		if (current->task_works)
 			task_work_run();
@@ -6224,6 +7049,7 @@ static int io_cqring_wait(struct io_ring_ctx *ctx, int min_events,
 		schedule();
 	} while (1);
 	finish_wait(&ctx->wait, &iowq.wq);
+	io_cqring_wait_nr_del(ctx);
 
 	restore_saved_sigmask_unless(ret == -EINTR);
 
@@ -6296,18 +7122,105 @@ static int io_sqe_files_unregister(struct io_ring_ctx *ctx)
 	return 0;
 }
 
-static void io_sq_thread_stop(struct io_ring_ctx *ctx)
+static void io_sq_thread_park(struct io_sq_data *sqd)
+	__acquires(&sqd->lock)
+{
+	mutex_lock(&sqd->lock);
+	if (sqd->thread)
+		kthread_park(sqd->thread);
+}
+
+static void io_sq_thread_unpark(struct io_sq_data *sqd)
+	__releases(&sqd->lock)
+{
+	if (sqd->thread)
+		kthread_unpark(sqd->thread);
+	mutex_unlock(&sqd->lock);
+}
+
+static void io_put_sq_data(struct io_sq_data *sqd)
 {
-	if (ctx->sqo_thread) {
-		wait_for_completion(&ctx->sq_thread_comp);
+	if (!refcount_dec_and_test(&sqd->refs))
+		return;
+
+	if (sqd->thread) {
+		wait_for_completion(&sqd->startup);
 		/*
 		 * The park is a bit of a work-around, without it we get
 		 * warning spews on shutdown with SQPOLL set and affinity
 		 * set to a single CPU.
 		 */
-		kthread_park(ctx->sqo_thread);
-		kthread_stop(ctx->sqo_thread);
-		ctx->sqo_thread = NULL;
+		kthread_park(sqd->thread);
+		kthread_stop(sqd->thread);
+	}
+	kfree(sqd);
+}
+
+/*
+ * Share the SQPOLL thread of the ring passed in ->wq_fd, provided that ring
+ * has one and was set up by the same process. Returns NULL if a thread of
+ * our own is needed instead.
+ */
+static struct io_sq_data *io_attach_sq_data(struct io_uring_params *p)
+{
+	struct io_ring_ctx *ctx_attach;
+	struct io_sq_data *sqd;
+	struct fd f;
+
+	f = fdget(p->wq_fd);
+	if (!f.file)
+		return ERR_PTR(-ENXIO);
+	if (f.file->f_op != &io_uring_fops) {
+		fdput(f);
+		return ERR_PTR(-EINVAL);
+	}
+
+	ctx_attach = f.file->private_data;
+	/* @sq_data is protected by holding the fd */
+	sqd = ctx_attach->sq_data;
+	if (sqd && sqd->task_tgid == current->tgid)
+		refcount_inc(&sqd->refs);
+	else
+		sqd = NULL;
+
+	fdput(f);
+	return sqd;
+}
+
+static struct io_sq_data *io_get_sq_data(struct io_uring_params *p)
+{
+	struct io_sq_data *sqd;
+
+	if (p->flags & IORING_SETUP_ATTACH_WQ) {
+		sqd = io_attach_sq_data(p);
+		if (sqd)
+			return sqd;
+	}
+
+	sqd = kzalloc(sizeof(*sqd), GFP_KERNEL);
+	if (!sqd)
+		return ERR_PTR(-ENOMEM);
+
+	refcount_set(&sqd->refs, 1);
+	mutex_init(&sqd->lock);
+	INIT_LIST_HEAD(&sqd->ctx_list);
+	init_waitqueue_head(&sqd->wait);
+	init_completion(&sqd->startup);
+	sqd->task_tgid = current->tgid;
+	return sqd;
+}
+
+static void io_sq_thread_stop(struct io_ring_ctx *ctx)
+{
+	struct io_sq_data *sqd = ctx->sq_data;
+
+	if (sqd) {
+		io_sq_thread_park(sqd);
+		list_del_init(&ctx->sqd_list);
+		io_sq_thread_unpark(sqd);
+
+		io_put_sq_data(sqd);
+		ctx->sq_data = NULL;
 	}
 }
 
@@ -6947,13 +7860,33 @@ static int io_sq_offload_start(struct io_ring_ctx *ctx,
 	ctx->sqo_mm = current->mm;
 
 	if (ctx->flags & IORING_SETUP_SQPOLL) {
+		struct io_sq_data *sqd;
+
 		ret = -EPERM;
 		if (!capable(CAP_SYS_ADMIN))
 			goto err;
 
+		sqd = io_get_sq_data(p);
+		if (IS_ERR(sqd)) {
+			ret = PTR_ERR(sqd);
+			goto err;
+		}
+		ctx->sq_data = sqd;
+		ctx->sqo_wait = &sqd->wait;
+
 		ctx->sq_thread_idle = msecs_to_jiffies(p->sq_thread_idle);
 		if (!ctx->sq_thread_idle)
 			ctx->sq_thread_idle = HZ;
+		ctx->sq_idle_end = jiffies + ctx->sq_thread_idle;
+
+		if (sqd->thread) {
+			/* shared thread, IORING_SETUP_SQ_AFF is ignored */
+			io_sq_thread_park(sqd);
+			list_add_tail(&ctx->sqd_list, &sqd->ctx_list);
+			io_sq_thread_unpark(sqd);
+			goto done;
+		}
+		list_add_tail(&ctx->sqd_list, &sqd->ctx_list);
 
 		if (p->flags & IORING_SETUP_SQ_AFF) {
 			int cpu = p->sq_thread_cpu;
@@ -6964,25 +7897,25 @@ static int io_sq_offload_start(struct io_ring_ctx *ctx,
 			if (!cpu_online(cpu))
 				goto err;
 
-			ctx->sqo_thread = kthread_create_on_cpu(io_sq_thread,
-							ctx, cpu,
-							"io_uring-sq");
+			sqd->thread = kthread_create_on_cpu(io_sq_thread, sqd,
+							cpu, "io_uring-sq");
 		} else {
-			ctx->sqo_thread = kthread_create(io_sq_thread, ctx,
+			sqd->thread = kthread_create(io_sq_thread, sqd,
 							"io_uring-sq");
 		}
-		if (IS_ERR(ctx->sqo_thread)) {
-			ret = PTR_ERR(ctx->sqo_thread);
-			ctx->sqo_thread = NULL;
+		if (IS_ERR(sqd->thread)) {
+			ret = PTR_ERR(sqd->thread);
+			sqd->thread = NULL;
 			goto err;
 		}
-		wake_up_process(ctx->sqo_thread);
+		wake_up_process(sqd->thread);
+		wait_for_completion(&sqd->startup);
 	} else if (p->flags & IORING_SETUP_SQ_AFF) {
 		/* Can't have SQ_AFF without SQPOLL */
 		ret = -EINVAL;
 		goto err;
 	}
-
+done:
 	ret = io_init_wq_offload(ctx, p);
 	if (ret)
 		goto err;
@@ -7312,10 +8245,144 @@ static int __io_destroy_buffers(int id, void *p, void *data)
 	return 0;
 }
 
+static void io_free_buf_ring(struct io_buffer_ring *br)
+{
+	vunmap(br->ring);
+	unpin_user_pages(br->pages, br->nr_pages);
+	kvfree(br->pages);
+	kfree(br);
+}
+
+static int __io_destroy_buf_ring(int id, void *p, void *data)
+{
+	io_free_buf_ring(p);
+	return 0;
+}
+
 static void io_destroy_buffers(struct io_ring_ctx *ctx)
 {
 	idr_for_each(&ctx->io_buffer_idr, __io_destroy_buffers, ctx);
 	idr_destroy(&ctx->io_buffer_idr);
+	idr_for_each(&ctx->io_buf_ring_idr, __io_destroy_buf_ring, ctx);
+	idr_destroy(&ctx->io_buf_ring_idr);
+}
+
+/*
+ * Pin the application's buffer ring and map it contiguously, so that
+ * selecting a buffer is just a read of the tail and of one ring entry.
+ */
+static int io_map_buf_ring(struct io_buffer_ring *br, unsigned long uaddr,
+			   size_t size)
+{
+	struct vm_area_struct **vmas;
+	unsigned int nr_pages, i;
+	int ret, pret;
+
+	nr_pages = PAGE_ALIGN(size) >> PAGE_SHIFT;
+	br->pages = kvmalloc_array(nr_pages, sizeof(struct page *), GFP_KERNEL);
+	vmas = kvmalloc_array(nr_pages, sizeof(struct vm_area_struct *),
+				GFP_KERNEL);
+	ret = -ENOMEM;
+	if (!br->pages || !vmas)
+		goto err;
+
+	ret = 0;
+	mmap_read_lock(current->mm);
+	pret = pin_user_pages(uaddr, nr_pages, FOLL_WRITE | FOLL_LONGTERM,
+			      br->pages, vmas);
+	if (pret == nr_pages) {
+		/* same rules as registered buffers, no file backed memory */
+		for (i = 0; i < nr_pages; i++) {
+			if (vmas[i]->vm_file &&
+			    !is_file_hugepages(vmas[i]->vm_file)) {
+				ret = -EOPNOTSUPP;
+				break;
+			}
+		}
+	} else {
+		ret = pret < 0 ? pret : -EFAULT;
+	}
+	mmap_read_unlock(current->mm);
+	if (ret) {
+		if (pret > 0)
+			unpin_user_pages(br->pages, pret);
+		goto err;
+	}
+
+	br->ring = vmap(br->pages, nr_pages, VM_MAP, PAGE_KERNEL);
+	if (!br->ring) {
+		unpin_user_pages(br->pages, nr_pages);
+		ret = -ENOMEM;
+		goto err;
+	}
+	br->nr_pages = nr_pages;
+	kvfree(vmas);
+	return 0;
+err:
+	kvfree(br->pages);
+	kvfree(vmas);
+	return ret;
+}
+
+static int io_register_pbuf_ring(struct io_ring_ctx *ctx, void __user *arg)
+{
+	struct io_uring_buf_reg reg;
+	struct io_buffer_ring *br;
+	int ret;
+
+	if (copy_from_user(&reg, arg, sizeof(reg)))
+		return -EFAULT;
+	if (reg.pad || reg.resv[0] || reg.resv[1] || reg.resv[2])
+		return -EINVAL;
+	if (!reg.ring_addr || (reg.ring_addr & ~PAGE_MASK))
+		return -EINVAL;
+	/* the ring is indexed by a 16-bit head and tail */
+	if (!is_power_of_2(reg.ring_entries) || reg.ring_entries > 32768)
+		return -EINVAL;
+	if (idr_find(&ctx->io_buffer_idr, reg.bgid) ||
+	    idr_find(&ctx->io_buf_ring_idr, reg.bgid))
+		return -EEXIST;
+
+	br = kzalloc(sizeof(*br), GFP_KERNEL);
+	if (!br)
+		return -ENOMEM;
+
+	ret = io_map_buf_ring(br, reg.ring_addr,
+			      reg.ring_entries * sizeof(struct io_uring_buf));
+	if (ret) {
+		kfree(br);
+		return ret;
+	}
+	br->mask = reg.ring_entries - 1;
+
+	ret = idr_alloc(&ctx->io_buf_ring_idr, br, reg.bgid, reg.bgid + 1,
+			GFP_KERNEL);
+	if (ret < 0) {
+		io_free_buf_ring(br);
+		return ret;
+	}
+	return 0;
+}
+
+static int io_unregister_pbuf_ring(struct io_ring_ctx *ctx, void __user *arg)
+{
+	struct io_uring_buf_reg reg;
+	struct io_buffer_ring *br;
+
+	if (copy_from_user(&reg, arg, sizeof(reg)))
+		return -EFAULT;
+	if (reg.pad || reg.resv[0] || reg.resv[1] || reg.resv[2])
+		return -EINVAL;
+
+	/*
+	 * Requests holding a buffer from this ring only reference the user
+	 * address and buffer ID, so the ring can go away under them.
+	 */
+	br = idr_remove(&ctx->io_buf_ring_idr, reg.bgid);
+	if (!br)
+		return -ENOENT;
+	io_free_buf_ring(br);
+	return 0;
 }
 
 static void io_ring_ctx_free(struct io_ring_ctx *ctx)
@@ -7618,10 +8685,29 @@ SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 	if (current->task_works)
 		task_work_run();
 
-	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP))
+	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP |
+			IORING_ENTER_REGISTERED_RING))
 		return -EINVAL;
 
-	f = fdget(fd);
+	/*
+	 * A registered ring is pinned by the task's ring table, so there's no
+	 * fd lookup and no reference to take. f.flags stays clear, which makes
+	 * the fdput() below a no-op.
+	 */
+	if (flags & IORING_ENTER_REGISTERED_RING) {
+		struct io_uring_task *tctx = current->io_uring;
+		struct io_ringfd_reg *rfd;
+
+		if (!tctx || fd >= IO_RINGFD_REG_MAX)
+			return -EINVAL;
+		rfd = &tctx->registered_rings[array_index_nospec(fd,
+							IO_RINGFD_REG_MAX)];
+		f.file = rfd->file;
+		f.flags = 0;
+		fd = rfd->fd;
+	} else {
+		f = fdget(fd);
+	}
 	if (!f.file)
 		return -EBADF;
 
@@ -7644,11 +8730,12 @@ SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
 		if (!list_empty_careful(&ctx->cq_overflow_list))
 			io_cqring_overflow_flush(ctx, false);
 		if (flags & IORING_ENTER_SQ_WAKEUP)
-			wake_up(&ctx->sqo_wait);
+			wake_up(ctx->sqo_wait);
 		submitted = to_submit;
 	} else if (to_submit) {
 		mutex_lock(&ctx->uring_lock);
-		submitted = io_submit_sqes(ctx, to_submit, f.file, fd);
+		submitted = io_submit_sqes(ctx, to_submit, f.file, fd,
+					   flags & IORING_ENTER_REGISTERED_RING);
 		mutex_unlock(&ctx->uring_lock);
 
 		if (submitted != to_submit)
@@ -8079,6 +9166,213 @@ static int io_unregister_personality(struct io_ring_ctx *ctx, unsigned id)
 	return -EINVAL;
 }
 
+/*
+ * Note that these apply to the io-wq backing this ring, which is shared
+ * with any ring attached to it through IORING_SETUP_ATTACH_WQ.
+ */
+static int io_register_iowq_aff(struct io_ring_ctx *ctx, void __user *arg,
+				unsigned int len)
+{
+	cpumask_var_t new_mask;
+	int ret;
+
+	if (!zalloc_cpumask_var(&new_mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	if (len > cpumask_size())
+		len = cpumask_size();
+
+#ifdef CONFIG_COMPAT
+	if (in_compat_syscall())
+		ret = compat_get_bitmap(cpumask_bits(new_mask),
+					(const compat_ulong_t __user *)arg,
+					len * 8);
+	else
+#endif
+		ret = copy_from_user(new_mask, arg, len) ? -EFAULT : 0;
+
+	if (!ret)
+		ret = io_wq_cpu_affinity(ctx->io_wq, new_mask);
+	free_cpumask_var(new_mask);
+	return ret;
+}
+
+static int io_register_iowq_limits(struct io_ring_ctx *ctx, void __user *arg)
+{
+	struct io_uring_iowq_limits limits;
+	int i, ret;
+
+	if (copy_from_user(&limits, arg, sizeof(limits)))
+		return -EFAULT;
+	for (i = 0; i < ARRAY_SIZE(limits.resv); i++) {
+		if (limits.resv[i])
+			return -EINVAL;
+	}
+
+	ret = io_wq_set_limits(ctx->io_wq, limits.max_workers,
+			       limits.max_queued);
+	if (ret)
+		return ret;
+	if (copy_to_user(arg, &limits, sizeof(limits)))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Requests submitted through a registered ring take current->files without
+ * io_grab_files() checking the fd, which the app may have closed already.
+ * Cancel them before the table drops its reference, like io_uring_flush().
+ */
+static void io_ringfd_put(struct file *file)
+{
+	io_uring_cancel_files(file->private_data, current->files);
+	fput(file);
+}
+
+static int io_ringfd_register_one(struct io_uring_task *tctx, int fd,
+				  int start, int end)
+{
+	struct file *file;
+	int offset;
+
+	for (offset = start; offset < end; offset++) {
+		offset = array_index_nospec(offset, IO_RINGFD_REG_MAX);
+		if (!tctx->registered_rings[offset].file)
+			break;
+	}
+	if (offset == end)
+		return -EBUSY;
+
+	file = fget(fd);
+	if (!file)
+		return -EBADF;
+	if (file->f_op != &io_uring_fops) {
+		fput(file);
+		return -EOPNOTSUPP;
+	}
+
+	tctx->registered_rings[offset].file = file;
+	tctx->registered_rings[offset].fd = fd;
+	return offset;
+}
+
+/*
+ * Register ring fds in the task's private table, so io_uring_enter() can
+ * be passed the table offset with IORING_ENTER_REGISTERED_RING and skip
+ * the fd lookup. An offset of -1U picks the first free slot. Returns the
+ * number of entries registered, and writes the chosen offsets back.
+ */
+static int io_ringfd_register(struct io_ring_ctx *ctx, void __user *arg,
+			      unsigned int nr_args)
+{
+	struct io_uring_rsrc_update __user *uarg = arg;
+	struct io_uring_rsrc_update reg;
+	struct io_uring_task *tctx;
+	int ret = 0, i, start, end;
+
+	if (!nr_args || nr_args > IO_RINGFD_REG_MAX)
+		return -EINVAL;
+
+	tctx = current->io_uring;
+	if (!tctx) {
+		tctx = kzalloc(sizeof(*tctx), GFP_KERNEL);
+		if (!tctx)
+			return -ENOMEM;
+		current->io_uring = tctx;
+	}
+
+	for (i = 0; i < nr_args; i++) {
+		if (copy_from_user(&reg, &uarg[i], sizeof(reg))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (reg.resv) {
+			ret = -EINVAL;
+			break;
+		}
+
+		if (reg.offset == -1U) {
+			start = 0;
+			end = IO_RINGFD_REG_MAX;
+		} else {
+			if (reg.offset >= IO_RINGFD_REG_MAX) {
+				ret = -EINVAL;
+				break;
+			}
+			start = reg.offset;
+			end = start + 1;
+		}
+
+		ret = io_ringfd_register_one(tctx, reg.data, start, end);
+		if (ret < 0)
+			break;
+
+		reg.offset = ret;
+		if (copy_to_user(&uarg[i], &reg, sizeof(reg))) {
+			fput(tctx->registered_rings[reg.offset].file);
+			tctx->registered_rings[reg.offset].file = NULL;
+			ret = -EFAULT;
+			break;
+		}
+	}
+
+	return i ? i : ret;
+}
+
+static int io_ringfd_unregister(struct io_ring_ctx *ctx, void __user *arg,
+				unsigned int nr_args)
+{
+	struct io_uring_rsrc_update __user *uarg = arg;
+	struct io_uring_task *tctx = current->io_uring;
+	struct io_uring_rsrc_update reg;
+	int ret = 0, i;
+
+	if (!nr_args || nr_args > IO_RINGFD_REG_MAX)
+		return -EINVAL;
+	if (!tctx)
+		return 0;
+
+	for (i = 0; i < nr_args; i++) {
+		struct io_ringfd_reg *rfd;
+
+		if (copy_from_user(&reg, &uarg[i], sizeof(reg))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (reg.resv || reg.data || reg.offset >= IO_RINGFD_REG_MAX) {
+			ret = -EINVAL;
+			break;
+		}
+
+		reg.offset = array_index_nospec(reg.offset, IO_RINGFD_REG_MAX);
+		rfd = &tctx->registered_rings[reg.offset];
+		if (rfd->file) {
+			struct file *file = rfd->file;
+
+			/* the ring may be ours, don't wait for it locked */
+			rfd->file = NULL;
+			mutex_unlock(&ctx->uring_lock);
+			io_ringfd_put(file);
+			mutex_lock(&ctx->uring_lock);
+		}
+	}
+
+	return i ? i : ret;
+}
+
+void __io_uring_task_exit(void)
+{
+	struct io_uring_task *tctx = current->io_uring;
+	int i;
+
+	for (i = 0; i < IO_RINGFD_REG_MAX; i++) {
+		if (tctx->registered_rings[i].file)
+			io_ringfd_put(tctx->registered_rings[i].file);
+	}
+	current->io_uring = NULL;
+	kfree(tctx);
+}
+
 static bool io_register_op_must_quiesce(int op)
 {
 	switch (op) {
@@ -8087,6 +9381,13 @@ static bool io_register_op_must_quiesce(int op)
 	case IORING_REGISTER_PROBE:
 	case IORING_REGISTER_PERSONALITY:
 	case IORING_UNREGISTER_PERSONALITY:
+	case IORING_REGISTER_PBUF_RING:
+	case IORING_UNREGISTER_PBUF_RING:
+	case IORING_REGISTER_RING_FDS:
+	case IORING_UNREGISTER_RING_FDS:
+	case IORING_REGISTER_IOWQ_AFF:
+	case IORING_UNREGISTER_IOWQ_AFF:
+	case IORING_REGISTER_IOWQ_LIMITS:
 		return false;
 	default:
 		return true;
@@ -8188,6 +9489,42 @@ static int __io_uring_register(struct io_ring_ctx *ctx, unsigned opcode,
 			break;
 		ret = io_unregister_personality(ctx, nr_args);
 		break;
+	case IORING_REGISTER_PBUF_RING:
+		ret = -EINVAL;
+		if (!arg || nr_args != 1)
+			break;
+		ret = io_register_pbuf_ring(ctx, arg);
+		break;
+	case IORING_UNREGISTER_PBUF_RING:
+		ret = -EINVAL;
+		if (!arg || nr_args != 1)
+			break;
+		ret = io_unregister_pbuf_ring(ctx, arg);
+		break;
+	case IORING_REGISTER_RING_FDS:
+		ret = io_ringfd_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_RING_FDS:
+		ret = io_ringfd_unregister(ctx, arg, nr_args);
+		break;
+	case IORING_REGISTER_IOWQ_AFF:
+		ret = -EINVAL;
+		if (!arg || !nr_args)
+			break;
+		ret = io_register_iowq_aff(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_IOWQ_AFF:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		ret = io_wq_cpu_affinity(ctx->io_wq, NULL);
+		break;
+	case IORING_REGISTER_IOWQ_LIMITS:
+		ret = -EINVAL;
+		if (!arg || nr_args != 1)
+			break;
+		ret = io_register_iowq_limits(ctx, arg);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
@@ -13,6 +13,7 @@
 #include <linux/init.h>
 #include <linux/fs.h>
 #include <linux/log2.h>
+#include <linux/sizes.h>
 #include <linux/mount.h>
 #include <linux/pseudo_fs.h>
 #include <linux/magic.h>
@@ -43,6 +44,14 @@ unsigned int pipe_max_size = 1048576;
 unsigned long pipe_user_pages_hard;
 unsigned long pipe_user_pages_soft = PIPE_DEF_BUFFERS * INR_OPEN_CUR;
 
+/*
+ * Pipes sized to at least PIPE_LARGE_MIN_SIZE get filled by write() with
+ * compound pages of PIPE_LARGE_BUF_ORDER, so bulk transfers copy 64K per
+ * buffer rather than a page at a time.
+ */
+#define PIPE_LARGE_MIN_SIZE	SZ_1M
+#define PIPE_LARGE_BUF_ORDER	get_order(SZ_64K)
+
 /*
  * We use head and tail indices that aren't masked off, except at the point of
  * dereference, but rather they're allowed to wrap naturally.  This means there
@@ -146,7 +155,8 @@ static bool anon_pipe_buf_try_steal(struct pipe_inode_info *pipe,
 {
 	struct page *page = buf->page;
 
-	if (page_count(page) != 1)
+	/* Large buffers can't be moved into the page cache */
+	if (PageCompound(page) || page_count(page) != 1)
 		return false;
 	memcg_kmem_uncharge_page(page, 0);
 	__SetPageLocked(page);
@@ -230,6 +240,16 @@ static inline bool pipe_readable(const struct pipe_inode_info *pipe)
 	return !pipe_empty(head, tail) || !writers;
 }
 
+/*
+ * Writers filling buffers of @order pages count the pipe as full once this
+ * many slots are in use, which keeps large buffers within the pipe size.
+ */
+static inline unsigned int pipe_usage_for_order(const struct pipe_inode_info *pipe,
+						unsigned int order)
+{
+	return READ_ONCE(pipe->max_usage) >> order;
+}
+
 static ssize_t
 pipe_read(struct kiocb *iocb, struct iov_iter *to)
 {
@@ -252,9 +272,10 @@ pipe_read(struct kiocb *iocb, struct iov_iter *to)
 	 *
 	 * But when we do wake up writers, we do so using a sync wakeup
 	 * (WF_SYNC), because we want them to get going and generate more
-	 * data for us.
+	 * data for us. Writers of large buffers stop short of max_usage.
 	 */
-	was_full = pipe_full(pipe->head, pipe->tail, pipe->max_usage);
+	was_full = pipe_full(pipe->head, pipe->tail,
+			     pipe_usage_for_order(pipe, pipe->buf_order));
 	for (;;) {
 		unsigned int head = pipe->head;
 		unsigned int tail = pipe->tail;
@@ -382,7 +403,8 @@ pipe_read(struct kiocb *iocb, struct iov_iter *to)
 			return -ERESTARTSYS;
 
 		__pipe_lock(pipe);
-		was_full = pipe_full(pipe->head, pipe->tail, pipe->max_usage);
+		was_full = pipe_full(pipe->head, pipe->tail,
+				     pipe_usage_for_order(pipe, pipe->buf_order));
 		wake_next_reader = true;
 	}
 	if (pipe_empty(pipe->head, pipe->tail))
@@ -405,12 +427,45 @@ static inline int is_packetized(struct file *file)
 	return (file->f_flags & O_DIRECT) != 0;
 }
 
+/* Packets are never larger than a page, so they keep order-0 buffers */
+static inline unsigned int pipe_write_order(const struct pipe_inode_info *pipe,
+					    struct file *file)
+{
+	return is_packetized(file) ? 0 : READ_ONCE(pipe->buf_order);
+}
+
+static inline unsigned int pipe_write_usage(const struct pipe_inode_info *pipe,
+					    struct file *file)
+{
+	return pipe_usage_for_order(pipe, pipe_write_order(pipe, file));
+}
+
+/*
+ * Large buffers come from lowmem, so the whole compound page is mapped and
+ * copy_page_from_iter() can cross its subpages. The writer holds the pipe
+ * lock, so don't reclaim or compact for a high-order page; fall back to a
+ * single page if none is free.
+ */
+static struct page *anon_pipe_alloc_page(unsigned int order)
+{
+	struct page *page;
+
+	if (order) {
+		page = alloc_pages((GFP_KERNEL_ACCOUNT | __GFP_COMP |
+				    __GFP_NOWARN) & ~__GFP_DIRECT_RECLAIM, order);
+		if (page)
+			return page;
+	}
+	return alloc_page(GFP_HIGHUSER | __GFP_ACCOUNT);
+}
+
 /* Done while waiting without holding the pipe lock - thus the READ_ONCE() */
-static inline bool pipe_writable(const struct pipe_inode_info *pipe)
+static inline bool pipe_writable(const struct pipe_inode_info *pipe,
+				 struct file *file)
 {
 	unsigned int head = READ_ONCE(pipe->head);
 	unsigned int tail = READ_ONCE(pipe->tail);
-	unsigned int max_usage = READ_ONCE(pipe->max_usage);
+	unsigned int max_usage = pipe_write_usage(pipe, file);
 
 	return !pipe_full(head, tail, max_usage) ||
 		!READ_ONCE(pipe->readers);
@@ -456,18 +511,18 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 	 *
 	 * That naturally merges small writes, but it also
 	 * page-aligs the rest of the writes for large writes
-	 * spanning multiple pages.
+	 * spanning multiple pages (or buffers, for large pipes).
 	 */
 	head = pipe->head;
 	was_empty = pipe_empty(head, pipe->tail);
-	chars = total_len & (PAGE_SIZE-1);
+	chars = total_len & ((PAGE_SIZE << pipe_write_order(pipe, filp)) - 1);
 	if (chars && !was_empty) {
 		unsigned int mask = pipe->ring_size - 1;
 		struct pipe_buffer *buf = &pipe->bufs[(head - 1) & mask];
 		int offset = buf->offset + buf->len;
 
 		if ((buf->flags & PIPE_BUF_FLAG_CAN_MERGE) &&
-		    offset + chars <= PAGE_SIZE) {
+		    offset + chars <= page_size(buf->page)) {
 			ret = pipe_buf_confirm(pipe, buf);
 			if (ret)
 				goto out;
@@ -493,14 +548,20 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 		}
 
 		head = pipe->head;
-		if (!pipe_full(head, pipe->tail, pipe->max_usage)) {
+		if (!pipe_full(head, pipe->tail, pipe_write_usage(pipe, filp))) {
 			unsigned int mask = pipe->ring_size - 1;
+			unsigned int order = pipe_write_order(pipe, filp);
 			struct pipe_buffer *buf = &pipe->bufs[head & mask];
 			struct page *page = pipe->tmp_page;
+			size_t size;
 			int copied;
 
+			if (page && compound_order(page) != order) {
+				put_page(page);
+				pipe->tmp_page = page = NULL;
+			}
 			if (!page) {
-				page = alloc_page(GFP_HIGHUSER | __GFP_ACCOUNT);
+				page = anon_pipe_alloc_page(order);
 				if (unlikely(!page)) {
 					ret = ret ? : -ENOMEM;
 					break;
@@ -516,7 +577,8 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 			spin_lock_irq(&pipe->rd_wait.lock);
 
 			head = pipe->head;
-			if (pipe_full(head, pipe->tail, pipe->max_usage)) {
+			if (pipe_full(head, pipe->tail,
+				      pipe_write_usage(pipe, filp))) {
 				spin_unlock_irq(&pipe->rd_wait.lock);
 				continue;
 			}
@@ -536,8 +598,9 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 				buf->flags = PIPE_BUF_FLAG_CAN_MERGE;
 			pipe->tmp_page = NULL;
 
-			copied = copy_page_from_iter(page, 0, PAGE_SIZE, from);
-			if (unlikely(copied < PAGE_SIZE && iov_iter_count(from))) {
+			size = page_size(page);
+			copied = copy_page_from_iter(page, 0, size, from);
+			if (unlikely(copied < size && iov_iter_count(from))) {
 				if (!ret)
 					ret = -EFAULT;
 				break;
@@ -550,7 +613,7 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 				break;
 		}
 
-		if (!pipe_full(head, pipe->tail, pipe->max_usage))
+		if (!pipe_full(head, pipe->tail, pipe_write_usage(pipe, filp)))
 			continue;
 
 		/* Wait for buffer space to become available. */
@@ -576,13 +639,13 @@ pipe_write(struct kiocb *iocb, struct iov_iter *from)
 			wake_up_interruptible_sync_poll(&pipe->rd_wait, EPOLLIN | EPOLLRDNORM);
 			kill_fasync(&pipe->fasync_readers, SIGIO, POLL_IN);
 		}
-		wait_event_interruptible_exclusive(pipe->wr_wait, pipe_writable(pipe));
+		wait_event_interruptible_exclusive(pipe->wr_wait, pipe_writable(pipe, filp));
 		__pipe_lock(pipe);
 		was_empty = pipe_empty(pipe->head, pipe->tail);
 		wake_next_writer = true;
 	}
 out:
-	if (pipe_full(pipe->head, pipe->tail, pipe->max_usage))
+	if (pipe_full(pipe->head, pipe->tail, pipe_write_usage(pipe, filp)))
 		wake_next_writer = false;
 	__pipe_unlock(pipe);
 
@@ -686,7 +749,7 @@ pipe_poll(struct file *filp, poll_table *wait)
 	}
 
 	if (filp->f_mode & FMODE_WRITE) {
-		if (!pipe_full(head, tail, pipe->max_usage))
+		if (!pipe_full(head, tail, pipe_write_usage(pipe, filp)))
 			mask |= EPOLLOUT | EPOLLWRNORM;
 		/*
 		 * Most Unices do not set EPOLLERR for FIFOs but on Linux they
@@ -849,7 +912,7 @@ void free_pipe_info(struct pipe_inode_info *pipe)
 			pipe_buf_release(pipe, buf);
 	}
 	if (pipe->tmp_page)
-		__free_page(pipe->tmp_page);
+		put_page(pipe->tmp_page);
 	kfree(pipe->bufs);
 	kfree(pipe);
 }
@@ -1315,6 +1378,7 @@ static long pipe_set_size(struct pipe_inode_info *pipe, unsigned long arg)
 
 	pipe->max_usage = nr_slots;
 	pipe->nr_accounted = nr_slots;
+	pipe->buf_order = size >= PIPE_LARGE_MIN_SIZE ? PIPE_LARGE_BUF_ORDER : 0;
 	return pipe->max_usage * PAGE_SIZE;
 
 out_revert_acct:
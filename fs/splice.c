@@ -1238,6 +1238,113 @@ static int iter_to_pipe(struct iov_iter *from,
 	return total ? total : ret;
 }
 
+/*
+ * Take ownership of a page that is about to be unmapped from the caller. An
+ * anonymous page that only the caller maps and nobody else holds can't
+ * change once it's gone from the caller's page tables, so it goes into the
+ * pipe as is. Anything else may still be written through another mapping
+ * or a pin (O_DIRECT, io_uring fixed buffers, RDMA) and gets copied.
+ */
+static struct page *vmsplice_detach_page(struct page *page)
+{
+	struct page *copy;
+
+	/* The mapping, our GUP reference and the swap cache, if any */
+	if (PageAnon(page) && !PageCompound(page) && !PageKsm(page) &&
+	    page_mapcount(page) == 1 && !page_maybe_dma_pinned(page) &&
+	    page_count(page) == 2 + PageSwapCache(page))
+		return page;
+
+	copy = alloc_page(GFP_HIGHUSER | __GFP_ACCOUNT);
+	if (copy)
+		copy_highpage(copy, page);
+	put_page(page);
+	return copy;
+}
+
+/*
+ * SPLICE_F_DETACH: move page aligned user memory into the pipe. Once the
+ * pages are in hand the range is unmapped, so the caller's later writes
+ * fault in fresh pages rather than changing what the reader will see. This
+ * is what SPLICE_F_GIFT promises but can't enforce.
+ *
+ * The buffers aren't marked as gifts: anonymous pages can't be moved into
+ * the page cache, and the point is that the data is stable, not stealable.
+ */
+static int iter_to_pipe_detach(struct iov_iter *from,
+			       struct pipe_inode_info *pipe)
+{
+	struct pipe_buffer buf = {
+		.ops = &user_page_pipe_buf_ops,
+		.len = PAGE_SIZE,
+	};
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vmas[16];
+	struct page *pages[16];
+	size_t total = 0;
+	int ret = 0;
+
+	if (iov_iter_alignment(from) & ~PAGE_MASK)
+		return -EINVAL;
+
+	while (iov_iter_count(from) && !ret) {
+		unsigned long start, nr;
+		long n, i;
+
+		start = (unsigned long)from->iov->iov_base + from->iov_offset;
+		nr = min_t(unsigned long, ARRAY_SIZE(pages),
+			   iov_iter_single_seg_count(from) >> PAGE_SHIFT);
+		nr = min_t(unsigned long, nr, pipe->max_usage -
+			   pipe_occupancy(pipe->head, pipe->tail));
+		if (!nr)
+			break;
+
+		mmap_read_lock(mm);
+		n = get_user_pages(start, nr, FOLL_WRITE, pages, vmas);
+		/* Don't count the pagevec references of freshly faulted pages */
+		if (n > 0)
+			lru_add_drain();
+		for (i = 0; i < n; i++) {
+			/* Same restrictions as MADV_DONTNEED */
+			if (vmas[i]->vm_flags & (VM_LOCKED|VM_HUGETLB|VM_PFNMAP)) {
+				ret = -EINVAL;
+				break;
+			}
+			pages[i] = vmsplice_detach_page(pages[i]);
+			if (!pages[i]) {
+				ret = -ENOMEM;
+				break;
+			}
+		}
+		nr = i;
+		for (; i < n; i++)
+			if (pages[i])
+				put_page(pages[i]);
+		if (nr)
+			zap_page_range(vmas[0], start, nr << PAGE_SHIFT);
+		mmap_read_unlock(mm);
+
+		if (n < 0)
+			ret = n;
+
+		for (i = 0; i < nr; i++) {
+			int err;
+
+			buf.page = pages[i];
+			err = add_to_pipe(pipe, &buf);
+			if (unlikely(err < 0)) {
+				while (++i < nr)
+					put_page(pages[i]);
+				ret = err;
+				break;
+			}
+			iov_iter_advance(from, PAGE_SIZE);
+			total += PAGE_SIZE;
+		}
+	}
+	return total ? total : ret;
+}
+
 static int pipe_to_user(struct pipe_inode_info *pipe, struct pipe_buffer *buf,
 			struct splice_desc *sd)
 {
@@ -1287,14 +1394,22 @@ static long vmsplice_to_pipe(struct file *file, struct iov_iter *iter,
 	if (flags & SPLICE_F_GIFT)
 		buf_flag = PIPE_BUF_FLAG_GIFT;
 
+	/* Unmapping user memory needs an MMU */
+	if ((flags & SPLICE_F_DETACH) && !IS_ENABLED(CONFIG_MMU))
+		return -EINVAL;
+
 	pipe = get_pipe_info(file, true);
 	if (!pipe)
 		return -EBADF;
 
 	pipe_lock(pipe);
 	ret = wait_for_space(pipe, flags);
-	if (!ret)
-		ret = iter_to_pipe(iter, pipe, buf_flag);
+	if (!ret) {
+		if (flags & SPLICE_F_DETACH)
+			ret = iter_to_pipe_detach(iter, pipe);
+		else
+			ret = iter_to_pipe(iter, pipe, buf_flag);
+	}
 	pipe_unlock(pipe);
 	if (ret > 0)
 		wakeup_pipe_readers(pipe);
@@ -232,6 +232,23 @@ static inline void clear_user_highpage(struct page *page, unsigned long vaddr)
 }
 #endif
 
+/* For pages the caller doesn't expect to be touched again soon */
+#ifdef clear_page_nocache
+static inline void clear_user_highpage_nocache(struct page *page,
+					       unsigned long vaddr)
+{
+	void *addr = kmap_atomic(page);
+	clear_page_nocache(addr);
+	kunmap_atomic(addr);
+}
+#else
+static inline void clear_user_highpage_nocache(struct page *page,
+					       unsigned long vaddr)
+{
+	clear_user_highpage(page, vaddr);
+}
+#endif
+
 #ifndef __HAVE_ARCH_ALLOC_ZEROED_USER_HIGHPAGE
 /**
  * __alloc_zeroed_user_highpage - Allocate a zeroed HIGHMEM page for a VMA with caller-specified movable GFP flags
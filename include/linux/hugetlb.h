@@ -15,6 +15,12 @@ struct ctl_table;
 struct user_struct;
 struct mmu_gather;
 
+#ifdef CONFIG_HUGETLB_PAGE_FREE_VMEMMAP
+extern bool hugetlb_free_vmemmap_enabled;
+#else
+#define hugetlb_free_vmemmap_enabled false
+#endif
+
 #ifndef is_hugepd
 typedef struct { unsigned long pd; } hugepd_t;
 #define is_hugepd(hugepd) (0)
@@ -185,6 +191,7 @@ unsigned long hugetlb_change_protection(struct vm_area_struct *vma,
 		unsigned long address, unsigned long end, pgprot_t newprot);
 
 bool is_hugetlb_entry_migration(pte_t pte);
+void hugetlb_zero_page(struct hstate *h, struct page *page, unsigned long addr);
 
 #else /* !CONFIG_HUGETLB_PAGE */
 
@@ -489,6 +496,17 @@ struct hstate {
 	unsigned int nr_huge_pages_node[MAX_NUMNODES];
 	unsigned int free_huge_pages_node[MAX_NUMNODES];
 	unsigned int surplus_huge_pages_node[MAX_NUMNODES];
+	/* free pages kept zeroed by zero_work, and their target number */
+	unsigned long zeroed_huge_pages;
+	unsigned int zeroed_huge_pages_node[MAX_NUMNODES];
+	unsigned long nr_zeroed_huge_pages;
+	struct work_struct zero_work;
+	/* threads zeroing a page at fault time */
+	unsigned int clear_threads;
+#ifdef CONFIG_HUGETLB_PAGE_FREE_VMEMMAP
+	/* vmemmap pages of each huge page handed back to the buddy */
+	unsigned int nr_free_vmemmap_pages;
+#endif
 #ifdef CONFIG_CGROUP_HUGETLB
 	/* cgroup control files */
 	struct cftype cgroup_files_dfl[7];
@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+#ifndef _LINUX_IO_URING_H
+#define _LINUX_IO_URING_H
+
+#include <linux/sched.h>
+
+#if defined(CONFIG_IO_URING)
+void __io_uring_task_exit(void);
+
+/*
+ * Drop the rings the task registered with IORING_REGISTER_RING_FDS. Called
+ * on exit and exec, like the file table they shadow.
+ */
+static inline void io_uring_task_exit(void)
+{
+	if (current->io_uring)
+		__io_uring_task_exit();
+}
+#else
+static inline void io_uring_task_exit(void)
+{
+}
+#endif
+
+#endif
@@ -16,6 +16,8 @@ typedef void free_page_t(struct page *page, unsigned long private);
  * - zero on page migration success;
  */
 #define MIGRATEPAGE_SUCCESS		0
+/* Internal to migrate_pages(): unmapped and waiting for its batch to move */
+#define MIGRATEPAGE_UNMAP		1
 
 enum migrate_reason {
 	MR_COMPACTION,
@@ -25,6 +27,7 @@ enum migrate_reason {
 	MR_MEMPOLICY_MBIND,
 	MR_NUMA_MISPLACED,
 	MR_CONTIG_RANGE,
+	MR_DEMOTION,
 	MR_TYPES
 };
 
@@ -121,6 +124,24 @@ static inline void __ClearPageMovable(struct page *page)
 }
 #endif
 
+#if defined(CONFIG_MIGRATION) && defined(CONFIG_NUMA)
+extern bool numa_demotion_enabled;
+extern bool numa_promotion_enabled;
+extern int next_demotion_node(int node);
+extern bool node_is_lower_tier(int node);
+#else
+#define numa_demotion_enabled	false
+#define numa_promotion_enabled	false
+static inline int next_demotion_node(int node)
+{
+	return NUMA_NO_NODE;
+}
+static inline bool node_is_lower_tier(int node)
+{
+	return false;
+}
+#endif
+
 #ifdef CONFIG_NUMA_BALANCING
 extern bool pmd_trans_migrating(pmd_t pmd);
 extern int migrate_misplaced_page(struct page *page,
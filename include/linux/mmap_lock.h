@@ -6,38 +6,95 @@
 #define MMAP_LOCK_INITIALIZER(name) \
 	.mmap_lock = __RWSEM_INITIALIZER((name).mmap_lock),
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * mm->mmap_seq is odd while mmap_lock is held for write. Speculative page
+ * faults, which run without mmap_lock, sample it before looking at the
+ * VMA and check it again, under the page table lock, before committing
+ * the fault.
+ */
+static inline void mmap_seq_write_begin(struct mm_struct *mm)
+{
+	VM_BUG_ON_MM(mm->mmap_seq & 1, mm);
+	WRITE_ONCE(mm->mmap_seq, mm->mmap_seq + 1);
+	smp_wmb();	/* Pairs with smp_rmb() in mmap_seq_read_check() */
+}
+
+static inline void mmap_seq_write_end(struct mm_struct *mm)
+{
+	smp_wmb();	/* Pairs with smp_rmb() in mmap_seq_read_start() */
+	WRITE_ONCE(mm->mmap_seq, mm->mmap_seq + 1);
+	VM_BUG_ON_MM(mm->mmap_seq & 1, mm);
+}
+
+/* Returns false if mmap_lock is currently held for write */
+static inline bool mmap_seq_read_start(struct mm_struct *mm,
+				       unsigned long *seq)
+{
+	*seq = READ_ONCE(mm->mmap_seq);
+	smp_rmb();	/* Pairs with smp_wmb() in mmap_seq_write_end() */
+	return !(*seq & 1);
+}
+
+/* Returns false if mmap_lock was write-locked since mmap_seq_read_start() */
+static inline bool mmap_seq_read_check(struct mm_struct *mm,
+				       unsigned long seq)
+{
+	smp_rmb();	/* Pairs with smp_wmb() in mmap_seq_write_begin() */
+	return READ_ONCE(mm->mmap_seq) == seq;
+}
+#else
+static inline void mmap_seq_write_begin(struct mm_struct *mm) {}
+static inline void mmap_seq_write_end(struct mm_struct *mm) {}
+#endif
+
 static inline void mmap_init_lock(struct mm_struct *mm)
 {
 	init_rwsem(&mm->mmap_lock);
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	mm->mmap_seq = 0;
+#endif
 }
 
 static inline void mmap_write_lock(struct mm_struct *mm)
 {
 	down_write(&mm->mmap_lock);
+	mmap_seq_write_begin(mm);
 }
 
 static inline void mmap_write_lock_nested(struct mm_struct *mm, int subclass)
 {
 	down_write_nested(&mm->mmap_lock, subclass);
+	mmap_seq_write_begin(mm);
 }
 
 static inline int mmap_write_lock_killable(struct mm_struct *mm)
 {
-	return down_write_killable(&mm->mmap_lock);
+	int ret;
+
+	ret = down_write_killable(&mm->mmap_lock);
+	if (!ret)
+		mmap_seq_write_begin(mm);
+	return ret;
 }
 
 static inline bool mmap_write_trylock(struct mm_struct *mm)
 {
-	return down_write_trylock(&mm->mmap_lock) != 0;
+	if (!down_write_trylock(&mm->mmap_lock))
+		return false;
+	mmap_seq_write_begin(mm);
+	return true;
 }
 
 static inline void mmap_write_unlock(struct mm_struct *mm)
 {
+	mmap_seq_write_end(mm);
 	up_write(&mm->mmap_lock);
 }
 
 static inline void mmap_write_downgrade(struct mm_struct *mm)
 {
+	mmap_seq_write_end(mm);
 	downgrade_write(&mm->mmap_lock);
 }
 
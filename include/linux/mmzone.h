@@ -115,7 +115,7 @@ static inline bool free_area_empty(struct free_area *area, int migratetype)
 struct pglist_data;
 
 /*
- * zone->lock and the zone lru_lock are two of the hottest locks in the kernel.
+ * zone->lock and the lruvec lru_lock are two of the hottest locks in the kernel.
  * So add a wild amount of padding here to ensure that they fall into separate
  * cachelines.  There are very few zone structures in the machine, so space
  * consumption is not a concern here.
@@ -248,8 +248,53 @@ enum lruvec_flags {
 					 */
 };
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * The multi-generational LRU replaces the active and inactive lists with
+ * up to MAX_NR_GENS generations per page type, numbered by a sequence
+ * that only grows: max_seq is the youngest generation, min_seq[] the
+ * oldest one of each type. Pages on the generation lists store their
+ * generation (seq % MAX_NR_GENS) + 1 in page->flags, see LRU_GEN_MASK.
+ *
+ * Aging creates a new youngest generation and moves the pages accessed
+ * since the last aging into it, by walking the page tables of the tasks
+ * charged to the lruvec rather than the rmap of each page. Eviction
+ * reclaims the oldest generation. Pages are only moved between lists
+ * when eviction comes across them; page->flags and nr_pages[] always
+ * reflect a page's current generation.
+ *
+ * For the LRU size statistics, the two youngest generations count as
+ * active, the others as inactive.
+ */
+#define MIN_NR_GENS		2U
+#define MAX_NR_GENS		4U
+
+enum {
+	LRU_GEN_ANON,
+	LRU_GEN_FILE,
+	ANON_AND_FILE
+};
+
+struct lru_gen_struct {
+	/* the youngest generation */
+	unsigned long max_seq;
+	/* the oldest generation of each type */
+	unsigned long min_seq[ANON_AND_FILE];
+	/* creation time of each generation, in jiffies */
+	unsigned long timestamps[MAX_NR_GENS];
+	/* the generation lists, per type and zone */
+	struct list_head lists[MAX_NR_GENS][ANON_AND_FILE][MAX_NR_ZONES];
+	/* the number of pages in each generation, per type and zone */
+	long nr_pages[MAX_NR_GENS][ANON_AND_FILE][MAX_NR_ZONES];
+	/* whether new pages are added to the generation lists */
+	bool enabled;
+};
+#endif /* CONFIG_LRU_GEN */
+
 struct lruvec {
 	struct list_head		lists[NR_LRU_LISTS];
+	/* per lruvec lru_lock for memcg */
+	spinlock_t			lru_lock;
 	/*
 	 * These track the cost of reclaiming one LRU - file or anon -
 	 * over the other. As the observed cost of reclaiming one LRU
@@ -263,11 +308,23 @@ struct lruvec {
 	unsigned long			refaults;
 	/* Various lruvec state flags (enum lruvec_flags) */
 	unsigned long			flags;
+#ifdef CONFIG_LRU_GEN
+	/* multi-generational LRU, protected by lru_lock */
+	struct lru_gen_struct		lrugen;
+#endif
 #ifdef CONFIG_MEMCG
 	struct pglist_data *pgdat;
 #endif
 };
 
+#ifdef CONFIG_LRU_GEN
+void lru_gen_init_lruvec(struct lruvec *lruvec);
+#else
+static inline void lru_gen_init_lruvec(struct lruvec *lruvec)
+{
+}
+#endif
+
 /* Isolate unmapped pages */
 #define ISOLATE_UNMAPPED	((__force isolate_mode_t)0x2)
 /* Isolate for asynchronous migration */
@@ -732,7 +789,6 @@ typedef struct pglist_data {
 
 	/* Write-intensive fields used by page reclaim */
 	ZONE_PADDING(_pad1_)
-	spinlock_t		lru_lock;
 
 #ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
 	/*
@@ -457,6 +457,11 @@ enum {
  * false on data copy or out of memory error caused by data copy attempt.
  * The ctx field is used to track device context.
  * The desc field is used to track userspace buffer index.
+ *
+ * With UBUF_F_SHARED set in flags, the structure may be shared by all skbs
+ * of a send and by their clones. Each skb then holds a reference, and the
+ * callback runs once from sock_zerocopy_put() when the last one is dropped.
+ * Such users track the zerocopy bit rather than desc and ctx.
  */
 struct ubuf_info {
 	void (*callback)(struct ubuf_info *, bool zerocopy_success);
@@ -473,6 +478,7 @@ struct ubuf_info {
 		};
 	};
 	refcount_t refcnt;
+	u8 flags;
 
 	struct mmpin {
 		struct user_struct *user;
@@ -480,6 +486,9 @@ struct ubuf_info {
 	} mmp;
 };
 
+/* ubuf_info->flags */
+#define UBUF_F_SHARED		(1U << 0)
+
 #define skb_uarg(SKB)	((struct ubuf_info *)(skb_shinfo(SKB)->destructor_arg))
 
 int mm_account_pinned_pages(struct mmpin *mmp, size_t size);
@@ -1459,7 +1468,7 @@ static inline void skb_zcopy_clear(struct sk_buff *skb, bool zerocopy)
 	if (uarg) {
 		if (skb_zcopy_is_nouarg(skb)) {
 			/* no notification callback */
-		} else if (uarg->callback == sock_zerocopy_callback) {
+		} else if (uarg->flags & UBUF_F_SHARED) {
 			uarg->zerocopy = uarg->zerocopy && zerocopy;
 			sock_zerocopy_put(uarg);
 		} else {
@@ -2751,7 +2760,7 @@ static inline int skb_orphan_frags(struct sk_buff *skb, gfp_t gfp_mask)
 	if (likely(!skb_zcopy(skb)))
 		return 0;
 	if (!skb_zcopy_is_nouarg(skb) &&
-	    skb_uarg(skb)->callback == sock_zerocopy_callback)
+	    skb_uarg(skb)->flags & UBUF_F_SHARED)
 		return 0;
 	return skb_copy_ubufs(skb, gfp_mask);
 }
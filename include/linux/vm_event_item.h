@@ -56,6 +56,8 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 #endif
 #ifdef CONFIG_MIGRATION
 		PGMIGRATE_SUCCESS, PGMIGRATE_FAIL,
+		PGDEMOTE_KSWAPD, PGDEMOTE_DIRECT,
+		PGPROMOTE_SUCCESS,
 #endif
 #ifdef CONFIG_COMPACTION
 		COMPACTMIGRATE_SCANNED, COMPACTFREE_SCANNED,
@@ -116,6 +118,11 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 #ifdef CONFIG_SWAP
 		SWAP_RA,
 		SWAP_RA_HIT,
+		SWAP_RA_MISS,
+#endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+		SPF_SUCCESS,
+		SPF_ABORT,
 #endif
 		NR_VM_EVENT_ITEMS
 };
@@ -21,6 +21,8 @@
 
 /* Flags for epoll_create1.  */
 #define EPOLL_CLOEXEC O_CLOEXEC
+/* Queue ready events on per-CPU lists, for many producers and waiters */
+#define EPOLL_PERCPU 0x00000001
 
 /* Valid opcodes to issue to sys_epoll_ctl() */
 #define EPOLL_CTL_ADD 1
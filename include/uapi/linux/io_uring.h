@@ -130,6 +130,7 @@ enum {
 	IORING_OP_PROVIDE_BUFFERS,
 	IORING_OP_REMOVE_BUFFERS,
 	IORING_OP_TEE,
+	IORING_OP_SEND_ZC,
 
 	/* this goes last, obviously */
 	IORING_OP_LAST,
@@ -151,6 +152,24 @@ enum {
  */
 #define SPLICE_F_FD_IN_FIXED	(1U << 31) /* the last bit of __u32 */
 
+/*
+ * POLL_ADD flags. Note that since sqe->poll_events is the flag space, the
+ * command flags for POLL_ADD are stored in sqe->len.
+ *
+ * IORING_POLL_ADD_MULTI	Multishot poll. Sets IORING_CQE_F_MORE if
+ *				the poll handler will continue to report
+ *				CQEs on behalf of the same SQE.
+ */
+#define IORING_POLL_ADD_MULTI	(1U << 0)
+
+/*
+ * accept flags stored in sqe->ioprio
+ *
+ * IORING_ACCEPT_MULTISHOT	Keep accepting connections with the same
+ *				SQE, posting a CQE for each of them.
+ */
+#define IORING_ACCEPT_MULTISHOT	(1U << 0)
+
 /*
  * IO completion data structure (Completion Queue Entry)
  */
@@ -164,13 +183,26 @@ struct io_uring_cqe {
  * cqe->flags
  *
  * IORING_CQE_F_BUFFER	If set, the upper 16 bits are the buffer ID
+ * IORING_CQE_F_MORE	If set, parent SQE will generate more CQE entries
+ * IORING_CQE_F_NOTIF	Notification of an IORING_OP_SEND_ZC request, posted
+ *			once the kernel has released the sent buffer
  */
 #define IORING_CQE_F_BUFFER		(1U << 0)
+#define IORING_CQE_F_MORE		(1U << 1)
+#define IORING_CQE_F_NOTIF		(1U << 2)
 
 enum {
 	IORING_CQE_BUFFER_SHIFT		= 16,
 };
 
+/*
+ * cqe->res of an IORING_CQE_F_NOTIF notification
+ *
+ * IORING_NOTIF_COPIED	The data had to be copied after all, e.g. because
+ *			the device doesn't support scatter-gather
+ */
+#define IORING_NOTIF_COPIED		(1U << 0)
+
 /*
  * Magic offsets for the application to mmap the data it needs
  */
@@ -222,6 +254,7 @@ struct io_cqring_offsets {
  */
 #define IORING_ENTER_GETEVENTS	(1U << 0)
 #define IORING_ENTER_SQ_WAKEUP	(1U << 1)
+#define IORING_ENTER_REGISTERED_RING	(1U << 2)
 
 /*
  * Passed in for io_uring_setup(2). Copied back with updated info on success
@@ -263,6 +296,13 @@ struct io_uring_params {
 #define IORING_REGISTER_PROBE		8
 #define IORING_REGISTER_PERSONALITY	9
 #define IORING_UNREGISTER_PERSONALITY	10
+#define IORING_REGISTER_PBUF_RING	11
+#define IORING_UNREGISTER_PBUF_RING	12
+#define IORING_REGISTER_RING_FDS	13
+#define IORING_UNREGISTER_RING_FDS	14
+#define IORING_REGISTER_IOWQ_AFF	15
+#define IORING_UNREGISTER_IOWQ_AFF	16
+#define IORING_REGISTER_IOWQ_LIMITS	17
 
 struct io_uring_files_update {
 	__u32 offset;
@@ -270,6 +310,25 @@ struct io_uring_files_update {
 	__aligned_u64 /* __s32 * */ fds;
 };
 
+/*
+ * Argument for IORING_REGISTER_IOWQ_LIMITS. All limits are per NUMA node,
+ * index 0 is for bounded work (regular files, block devices) and index 1
+ * for unbounded work (sockets, pipes, ...). A value of 0 leaves a limit
+ * unchanged, and the previous limits are written back.
+ */
+struct io_uring_iowq_limits {
+	__u32	max_workers[2];
+	__u32	max_queued[2];	/* refuse new work beyond this, ~0U for none */
+	__u32	resv[4];
+};
+
+/* argument for IORING_(UN)REGISTER_RING_FDS, an array of nr_args entries */
+struct io_uring_rsrc_update {
+	__u32 offset;
+	__u32 resv;
+	__aligned_u64 data;
+};
+
 #define IO_URING_OP_SUPPORTED	(1U << 0)
 
 struct io_uring_probe_op {
@@ -287,4 +346,38 @@ struct io_uring_probe {
 	struct io_uring_probe_op ops[0];
 };
 
+struct io_uring_buf {
+	__u64	addr;
+	__u32	len;
+	__u16	bid;
+	__u16	resv;
+};
+
+/*
+ * Provided buffer ring, shared with the application. The application fills
+ * in bufs[] and publishes them by storing the new tail with release
+ * semantics; the kernel consumes entries from its private head. The tail
+ * overlays the resv field of bufs[0], so all ring entries remain usable.
+ */
+struct io_uring_buf_ring {
+	union {
+		struct {
+			__u64	resv1;
+			__u32	resv2;
+			__u16	resv3;
+			__u16	tail;
+		};
+		struct io_uring_buf	bufs[0];
+	};
+};
+
+/* argument for IORING_(UN)REGISTER_PBUF_RING */
+struct io_uring_buf_reg {
+	__u64	ring_addr;
+	__u32	ring_entries;
+	__u16	bgid;
+	__u16	pad;
+	__u64	resv[3];
+};
+
 #endif
@@ -1426,6 +1426,15 @@ bool should_numa_migrate_memory(struct task_struct *p, struct page * page,
 	this_cpupid = cpu_pid_to_cpupid(dst_cpu, current->pid);
 	last_cpupid = page_cpupid_xchg_last(page, this_cpupid);
 
+	/*
+	 * A page that reclaim demoted to a slower memory tier is promoted
+	 * back as soon as it is accessed again; if it goes cold, demotion
+	 * will move it down again.
+	 */
+	if (numa_promotion_enabled && node_is_lower_tier(src_nid) &&
+	    !node_is_lower_tier(dst_nid))
+		return true;
+
 	/*
 	 * Allow first faults or private faults to migrate immediately early in
 	 * the lifetime of a task. The magic number 4 is based on waiting for
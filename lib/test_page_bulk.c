@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/*
+ * Test module for measuring the throughput of the bulk page allocator
+ * against allocating order-0 pages one at a time.
+ */
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+
+#define __param(type, name, init, msg)		\
+	static type name = init;				\
+	module_param(name, type, 0444);			\
+	MODULE_PARM_DESC(name, msg)				\
+
+__param(int, nr_pages, 64,
+	"Number of pages allocated and freed per iteration");
+
+__param(int, test_loop_count, 100000,
+	"Set test loop counter");
+
+__param(int, run_test_mask, INT_MAX,
+	"Set tests specified in the mask.\n\n"
+		"\t\tid: 1,   name: single_page_test\n"
+		"\t\tid: 2,   name: bulk_array_test\n"
+		"\t\tid: 4,   name: bulk_list_test\n"
+		/* Add a new test case description here. */
+);
+
+static struct page **pages;
+
+static unsigned long single_page_test(void)
+{
+	unsigned long allocated = 0;
+	int i, j;
+
+	for (i = 0; i < test_loop_count; i++) {
+		for (j = 0; j < nr_pages; j++) {
+			pages[j] = alloc_page(GFP_KERNEL);
+			if (!pages[j])
+				break;
+		}
+		allocated += j;
+		while (j--)
+			__free_page(pages[j]);
+		cond_resched();
+	}
+
+	return allocated;
+}
+
+static unsigned long bulk_array_test(void)
+{
+	unsigned long allocated = 0;
+	int i, j, nr;
+
+	for (i = 0; i < test_loop_count; i++) {
+		memset(pages, 0, sizeof(*pages) * nr_pages);
+		nr = alloc_pages_bulk_array(GFP_KERNEL, nr_pages, pages);
+		allocated += nr;
+		for (j = 0; j < nr; j++)
+			__free_page(pages[j]);
+		cond_resched();
+	}
+
+	return allocated;
+}
+
+static unsigned long bulk_list_test(void)
+{
+	unsigned long allocated = 0;
+	struct page *page, *next;
+	LIST_HEAD(list);
+	int i;
+
+	for (i = 0; i < test_loop_count; i++) {
+		allocated += alloc_pages_bulk_list(GFP_KERNEL, nr_pages, &list);
+		list_for_each_entry_safe(page, next, &list, lru) {
+			list_del(&page->lru);
+			__free_page(page);
+		}
+		cond_resched();
+	}
+
+	return allocated;
+}
+
+struct test_case_desc {
+	const char *test_name;
+	unsigned long (*test_func)(void);
+};
+
+static struct test_case_desc test_case_array[] = {
+	{ "single_page_test", single_page_test },
+	{ "bulk_array_test", bulk_array_test },
+	{ "bulk_list_test", bulk_list_test },
+	/* Add a new test case here. */
+};
+
+static void run_one_test(struct test_case_desc *t)
+{
+	unsigned long allocated;
+	u64 start, delta;
+
+	start = ktime_get_ns();
+	allocated = t->test_func();
+	delta = ktime_get_ns() - start;
+
+	pr_info("%s: %lu pages in %llu usec, %llu pages/sec\n",
+		t->test_name, allocated, div_u64(delta, NSEC_PER_USEC),
+		delta ? div64_u64((u64)allocated * NSEC_PER_SEC, delta) : 0);
+}
+
+static int __init page_bulk_test_init(void)
+{
+	int i;
+
+	if (nr_pages <= 0 || test_loop_count <= 0)
+		return -EINVAL;
+
+	pages = kcalloc(nr_pages, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	pr_info("nr_pages: %d, test_loop_count: %d\n",
+		nr_pages, test_loop_count);
+
+	for (i = 0; i < ARRAY_SIZE(test_case_array); i++) {
+		if (run_test_mask & BIT(i))
+			run_one_test(&test_case_array[i]);
+	}
+
+	kfree(pages);
+
+	/*
+	 * Return an error to unload the module right away; the results
+	 * are in the kernel log.
+	 */
+	return -EAGAIN;
+}
+
+module_init(page_bulk_test_init)
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Bulk page allocator performance test");
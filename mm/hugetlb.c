@@ -40,6 +40,7 @@
 #include <linux/userfaultfd_k.h>
 #include <linux/page_owner.h>
 #include "internal.h"
+#include "hugetlb_vmemmap.h"
 
 int hugetlb_max_hstate __read_mostly;
 unsigned int default_hstate_idx;
@@ -1025,10 +1026,62 @@ static bool vma_has_reserves(struct vm_area_struct *vma, long chg)
 	return false;
 }
 
+/*
+ * Free pages can be zeroed ahead of time by hugetlb_zero_workfn(), so that
+ * faults can map them right away. The flag lives in the second tail page,
+ * whose PG_private is otherwise unused, and goes when the page is freed.
+ */
+static bool page_huge_zeroed(struct page *page)
+{
+	return PagePrivate(&page[2]);
+}
+
+static void set_page_huge_zeroed(struct page *page)
+{
+	SetPagePrivate(&page[2]);
+}
+
+static void clear_page_huge_zeroed(struct page *page)
+{
+	ClearPagePrivate(&page[2]);
+}
+
+static void hugetlb_queue_zeroing(struct hstate *h)
+{
+	if (h->zeroed_huge_pages < h->nr_zeroed_huge_pages)
+		queue_work(system_unbound_wq, &h->zero_work);
+}
+
+/* Called with hugetlb_lock held for a free page leaving the free lists */
+static void unaccount_zeroed_huge_page(struct hstate *h, struct page *page)
+{
+	int nid = page_to_nid(page);
+
+	if (!page_huge_zeroed(page))
+		return;
+
+	h->zeroed_huge_pages--;
+	h->zeroed_huge_pages_node[nid]--;
+}
+
 static void enqueue_huge_page(struct hstate *h, struct page *page)
 {
 	int nid = page_to_nid(page);
-	list_move(&page->lru, &h->hugepage_freelists[nid]);
+
+	/*
+	 * Zeroed pages go to the head of the list, where allocations look
+	 * first, dirty ones to the tail for the zeroing worker to pick up.
+	 */
+	if (page_huge_zeroed(page)) {
+		list_move(&page->lru, &h->hugepage_freelists[nid]);
+		h->zeroed_huge_pages++;
+		h->zeroed_huge_pages_node[nid]++;
+	} else if (h->nr_zeroed_huge_pages) {
+		list_move_tail(&page->lru, &h->hugepage_freelists[nid]);
+		hugetlb_queue_zeroing(h);
+	} else {
+		list_move(&page->lru, &h->hugepage_freelists[nid]);
+	}
 	h->free_huge_pages++;
 	h->free_huge_pages_node[nid]++;
 }
@@ -1046,10 +1099,15 @@ static struct page *dequeue_huge_page_node_exact(struct hstate *h, int nid)
 	 */
 	if (&h->hugepage_freelists[nid] == &page->lru)
 		return NULL;
+	/*
+	 * The page may still be locked by hugetlb_zero_workfn(), in which
+	 * case the caller has to wait_on_page_locked() before using it.
+	 */
 	list_move(&page->lru, &h->hugepage_activelist);
 	set_page_refcounted(page);
 	h->free_huge_pages--;
 	h->free_huge_pages_node[nid]--;
+	unaccount_zeroed_huge_page(h, page);
 	return page;
 }
 
@@ -1287,12 +1345,43 @@ static inline void destroy_compound_gigantic_page(struct page *page,
 						unsigned int order) { }
 #endif
 
-static void update_and_free_page(struct hstate *h, struct page *page)
+/*
+ * Allocate the vmemmap pages @page needs before it can go back to the buddy
+ * allocator. If that fails, @page is put back on the free list as a surplus
+ * page and can be freed again later. Called with hugetlb_lock held, which is
+ * dropped around the allocation.
+ */
+static int hugetlb_restore_vmemmap(struct hstate *h, struct page *page)
+{
+	int nid = page_to_nid(page);
+	int ret;
+
+	if (!page_huge_vmemmap_freed(page))
+		return 0;
+
+	spin_unlock(&hugetlb_lock);
+	ret = alloc_huge_page_vmemmap(h, page);
+	spin_lock(&hugetlb_lock);
+	if (ret) {
+		/* The callers have already taken it off its list */
+		INIT_LIST_HEAD(&page->lru);
+		enqueue_huge_page(h, page);
+		h->surplus_huge_pages++;
+		h->surplus_huge_pages_node[nid]++;
+	}
+
+	return ret;
+}
+
+static int update_and_free_page(struct hstate *h, struct page *page)
 {
 	int i;
 
 	if (hstate_is_gigantic(h) && !gigantic_page_runtime_supported())
-		return;
+		return 0;
+
+	if (hugetlb_restore_vmemmap(h, page))
+		return -ENOMEM;
 
 	h->nr_huge_pages--;
 	h->nr_huge_pages_node[page_to_nid(page)]--;
@@ -1318,6 +1407,8 @@ static void update_and_free_page(struct hstate *h, struct page *page)
 	} else {
 		__free_pages(page, huge_page_order(h));
 	}
+
+	return 0;
 }
 
 struct hstate *size_to_hstate(unsigned long size)
@@ -1378,6 +1469,46 @@ static inline void ClearPageHugeTemporary(struct page *page)
 	page[2].mapping = NULL;
 }
 
+/*
+ * update_and_free_page() has to allocate the vmemmap of an optimized page
+ * back, which may sleep, but free_huge_page() can be called with spinlocks
+ * held. Such pages are freed from a workqueue instead. As in the
+ * hpage_freelist below, page->mapping doubles as the llist_node.
+ */
+static LLIST_HEAD(hpage_vmemmap_freelist);
+
+static void free_hpage_vmemmap_workfn(struct work_struct *work)
+{
+	struct llist_node *node;
+	struct page *page;
+
+	node = llist_del_all(&hpage_vmemmap_freelist);
+
+	spin_lock(&hugetlb_lock);
+	while (node) {
+		page = container_of((struct address_space **)node,
+				     struct page, mapping);
+		node = node->next;
+		page->mapping = NULL;
+		update_and_free_page(page_hstate(page), page);
+	}
+	spin_unlock(&hugetlb_lock);
+}
+static DECLARE_WORK(free_hpage_vmemmap_work, free_hpage_vmemmap_workfn);
+
+/* Called with hugetlb_lock held, @page already off its list */
+static void update_and_free_page_nosleep(struct hstate *h, struct page *page)
+{
+	if (!page_huge_vmemmap_freed(page)) {
+		update_and_free_page(h, page);
+		return;
+	}
+
+	if (llist_add((struct llist_node *)&page->mapping,
+		      &hpage_vmemmap_freelist))
+		schedule_work(&free_hpage_vmemmap_work);
+}
+
 static void __free_huge_page(struct page *page)
 {
 	/*
@@ -1397,6 +1528,7 @@ static void __free_huge_page(struct page *page)
 	page->mapping = NULL;
 	restore_reserve = PagePrivate(page);
 	ClearPagePrivate(page);
+	clear_page_huge_zeroed(page);
 
 	/*
 	 * If PagePrivate() was set on page, page allocation consumed a
@@ -1429,11 +1561,11 @@ static void __free_huge_page(struct page *page)
 	if (PageHugeTemporary(page)) {
 		list_del(&page->lru);
 		ClearPageHugeTemporary(page);
-		update_and_free_page(h, page);
+		update_and_free_page_nosleep(h, page);
 	} else if (h->surplus_huge_pages_node[nid]) {
 		/* remove the page from active list */
 		list_del(&page->lru);
-		update_and_free_page(h, page);
+		update_and_free_page_nosleep(h, page);
 		h->surplus_huge_pages--;
 		h->surplus_huge_pages_node[nid]--;
 	} else {
@@ -1493,6 +1625,7 @@ void free_huge_page(struct page *page)
 
 static void prep_new_huge_page(struct hstate *h, struct page *page, int nid)
 {
+	free_huge_page_vmemmap(h, page);
 	INIT_LIST_HEAD(&page->lru);
 	set_compound_page_dtor(page, HUGETLB_PAGE_DTOR);
 	spin_lock(&hugetlb_lock);
@@ -1778,6 +1911,22 @@ static int alloc_pool_huge_page(struct hstate *h, nodemask_t *nodes_allowed,
 	return 1;
 }
 
+/*
+ * Pick a free page of @nid to give back to the buddy allocator: preferably
+ * a dirty one from the tail of the list, and never one that is locked for
+ * zeroing.
+ */
+static struct page *pool_page_to_free(struct hstate *h, int nid)
+{
+	struct page *page;
+
+	list_for_each_entry_reverse(page, &h->hugepage_freelists[nid], lru)
+		if (!PageLocked(page))
+			return page;
+
+	return NULL;
+}
+
 /*
  * Free huge page from pool from next node to free.
  * Attempt to keep persistent huge pages more or less
@@ -1795,14 +1944,15 @@ static int free_pool_huge_page(struct hstate *h, nodemask_t *nodes_allowed,
 		 * If we're returning unused surplus pages, only examine
 		 * nodes with surplus pages.
 		 */
-		if ((!acct_surplus || h->surplus_huge_pages_node[node]) &&
-		    !list_empty(&h->hugepage_freelists[node])) {
-			struct page *page =
-				list_entry(h->hugepage_freelists[node].next,
-					  struct page, lru);
+		if (!acct_surplus || h->surplus_huge_pages_node[node]) {
+			struct page *page = pool_page_to_free(h, node);
+
+			if (!page)
+				continue;
 			list_del(&page->lru);
 			h->free_huge_pages--;
 			h->free_huge_pages_node[node]--;
+			unaccount_zeroed_huge_page(h, page);
 			if (acct_surplus) {
 				h->surplus_huge_pages--;
 				h->surplus_huge_pages_node[node]--;
@@ -1846,6 +1996,21 @@ int dissolve_free_huge_page(struct page *page)
 		int nid = page_to_nid(head);
 		if (h->free_huge_pages - h->resv_huge_pages == 0)
 			goto out;
+		/* Being zeroed by hugetlb_zero_workfn() */
+		if (PageLocked(head))
+			goto out;
+		list_del(&head->lru);
+		h->free_huge_pages--;
+		h->free_huge_pages_node[nid]--;
+		unaccount_zeroed_huge_page(h, head);
+		h->max_huge_pages--;
+		/*
+		 * The tail struct pages have to be writable before the
+		 * HWPoison flag can be moved onto one of them.
+		 */
+		rc = hugetlb_restore_vmemmap(h, head);
+		if (rc)
+			goto out;
 		/*
 		 * Move PageHWPoison flag from head page to the raw error page,
 		 * which makes any subpages rather than the error page reusable.
@@ -1854,10 +2019,6 @@ int dissolve_free_huge_page(struct page *page)
 			SetPageHWPoison(page);
 			ClearPageHWPoison(head);
 		}
-		list_del(&head->lru);
-		h->free_huge_pages--;
-		h->free_huge_pages_node[nid]--;
-		h->max_huge_pages--;
 		update_and_free_page(h, head);
 		rc = 0;
 	}
@@ -1992,7 +2153,9 @@ struct page *alloc_huge_page_node(struct hstate *h, int nid)
 		page = dequeue_huge_page_nodemask(h, gfp_mask, nid, NULL);
 	spin_unlock(&hugetlb_lock);
 
-	if (!page)
+	if (page)
+		wait_on_page_locked(page);
+	else
 		page = alloc_migrate_huge_page(h, gfp_mask, nid, NULL);
 
 	return page;
@@ -2011,6 +2174,7 @@ struct page *alloc_huge_page_nodemask(struct hstate *h, int preferred_nid,
 		page = dequeue_huge_page_nodemask(h, gfp_mask, preferred_nid, nmask);
 		if (page) {
 			spin_unlock(&hugetlb_lock);
+			wait_on_page_locked(page);
 			return page;
 		}
 	}
@@ -2443,6 +2607,9 @@ struct page *alloc_huge_page(struct vm_area_struct *vma,
 
 	spin_unlock(&hugetlb_lock);
 
+	/* Let hugetlb_zero_workfn() finish with it */
+	wait_on_page_locked(page);
+
 	set_page_private(page, (unsigned long)spool);
 
 	map_commit = vma_commit_reservation(h, vma, addr);
@@ -2638,12 +2805,13 @@ static void try_to_free_low(struct hstate *h, unsigned long count,
 		list_for_each_entry_safe(page, next, freel, lru) {
 			if (count >= h->nr_huge_pages)
 				return;
-			if (PageHighMem(page))
+			if (PageHighMem(page) || PageLocked(page))
 				continue;
 			list_del(&page->lru);
-			update_and_free_page(h, page);
 			h->free_huge_pages--;
 			h->free_huge_pages_node[page_to_nid(page)]--;
+			unaccount_zeroed_huge_page(h, page);
+			update_and_free_page(h, page);
 		}
 	}
 }
@@ -2703,6 +2871,9 @@ static int set_max_huge_pages(struct hstate *h, unsigned long count, int nid,
 	else
 		return -ENOMEM;
 
+	/* Don't let pages locked for zeroing hold up shrinking the pool */
+	cancel_work_sync(&h->zero_work);
+
 	spin_lock(&hugetlb_lock);
 
 	/*
@@ -2808,6 +2979,7 @@ static int set_max_huge_pages(struct hstate *h, unsigned long count, int nid,
 	}
 out:
 	h->max_huge_pages = persistent_huge_pages(h);
+	hugetlb_queue_zeroing(h);
 	spin_unlock(&hugetlb_lock);
 
 	NODEMASK_FREE(node_alloc_noretry);
@@ -2815,6 +2987,97 @@ static int set_max_huge_pages(struct hstate *h, unsigned long count, int nid,
 	return 0;
 }
 
+/*
+ * Pick a free page for hugetlb_zero_workfn(), from the node with the fewest
+ * zeroed pages. Dirty pages sit at the tail of the free lists, see
+ * enqueue_huge_page(). Called with hugetlb_lock held.
+ */
+static struct page *hugetlb_zero_next_page(struct hstate *h)
+{
+	struct page *page, *next = NULL;
+	int nid;
+
+	if (h->zeroed_huge_pages >= h->nr_zeroed_huge_pages)
+		return NULL;
+
+	for_each_node_state(nid, N_MEMORY) {
+		if (next && h->zeroed_huge_pages_node[nid] >=
+			    h->zeroed_huge_pages_node[page_to_nid(next)])
+			continue;
+		list_for_each_entry_reverse(page, &h->hugepage_freelists[nid],
+					    lru) {
+			if (page_huge_zeroed(page))
+				break;
+			if (PageLocked(page) || PageHWPoison(page))
+				continue;
+			next = page;
+			break;
+		}
+	}
+
+	if (next && !trylock_page(next))
+		next = NULL;
+
+	return next;
+}
+
+/*
+ * Zero free pages in the background until nr_zeroed_huge_pages of them are
+ * ready. Each page stays on its free list while it is zeroed, locked, so
+ * that an allocation can still take it and wait for it to be done.
+ */
+static void hugetlb_zero_workfn(struct work_struct *work)
+{
+	struct hstate *h = container_of(work, struct hstate, zero_work);
+	struct page *page;
+	int nid;
+
+	for (;;) {
+		spin_lock(&hugetlb_lock);
+		page = hugetlb_zero_next_page(h);
+		spin_unlock(&hugetlb_lock);
+		if (!page)
+			break;
+
+		clear_huge_page_nocache(page, 0, pages_per_huge_page(h), 1);
+
+		spin_lock(&hugetlb_lock);
+		set_page_huge_zeroed(page);
+		/* Unless an allocation took it in the meantime */
+		if (!page_count(page)) {
+			nid = page_to_nid(page);
+			list_move(&page->lru, &h->hugepage_freelists[nid]);
+			h->zeroed_huge_pages++;
+			h->zeroed_huge_pages_node[nid]++;
+		}
+		unlock_page(page);
+		spin_unlock(&hugetlb_lock);
+	}
+}
+
+/**
+ * hugetlb_zero_page - zero a newly allocated huge page before mapping it
+ * @h: the hstate of @page
+ * @page: the page returned by alloc_huge_page()
+ * @addr: the address the page will be mapped at
+ *
+ * Pages that were zeroed in the pool are handed out as they are. Others are
+ * zeroed by h->clear_threads threads.
+ */
+void hugetlb_zero_page(struct hstate *h, struct page *page, unsigned long addr)
+{
+	if (page_huge_zeroed(page)) {
+		clear_page_huge_zeroed(page);
+		return;
+	}
+
+	if (h->clear_threads > 1)
+		clear_huge_page_nocache(page, addr, pages_per_huge_page(h),
+					h->clear_threads);
+	else
+		clear_huge_page(page, addr, pages_per_huge_page(h));
+}
+
 #define HSTATE_ATTR_RO(_name) \
 	static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
 
@@ -3012,12 +3275,77 @@ static ssize_t surplus_hugepages_show(struct kobject *kobj,
 }
 HSTATE_ATTR_RO(surplus_hugepages);
 
+static ssize_t zeroed_hugepages_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	struct hstate *h = kobj_to_hstate(kobj, NULL);
+	return sprintf(buf, "%lu\n", h->zeroed_huge_pages);
+}
+HSTATE_ATTR_RO(zeroed_hugepages);
+
+static ssize_t nr_zeroed_hugepages_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	struct hstate *h = kobj_to_hstate(kobj, NULL);
+	return sprintf(buf, "%lu\n", h->nr_zeroed_huge_pages);
+}
+
+static ssize_t nr_zeroed_hugepages_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	int err;
+	unsigned long input;
+	struct hstate *h = kobj_to_hstate(kobj, NULL);
+
+	err = kstrtoul(buf, 10, &input);
+	if (err)
+		return err;
+
+	spin_lock(&hugetlb_lock);
+	h->nr_zeroed_huge_pages = input;
+	hugetlb_queue_zeroing(h);
+	spin_unlock(&hugetlb_lock);
+
+	return count;
+}
+HSTATE_ATTR(nr_zeroed_hugepages);
+
+static ssize_t clear_threads_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	struct hstate *h = kobj_to_hstate(kobj, NULL);
+	return sprintf(buf, "%u\n", h->clear_threads);
+}
+
+static ssize_t clear_threads_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	int err;
+	unsigned int input;
+	struct hstate *h = kobj_to_hstate(kobj, NULL);
+
+	err = kstrtouint(buf, 10, &input);
+	if (err)
+		return err;
+
+	if (!input || input > num_possible_cpus())
+		return -EINVAL;
+
+	h->clear_threads = input;
+
+	return count;
+}
+HSTATE_ATTR(clear_threads);
+
 static struct attribute *hstate_attrs[] = {
 	&nr_hugepages_attr.attr,
 	&nr_overcommit_hugepages_attr.attr,
 	&free_hugepages_attr.attr,
 	&resv_hugepages_attr.attr,
 	&surplus_hugepages_attr.attr,
+	&zeroed_hugepages_attr.attr,
+	&nr_zeroed_hugepages_attr.attr,
+	&clear_threads_attr.attr,
 #ifdef CONFIG_NUMA
 	&nr_hugepages_mempolicy_attr.attr,
 #endif
@@ -3299,8 +3627,11 @@ void __init hugetlb_add_hstate(unsigned int order)
 	INIT_LIST_HEAD(&h->hugepage_activelist);
 	h->next_nid_to_alloc = first_memory_node;
 	h->next_nid_to_free = first_memory_node;
+	h->clear_threads = 1;
+	INIT_WORK(&h->zero_work, hugetlb_zero_workfn);
 	snprintf(h->name, HSTATE_NAME_LEN, "hugepages-%lukB",
 					huge_page_size(h)/1024);
+	hugetlb_vmemmap_init(h);
 
 	parsed_hstate = h;
 }
@@ -4389,7 +4720,7 @@ static vm_fault_t hugetlb_no_page(struct mm_struct *mm,
 			ret = vmf_error(PTR_ERR(page));
 			goto out;
 		}
-		clear_huge_page(page, address, pages_per_huge_page(h));
+		hugetlb_zero_page(h, page, address);
 		__SetPageUptodate(page);
 		new_page = true;
 
@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Free the tail vmemmap pages of HugeTLB pages
+ *
+ * With 64 byte struct pages, the vmemmap of a 2MB HugeTLB page takes 8
+ * pages and that of a 1GB page 4096. Apart from the first few tail
+ * struct pages, which hold the compound and hugetlb metadata, all tail
+ * struct pages of a HugeTLB page are identical and are never written to
+ * while it is a HugeTLB page. So the vmemmap pages after the first two
+ * are remapped read-only onto the second one and handed back to the
+ * buddy allocator:
+ *
+ *    HugeTLB page                  vmemmap                 backing pages
+ *  +-------------+            +-------------+            +-------------+
+ *  |             |  ------->  |      0      |  ------->  |      0      |
+ *  |             |            +-------------+            +-------------+
+ *  |             |            |      1      |  ------->  |      1      |
+ *  |             |            +-------------+            +-------------+
+ *  |             |            |      2      |  ----+       ^  ^  ^
+ *  |             |            +-------------+      |       |  |  |
+ *  |             |            |     ...     |  ----+-------+  |  |
+ *  |             |            +-------------+      |          |  |
+ *  |             |            |    N - 1    |  ----+----------+--+
+ *  +-------------+            +-------------+
+ *
+ * The first vmemmap page keeps the head and the first tail struct pages
+ * writable. Before a HugeTLB page goes back to the buddy allocator, which
+ * writes to every struct page, its vmemmap is allocated and copied back
+ * in from the shared page.
+ *
+ * The vmemmap has to be mapped with base pages for this, see
+ * vmemmap_populate() on x86.
+ */
+#define pr_fmt(fmt)	"HugeTLB: " fmt
+
+#include "hugetlb_vmemmap.h"
+
+/* The vmemmap pages that stay with the HugeTLB page: the head and reuse */
+#define RESERVE_VMEMMAP_NR	2U
+#define RESERVE_VMEMMAP_SIZE	(RESERVE_VMEMMAP_NR << PAGE_SHIFT)
+
+/* Only if a struct page can't straddle two vmemmap pages */
+bool hugetlb_free_vmemmap_enabled __read_mostly =
+	IS_ENABLED(CONFIG_HUGETLB_PAGE_FREE_VMEMMAP_DEFAULT_ON) &&
+	!(sizeof(struct page) & (sizeof(struct page) - 1));
+
+static int __init early_hugetlb_free_vmemmap_param(char *buf)
+{
+	if (!buf)
+		return -EINVAL;
+
+	if (!strcmp(buf, "on"))
+		hugetlb_free_vmemmap_enabled = true;
+	else if (!strcmp(buf, "off"))
+		hugetlb_free_vmemmap_enabled = false;
+	else
+		return -EINVAL;
+
+	if (!is_power_of_2(sizeof(struct page))) {
+		pr_warn("cannot free vmemmap pages because \"struct page\" crosses page boundaries\n");
+		hugetlb_free_vmemmap_enabled = false;
+	}
+
+	return 0;
+}
+early_param("hugetlb_free_vmemmap", early_hugetlb_free_vmemmap_param);
+
+void free_huge_page_vmemmap(struct hstate *h, struct page *head)
+{
+	unsigned long vmemmap_addr = (unsigned long)head;
+	unsigned long vmemmap_end, vmemmap_reuse;
+
+	if (!h->nr_free_vmemmap_pages)
+		return;
+
+	vmemmap_addr += RESERVE_VMEMMAP_SIZE;
+	vmemmap_end = vmemmap_addr + (h->nr_free_vmemmap_pages << PAGE_SHIFT);
+	vmemmap_reuse = vmemmap_addr - PAGE_SIZE;
+
+	if (!vmemmap_remap_free(vmemmap_addr, vmemmap_end, vmemmap_reuse))
+		set_page_private(&head[1],
+				 page_private(&head[1]) | HPAGE_VMEMMAP_FREED);
+}
+
+/*
+ * Returns -ENOMEM if the vmemmap pages can't be allocated, in which case
+ * @head has to stay a HugeTLB page.
+ */
+int alloc_huge_page_vmemmap(struct hstate *h, struct page *head)
+{
+	unsigned long vmemmap_addr = (unsigned long)head;
+	unsigned long vmemmap_end, vmemmap_reuse;
+	int ret;
+
+	if (!page_huge_vmemmap_freed(head))
+		return 0;
+
+	vmemmap_addr += RESERVE_VMEMMAP_SIZE;
+	vmemmap_end = vmemmap_addr + (h->nr_free_vmemmap_pages << PAGE_SHIFT);
+	vmemmap_reuse = vmemmap_addr - PAGE_SIZE;
+
+	/*
+	 * Don't dip into the reserves or try hard: the caller can keep the
+	 * HugeTLB page around and free it later.
+	 */
+	ret = vmemmap_remap_alloc(vmemmap_addr, vmemmap_end, vmemmap_reuse,
+				  GFP_KERNEL | __GFP_NORETRY | __GFP_THISNODE);
+	if (!ret)
+		set_page_private(&head[1],
+				 page_private(&head[1]) & ~HPAGE_VMEMMAP_FREED);
+
+	return ret;
+}
+
+void __init hugetlb_vmemmap_init(struct hstate *h)
+{
+	unsigned int vmemmap_pages;
+
+	if (!hugetlb_free_vmemmap_enabled)
+		return;
+
+	vmemmap_pages = (pages_per_huge_page(h) * sizeof(struct page)) >>
+			PAGE_SHIFT;
+	if (vmemmap_pages <= RESERVE_VMEMMAP_NR)
+		return;
+
+	h->nr_free_vmemmap_pages = vmemmap_pages - RESERVE_VMEMMAP_NR;
+	pr_info("can free %u vmemmap pages for %s\n",
+		h->nr_free_vmemmap_pages, h->name);
+}
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _MM_HUGETLB_VMEMMAP_H
+#define _MM_HUGETLB_VMEMMAP_H
+
+#include <linux/hugetlb.h>
+
+#ifdef CONFIG_HUGETLB_PAGE_FREE_VMEMMAP
+void free_huge_page_vmemmap(struct hstate *h, struct page *head);
+int alloc_huge_page_vmemmap(struct hstate *h, struct page *head);
+void hugetlb_vmemmap_init(struct hstate *h);
+
+/*
+ * Set in ->private of the first tail page, whose struct page is never
+ * remapped, on HugeTLB pages whose tail vmemmap pages have been freed.
+ * The head's ->private holds the subpool and the first tail page's flags
+ * are not free for us: PG_private_2 there is PG_double_map.
+ */
+#define HPAGE_VMEMMAP_FREED	BIT(0)
+
+static inline bool page_huge_vmemmap_freed(struct page *head)
+{
+	return page_private(&head[1]) & HPAGE_VMEMMAP_FREED;
+}
+#else
+static inline void free_huge_page_vmemmap(struct hstate *h, struct page *head)
+{
+}
+
+static inline int alloc_huge_page_vmemmap(struct hstate *h, struct page *head)
+{
+	return 0;
+}
+
+static inline void hugetlb_vmemmap_init(struct hstate *h)
+{
+}
+
+static inline bool page_huge_vmemmap_freed(struct page *head)
+{
+	return false;
+}
+#endif /* CONFIG_HUGETLB_PAGE_FREE_VMEMMAP */
+#endif /* _MM_HUGETLB_VMEMMAP_H */
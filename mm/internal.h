@@ -424,6 +424,23 @@ static inline struct file *maybe_unlock_mmap_for_io(struct vm_fault *vmf,
 	return fpin;
 }
 
+/*
+ * Called with mmap_lock held for write, before the page table under @pmd
+ * is freed or moved without taking its lock: a speculative fault that
+ * validated its VMA before mmap_lock was taken may still be installing a
+ * pte in it. Any later one fails its mmap_seq check under that lock.
+ */
+static inline void wait_for_speculative_faults(struct mm_struct *mm,
+					       pmd_t *pmd)
+{
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	spinlock_t *ptl = pte_lockptr(mm, pmd);
+
+	spin_lock(ptl);
+	spin_unlock(ptl);
+#endif
+}
+
 #else /* !CONFIG_MMU */
 static inline void clear_page_mlock(struct page *page) { }
 static inline void mlock_vma_page(struct page *page) { }
@@ -272,6 +272,53 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/*
+ * Number of threads hashing the pages of a batch, including ksmd itself.
+ * With more than one, ksmd gathers up to KSM_SCAN_BATCH pages of the
+ * current mm_slot, splits them between the ksm_hash workers to compute
+ * their checksums in parallel, and then merges them in scan order.
+ */
+#define KSM_MAX_SCAN_THREADS	32
+#define KSM_SCAN_BATCH		256
+static unsigned int ksm_nr_scan_threads = 1;
+
+/**
+ * struct ksm_scan_item - a page gathered by ksmd for the current batch
+ * @page: the page, with a reference held
+ * @rmap_item: the reverse mapping of @page
+ * @checksum: checksum of @page, valid if @has_checksum
+ * @has_checksum: @checksum was computed ahead by a hashing thread
+ */
+struct ksm_scan_item {
+	struct page *page;
+	struct rmap_item *rmap_item;
+	u32 checksum;
+	bool has_checksum;
+};
+
+/**
+ * struct ksm_scan_thread - one share of the hashing of a batch
+ * @work: runs the share on ksm_hash_wq (not used for ksmd's own share)
+ * @items: first item of the share
+ * @nr_items: number of items in the share
+ * @pages_hashed: pages hashed by this thread since boot
+ * @hash_ns: time this thread spent hashing since boot
+ */
+struct ksm_scan_thread {
+	struct work_struct work;
+	struct ksm_scan_item *items;
+	unsigned int nr_items;
+	unsigned long pages_hashed;
+	u64 hash_ns;
+};
+
+static struct ksm_scan_item ksm_scan_items[KSM_SCAN_BATCH];
+static struct ksm_scan_thread ksm_scan_threads[KSM_MAX_SCAN_THREADS];
+static struct workqueue_struct *ksm_hash_wq;
+
+/* The number of pages ksmd has scanned */
+static unsigned long ksm_pages_scanned;
+
 /* Checksum of an empty (zeroed) page */
 static unsigned int zero_checksum __read_mostly;
 
@@ -2031,8 +2078,10 @@ static void stable_tree_append(struct rmap_item *rmap_item,
  *
  * @page: the page that we are searching identical page to.
  * @rmap_item: the reverse mapping into the virtual address of this page
+ * @precomputed: checksum of @page if already calculated, or NULL
  */
-static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
+static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item,
+			       const u32 *precomputed)
 {
 	struct mm_struct *mm = rmap_item->mm;
 	struct rmap_item *tree_rmap_item;
@@ -2097,7 +2146,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
 	 */
-	checksum = calc_checksum(page);
+	checksum = precomputed ? *precomputed : calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
 		return;
@@ -2221,7 +2270,15 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+/*
+ * Return the next page to be scanned, or NULL at the end of a full scan.
+ * With @stay_in_slot, also return NULL instead of moving on from the
+ * current mm_slot: finishing a slot may free its rmap_items, so ksmd must
+ * merge the pages it has gathered from it first. The next call then
+ * resumes where this one stopped.
+ */
+static struct rmap_item *scan_get_next_rmap_item(struct page **page,
+						 bool stay_in_slot)
 {
 	struct mm_struct *mm;
 	struct mm_slot *slot;
@@ -2328,6 +2385,11 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 		}
 	}
 
+	if (stay_in_slot) {
+		mmap_read_unlock(mm);
+		return NULL;
+	}
+
 	if (ksm_test_exit(mm)) {
 		ksm_scan.address = 0;
 		ksm_scan.rmap_list = &slot->rmap_list;
@@ -2380,6 +2442,62 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 	return NULL;
 }
 
+static void ksm_hash_items(struct ksm_scan_thread *thread)
+{
+	struct ksm_scan_item *item;
+	unsigned long pages = 0;
+	u64 start = ktime_get_ns();
+	unsigned int i;
+
+	for (i = 0; i < thread->nr_items; i++) {
+		item = &thread->items[i];
+		/*
+		 * KSM pages usually take the stable tree fast path without
+		 * a checksum: leave those to cmp_and_merge_page().
+		 */
+		if (PageKsm(item->page))
+			continue;
+		item->checksum = calc_checksum(item->page);
+		item->has_checksum = true;
+		pages++;
+	}
+
+	thread->pages_hashed += pages;
+	thread->hash_ns += ktime_get_ns() - start;
+}
+
+static void ksm_hash_work_fn(struct work_struct *work)
+{
+	ksm_hash_items(container_of(work, struct ksm_scan_thread, work));
+}
+
+/*
+ * Compute the checksums of @nr gathered pages, spreading them over the
+ * hashing threads; ksmd takes the first share itself.
+ */
+static void ksm_hash_batch(struct ksm_scan_item *items, unsigned int nr,
+			   unsigned int nr_threads)
+{
+	unsigned int i, start = 0, per_thread;
+
+	nr_threads = min(nr_threads, nr);
+	per_thread = DIV_ROUND_UP(nr, nr_threads);
+
+	for (i = 0; i < nr_threads && start < nr; i++) {
+		struct ksm_scan_thread *thread = &ksm_scan_threads[i];
+
+		thread->items = items + start;
+		thread->nr_items = min(per_thread, nr - start);
+		start += thread->nr_items;
+		if (i)
+			queue_work(ksm_hash_wq, &thread->work);
+	}
+
+	ksm_hash_items(&ksm_scan_threads[0]);
+	while (--i > 0)
+		flush_work(&ksm_scan_threads[i].work);
+}
+
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
  * @scan_npages:  number of pages we want to scan before we return.
@@ -2388,14 +2506,49 @@ static void ksm_do_scan(unsigned int scan_npages)
 {
 	struct rmap_item *rmap_item;
 	struct page *uninitialized_var(page);
+	unsigned int nr_threads = READ_ONCE(ksm_nr_scan_threads);
+	unsigned int i, nr;
 
-	while (scan_npages-- && likely(!freezing(current))) {
-		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
-		if (!rmap_item)
+	if (nr_threads <= 1) {
+		while (scan_npages-- && likely(!freezing(current))) {
+			cond_resched();
+			rmap_item = scan_get_next_rmap_item(&page, false);
+			if (!rmap_item)
+				return;
+			cmp_and_merge_page(page, rmap_item, NULL);
+			put_page(page);
+			ksm_pages_scanned++;
+		}
+		return;
+	}
+
+	while (scan_npages && likely(!freezing(current))) {
+		nr = 0;
+		while (nr < min_t(unsigned int, scan_npages, KSM_SCAN_BATCH)) {
+			cond_resched();
+			rmap_item = scan_get_next_rmap_item(&page, nr > 0);
+			if (!rmap_item)
+				break;
+			ksm_scan_items[nr].page = page;
+			ksm_scan_items[nr].rmap_item = rmap_item;
+			ksm_scan_items[nr].has_checksum = false;
+			nr++;
+		}
+		if (!nr)
 			return;
-		cmp_and_merge_page(page, rmap_item);
-		put_page(page);
+
+		ksm_hash_batch(ksm_scan_items, nr, nr_threads);
+
+		for (i = 0; i < nr; i++) {
+			struct ksm_scan_item *item = &ksm_scan_items[i];
+
+			cmp_and_merge_page(item->page, item->rmap_item,
+				item->has_checksum ? &item->checksum : NULL);
+			put_page(item->page);
+			cond_resched();
+		}
+		scan_npages -= nr;
+		ksm_pages_scanned += nr;
 	}
 }
 
@@ -3151,6 +3304,68 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t pages_scanned_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_scanned);
+}
+KSM_ATTR_RO(pages_scanned);
+
+static ssize_t scan_threads_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_nr_scan_threads);
+}
+
+static ssize_t scan_threads_store(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  const char *buf, size_t count)
+{
+	unsigned int nr_threads;
+	int err;
+
+	err = kstrtouint(buf, 10, &nr_threads);
+	if (err || !nr_threads || nr_threads > KSM_MAX_SCAN_THREADS)
+		return -EINVAL;
+
+	/* Not while ksmd is in the middle of a batch */
+	mutex_lock(&ksm_thread_mutex);
+	ksm_nr_scan_threads = nr_threads;
+	mutex_unlock(&ksm_thread_mutex);
+
+	return count;
+}
+KSM_ATTR(scan_threads);
+
+/*
+ * One line per hashing thread: pages hashed, msecs spent hashing and the
+ * resulting hash rate in pages per second.
+ */
+static ssize_t scan_thread_stats_show(struct kobject *kobj,
+				      struct kobj_attribute *attr, char *buf)
+{
+	ssize_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < KSM_MAX_SCAN_THREADS; i++) {
+		struct ksm_scan_thread *thread = &ksm_scan_threads[i];
+		unsigned long pages = READ_ONCE(thread->pages_hashed);
+		u64 ns = READ_ONCE(thread->hash_ns);
+
+		if (i >= ksm_nr_scan_threads && !pages)
+			continue;
+
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%u %lu %llu %llu\n", i, pages,
+				 div_u64(ns, NSEC_PER_MSEC),
+				 ns ? div64_u64((u64)pages * NSEC_PER_SEC, ns)
+				    : 0);
+	}
+
+	return len;
+}
+KSM_ATTR_RO(scan_thread_stats);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -3160,6 +3375,9 @@ static struct attribute *ksm_attrs[] = {
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&pages_scanned_attr.attr,
+	&scan_threads_attr.attr,
+	&scan_thread_stats_attr.attr,
 #ifdef CONFIG_NUMA
 	&merge_across_nodes_attr.attr,
 #endif
@@ -3180,7 +3398,7 @@ static const struct attribute_group ksm_attr_group = {
 static int __init ksm_init(void)
 {
 	struct task_struct *ksm_thread;
-	int err;
+	int err, i;
 
 	/* The correct value depends on page size and endianness */
 	zero_checksum = calc_checksum(ZERO_PAGE(0));
@@ -3191,11 +3409,20 @@ static int __init ksm_init(void)
 	if (err)
 		goto out;
 
+	for (i = 0; i < KSM_MAX_SCAN_THREADS; i++)
+		INIT_WORK(&ksm_scan_threads[i].work, ksm_hash_work_fn);
+	ksm_hash_wq = alloc_workqueue("ksm_hash", WQ_UNBOUND,
+				      KSM_MAX_SCAN_THREADS);
+	if (!ksm_hash_wq) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
 	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
 	if (IS_ERR(ksm_thread)) {
 		pr_err("ksm: creating kthread failed\n");
 		err = PTR_ERR(ksm_thread);
-		goto out_free;
+		goto out_wq;
 	}
 
 #ifdef CONFIG_SYSFS
@@ -3203,7 +3430,7 @@ static int __init ksm_init(void)
 	if (err) {
 		pr_err("ksm: register sysfs failed\n");
 		kthread_stop(ksm_thread);
-		goto out_free;
+		goto out_wq;
 	}
 #else
 	ksm_run = KSM_RUN_MERGE;	/* no way for user to start it */
@@ -3216,6 +3443,8 @@ static int __init ksm_init(void)
 #endif
 	return 0;
 
+out_wq:
+	destroy_workqueue(ksm_hash_wq);
 out_free:
 	ksm_slab_free();
 out:
@@ -71,6 +71,7 @@
 #include <linux/dax.h>
 #include <linux/oom.h>
 #include <linux/numa.h>
+#include <linux/padata.h>
 
 #include <trace/events/kmem.h>
 
@@ -3150,9 +3151,7 @@ vm_fault_t do_swap_page(struct vm_fault *vmf)
 				 * XXX: Move to lru_cache_add() when it
 				 * supports new vs putback
 				 */
-				spin_lock_irq(&page_pgdat(page)->lru_lock);
 				lru_note_cost_page(page);
-				spin_unlock_irq(&page_pgdat(page)->lru_lock);
 
 				lru_cache_add(page);
 				swap_readpage(page, true);
@@ -3313,10 +3312,84 @@ vm_fault_t do_swap_page(struct vm_fault *vmf)
 	return ret;
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Map and lock the pte for vmf->address in a speculative fault. Without
+ * mmap_lock the page table may have been freed since it was walked, so
+ * first make sure that no mmap_lock writer has run since the VMA snapshot
+ * was taken; with interrupts disabled, the TLB shootdown or RCU grace
+ * period that precedes freeing a page table can't complete until the pte
+ * lock is held, and every path that frees or moves a page table either
+ * takes that lock or waits for it under mmap_lock held for write.
+ *
+ * Returns false if the fault must be retried under mmap_lock.
+ */
+static bool pte_map_lock_speculative(struct vm_fault *vmf)
+{
+	struct mm_struct *mm = vmf->vma->vm_mm;
+	spinlock_t *ptl;
+	pmd_t pmdval;
+	pte_t *pte;
+
+	local_irq_disable();
+	if (!mmap_seq_read_check(mm, vmf->seq))
+		goto fail;
+
+	pmdval = READ_ONCE(*vmf->pmd);
+	if (!pmd_same(pmdval, vmf->orig_pmd))
+		goto fail;
+
+	ptl = pte_lockptr(mm, &pmdval);
+	pte = pte_offset_map(&pmdval, vmf->address);
+	/*
+	 * Only trylock: the holder may be waiting for this CPU to answer a
+	 * TLB shootdown IPI.
+	 */
+	if (!spin_trylock(ptl)) {
+		pte_unmap(pte);
+		goto fail;
+	}
+	if (!mmap_seq_read_check(mm, vmf->seq)) {
+		pte_unmap_unlock(pte, ptl);
+		goto fail;
+	}
+	local_irq_enable();
+
+	vmf->pte = pte;
+	vmf->ptl = ptl;
+	return true;
+fail:
+	local_irq_enable();
+	return false;
+}
+#else
+static inline bool pte_map_lock_speculative(struct vm_fault *vmf)
+{
+	return false;
+}
+#endif
+
+/*
+ * Map and lock the pte for vmf->address. Always succeeds unless the fault
+ * is speculative, see pte_map_lock_speculative().
+ */
+static bool pte_map_lock(struct vm_fault *vmf)
+{
+	if (vmf->flags & FAULT_FLAG_SPECULATIVE)
+		return pte_map_lock_speculative(vmf);
+
+	vmf->pte = pte_offset_map_lock(vmf->vma->vm_mm, vmf->pmd,
+				       vmf->address, &vmf->ptl);
+	return true;
+}
+
 /*
  * We enter with non-exclusive mmap_lock (to exclude vma changes,
  * but allow concurrent faults), and pte mapped but not yet locked.
  * We return with mmap_lock still held, but pte unmapped and unlocked.
+ *
+ * Speculative faults enter without mmap_lock and with the page table
+ * known to exist, see handle_speculative_fault().
  */
 static vm_fault_t do_anonymous_page(struct vm_fault *vmf)
 {
@@ -3339,20 +3412,22 @@ static vm_fault_t do_anonymous_page(struct vm_fault *vmf)
 	 *
 	 * Here we only have mmap_read_lock(mm).
 	 */
-	if (pte_alloc(vma->vm_mm, vmf->pmd))
-		return VM_FAULT_OOM;
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE)) {
+		if (pte_alloc(vma->vm_mm, vmf->pmd))
+			return VM_FAULT_OOM;
 
-	/* See the comment in pte_alloc_one_map() */
-	if (unlikely(pmd_trans_unstable(vmf->pmd)))
-		return 0;
+		/* See the comment in pte_alloc_one_map() */
+		if (unlikely(pmd_trans_unstable(vmf->pmd)))
+			return 0;
+	}
 
 	/* Use the zero-page for reads */
 	if (!(vmf->flags & FAULT_FLAG_WRITE) &&
 			!mm_forbids_zeropage(vma->vm_mm)) {
 		entry = pte_mkspecial(pfn_pte(my_zero_pfn(vmf->address),
 						vma->vm_page_prot));
-		vmf->pte = pte_offset_map_lock(vma->vm_mm, vmf->pmd,
-				vmf->address, &vmf->ptl);
+		if (!pte_map_lock(vmf))
+			return VM_FAULT_RETRY;
 		if (!pte_none(*vmf->pte)) {
 			update_mmu_tlb(vma, vmf->address, vmf->pte);
 			goto unlock;
@@ -3369,7 +3444,11 @@ static vm_fault_t do_anonymous_page(struct vm_fault *vmf)
 	}
 
 	/* Allocate our own private page. */
-	if (unlikely(anon_vma_prepare(vma)))
+	if (vmf->flags & FAULT_FLAG_SPECULATIVE) {
+		/* vma is a snapshot, anon_vma_prepare() needs mmap_lock */
+		if (!vma->anon_vma)
+			return VM_FAULT_RETRY;
+	} else if (unlikely(anon_vma_prepare(vma)))
 		goto oom;
 	page = alloc_zeroed_user_highpage_movable(vma, vmf->address);
 	if (!page)
@@ -3391,8 +3470,10 @@ static vm_fault_t do_anonymous_page(struct vm_fault *vmf)
 	if (vma->vm_flags & VM_WRITE)
 		entry = pte_mkwrite(pte_mkdirty(entry));
 
-	vmf->pte = pte_offset_map_lock(vma->vm_mm, vmf->pmd, vmf->address,
-			&vmf->ptl);
+	if (!pte_map_lock(vmf)) {
+		put_page(page);
+		return VM_FAULT_RETRY;
+	}
 	if (!pte_none(*vmf->pte)) {
 		update_mmu_cache(vma, vmf->address, vmf->pte);
 		goto release;
@@ -3642,6 +3723,13 @@ vm_fault_t alloc_set_pte(struct vm_fault *vmf, struct page *page)
 	pte_t entry;
 	vm_fault_t ret;
 
+	if (vmf->flags & FAULT_FLAG_SPECULATIVE) {
+		/* The page table exists, but may be gone without its lock */
+		if (!vmf->pte && !pte_map_lock(vmf))
+			return VM_FAULT_RETRY;
+		goto map_pte;
+	}
+
 	if (pmd_none(*vmf->pmd) && PageTransCompound(page)) {
 		ret = do_set_pmd(vmf, page);
 		if (ret != VM_FAULT_FALLBACK)
@@ -3654,6 +3742,8 @@ vm_fault_t alloc_set_pte(struct vm_fault *vmf, struct page *page)
 			return ret;
 	}
 
+map_pte:
+
 	/* Re-check under ptl */
 	if (unlikely(!pte_none(*vmf->pte))) {
 		update_mmu_tlb(vma, vmf->address, vmf->pte);
@@ -3808,7 +3898,11 @@ static vm_fault_t do_fault_around(struct vm_fault *vmf)
 	end_pgoff = min3(end_pgoff, vma_pages(vmf->vma) + vmf->vma->vm_pgoff - 1,
 			start_pgoff + nr_pages - 1);
 
-	if (pmd_none(*vmf->pmd)) {
+	/*
+	 * A speculative fault only gets here with the page table in place,
+	 * and must not look at the pmd without holding the pte lock.
+	 */
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE) && pmd_none(*vmf->pmd)) {
 		vmf->prealloc_pte = pte_alloc_one(vmf->vma->vm_mm);
 		if (!vmf->prealloc_pte)
 			goto out;
@@ -3818,7 +3912,8 @@ static vm_fault_t do_fault_around(struct vm_fault *vmf)
 	vmf->vma->vm_ops->map_pages(vmf, start_pgoff, end_pgoff);
 
 	/* Huge page is mapped? Page fault is solved */
-	if (pmd_trans_huge(*vmf->pmd)) {
+	if (!(vmf->flags & FAULT_FLAG_SPECULATIVE) &&
+	    pmd_trans_huge(*vmf->pmd)) {
 		ret = VM_FAULT_NOPAGE;
 		goto out;
 	}
@@ -3854,6 +3949,10 @@ static vm_fault_t do_read_fault(struct vm_fault *vmf)
 			return ret;
 	}
 
+	/* ->fault() may sleep on I/O and expects mmap_lock to be held */
+	if (vmf->flags & FAULT_FLAG_SPECULATIVE)
+		return VM_FAULT_RETRY;
+
 	ret = __do_fault(vmf);
 	if (unlikely(ret & (VM_FAULT_ERROR | VM_FAULT_NOPAGE | VM_FAULT_RETRY)))
 		return ret;
@@ -4409,6 +4508,121 @@ vm_fault_t handle_mm_fault(struct vm_area_struct *vma, unsigned long address,
 }
 EXPORT_SYMBOL_GPL(handle_mm_fault);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Which faults can be handled without mmap_lock: only anonymous faults,
+ * and read faults on page cache that filemap_map_pages() can map, on
+ * VMAs that need nothing beyond the snapshot taken by the caller.
+ */
+static bool vma_can_speculate(struct vm_area_struct *vma, unsigned int flags)
+{
+	if (vma->vm_flags & (VM_HUGETLB | VM_PFNMAP | VM_MIXEDMAP | VM_IO))
+		return false;
+	if (userfaultfd_armed(vma))
+		return false;
+	/* The mempolicy isn't RCU-freed and may be gone with the VMA */
+	if (vma_policy(vma))
+		return false;
+	if (vma_is_anonymous(vma))
+		return true;
+	return !(flags & FAULT_FLAG_WRITE) && vma->vm_ops &&
+		vma->vm_ops->map_pages == filemap_map_pages &&
+		fault_around_bytes >> PAGE_SHIFT > 1;
+}
+
+/**
+ * handle_speculative_fault - handle a page fault without mmap_lock
+ * @vma: snapshot of the faulting VMA from get_vma_speculative()
+ * @address: the faulting address
+ * @flags: FAULT_FLAG_xxx flags
+ * @seq: the mmap sequence count @vma was taken at
+ *
+ * Handles faults on pte_none() entries of anonymous and page cache
+ * mappings whose page tables already exist. Everything else, including
+ * any error and any race with an mmap_lock writer, is left to the
+ * regular fault path.
+ *
+ * Return: VM_FAULT_RETRY if the fault must be retried under mmap_lock.
+ */
+vm_fault_t handle_speculative_fault(struct vm_area_struct *vma,
+				    unsigned long address, unsigned int flags,
+				    unsigned long seq)
+{
+	struct vm_fault vmf = {
+		.vma = vma,
+		.address = address & PAGE_MASK,
+		.flags = flags | FAULT_FLAG_SPECULATIVE,
+		.pgoff = linear_page_index(vma, address),
+		.gfp_mask = __get_fault_gfp_mask(vma),
+		.seq = seq,
+	};
+	vm_fault_t ret = VM_FAULT_RETRY;
+	pgd_t pgd;
+	p4d_t p4d;
+	pud_t pud;
+	pte_t *pte;
+
+	if (!vma_can_speculate(vma, flags))
+		return VM_FAULT_RETRY;
+
+	if (!arch_vma_access_permitted(vma, flags & FAULT_FLAG_WRITE,
+				       flags & FAULT_FLAG_INSTRUCTION,
+				       flags & FAULT_FLAG_REMOTE))
+		return VM_FAULT_RETRY;
+
+	/*
+	 * Walk the page tables like gup_fast: with interrupts disabled, none
+	 * of the levels can be freed under us. Anything but a pte_none()
+	 * entry in an existing page table goes the regular way.
+	 */
+	local_irq_disable();
+	pgd = READ_ONCE(*pgd_offset(vma->vm_mm, address));
+	if (pgd_none(pgd) || unlikely(pgd_bad(pgd)))
+		goto out_walk;
+	p4d = READ_ONCE(*p4d_offset(&pgd, address));
+	if (p4d_none(p4d) || unlikely(p4d_bad(p4d)))
+		goto out_walk;
+	pud = READ_ONCE(*pud_offset(&p4d, address));
+	if (pud_none(pud) || pud_trans_huge(pud) || pud_devmap(pud) ||
+	    unlikely(pud_bad(pud)))
+		goto out_walk;
+	vmf.pmd = pmd_offset(&pud, address);
+	vmf.orig_pmd = READ_ONCE(*vmf.pmd);
+	if (pmd_none(vmf.orig_pmd) || pmd_trans_huge(vmf.orig_pmd) ||
+	    pmd_devmap(vmf.orig_pmd) || unlikely(pmd_bad(vmf.orig_pmd)))
+		goto out_walk;
+	pte = pte_offset_map(&vmf.orig_pmd, address);
+	vmf.orig_pte = READ_ONCE(*pte);
+	pte_unmap(pte);
+	local_irq_enable();
+
+	if (!pte_none(vmf.orig_pte))
+		return VM_FAULT_RETRY;
+
+	__set_current_state(TASK_RUNNING);
+	check_sync_rss_stat(current);
+
+	if (vma_is_anonymous(vma))
+		ret = do_anonymous_page(&vmf);
+	else
+		ret = do_read_fault(&vmf);
+
+	/* Let the regular path deal with OOM, signals and the like */
+	if (ret & VM_FAULT_ERROR)
+		return VM_FAULT_RETRY;
+
+	if (!(ret & VM_FAULT_RETRY)) {
+		count_vm_event(PGFAULT);
+		count_memcg_event_mm(vma->vm_mm, PGFAULT);
+	}
+	return ret;
+
+out_walk:
+	local_irq_enable();
+	return ret;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_P4D_FOLDED
 /*
  * Allocate p4d page table.
@@ -4909,6 +5123,66 @@ void clear_huge_page(struct page *page,
 	process_huge_page(addr_hint, pages_per_huge_page, clear_subpage, page);
 }
 
+/* Smallest share of a huge page worth handing to another thread */
+#define CLEAR_HUGE_PAGE_CHUNK	(SZ_2M >> PAGE_SHIFT)
+
+struct clear_huge_page_arg {
+	struct page *page;
+	unsigned long addr;
+};
+
+static void clear_huge_page_range(unsigned long start, unsigned long end,
+				  void *arg)
+{
+	struct clear_huge_page_arg *args = arg;
+	unsigned long i;
+
+	for (i = start; i < end; i++) {
+		cond_resched();
+		clear_user_highpage_nocache(mem_map_offset(args->page, i),
+					    args->addr + i * PAGE_SIZE);
+	}
+}
+
+/**
+ * clear_huge_page_nocache - zero a huge page bypassing the CPU caches
+ * @page: the head page
+ * @addr_hint: the address the page will be mapped at
+ * @pages_per_huge_page: the size of @page in base pages
+ * @max_threads: the number of threads to split the work over
+ *
+ * Unlike clear_huge_page(), which keeps the subpages around @addr_hint
+ * cache hot for the faulting task, this is meant for pages that are too
+ * large to stay cached or won't be touched for a while. Gigantic pages are
+ * zeroed by up to @max_threads threads in parallel, including the caller.
+ */
+void clear_huge_page_nocache(struct page *page, unsigned long addr_hint,
+			     unsigned int pages_per_huge_page, int max_threads)
+{
+	struct clear_huge_page_arg arg = {
+		.page	= page,
+		.addr	= addr_hint &
+			  ~(((unsigned long)pages_per_huge_page << PAGE_SHIFT) - 1),
+	};
+#ifdef CONFIG_PADATA
+	struct padata_mt_job job = {
+		.thread_fn	= clear_huge_page_range,
+		.fn_arg		= &arg,
+		.start		= 0,
+		.size		= pages_per_huge_page,
+		.align		= 1,
+		.min_chunk	= CLEAR_HUGE_PAGE_CHUNK,
+		.max_threads	= max(max_threads, 1),
+	};
+
+	might_sleep();
+	padata_do_multithreaded(&job);
+#else
+	might_sleep();
+	clear_huge_page_range(0, pages_per_huge_page, &arg);
+#endif
+}
+
 static void copy_user_gigantic_page(struct page *dst, struct page *src,
 				    unsigned long addr,
 				    struct vm_area_struct *vma,
@@ -49,6 +49,7 @@
 #include <linux/sched/mm.h>
 #include <linux/ptrace.h>
 #include <linux/oom.h>
+#include <linux/memory.h>
 
 #include <asm/tlbflush.h>
 
@@ -1015,8 +1016,35 @@ static int move_to_new_page(struct page *newpage, struct page *page,
 	return rc;
 }
 
-static int __unmap_and_move(struct page *page, struct page *newpage,
-				int force, enum migrate_mode mode)
+/*
+ * Between the unmap and the move step, a page waiting for the rest of its
+ * batch keeps the state of the former in the private field of its target
+ * page: the anon_vma reference and whether the page was mapped.
+ */
+static void __migrate_page_record(struct page *newpage, int page_was_mapped,
+				  struct anon_vma *anon_vma)
+{
+	set_page_private(newpage, (unsigned long)anon_vma | page_was_mapped);
+}
+
+static void __migrate_page_extract(struct page *newpage, int *page_was_mapped,
+				   struct anon_vma **anon_vma)
+{
+	unsigned long private = page_private(newpage);
+
+	*page_was_mapped = private & 1;
+	*anon_vma = (struct anon_vma *)(private & ~1UL);
+	set_page_private(newpage, 0);
+}
+
+/*
+ * Lock page and newpage and replace the ptes of page with migration entries.
+ * Returns MIGRATEPAGE_UNMAP with both pages locked, to be finished by
+ * __migrate_page_move(), or the final result of the migration. With @batch,
+ * the TLB flush is left to the caller: see try_to_unmap_flush().
+ */
+static int __migrate_page_unmap(struct page *page, struct page *newpage,
+				int force, enum migrate_mode mode, bool batch)
 {
 	int rc = -EAGAIN;
 	int page_was_mapped = 0;
@@ -1095,8 +1123,8 @@ static int __unmap_and_move(struct page *page, struct page *newpage,
 		goto out_unlock;
 
 	if (unlikely(!is_lru)) {
-		rc = move_to_new_page(newpage, page, mode);
-		goto out_unlock_both;
+		__migrate_page_record(newpage, 0, anon_vma);
+		return MIGRATEPAGE_UNMAP;
 	}
 
 	/*
@@ -1122,25 +1150,54 @@ static int __unmap_and_move(struct page *page, struct page *newpage,
 		VM_BUG_ON_PAGE(PageAnon(page) && !PageKsm(page) && !anon_vma,
 				page);
 		try_to_unmap(page,
-			TTU_MIGRATION|TTU_IGNORE_MLOCK|TTU_IGNORE_ACCESS);
+			TTU_MIGRATION|TTU_IGNORE_MLOCK|TTU_IGNORE_ACCESS|
+			(batch ? TTU_BATCH_FLUSH : 0));
 		page_was_mapped = 1;
 	}
 
-	if (!page_mapped(page))
+	__migrate_page_record(newpage, page_was_mapped, anon_vma);
+	return MIGRATEPAGE_UNMAP;
+
+out_unlock_both:
+	unlock_page(newpage);
+out_unlock:
+	/* Drop an anon_vma reference if we took one */
+	if (anon_vma)
+		put_anon_vma(anon_vma);
+	unlock_page(page);
+out:
+	return rc;
+}
+
+/*
+ * Second half of __migrate_page_unmap(): move the contents and state of the
+ * unmapped page to newpage and point the migration entries at the result.
+ */
+static int __migrate_page_move(struct page *page, struct page *newpage,
+			       enum migrate_mode mode)
+{
+	int rc = -EAGAIN;
+	int page_was_mapped;
+	struct anon_vma *anon_vma;
+	bool is_lru = !__PageMovable(page);
+
+	__migrate_page_extract(newpage, &page_was_mapped, &anon_vma);
+
+	if (unlikely(!is_lru))
+		rc = move_to_new_page(newpage, page, mode);
+	else if (!page_mapped(page))
 		rc = move_to_new_page(newpage, page, mode);
 
 	if (page_was_mapped)
 		remove_migration_ptes(page,
 			rc == MIGRATEPAGE_SUCCESS ? newpage : page, false);
 
-out_unlock_both:
 	unlock_page(newpage);
-out_unlock:
 	/* Drop an anon_vma reference if we took one */
 	if (anon_vma)
 		put_anon_vma(anon_vma);
 	unlock_page(page);
-out:
+
 	/*
 	 * If migration is successful, decrease refcount of the newpage
 	 * which will not free the page because new page owner increased
@@ -1161,54 +1218,13 @@ static int __unmap_and_move(struct page *page, struct page *newpage,
 }
 
 /*
- * gcc 4.7 and 4.8 on arm get an ICEs when inlining unmap_and_move().  Work
- * around it.
+ * Release page, and newpage if there is one, once their migration has
+ * finished with @rc.
  */
-#if defined(CONFIG_ARM) && \
-	defined(GCC_VERSION) && GCC_VERSION < 40900 && GCC_VERSION >= 40700
-#define ICE_noinline noinline
-#else
-#define ICE_noinline
-#endif
-
-/*
- * Obtain the lock on page, remove all ptes and migrate the page
- * to the newly allocated page in newpage.
- */
-static ICE_noinline int unmap_and_move(new_page_t get_new_page,
-				   free_page_t put_new_page,
-				   unsigned long private, struct page *page,
-				   int force, enum migrate_mode mode,
-				   enum migrate_reason reason)
+static void migrate_page_done(free_page_t put_new_page, unsigned long private,
+			      struct page *page, struct page *newpage, int rc,
+			      enum migrate_reason reason)
 {
-	int rc = MIGRATEPAGE_SUCCESS;
-	struct page *newpage = NULL;
-
-	if (!thp_migration_supported() && PageTransHuge(page))
-		return -ENOMEM;
-
-	if (page_count(page) == 1) {
-		/* page was freed from under us. So we are done. */
-		ClearPageActive(page);
-		ClearPageUnevictable(page);
-		if (unlikely(__PageMovable(page))) {
-			lock_page(page);
-			if (!PageMovable(page))
-				__ClearPageIsolated(page);
-			unlock_page(page);
-		}
-		goto out;
-	}
-
-	newpage = get_new_page(page, private);
-	if (!newpage)
-		return -ENOMEM;
-
-	rc = __unmap_and_move(page, newpage, force, mode);
-	if (rc == MIGRATEPAGE_SUCCESS)
-		set_page_owner_migrate_reason(newpage, reason);
-
-out:
 	if (rc != -EAGAIN) {
 		/*
 		 * A page that has been migrated has all references
@@ -1264,6 +1280,114 @@ static ICE_noinline int unmap_and_move(new_page_t get_new_page,
 		else
 			put_page(newpage);
 	}
+}
+
+/*
+ * A batch tried in MIGRATE_ASYNC on behalf of a sync migration leaves the
+ * pages it fails on isolated, so they can be retried in the requested mode.
+ */
+static inline int migrate_batch_rc(int rc, bool retry_failed)
+{
+	if (retry_failed && rc != MIGRATEPAGE_SUCCESS &&
+	    rc != MIGRATEPAGE_UNMAP && rc != -ENOMEM)
+		return -EAGAIN;
+	return rc;
+}
+
+/*
+ * Obtain the lock on page, allocate newpage and remove all ptes of page.
+ * Returns MIGRATEPAGE_UNMAP with *newpagep set if migrate_page_move() has to
+ * finish the job, or the final result.
+ */
+static int migrate_page_unmap(new_page_t get_new_page,
+			      free_page_t put_new_page, unsigned long private,
+			      struct page *page, struct page **newpagep,
+			      int force, enum migrate_mode mode,
+			      enum migrate_reason reason, bool batch,
+			      bool retry_failed)
+{
+	struct page *newpage;
+	int rc;
+
+	if (!thp_migration_supported() && PageTransHuge(page))
+		return -ENOMEM;
+
+	if (page_count(page) == 1) {
+		/* page was freed from under us. So we are done. */
+		ClearPageActive(page);
+		ClearPageUnevictable(page);
+		if (unlikely(__PageMovable(page))) {
+			lock_page(page);
+			if (!PageMovable(page))
+				__ClearPageIsolated(page);
+			unlock_page(page);
+		}
+		migrate_page_done(put_new_page, private, page, NULL,
+				  MIGRATEPAGE_SUCCESS, reason);
+		return MIGRATEPAGE_SUCCESS;
+	}
+
+	newpage = get_new_page(page, private);
+	if (!newpage)
+		return -ENOMEM;
+
+	rc = __migrate_page_unmap(page, newpage, force, mode, batch);
+	rc = migrate_batch_rc(rc, retry_failed);
+	if (rc == MIGRATEPAGE_UNMAP)
+		*newpagep = newpage;
+	else
+		migrate_page_done(put_new_page, private, page, newpage, rc,
+				  reason);
+
+	return rc;
+}
+
+static int migrate_page_move(free_page_t put_new_page, unsigned long private,
+			     struct page *page, struct page *newpage,
+			     enum migrate_mode mode, enum migrate_reason reason,
+			     bool retry_failed)
+{
+	int rc;
+
+	rc = __migrate_page_move(page, newpage, mode);
+	rc = migrate_batch_rc(rc, retry_failed);
+	if (rc == MIGRATEPAGE_SUCCESS)
+		set_page_owner_migrate_reason(newpage, reason);
+
+	migrate_page_done(put_new_page, private, page, newpage, rc, reason);
+
+	return rc;
+}
+
+/*
+ * gcc 4.7 and 4.8 on arm get an ICEs when inlining unmap_and_move().  Work
+ * around it.
+ */
+#if defined(CONFIG_ARM) && \
+	defined(GCC_VERSION) && GCC_VERSION < 40900 && GCC_VERSION >= 40700
+#define ICE_noinline noinline
+#else
+#define ICE_noinline
+#endif
+
+/*
+ * Obtain the lock on page, remove all ptes and migrate the page
+ * to the newly allocated page in newpage.
+ */
+static ICE_noinline int unmap_and_move(new_page_t get_new_page,
+				   free_page_t put_new_page,
+				   unsigned long private, struct page *page,
+				   int force, enum migrate_mode mode,
+				   enum migrate_reason reason)
+{
+	struct page *newpage = NULL;
+	int rc;
+
+	rc = migrate_page_unmap(get_new_page, put_new_page, private, page,
+				&newpage, force, mode, reason, false, false);
+	if (rc == MIGRATEPAGE_UNMAP)
+		rc = migrate_page_move(put_new_page, private, page, newpage,
+				       mode, reason, false);
 
 	return rc;
 }
@@ -1403,6 +1527,65 @@ static int unmap_and_move_huge_page(new_page_t get_new_page,
 	return rc;
 }
 
+/*
+ * Base pages unmapped before their TLB entries are flushed together and
+ * they are moved to their new pages.
+ *
+ * All pages of a batch stay locked until it is moved, so batches only
+ * ever run in MIGRATE_ASYNC, where neither step blocks: a batched move
+ * never waits in lock_buffer() or ->writepage with the rest locked.
+ */
+#define MIGRATE_PAGES_BATCH	512
+
+struct migrate_batch {
+	struct list_head pages;		/* unmapped source pages */
+	struct list_head newpages;	/* their targets, in the same order */
+	int nr_pages;
+	bool retry_failed;		/* on behalf of a sync migration */
+};
+
+/*
+ * Flush the TLB entries of the pages unmapped by the batch once, then move
+ * each of them. Pages to be retried are moved to @retry_pages.
+ */
+static void migrate_batch_move(struct migrate_batch *batch,
+			       struct list_head *retry_pages,
+			       free_page_t put_new_page, unsigned long private,
+			       int reason, int *nr_succeeded, int *nr_failed,
+			       int *retry)
+{
+	struct page *page, *page2, *newpage;
+	int rc;
+
+	if (list_empty(&batch->pages))
+		return;
+
+	try_to_unmap_flush();
+
+	list_for_each_entry_safe(page, page2, &batch->pages, lru) {
+		newpage = list_first_entry(&batch->newpages, struct page, lru);
+		list_del(&newpage->lru);
+
+		rc = migrate_page_move(put_new_page, private, page, newpage,
+				       MIGRATE_ASYNC, reason,
+				       batch->retry_failed);
+		switch (rc) {
+		case -EAGAIN:
+			list_move_tail(&page->lru, retry_pages);
+			(*retry)++;
+			break;
+		case MIGRATEPAGE_SUCCESS:
+			(*nr_succeeded)++;
+			break;
+		default:
+			(*nr_failed)++;
+			break;
+		}
+	}
+
+	batch->nr_pages = 0;
+}
+
 /*
  * migrate_pages - migrate the pages specified in a list, to the free pages
  *		   supplied as the target for the page migration
@@ -1419,6 +1602,10 @@ static int unmap_and_move_huge_page(new_page_t get_new_page,
  *
  * The function returns after 10 attempts or if no pages are movable any more
  * because the list has become empty or no retryable pages exist any more.
+ * During the first attempts, base pages and THPs are unmapped in batches
+ * that share a single TLB flush before they are moved. Batches always run
+ * in MIGRATE_ASYNC: sync migrations make one batched attempt and retry the
+ * pages left over one at a time in the requested mode.
  * The caller should call putback_movable_pages() to return pages to the LRU
  * or free list only if ret != 0.
  *
@@ -1434,12 +1621,21 @@ int migrate_pages(struct list_head *from, new_page_t get_new_page,
 	int pass = 0;
 	struct page *page;
 	struct page *page2;
+	struct page *newpage;
+	struct migrate_batch batch;
+	LIST_HEAD(retry_pages);
 	int swapwrite = current->flags & PF_SWAPWRITE;
+	int batch_passes = mode == MIGRATE_ASYNC ? 3 : 1;
 	int rc;
 
 	if (!swapwrite)
 		current->flags |= PF_SWAPWRITE;
 
+	INIT_LIST_HEAD(&batch.pages);
+	INIT_LIST_HEAD(&batch.newpages);
+	batch.nr_pages = 0;
+	batch.retry_failed = mode != MIGRATE_ASYNC;
+
 	for(pass = 0; pass < 10 && retry; pass++) {
 		retry = 0;
 
@@ -1447,17 +1643,50 @@ int migrate_pages(struct list_head *from, new_page_t get_new_page,
 retry:
 			cond_resched();
 
-			if (PageHuge(page))
+			if (PageHuge(page)) {
+				/* May block, don't hold the batch locked */
+				migrate_batch_move(&batch, &retry_pages,
+						   put_new_page, private,
+						   reason, &nr_succeeded,
+						   &nr_failed, &retry);
 				rc = unmap_and_move_huge_page(get_new_page,
 						put_new_page, private, page,
 						pass > 2, mode, reason);
-			else
+			} else if (pass < batch_passes) {
+				rc = migrate_page_unmap(get_new_page,
+						put_new_page, private, page,
+						&newpage, 0, MIGRATE_ASYNC,
+						reason, true,
+						batch.retry_failed);
+				if (rc == MIGRATEPAGE_UNMAP) {
+					list_move_tail(&page->lru, &batch.pages);
+					list_add_tail(&newpage->lru,
+						      &batch.newpages);
+					batch.nr_pages += hpage_nr_pages(page);
+					if (batch.nr_pages >= MIGRATE_PAGES_BATCH)
+						migrate_batch_move(&batch,
+							&retry_pages,
+							put_new_page, private,
+							reason, &nr_succeeded,
+							&nr_failed, &retry);
+					continue;
+				}
+			} else {
 				rc = unmap_and_move(get_new_page, put_new_page,
 						private, page, pass > 2, mode,
 						reason);
+			}
 
 			switch(rc) {
 			case -ENOMEM:
+				/*
+				 * Move the batch before anything below can
+				 * block with its pages locked.
+				 */
+				migrate_batch_move(&batch, &retry_pages,
+						   put_new_page, private,
+						   reason, &nr_succeeded,
+						   &nr_failed, &retry);
 				/*
 				 * THP migration might be unsupported or the
 				 * allocation could've failed so we should
@@ -1479,6 +1708,7 @@ int migrate_pages(struct list_head *from, new_page_t get_new_page,
 					}
 				}
 				nr_failed++;
+				list_splice(&retry_pages, from);
 				goto out;
 			case -EAGAIN:
 				retry++;
@@ -1497,6 +1727,11 @@ int migrate_pages(struct list_head *from, new_page_t get_new_page,
 				break;
 			}
 		}
+
+		migrate_batch_move(&batch, &retry_pages, put_new_page,
+				   private, reason, &nr_succeeded,
+				   &nr_failed, &retry);
+		list_splice_init(&retry_pages, from);
 	}
 	nr_failed += retry;
 	rc = nr_failed;
@@ -1988,6 +2223,7 @@ int migrate_misplaced_page(struct page *page, struct vm_area_struct *vma,
 			   int node)
 {
 	pg_data_t *pgdat = NODE_DATA(node);
+	bool promote = node_is_lower_tier(page_to_nid(page));
 	int isolated;
 	int nr_remaining;
 	LIST_HEAD(migratepages);
@@ -2023,8 +2259,11 @@ int migrate_misplaced_page(struct page *page, struct vm_area_struct *vma,
 			putback_lru_page(page);
 		}
 		isolated = 0;
-	} else
+	} else {
 		count_vm_numa_event(NUMA_PAGE_MIGRATE);
+		if (promote)
+			count_vm_event(PGPROMOTE_SUCCESS);
+	}
 	BUG_ON(!list_empty(&migratepages));
 	return isolated;
 
@@ -2145,6 +2384,8 @@ int migrate_misplaced_transhuge_page(struct mm_struct *mm,
 
 	count_vm_events(PGMIGRATE_SUCCESS, HPAGE_PMD_NR);
 	count_vm_numa_events(NUMA_PAGE_MIGRATE, HPAGE_PMD_NR);
+	if (node_is_lower_tier(page_to_nid(page)))
+		count_vm_events(PGPROMOTE_SUCCESS, HPAGE_PMD_NR);
 
 	mod_node_page_state(page_pgdat(page),
 			NR_ISOLATED_ANON + page_lru,
@@ -2168,6 +2409,189 @@ int migrate_misplaced_transhuge_page(struct mm_struct *mm,
 }
 #endif /* CONFIG_NUMA_BALANCING */
 
+/*
+ * Memory tiers for reclaim-based demotion.
+ *
+ * A node with both CPUs and memory demotes its cold pages to the nearest
+ * node that has memory but no CPUs (typically persistent or otherwise slow
+ * memory), instead of reclaiming them. The pages come back up through the
+ * regular NUMA balancing hint faults when promotion is enabled.
+ *
+ * The targets are recomputed on memory hotplug, under demotion_mutex.
+ * Readers look at node_demotion[] locklessly: a stale target only means a
+ * page is demoted to a node that has since gone away, in which case the
+ * allocation on that node simply fails.
+ */
+static int node_demotion[MAX_NUMNODES] __read_mostly = {
+	[0 ... MAX_NUMNODES - 1] = NUMA_NO_NODE
+};
+static nodemask_t demotion_target_nodes __read_mostly;
+static DEFINE_MUTEX(demotion_mutex);
+
+bool numa_demotion_enabled __read_mostly;
+bool numa_promotion_enabled __read_mostly;
+
+/**
+ * next_demotion_node() - Get the next node in the demotion path
+ * @node: The starting node to lookup the next node
+ *
+ * Return: node id for next memory node in the demotion path hierarchy
+ * from @node; NUMA_NO_NODE if @node is terminal.
+ */
+int next_demotion_node(int node)
+{
+	return READ_ONCE(node_demotion[node]);
+}
+
+/**
+ * node_is_lower_tier() - Check whether a node is a demotion target
+ * @node: The node to check
+ *
+ * Return: true if some other node demotes its cold pages to @node.
+ */
+bool node_is_lower_tier(int node)
+{
+	return node_isset(node, demotion_target_nodes);
+}
+
+static void set_demotion_targets(void)
+{
+	nodemask_t targets = NODE_MASK_NONE;
+	int node, target;
+
+	mutex_lock(&demotion_mutex);
+
+	for_each_node(node) {
+		int best = NUMA_NO_NODE;
+
+		if (node_state(node, N_MEMORY) && node_state(node, N_CPU)) {
+			for_each_node_state(target, N_MEMORY) {
+				if (node_state(target, N_CPU))
+					continue;
+				if (best == NUMA_NO_NODE ||
+				    node_distance(node, target) <
+				    node_distance(node, best))
+					best = target;
+			}
+		}
+
+		if (best != NUMA_NO_NODE)
+			node_set(best, targets);
+		WRITE_ONCE(node_demotion[node], best);
+	}
+	demotion_target_nodes = targets;
+
+	mutex_unlock(&demotion_mutex);
+}
+
+static int demotion_memory_callback(struct notifier_block *self,
+				    unsigned long action, void *arg)
+{
+	switch (action) {
+	case MEM_ONLINE:
+	case MEM_OFFLINE:
+	case MEM_CANCEL_OFFLINE:
+		set_demotion_targets();
+		break;
+	}
+
+	return notifier_from_errno(0);
+}
+
+#ifdef CONFIG_SYSFS
+static ssize_t demotion_enabled_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n", numa_demotion_enabled ? "true" : "false");
+}
+
+static ssize_t demotion_enabled_store(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      const char *buf, size_t count)
+{
+	bool enabled;
+	int err;
+
+	err = kstrtobool(buf, &enabled);
+	if (err)
+		return err;
+
+	WRITE_ONCE(numa_demotion_enabled, enabled);
+	return count;
+}
+
+static ssize_t promotion_enabled_show(struct kobject *kobj,
+				      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n", numa_promotion_enabled ? "true" : "false");
+}
+
+static ssize_t promotion_enabled_store(struct kobject *kobj,
+				       struct kobj_attribute *attr,
+				       const char *buf, size_t count)
+{
+	bool enabled;
+	int err;
+
+	err = kstrtobool(buf, &enabled);
+	if (err)
+		return err;
+
+	WRITE_ONCE(numa_promotion_enabled, enabled);
+	return count;
+}
+
+static struct kobj_attribute numa_demotion_enabled_attr =
+	__ATTR(demotion_enabled, 0644, demotion_enabled_show,
+	       demotion_enabled_store);
+
+static struct kobj_attribute numa_promotion_enabled_attr =
+	__ATTR(promotion_enabled, 0644, promotion_enabled_show,
+	       promotion_enabled_store);
+
+static struct attribute *numa_attrs[] = {
+	&numa_demotion_enabled_attr.attr,
+	&numa_promotion_enabled_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group numa_attr_group = {
+	.attrs = numa_attrs,
+};
+
+static int __init numa_init_sysfs(void)
+{
+	struct kobject *numa_kobj;
+	int err;
+
+	numa_kobj = kobject_create_and_add("numa", mm_kobj);
+	if (!numa_kobj) {
+		pr_err("failed to create numa kobject\n");
+		return -ENOMEM;
+	}
+	err = sysfs_create_group(numa_kobj, &numa_attr_group);
+	if (err) {
+		pr_err("failed to register numa group\n");
+		kobject_put(numa_kobj);
+	}
+	return err;
+}
+#else
+static inline int numa_init_sysfs(void)
+{
+	return 0;
+}
+#endif /* CONFIG_SYSFS */
+
+static int __init numa_demotion_init(void)
+{
+	set_demotion_targets();
+	hotplug_memory_notifier(demotion_memory_callback, 100);
+
+	return numa_init_sysfs();
+}
+late_initcall(numa_demotion_init);
+
 #endif /* CONFIG_NUMA */
 
 #ifdef CONFIG_DEVICE_PRIVATE
@@ -2262,6 +2262,74 @@ struct vm_area_struct *find_vma(struct mm_struct *mm, unsigned long addr)
 	return vma;
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/**
+ * get_vma_speculative - snapshot the VMA at @addr without mmap_lock
+ * @mm: the address space
+ * @addr: the faulting address
+ * @vma: where to copy the VMA
+ * @seq: returns the mmap sequence count the copy was taken at
+ *
+ * The rbtree is walked under RCU, which keeps unlinked VMAs around but
+ * may return a stale one; the copy is only returned if no mmap_lock
+ * writer ran while it was taken. The VMA's file is pinned, and must be
+ * released with put_vma_speculative().
+ *
+ * Return: true if @vma holds a usable snapshot covering @addr.
+ */
+bool get_vma_speculative(struct mm_struct *mm, unsigned long addr,
+			 struct vm_area_struct *vma, unsigned long *seq)
+{
+	struct vm_area_struct *found = NULL;
+	struct rb_node *rb_node;
+
+	if (!mmap_seq_read_start(mm, seq))
+		return false;
+
+	rcu_read_lock();
+	rb_node = READ_ONCE(mm->mm_rb.rb_node);
+	while (rb_node) {
+		struct vm_area_struct *tmp;
+
+		tmp = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+
+		if (READ_ONCE(tmp->vm_end) > addr) {
+			found = tmp;
+			if (READ_ONCE(tmp->vm_start) <= addr)
+				break;
+			rb_node = READ_ONCE(rb_node->rb_left);
+		} else
+			rb_node = READ_ONCE(rb_node->rb_right);
+	}
+
+	if (!found) {
+		rcu_read_unlock();
+		return false;
+	}
+
+	*vma = *found;
+	if (vma->vm_file && !get_file_rcu(vma->vm_file)) {
+		rcu_read_unlock();
+		return false;
+	}
+	rcu_read_unlock();
+
+	if (!mmap_seq_read_check(mm, *seq) ||
+	    vma->vm_start > addr || vma->vm_end <= addr) {
+		put_vma_speculative(vma);
+		return false;
+	}
+
+	return true;
+}
+
+void put_vma_speculative(struct vm_area_struct *vma)
+{
+	if (vma->vm_file)
+		fput(vma->vm_file);
+}
+#endif
+
 EXPORT_SYMBOL(find_vma);
 
 /*
@@ -117,24 +117,37 @@ static void swap_slot_free_notify(struct page *page)
 	}
 }
 
+/*
+ * Readahead may put several pages in adjacent swap slots into one bio, see
+ * swap_readpage_batch(). A THP is a single page here, so skip its tails.
+ */
 static void end_swap_bio_read(struct bio *bio)
 {
-	struct page *page = bio_first_page_all(bio);
 	struct task_struct *waiter = bio->bi_private;
+	struct bvec_iter_all iter_all;
+	struct bio_vec *bvec;
 
-	if (bio->bi_status) {
-		SetPageError(page);
-		ClearPageUptodate(page);
+	if (bio->bi_status)
 		pr_alert("Read-error on swap-device (%u:%u:%llu)\n",
 			 MAJOR(bio_dev(bio)), MINOR(bio_dev(bio)),
 			 (unsigned long long)bio->bi_iter.bi_sector);
-		goto out;
+
+	bio_for_each_segment_all(bvec, bio, iter_all) {
+		struct page *page = bvec->bv_page;
+
+		if (PageTail(page))
+			continue;
+
+		if (bio->bi_status) {
+			SetPageError(page);
+			ClearPageUptodate(page);
+		} else {
+			SetPageUptodate(page);
+			swap_slot_free_notify(page);
+		}
+		unlock_page(page);
 	}
 
-	SetPageUptodate(page);
-	swap_slot_free_notify(page);
-out:
-	unlock_page(page);
 	WRITE_ONCE(bio->bi_private, NULL);
 	bio_put(bio);
 	if (waiter) {
@@ -434,6 +447,78 @@ int swap_readpage(struct page *page, bool synchronous)
 	return ret;
 }
 
+/* Readahead windows are at most this large, see swap_ra_info() */
+#define SWAP_READ_BATCH_PAGES	(1 << SWAP_RA_ORDER_CEILING)
+
+/**
+ * swap_readpage_batch - read a swap cache page as part of a batch
+ * @page: locked swap cache page, not uptodate
+ * @biop: the bio being built, or NULL to start a new one
+ *
+ * Like swap_readpage(page, false), except that pages in adjacent swap
+ * slots of a block device share one bio instead of taking one each. The
+ * bio is submitted when the next page doesn't fit; the caller has to
+ * submit the last one with swap_read_batch_submit() before waiting on
+ * any of the pages. Frontswap, swap files with their own ->readpage and
+ * devices with ->rw_page are read one page at a time as before.
+ */
+void swap_readpage_batch(struct page *page, struct bio **biop)
+{
+	struct swap_info_struct *sis = page_swap_info(page);
+	struct block_device *bdev;
+	struct bio *bio = *biop;
+	sector_t sector;
+
+	VM_BUG_ON_PAGE(!PageSwapCache(page), page);
+	VM_BUG_ON_PAGE(!PageLocked(page), page);
+	VM_BUG_ON_PAGE(PageUptodate(page), page);
+	VM_BUG_ON_PAGE(PageTransHuge(page), page);
+
+	if (frontswap_enabled() || (sis->flags & SWP_FS) ||
+	    sis->bdev->bd_disk->fops->rw_page) {
+		swap_readpage(page, false);
+		return;
+	}
+
+	sector = map_swap_page(page, &bdev) << (PAGE_SHIFT - 9);
+	if (bio && (bio->bi_disk != bdev->bd_disk ||
+		    bio->bi_partno != bdev->bd_partno ||
+		    bio_end_sector(bio) != sector ||
+		    !bio_add_page(bio, page, PAGE_SIZE, 0))) {
+		swap_read_batch_submit(bio);
+		bio = NULL;
+	}
+
+	if (!bio) {
+		bio = bio_alloc(GFP_KERNEL, SWAP_READ_BATCH_PAGES);
+		bio_set_dev(bio, bdev);
+		bio->bi_iter.bi_sector = sector;
+		bio->bi_opf = REQ_OP_READ;
+		bio->bi_end_io = end_swap_bio_read;
+		bio_add_page(bio, page, PAGE_SIZE, 0);
+	}
+
+	count_vm_event(PSWPIN);
+	*biop = bio;
+}
+
+/**
+ * swap_read_batch_submit - submit the bio built by swap_readpage_batch()
+ * @bio: the bio, may be NULL
+ */
+void swap_read_batch_submit(struct bio *bio)
+{
+	unsigned long pflags;
+
+	if (!bio)
+		return;
+
+	/* Count submission time as memory stall, as in swap_readpage() */
+	psi_memstall_enter(&pflags);
+	submit_bio(bio);
+	psi_memstall_leave(&pflags);
+}
+
 int swap_set_page_dirty(struct page *page)
 {
 	struct swap_info_struct *sis = page_swap_info(page);
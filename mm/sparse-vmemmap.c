@@ -27,8 +27,10 @@
 #include <linux/spinlock.h>
 #include <linux/vmalloc.h>
 #include <linux/sched.h>
+#include <linux/memory_hotplug.h>
 #include <asm/dma.h>
 #include <asm/pgalloc.h>
+#include <asm/tlbflush.h>
 
 /*
  * Allocate a block of memory to be used to back the virtual memory map
@@ -244,6 +246,148 @@ int __meminit vmemmap_populate_basepages(unsigned long start,
 	return 0;
 }
 
+#ifdef CONFIG_HUGETLB_PAGE_FREE_VMEMMAP
+/*
+ * Returns the pte mapping @addr, or NULL if the vmemmap around @addr is
+ * not mapped with base pages.
+ */
+static pte_t *vmemmap_lookup_pte(unsigned long addr)
+{
+	pgd_t *pgd;
+	p4d_t *p4d;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset_k(addr);
+	if (pgd_none(*pgd))
+		return NULL;
+	p4d = p4d_offset(pgd, addr);
+	if (p4d_none(*p4d))
+		return NULL;
+	pud = pud_offset(p4d, addr);
+	if (pud_none(*pud) || pud_leaf(*pud))
+		return NULL;
+	pmd = pmd_offset(pud, addr);
+	if (pmd_none(*pmd) || pmd_leaf(*pmd))
+		return NULL;
+
+	return pte_offset_kernel(pmd, addr);
+}
+
+static void free_vmemmap_page(struct page *page)
+{
+	if (PageReserved(page)) {
+#ifdef CONFIG_HAVE_BOOTMEM_INFO_NODE
+		/* Registered by register_page_bootmem_memmap() */
+		if (PagePrivate(page)) {
+			put_page_bootmem(page);
+			return;
+		}
+#endif
+		free_reserved_page(page);
+	} else {
+		__free_page(page);
+	}
+}
+
+/**
+ * vmemmap_remap_free - remap a vmemmap range onto a single page
+ * @start:	start of the vmemmap range to remap
+ * @end:	end of the vmemmap range to remap
+ * @reuse:	the vmemmap page all of [@start, @end) gets mapped to
+ *
+ * The pages backing [@start, @end) are freed; the range is mapped
+ * read-only, so it must not be written to until vmemmap_remap_alloc().
+ *
+ * Return: 0 on success, -EINVAL if the range is not mapped with base
+ * pages.
+ */
+int vmemmap_remap_free(unsigned long start, unsigned long end,
+		       unsigned long reuse)
+{
+	struct page *reuse_page, *page, *next;
+	unsigned long addr;
+	LIST_HEAD(free_pages);
+	pte_t *pte;
+
+	pte = vmemmap_lookup_pte(reuse);
+	if (!pte)
+		return -EINVAL;
+	reuse_page = pte_page(*pte);
+
+	for (addr = start; addr < end; addr += PAGE_SIZE)
+		if (!vmemmap_lookup_pte(addr))
+			return -EINVAL;
+
+	for (addr = start; addr < end; addr += PAGE_SIZE) {
+		pte = vmemmap_lookup_pte(addr);
+		list_add(&pte_page(*pte)->lru, &free_pages);
+		set_pte_at(&init_mm, addr, pte,
+			   mk_pte(reuse_page, PAGE_KERNEL_RO));
+	}
+
+	flush_tlb_kernel_range(start, end);
+
+	list_for_each_entry_safe(page, next, &free_pages, lru) {
+		list_del(&page->lru);
+		free_vmemmap_page(page);
+	}
+
+	return 0;
+}
+
+/**
+ * vmemmap_remap_alloc - undo vmemmap_remap_free()
+ * @start:	start of the vmemmap range to restore
+ * @end:	end of the vmemmap range to restore
+ * @reuse:	the vmemmap page [@start, @end) is currently mapped to
+ * @gfp_mask:	allocation flags for the new vmemmap pages
+ *
+ * Every page in [@start, @end) gets a newly allocated copy of @reuse.
+ *
+ * Return: 0 on success, -ENOMEM if not all pages could be allocated, in
+ * which case the range is left untouched.
+ */
+int vmemmap_remap_alloc(unsigned long start, unsigned long end,
+			unsigned long reuse, gfp_t gfp_mask)
+{
+	int nid = page_to_nid((struct page *)start);
+	struct page *page, *next;
+	unsigned long addr;
+	LIST_HEAD(new_pages);
+	pte_t *pte;
+
+	for (addr = start; addr < end; addr += PAGE_SIZE) {
+		page = alloc_pages_node(nid, gfp_mask, 0);
+		if (!page)
+			goto out;
+		list_add_tail(&page->lru, &new_pages);
+	}
+
+	for (addr = start; addr < end; addr += PAGE_SIZE) {
+		page = list_first_entry(&new_pages, struct page, lru);
+		list_del(&page->lru);
+		copy_page(page_address(page), (void *)reuse);
+
+		/* Make the copy visible before the pte that maps it */
+		smp_wmb();
+
+		pte = vmemmap_lookup_pte(addr);
+		set_pte_at(&init_mm, addr, pte, mk_pte(page, PAGE_KERNEL));
+	}
+
+	flush_tlb_kernel_range(start, end);
+
+	return 0;
+out:
+	list_for_each_entry_safe(page, next, &new_pages, lru) {
+		list_del(&page->lru);
+		__free_page(page);
+	}
+	return -ENOMEM;
+}
+#endif /* CONFIG_HUGETLB_PAGE_FREE_VMEMMAP */
+
 struct page * __meminit __populate_section_memmap(unsigned long pfn,
 		unsigned long nr_pages, int nid, struct vmem_altmap *altmap)
 {
@@ -87,6 +87,21 @@ PLIST_HEAD(swap_active_head);
  */
 static struct plist_head *swap_avail_heads;
 static DEFINE_SPINLOCK(swap_avail_lock);
+/* bumped whenever swap_avail_heads change, protected with swap_avail_lock */
+static unsigned long swap_avail_seq;
+
+/*
+ * The device each CPU allocated swap slots from last time. As long as no
+ * device was added to or removed from swap_avail_heads since, it is still
+ * the one get_swap_pages() would pick, so it can be tried without taking
+ * swap_avail_lock. swap_info_structs are never freed, and the device is
+ * checked for SWP_WRITEOK under si->lock before being used.
+ */
+struct swap_alloc_hint {
+	struct swap_info_struct *si;
+	unsigned long seq;
+};
+static DEFINE_PER_CPU(struct swap_alloc_hint, swap_alloc_hint);
 
 struct swap_info_struct *swap_info[MAX_SWAPFILES];
 
@@ -655,6 +670,7 @@ static void __del_from_avail_list(struct swap_info_struct *p)
 
 	for_each_node(nid)
 		plist_del(&p->avail_lists[nid], &swap_avail_heads[nid]);
+	WRITE_ONCE(swap_avail_seq, swap_avail_seq + 1);
 }
 
 static void del_from_avail_list(struct swap_info_struct *p)
@@ -690,6 +706,7 @@ static void add_to_avail_list(struct swap_info_struct *p)
 		WARN_ON(!plist_node_empty(&p->avail_lists[nid]));
 		plist_add(&p->avail_lists[nid], &swap_avail_heads[nid]);
 	}
+	WRITE_ONCE(swap_avail_seq, swap_avail_seq + 1);
 	spin_unlock(&swap_avail_lock);
 }
 
@@ -1029,6 +1046,41 @@ static unsigned long scan_swap_map(struct swap_info_struct *si,
 
 }
 
+static struct swap_info_struct *swap_alloc_hint_get(void)
+{
+	struct swap_alloc_hint *hint = get_cpu_ptr(&swap_alloc_hint);
+	struct swap_info_struct *si = NULL;
+
+	if (hint->si && hint->seq == READ_ONCE(swap_avail_seq))
+		si = hint->si;
+	put_cpu_ptr(&swap_alloc_hint);
+
+	return si;
+}
+
+static void swap_alloc_hint_set(struct swap_info_struct *si,
+				unsigned long seq)
+{
+	struct swap_alloc_hint *hint = get_cpu_ptr(&swap_alloc_hint);
+
+	hint->si = si;
+	hint->seq = seq;
+	put_cpu_ptr(&swap_alloc_hint);
+}
+
+/* Called with si->lock held */
+static int swap_alloc_slots(struct swap_info_struct *si, int n_goal,
+			    swp_entry_t swp_entries[], unsigned long size)
+{
+	if (size == SWAPFILE_CLUSTER) {
+		if (si->flags & SWP_FS)
+			return 0;
+		return swap_alloc_cluster(si, swp_entries);
+	}
+
+	return scan_swap_map_slots(si, SWAP_HAS_CACHE, n_goal, swp_entries);
+}
+
 int get_swap_pages(int n_goal, swp_entry_t swp_entries[], int entry_size)
 {
 	unsigned long size = swap_entry_size(entry_size);
@@ -1048,11 +1100,24 @@ int get_swap_pages(int n_goal, swp_entry_t swp_entries[], int entry_size)
 
 	atomic_long_sub(n_goal * size, &nr_swap_pages);
 
+	/* Fast path: the device this CPU used last, without swap_avail_lock */
+	si = swap_alloc_hint_get();
+	if (si) {
+		spin_lock(&si->lock);
+		if (si->highest_bit && (si->flags & SWP_WRITEOK))
+			n_ret = swap_alloc_slots(si, n_goal, swp_entries, size);
+		spin_unlock(&si->lock);
+		if (n_ret)
+			goto check_out;
+	}
+
 	spin_lock(&swap_avail_lock);
 
 start_over:
 	node = numa_node_id();
 	plist_for_each_entry_safe(si, next, &swap_avail_heads[node], avail_lists[node]) {
+		unsigned long seq = swap_avail_seq;
+
 		/* requeue si to after same-priority siblings */
 		plist_requeue(&si->avail_lists[node], &swap_avail_heads[node]);
 		spin_unlock(&swap_avail_lock);
@@ -1073,13 +1138,10 @@ int get_swap_pages(int n_goal, swp_entry_t swp_entries[], int entry_size)
 			spin_unlock(&si->lock);
 			goto nextsi;
 		}
-		if (size == SWAPFILE_CLUSTER) {
-			if (!(si->flags & SWP_FS))
-				n_ret = swap_alloc_cluster(si, swp_entries);
-		} else
-			n_ret = scan_swap_map_slots(si, SWAP_HAS_CACHE,
-						    n_goal, swp_entries);
+		n_ret = swap_alloc_slots(si, n_goal, swp_entries, size);
 		spin_unlock(&si->lock);
+		if (n_ret)
+			swap_alloc_hint_set(si, seq);
 		if (n_ret || size == SWAPFILE_CLUSTER)
 			goto check_out;
 		pr_debug("scan_swap_map of si %d failed to find offset\n",
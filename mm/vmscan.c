@@ -51,6 +51,10 @@
 #include <linux/printk.h>
 #include <linux/dax.h>
 #include <linux/psi.h>
+#include <linux/pagewalk.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/migrate.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -120,6 +124,12 @@ struct scan_control {
 	/* The file pages on the current node are dangerously low */
 	unsigned int file_is_tiny:1;
 
+	/* Don't move pages to a slower memory tier instead of reclaiming */
+	unsigned int no_demotion:1;
+
+	/* Swappiness requested by proactive reclaim, overrides the memcg's */
+	int *proactive_swappiness;
+
 	/* Allocation order */
 	s8 order;
 
@@ -293,6 +303,40 @@ static bool writeback_throttling_sane(struct scan_control *sc)
 }
 #endif
 
+static bool can_demote(int nid, struct scan_control *sc)
+{
+	if (!numa_demotion_enabled)
+		return false;
+	if (sc && sc->no_demotion)
+		return false;
+	/*
+	 * Demotion moves pages between nodes, it does not uncharge them:
+	 * it can't help a cgroup that is over its limit.
+	 */
+	if (sc && cgroup_reclaim(sc))
+		return false;
+
+	return next_demotion_node(nid) != NUMA_NO_NODE;
+}
+
+/*
+ * Anon pages can be aged and reclaimed if there is swap space to put them
+ * in, or a lower memory tier to demote them to.
+ */
+static inline bool can_reclaim_anon_pages(struct mem_cgroup *memcg, int nid,
+					  struct scan_control *sc)
+{
+	if (memcg) {
+		if (mem_cgroup_get_nr_swap_pages(memcg) > 0)
+			return true;
+	} else {
+		if (get_nr_swap_pages() > 0)
+			return true;
+	}
+
+	return can_demote(nid, sc);
+}
+
 /*
  * This misses isolated pages which are not accounted for to save counters.
  * As the data only determines if reclaim or compaction continues, it is
@@ -1070,6 +1114,92 @@ static void page_check_dirty_writeback(struct page *page,
 		mapping->a_ops->is_dirty_writeback(page, dirty, writeback);
 }
 
+struct demote_control {
+	int nid;
+	unsigned int nr_allocated;
+	unsigned int nr_freed;
+};
+
+static struct page *alloc_demote_page(struct page *page, unsigned long private)
+{
+	struct demote_control *dc = (struct demote_control *)private;
+	/*
+	 * Demotion is opportunistic: if the target node is short on
+	 * memory too, don't reclaim there on our behalf, just fall back
+	 * to reclaiming the page.
+	 */
+	gfp_t gfp_mask = (GFP_HIGHUSER_MOVABLE & ~__GFP_RECLAIM) |
+			 __GFP_THISNODE | __GFP_NOWARN | __GFP_NOMEMALLOC |
+			 GFP_NOWAIT;
+	unsigned int order = 0;
+	struct page *newpage;
+
+	if (PageTransHuge(page)) {
+		gfp_mask |= __GFP_COMP;
+		order = HPAGE_PMD_ORDER;
+	}
+
+	newpage = alloc_pages_node(dc->nid, gfp_mask, order);
+	if (!newpage)
+		return NULL;
+	if (order)
+		prep_transhuge_page(newpage);
+
+	dc->nr_allocated += hpage_nr_pages(newpage);
+	return newpage;
+}
+
+static void free_demote_page(struct page *newpage, unsigned long private)
+{
+	struct demote_control *dc = (struct demote_control *)private;
+
+	dc->nr_freed += hpage_nr_pages(newpage);
+	put_page(newpage);
+}
+
+/*
+ * Take pages on @demote_pages and attempt to demote them to another node.
+ * Pages which are not demoted are left on @demote_pages.
+ */
+static unsigned int demote_page_list(struct list_head *demote_pages,
+				     struct pglist_data *pgdat)
+{
+	struct demote_control dc = {
+		.nid = next_demotion_node(pgdat->node_id),
+	};
+	unsigned int nr_demoted;
+	struct page *page;
+
+	if (list_empty(demote_pages) || dc.nid == NUMA_NO_NODE)
+		return 0;
+
+	/*
+	 * The caller accounts the whole batch as isolated and drops that
+	 * again when it is done, while migrate_pages() drops the count for
+	 * every page it takes off the list. Balance the two.
+	 */
+	list_for_each_entry(page, demote_pages, lru)
+		mod_node_page_state(page_pgdat(page), NR_ISOLATED_ANON +
+				    page_is_file_lru(page),
+				    hpage_nr_pages(page));
+
+	migrate_pages(demote_pages, alloc_demote_page, free_demote_page,
+		      (unsigned long)&dc, MIGRATE_ASYNC, MR_DEMOTION);
+
+	list_for_each_entry(page, demote_pages, lru)
+		mod_node_page_state(page_pgdat(page), NR_ISOLATED_ANON +
+				    page_is_file_lru(page),
+				    -hpage_nr_pages(page));
+
+	nr_demoted = dc.nr_allocated - dc.nr_freed;
+	if (current_is_kswapd())
+		count_vm_events(PGDEMOTE_KSWAPD, nr_demoted);
+	else
+		count_vm_events(PGDEMOTE_DIRECT, nr_demoted);
+
+	return nr_demoted;
+}
+
 /*
  * shrink_page_list() returns the number of reclaimed pages
  */
@@ -1082,12 +1212,16 @@ static unsigned int shrink_page_list(struct list_head *page_list,
 {
 	LIST_HEAD(ret_pages);
 	LIST_HEAD(free_pages);
+	LIST_HEAD(demote_pages);
 	unsigned int nr_reclaimed = 0;
 	unsigned int pgactivate = 0;
+	bool do_demote_pass;
 
 	memset(stat, 0, sizeof(*stat));
 	cond_resched();
+	do_demote_pass = can_demote(pgdat->node_id, sc);
 
+retry:
 	while (!list_empty(page_list)) {
 		struct address_space *mapping;
 		struct page *page;
@@ -1236,6 +1370,17 @@ static unsigned int shrink_page_list(struct list_head *page_list,
 			; /* try to reclaim the page below */
 		}
 
+		/*
+		 * Before reclaiming the page, try to relocate its contents
+		 * to a slower memory node.
+		 */
+		if (do_demote_pass &&
+		    (thp_migration_supported() || !PageTransHuge(page))) {
+			list_add(&page->lru, &demote_pages);
+			unlock_page(page);
+			continue;
+		}
+
 		/*
 		 * Anonymous process memory has backing store?
 		 * Try to allocate it some swap space here.
@@ -1483,6 +1628,16 @@ static unsigned int shrink_page_list(struct list_head *page_list,
 		list_add(&page->lru, &ret_pages);
 		VM_BUG_ON_PAGE(PageLRU(page) || PageUnevictable(page), page);
 	}
+	/* 'page_list' is always empty here */
+
+	/* Migrate pages selected for demotion */
+	nr_reclaimed += demote_page_list(&demote_pages, pgdat);
+	/* Pages that could not be demoted are reclaimed the usual way */
+	if (!list_empty(&demote_pages)) {
+		list_splice_init(&demote_pages, page_list);
+		do_demote_pass = false;
+		goto retry;
+	}
 
 	pgactivate = stat->nr_activate[0] + stat->nr_activate[1];
 
@@ -1503,6 +1658,7 @@ unsigned int reclaim_clean_pages_from_list(struct zone *zone,
 		.gfp_mask = GFP_KERNEL,
 		.priority = DEF_PRIORITY,
 		.may_unmap = 1,
+		.no_demotion = 1,
 	};
 	struct reclaim_stat stat;
 	unsigned int nr_reclaimed;
@@ -1535,16 +1691,16 @@ unsigned int reclaim_clean_pages_from_list(struct zone *zone,
 }
 
 /*
- * Attempt to remove the specified page from its LRU.  Only take this page
- * if it is of the appropriate PageActive status.  Pages which are being
- * freed elsewhere are also ignored.
+ * Check whether the specified page can be taken off its LRU for the
+ * given isolation mode. The caller is expected to pin the page and to
+ * claim it with TestClearPageLRU() afterwards.
  *
  * page:	page to consider
  * mode:	one of the LRU isolation modes defined above
  *
  * returns 0 on success, -ve errno on failure.
  */
-int __isolate_lru_page(struct page *page, isolate_mode_t mode)
+int __isolate_lru_page_prepare(struct page *page, isolate_mode_t mode)
 {
 	int ret = -EINVAL;
 
@@ -1598,17 +1754,7 @@ int __isolate_lru_page(struct page *page, isolate_mode_t mode)
 	if ((mode & ISOLATE_UNMAPPED) && page_mapped(page))
 		return ret;
 
-	if (likely(get_page_unless_zero(page))) {
-		/*
-		 * Be careful not to clear PageLRU until after we're
-		 * sure the page is not being freed elsewhere -- the
-		 * page release code relies on it.
-		 */
-		ClearPageLRU(page);
-		ret = 0;
-	}
-
-	return ret;
+	return 0;
 }
 
 
@@ -1631,7 +1777,9 @@ static __always_inline void update_lru_sizes(struct lruvec *lruvec,
 }
 
 /**
- * pgdat->lru_lock is heavily contended.  Some of the functions that
+ * Isolating page from the lruvec to fill in @dst list by nr_to_scan times.
+ *
+ * lruvec->lru_lock is heavily contended.  Some of the functions that
  * shrink the lists perform better by taking out a batch of pages
  * and working on them outside the LRU lock.
  *
@@ -1689,24 +1837,38 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 		 * pages, triggering a premature OOM.
 		 *
 		 * Account all tail pages of THP.  This would not cause
-		 * premature OOM since __isolate_lru_page() returns -EBUSY
-		 * only when the page is being freed somewhere else.
+		 * premature OOM since __isolate_lru_page_prepare() returns
+		 * -EBUSY only when the page is being freed somewhere else.
 		 */
 		scan += nr_pages;
-		switch (__isolate_lru_page(page, mode)) {
+		switch (__isolate_lru_page_prepare(page, mode)) {
 		case 0:
+			/*
+			 * Be careful not to clear PageLRU until after we're
+			 * sure the page is not being freed elsewhere -- the
+			 * page release code relies on it.
+			 */
+			if (unlikely(!get_page_unless_zero(page)))
+				goto busy;
+
+			if (!TestClearPageLRU(page)) {
+				/*
+				 * This page may in other isolation path,
+				 * but we still hold lru_lock.
+				 */
+				put_page(page);
+				goto busy;
+			}
+
 			nr_taken += nr_pages;
 			nr_zone_taken[page_zonenum(page)] += nr_pages;
 			list_move(&page->lru, dst);
 			break;
 
-		case -EBUSY:
+		default:
+busy:
 			/* else it is being freed elsewhere */
 			list_move(&page->lru, src);
-			continue;
-
-		default:
-			BUG();
 		}
 	}
 
@@ -1736,6 +1898,139 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 	return nr_taken;
 }
 
+#ifdef CONFIG_LRU_GEN
+static bool lruvec_is_gen(struct lruvec *lruvec)
+{
+	return lru_gen_enabled() && READ_ONCE(lruvec->lrugen.enabled);
+}
+
+/* Move @page to @new_gen and account for it; called with lru_lock held */
+static void lru_gen_set_gen(struct lruvec *lruvec, struct page *page,
+			    int new_gen)
+{
+	int old_gen = page_lru_gen(page);
+
+	set_mask_bits(&page->flags, LRU_GEN_MASK,
+		      (new_gen + 1UL) << LRU_GEN_PGOFF);
+	lru_gen_update_size(lruvec, page, old_gen, new_gen);
+}
+
+/*
+ * Aging only updates the generation in page->flags, and pages are sorted
+ * onto the matching lists here, when eviction gets to them. Pages from
+ * zones the reclaim can't use get another generation instead of being
+ * skipped over again and again. Returns true if @page was moved.
+ */
+static bool lru_gen_sort_page(struct lruvec *lruvec, struct page *page,
+			      int gen, struct scan_control *sc)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int type = page_is_file_lru(page);
+	int zone = page_zonenum(page);
+	int new_gen = page_lru_gen(page);
+
+	if (new_gen != gen) {
+		list_move(&page->lru, &lrugen->lists[new_gen][type][zone]);
+		return true;
+	}
+
+	if (zone > sc->reclaim_idx) {
+		new_gen = lru_gen_from_seq(lrugen->min_seq[type] + 1);
+		lru_gen_set_gen(lruvec, page, new_gen);
+		list_move_tail(&page->lru, &lrugen->lists[new_gen][type][zone]);
+		__count_zid_vm_events(PGSCAN_SKIP, zone, hpage_nr_pages(page));
+		return true;
+	}
+
+	return false;
+}
+
+/* Retire the oldest generation of @type once it has been emptied */
+static void lru_gen_try_inc_min_seq(struct lruvec *lruvec, int type)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int gen, zone;
+
+	lockdep_assert_held(&lruvec->lru_lock);
+
+	while (lrugen->max_seq - lrugen->min_seq[type] + 1 > MIN_NR_GENS) {
+		gen = lru_gen_from_seq(lrugen->min_seq[type]);
+		for (zone = 0; zone < MAX_NR_ZONES; zone++)
+			if (!list_empty(&lrugen->lists[gen][type][zone]))
+				return;
+
+		WRITE_ONCE(lrugen->min_seq[type], lrugen->min_seq[type] + 1);
+	}
+}
+
+/*
+ * The multi-gen LRU counterpart of isolate_lru_pages(): isolates up to
+ * @nr_to_scan pages of @type from the oldest generation. Nothing is
+ * isolated while only the two youngest generations are left, because
+ * those hold the pages accessed since the last aging.
+ */
+static unsigned long lru_gen_isolate_pages(unsigned long nr_to_scan,
+		struct lruvec *lruvec, struct list_head *dst,
+		unsigned long *nr_scanned, struct scan_control *sc, int type)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	isolate_mode_t mode = (sc->may_unmap ? 0 : ISOLATE_UNMAPPED);
+	unsigned long scan = 0, total_scan = 0, nr_taken = 0;
+	int gen, zone;
+
+	lru_gen_try_inc_min_seq(lruvec, type);
+	if (lrugen->max_seq - lrugen->min_seq[type] + 1 <= MIN_NR_GENS)
+		goto done;
+
+	gen = lru_gen_from_seq(lrugen->min_seq[type]);
+	for (zone = MAX_NR_ZONES - 1; zone >= 0; zone--) {
+		struct list_head *head = &lrugen->lists[gen][type][zone];
+
+		while (scan < nr_to_scan && !list_empty(head)) {
+			struct page *page = lru_to_page(head);
+			int delta = hpage_nr_pages(page);
+
+			total_scan += delta;
+			if (lru_gen_sort_page(lruvec, page, gen, sc))
+				continue;
+
+			scan += delta;
+			if (__isolate_lru_page_prepare(page, mode) ||
+			    !get_page_unless_zero(page))
+				goto busy;
+
+			if (!TestClearPageLRU(page)) {
+				put_page(page);
+				goto busy;
+			}
+
+			lru_gen_del_page(lruvec, page, true);
+			list_add(&page->lru, dst);
+			nr_taken += delta;
+			continue;
+busy:
+			list_move(&page->lru, head);
+		}
+	}
+done:
+	*nr_scanned = total_scan;
+	return nr_taken;
+}
+#else
+static bool lruvec_is_gen(struct lruvec *lruvec)
+{
+	return false;
+}
+
+static unsigned long lru_gen_isolate_pages(unsigned long nr_to_scan,
+		struct lruvec *lruvec, struct list_head *dst,
+		unsigned long *nr_scanned, struct scan_control *sc, int type)
+{
+	*nr_scanned = 0;
+	return 0;
+}
+#endif /* CONFIG_LRU_GEN */
+
 /**
  * isolate_lru_page - tries to isolate a page from its LRU list
  * @page: page to isolate from its LRU list
@@ -1769,21 +2064,17 @@ int isolate_lru_page(struct page *page)
 	VM_BUG_ON_PAGE(!page_count(page), page);
 	WARN_RATELIMIT(PageTail(page), "trying to isolate tail page");
 
-	if (PageLRU(page)) {
-		pg_data_t *pgdat = page_pgdat(page);
+	if (TestClearPageLRU(page)) {
 		struct lruvec *lruvec;
+		int lru = page_lru(page);
 
-		spin_lock_irq(&pgdat->lru_lock);
-		lruvec = mem_cgroup_page_lruvec(page, pgdat);
-		if (PageLRU(page)) {
-			int lru = page_lru(page);
-			get_page(page);
-			ClearPageLRU(page);
-			del_page_from_lru_list(page, lruvec, lru);
-			ret = 0;
-		}
-		spin_unlock_irq(&pgdat->lru_lock);
+		get_page(page);
+		lruvec = lock_page_lruvec_irq(page);
+		del_page_from_lru_list(page, lruvec, lru);
+		unlock_page_lruvec_irq(lruvec);
+		ret = 0;
 	}
+
 	return ret;
 }
 
@@ -1831,9 +2122,9 @@ static int too_many_isolated(struct pglist_data *pgdat, int file,
  * processes, from rmap.
  *
  * If the pages are mostly unmapped, the processing is fast and it is
- * appropriate to hold zone_lru_lock across the whole operation.  But if
+ * appropriate to hold lru_lock across the whole operation.  But if
  * the pages are mapped, the processing is slow (page_referenced()) so we
- * should drop zone_lru_lock around each page.  It's impossible to balance
+ * should drop lru_lock around each page.  It's impossible to balance
  * this, so instead we remove the pages from the LRU while processing them.
  * It is safe to rely on PG_active against the non-LRU pages in here because
  * nobody will play with that bit on a non-LRU page.
@@ -1841,13 +2132,15 @@ static int too_many_isolated(struct pglist_data *pgdat, int file,
  * The downside is that we have to touch page->_refcount against each page.
  * But we had to alter page->flags anyway.
  *
+ * The pages were isolated from @lruvec, and their memcg cannot change
+ * while they are off the LRU, so they all go back to @lruvec.
+ *
  * Returns the number of pages moved to the given lruvec.
  */
 
 static unsigned noinline_for_stack move_pages_to_lru(struct lruvec *lruvec,
 						     struct list_head *list)
 {
-	struct pglist_data *pgdat = lruvec_pgdat(lruvec);
 	int nr_pages, nr_moved = 0;
 	LIST_HEAD(pages_to_free);
 	struct page *page;
@@ -1858,34 +2151,38 @@ static unsigned noinline_for_stack move_pages_to_lru(struct lruvec *lruvec,
 		VM_BUG_ON_PAGE(PageLRU(page), page);
 		if (unlikely(!page_evictable(page))) {
 			list_del(&page->lru);
-			spin_unlock_irq(&pgdat->lru_lock);
+			spin_unlock_irq(&lruvec->lru_lock);
 			putback_lru_page(page);
-			spin_lock_irq(&pgdat->lru_lock);
+			spin_lock_irq(&lruvec->lru_lock);
 			continue;
 		}
-		lruvec = mem_cgroup_page_lruvec(page, pgdat);
 
+		/*
+		 * All pages were isolated from the same lruvec (and isolation
+		 * inhibits memcg migration).
+		 */
+		VM_BUG_ON_PAGE(!page_matches_lruvec(page, lruvec), page);
 		SetPageLRU(page);
 		lru = page_lru(page);
 
 		nr_pages = hpage_nr_pages(page);
-		update_lru_size(lruvec, lru, page_zonenum(page), nr_pages);
-		list_move(&page->lru, &lruvec->lists[lru]);
+		list_del(&page->lru);
+		add_page_to_lru_list(page, lruvec, lru);
 
 		if (put_page_testzero(page)) {
 			__ClearPageLRU(page);
-			__ClearPageActive(page);
 			del_page_from_lru_list(page, lruvec, lru);
+			__ClearPageActive(page);
 
 			if (unlikely(PageCompound(page))) {
-				spin_unlock_irq(&pgdat->lru_lock);
+				spin_unlock_irq(&lruvec->lru_lock);
 				destroy_compound_page(page);
-				spin_lock_irq(&pgdat->lru_lock);
+				spin_lock_irq(&lruvec->lru_lock);
 			} else
 				list_add(&page->lru, &pages_to_free);
 		} else {
 			nr_moved += nr_pages;
-			if (PageActive(page))
+			if (is_active_lru(lru))
 				workingset_age_nonresident(lruvec, nr_pages);
 		}
 	}
@@ -1944,10 +2241,14 @@ shrink_inactive_list(unsigned long nr_to_scan, struct lruvec *lruvec,
 
 	lru_add_drain();
 
-	spin_lock_irq(&pgdat->lru_lock);
+	spin_lock_irq(&lruvec->lru_lock);
 
-	nr_taken = isolate_lru_pages(nr_to_scan, lruvec, &page_list,
-				     &nr_scanned, sc, lru);
+	if (lruvec_is_gen(lruvec))
+		nr_taken = lru_gen_isolate_pages(nr_to_scan, lruvec, &page_list,
+						 &nr_scanned, sc, file);
+	else
+		nr_taken = isolate_lru_pages(nr_to_scan, lruvec, &page_list,
+					     &nr_scanned, sc, lru);
 
 	__mod_node_page_state(pgdat, NR_ISOLATED_ANON + file, nr_taken);
 	item = current_is_kswapd() ? PGSCAN_KSWAPD : PGSCAN_DIRECT;
@@ -1956,7 +2257,7 @@ shrink_inactive_list(unsigned long nr_to_scan, struct lruvec *lruvec,
 	__count_memcg_events(lruvec_memcg(lruvec), item, nr_scanned);
 	__count_vm_events(PGSCAN_ANON + file, nr_scanned);
 
-	spin_unlock_irq(&pgdat->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 
 	if (nr_taken == 0)
 		return 0;
@@ -1964,19 +2265,20 @@ shrink_inactive_list(unsigned long nr_to_scan, struct lruvec *lruvec,
 	nr_reclaimed = shrink_page_list(&page_list, pgdat, sc, 0,
 				&stat, false);
 
-	spin_lock_irq(&pgdat->lru_lock);
+	spin_lock_irq(&lruvec->lru_lock);
 
 	move_pages_to_lru(lruvec, &page_list);
 
 	__mod_node_page_state(pgdat, NR_ISOLATED_ANON + file, -nr_taken);
-	lru_note_cost(lruvec, file, stat.nr_pageout);
 	item = current_is_kswapd() ? PGSTEAL_KSWAPD : PGSTEAL_DIRECT;
 	if (!cgroup_reclaim(sc))
 		__count_vm_events(item, nr_reclaimed);
 	__count_memcg_events(lruvec_memcg(lruvec), item, nr_reclaimed);
 	__count_vm_events(PGSTEAL_ANON + file, nr_reclaimed);
 
-	spin_unlock_irq(&pgdat->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
+
+	lru_note_cost(lruvec, file, stat.nr_pageout);
 
 	mem_cgroup_uncharge_list(&page_list);
 	free_unref_page_list(&page_list);
@@ -2028,7 +2330,7 @@ static void shrink_active_list(unsigned long nr_to_scan,
 
 	lru_add_drain();
 
-	spin_lock_irq(&pgdat->lru_lock);
+	spin_lock_irq(&lruvec->lru_lock);
 
 	nr_taken = isolate_lru_pages(nr_to_scan, lruvec, &l_hold,
 				     &nr_scanned, sc, lru);
@@ -2038,7 +2340,7 @@ static void shrink_active_list(unsigned long nr_to_scan,
 	__count_vm_events(PGREFILL, nr_scanned);
 	__count_memcg_events(lruvec_memcg(lruvec), PGREFILL, nr_scanned);
 
-	spin_unlock_irq(&pgdat->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 
 	while (!list_empty(&l_hold)) {
 		cond_resched();
@@ -2084,7 +2386,7 @@ static void shrink_active_list(unsigned long nr_to_scan,
 	/*
 	 * Move pages back to the lru list.
 	 */
-	spin_lock_irq(&pgdat->lru_lock);
+	spin_lock_irq(&lruvec->lru_lock);
 
 	nr_activate = move_pages_to_lru(lruvec, &l_active);
 	nr_deactivate = move_pages_to_lru(lruvec, &l_inactive);
@@ -2095,7 +2397,7 @@ static void shrink_active_list(unsigned long nr_to_scan,
 	__count_memcg_events(lruvec_memcg(lruvec), PGDEACTIVATE, nr_deactivate);
 
 	__mod_node_page_state(pgdat, NR_ISOLATED_ANON + file, -nr_taken);
-	spin_unlock_irq(&pgdat->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 
 	mem_cgroup_uncharge_list(&l_active);
 	free_unref_page_list(&l_active);
@@ -2241,7 +2543,8 @@ static void get_scan_count(struct lruvec *lruvec, struct scan_control *sc,
 {
 	struct mem_cgroup *memcg = lruvec_memcg(lruvec);
 	unsigned long anon_cost, file_cost, total_cost;
-	int swappiness = mem_cgroup_swappiness(memcg);
+	int swappiness = sc->proactive_swappiness ?
+		*sc->proactive_swappiness : mem_cgroup_swappiness(memcg);
 	u64 fraction[2];
 	u64 denominator = 0;	/* gcc */
 	enum scan_balance scan_balance;
@@ -2249,7 +2552,8 @@ static void get_scan_count(struct lruvec *lruvec, struct scan_control *sc,
 	enum lru_list lru;
 
 	/* If we have no swap space, do not bother scanning anon pages. */
-	if (!sc->may_swap || mem_cgroup_get_nr_swap_pages(memcg) <= 0) {
+	if (!sc->may_swap ||
+	    !can_reclaim_anon_pages(memcg, lruvec_pgdat(lruvec)->node_id, sc)) {
 		scan_balance = SCAN_FILE;
 		goto out;
 	}
@@ -2423,6 +2727,576 @@ static void get_scan_count(struct lruvec *lruvec, struct scan_control *sc,
 	}
 }
 
+#ifdef CONFIG_LRU_GEN
+DEFINE_STATIC_KEY_FALSE(lru_gen_key);
+
+#define LRU_GEN_WALK_BATCH	64
+
+struct lru_gen_walk {
+	struct lruvec *lruvec;
+	unsigned long max_seq;
+	int nr_pages;
+	struct page *pages[LRU_GEN_WALK_BATCH];
+};
+
+/*
+ * Move the young pages found by the page table walk into the youngest
+ * generation. Only page->flags and the sizes are updated; the pages are
+ * sorted onto their new lists by lru_gen_sort_page().
+ */
+static void lru_gen_flush_walk(struct lru_gen_walk *walk)
+{
+	struct lruvec *lruvec = walk->lruvec;
+	int new_gen = lru_gen_from_seq(walk->max_seq);
+	int i;
+
+	spin_lock_irq(&lruvec->lru_lock);
+	for (i = 0; i < walk->nr_pages; i++) {
+		struct page *page = walk->pages[i];
+		int old_gen;
+
+		if (!PageLRU(page) || !page_matches_lruvec(page, lruvec))
+			continue;
+
+		old_gen = page_lru_gen(page);
+		if (old_gen < 0 || old_gen == new_gen)
+			continue;
+
+		lru_gen_set_gen(lruvec, page, new_gen);
+	}
+	spin_unlock_irq(&lruvec->lru_lock);
+
+	walk->nr_pages = 0;
+}
+
+static void lru_gen_walk_add(struct lru_gen_walk *walk, struct page *page)
+{
+	walk->pages[walk->nr_pages++] = compound_head(page);
+	if (walk->nr_pages == LRU_GEN_WALK_BATCH)
+		lru_gen_flush_walk(walk);
+}
+
+/*
+ * Other nodes and memcgs age their pages from the same accessed bits, so
+ * only pages on the lruvec being aged may have them cleared. Rechecked
+ * under the lru_lock by lru_gen_flush_walk().
+ */
+static bool lru_gen_walk_owns(struct lru_gen_walk *walk, struct page *page)
+{
+	return page_matches_lruvec(compound_head(page), walk->lruvec);
+}
+
+static int lru_gen_test_walk(unsigned long start, unsigned long end,
+			     struct mm_walk *mmwalk)
+{
+	struct vm_area_struct *vma = mmwalk->vma;
+
+	if (vma->vm_flags & (VM_IO | VM_PFNMAP | VM_LOCKED | VM_HUGETLB))
+		return 1;
+
+	return 0;
+}
+
+static int lru_gen_walk_pmd(pmd_t *pmd, unsigned long addr,
+			    unsigned long end, struct mm_walk *mmwalk)
+{
+	struct lru_gen_walk *walk = mmwalk->private;
+	struct vm_area_struct *vma = mmwalk->vma;
+	pte_t *start_pte, *pte;
+	spinlock_t *ptl;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	ptl = pmd_trans_huge_lock(pmd, vma);
+	if (ptl) {
+		pmd_t pmdval = *pmd;
+
+		if (pmd_present(pmdval) && !is_huge_zero_pmd(pmdval) &&
+		    pmd_young(pmdval) &&
+		    lru_gen_walk_owns(walk, pmd_page(pmdval)) &&
+		    pmdp_test_and_clear_young(vma, addr, pmd))
+			lru_gen_walk_add(walk, pmd_page(pmdval));
+		spin_unlock(ptl);
+		goto out;
+	}
+#endif
+
+	if (pmd_trans_unstable(pmd))
+		goto out;
+
+	start_pte = pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+	for (; addr < end; pte++, addr += PAGE_SIZE) {
+		pte_t ptent = *pte;
+		struct page *page;
+
+		if (!pte_present(ptent) || !pte_young(ptent))
+			continue;
+
+		page = vm_normal_page(vma, addr, ptent);
+		if (!page || !lru_gen_walk_owns(walk, page))
+			continue;
+
+		/*
+		 * Like page_referenced_one(), don't flush the TLB: a stale
+		 * entry only delays noticing the next access.
+		 */
+		if (ptep_test_and_clear_young(vma, addr, pte))
+			lru_gen_walk_add(walk, page);
+	}
+	pte_unmap_unlock(start_pte, ptl);
+out:
+	cond_resched();
+	return 0;
+}
+
+static const struct mm_walk_ops lru_gen_walk_ops = {
+	.pmd_entry	= lru_gen_walk_pmd,
+	.test_walk	= lru_gen_test_walk,
+};
+
+/*
+ * Walk the page tables of the processes charged to the memcg of @lruvec
+ * and promote the pages accessed since the last aging. This replaces the
+ * rmap walks of shrink_active_list(): one walk finds all young pages of
+ * a process, instead of one rmap walk per page that may not be young.
+ * mm's that are busy are skipped; their pages just age.
+ */
+static void lru_gen_walk_mms(struct lruvec *lruvec, unsigned long max_seq)
+{
+	struct mem_cgroup *memcg = lruvec_memcg(lruvec);
+	struct cgroup_subsys_state *css;
+	struct lru_gen_walk *walk;
+	struct css_task_iter it;
+	struct task_struct *task;
+
+	walk = kzalloc(sizeof(*walk),
+		       GFP_NOWAIT | __GFP_NOMEMALLOC | __GFP_NOWARN);
+	if (!walk)
+		return;
+
+	walk->lruvec = lruvec;
+	walk->max_seq = max_seq;
+
+	css = memcg ? &memcg->css : &root_mem_cgroup->css;
+	css_task_iter_start(css, CSS_TASK_ITER_PROCS, &it);
+	while ((task = css_task_iter_next(&it))) {
+		struct mm_struct *mm = get_task_mm(task);
+
+		if (!mm)
+			continue;
+
+		if (mmap_read_trylock(mm)) {
+			walk_page_range(mm, 0, mm->highest_vm_end,
+					&lru_gen_walk_ops, walk);
+			mmap_read_unlock(mm);
+		}
+		mmput_async(mm);
+
+		if (walk->nr_pages)
+			lru_gen_flush_walk(walk);
+
+		/* somebody else has finished this round of aging */
+		if (READ_ONCE(lruvec->lrugen.max_seq) != max_seq)
+			break;
+
+		cond_resched();
+	}
+	css_task_iter_end(&it);
+
+	kfree(walk);
+}
+
+/*
+ * Fold the oldest generation of @type into the next one to make room
+ * for a new generation. Pages promoted since they were put on the list
+ * go to the generation in their flags.
+ */
+static void lru_gen_inc_min_seq(struct lruvec *lruvec, int type)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int old_gen = lru_gen_from_seq(lrugen->min_seq[type]);
+	int new_gen = lru_gen_from_seq(lrugen->min_seq[type] + 1);
+	int zone;
+
+	for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+		struct list_head *head = &lrugen->lists[old_gen][type][zone];
+
+		while (!list_empty(head)) {
+			struct page *page = lru_to_page(head);
+			int gen = page_lru_gen(page);
+
+			if (gen == old_gen) {
+				lru_gen_set_gen(lruvec, page, new_gen);
+				gen = new_gen;
+			}
+			list_move(&page->lru, &lrugen->lists[gen][type][zone]);
+		}
+	}
+
+	WRITE_ONCE(lrugen->min_seq[type], lrugen->min_seq[type] + 1);
+}
+
+static void lru_gen_inc_max_seq(struct lruvec *lruvec, unsigned long max_seq)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int prev, next, type, zone;
+
+	spin_lock_irq(&lruvec->lru_lock);
+
+	if (max_seq != lrugen->max_seq)
+		goto unlock;
+
+	for (type = 0; type < ANON_AND_FILE; type++) {
+		lru_gen_try_inc_min_seq(lruvec, type);
+		if (max_seq - lrugen->min_seq[type] + 1 == MAX_NR_GENS)
+			lru_gen_inc_min_seq(lruvec, type);
+	}
+
+	/* the second youngest generation becomes inactive */
+	prev = lru_gen_from_seq(max_seq - 1);
+	for (type = 0; type < ANON_AND_FILE; type++) {
+		for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+			enum lru_list lru = type * LRU_FILE;
+			long delta = lrugen->nr_pages[prev][type][zone];
+
+			if (!delta)
+				continue;
+
+			update_lru_size(lruvec, lru + LRU_ACTIVE, zone, -delta);
+			update_lru_size(lruvec, lru, zone, delta);
+		}
+	}
+
+	next = lru_gen_from_seq(max_seq + 1);
+	WRITE_ONCE(lrugen->timestamps[next], jiffies);
+	WRITE_ONCE(lrugen->max_seq, max_seq + 1);
+unlock:
+	spin_unlock_irq(&lruvec->lru_lock);
+}
+
+static void lru_gen_age_lruvec(struct lruvec *lruvec)
+{
+	unsigned long max_seq = READ_ONCE(lruvec->lrugen.max_seq);
+
+	lru_gen_walk_mms(lruvec, max_seq);
+	lru_gen_inc_max_seq(lruvec, max_seq);
+}
+
+/*
+ * Evict the type whose oldest generation is older; ties go to file pages,
+ * which are cheaper to reclaim. The scan budget per type comes from
+ * get_scan_count(), so swappiness and the anon/file cost balance still
+ * apply.
+ */
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec,
+				  struct scan_control *sc)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	unsigned long nr[NR_LRU_LISTS];
+	unsigned long nr_to_scan[ANON_AND_FILE];
+	unsigned long nr_reclaimed = 0;
+	struct blk_plug plug;
+	bool scan_adjusted;
+
+	get_scan_count(lruvec, sc, nr);
+	nr_to_scan[LRU_GEN_ANON] = nr[LRU_INACTIVE_ANON] + nr[LRU_ACTIVE_ANON];
+	nr_to_scan[LRU_GEN_FILE] = nr[LRU_INACTIVE_FILE] + nr[LRU_ACTIVE_FILE];
+
+	/* see the comment in shrink_lruvec() */
+	scan_adjusted = (!cgroup_reclaim(sc) && !current_is_kswapd() &&
+			 sc->priority == DEF_PRIORITY);
+
+	blk_start_plug(&plug);
+	while (nr_to_scan[LRU_GEN_ANON] || nr_to_scan[LRU_GEN_FILE]) {
+		unsigned long batch;
+		int type;
+
+		if (!nr_to_scan[LRU_GEN_ANON])
+			type = LRU_GEN_FILE;
+		else if (!nr_to_scan[LRU_GEN_FILE])
+			type = LRU_GEN_ANON;
+		else
+			type = READ_ONCE(lrugen->min_seq[LRU_GEN_ANON]) <
+			       READ_ONCE(lrugen->min_seq[LRU_GEN_FILE]) ?
+			       LRU_GEN_ANON : LRU_GEN_FILE;
+
+		if (READ_ONCE(lrugen->max_seq) -
+		    READ_ONCE(lrugen->min_seq[type]) + 1 <= MIN_NR_GENS)
+			lru_gen_age_lruvec(lruvec);
+
+		batch = min(nr_to_scan[type], SWAP_CLUSTER_MAX);
+		nr_to_scan[type] -= batch;
+		nr_reclaimed += shrink_inactive_list(batch, lruvec, sc,
+				type ? LRU_INACTIVE_FILE : LRU_INACTIVE_ANON);
+
+		cond_resched();
+
+		if (nr_reclaimed >= sc->nr_to_reclaim && !scan_adjusted)
+			break;
+	}
+	blk_finish_plug(&plug);
+	sc->nr_reclaimed += nr_reclaimed;
+}
+
+/*
+ * Switching an lruvec between the multi-gen LRU and the active/inactive
+ * lists moves all its evictable pages under lru_lock, dropping the lock
+ * when a reschedule is due. The pages stay on the LRU throughout, and
+ * the list hooks in mm_inline.h follow lrugen.enabled, so callers racing
+ * with the switch don't need to know about it.
+ */
+static void lru_gen_cond_resched(struct lruvec *lruvec)
+{
+	if (need_resched()) {
+		spin_unlock_irq(&lruvec->lru_lock);
+		cond_resched();
+		spin_lock_irq(&lruvec->lru_lock);
+	}
+}
+
+static void lru_gen_switch_lruvec(struct lruvec *lruvec, bool enable)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int gen, type, zone;
+	enum lru_list lru;
+
+	spin_lock_irq(&lruvec->lru_lock);
+
+	WRITE_ONCE(lrugen->enabled, enable);
+
+	if (enable) {
+		for_each_evictable_lru(lru) {
+			struct list_head *head = &lruvec->lists[lru];
+
+			while (!list_empty(head)) {
+				struct page *page = lru_to_page(head);
+
+				del_page_from_lru_list(page, lruvec, lru);
+				add_page_to_lru_list(page, lruvec, lru);
+				lru_gen_cond_resched(lruvec);
+			}
+		}
+		goto unlock;
+	}
+
+	for (gen = 0; gen < MAX_NR_GENS; gen++) {
+		for (type = 0; type < ANON_AND_FILE; type++) {
+			for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+				struct list_head *head;
+
+				head = &lrugen->lists[gen][type][zone];
+				while (!list_empty(head)) {
+					struct page *page = lru_to_page(head);
+
+					del_page_from_lru_list(page, lruvec,
+							page_lru(page));
+					add_page_to_lru_list(page, lruvec,
+							page_lru(page));
+					lru_gen_cond_resched(lruvec);
+				}
+			}
+		}
+	}
+unlock:
+	spin_unlock_irq(&lruvec->lru_lock);
+}
+
+static DEFINE_MUTEX(lru_gen_state_mutex);
+
+/*
+ * The static key is enabled before and disabled after the lruvecs are
+ * switched, so lruvec_is_gen() never sees generation lists with the key
+ * off. cgroup_lock() keeps new memcgs from being created in between with
+ * a stale lrugen.enabled.
+ */
+static void lru_gen_change_state(bool enable)
+{
+	struct mem_cgroup *memcg;
+	int nid;
+
+	mutex_lock(&lru_gen_state_mutex);
+	if (enable == lru_gen_enabled())
+		goto unlock;
+
+	cgroup_lock();
+
+	if (enable)
+		static_branch_enable(&lru_gen_key);
+
+	memcg = mem_cgroup_iter(NULL, NULL, NULL);
+	do {
+		for_each_node(nid) {
+			struct lruvec *lruvec;
+
+			if (!NODE_DATA(nid))
+				continue;
+
+			lruvec = mem_cgroup_lruvec(memcg, NODE_DATA(nid));
+			lru_gen_switch_lruvec(lruvec, enable);
+			cond_resched();
+		}
+	} while ((memcg = mem_cgroup_iter(NULL, memcg, NULL)));
+
+	if (!enable)
+		static_branch_disable(&lru_gen_key);
+
+	cgroup_unlock();
+unlock:
+	mutex_unlock(&lru_gen_state_mutex);
+}
+
+static ssize_t enabled_show(struct kobject *kobj, struct kobj_attribute *attr,
+			    char *buf)
+{
+	return sprintf(buf, "%d\n", lru_gen_enabled());
+}
+
+static ssize_t enabled_store(struct kobject *kobj, struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	bool enable;
+
+	if (kstrtobool(buf, &enable))
+		return -EINVAL;
+
+	lru_gen_change_state(enable);
+
+	return count;
+}
+
+static struct kobj_attribute lru_gen_enabled_attr = __ATTR_RW(enabled);
+
+static struct attribute *lru_gen_attrs[] = {
+	&lru_gen_enabled_attr.attr,
+	NULL
+};
+
+static const struct attribute_group lru_gen_attr_group = {
+	.name = "lru_gen",
+	.attrs = lru_gen_attrs,
+};
+
+#ifdef CONFIG_DEBUG_FS
+static void lru_gen_show_lruvec(struct seq_file *m, struct lruvec *lruvec)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	unsigned long max_seq = READ_ONCE(lrugen->max_seq);
+	unsigned long min_seq[ANON_AND_FILE];
+	unsigned long seq;
+	int type, zone;
+
+	for (type = 0; type < ANON_AND_FILE; type++)
+		min_seq[type] = READ_ONCE(lrugen->min_seq[type]);
+
+	for (seq = min(min_seq[0], min_seq[1]); seq <= max_seq; seq++) {
+		int gen = lru_gen_from_seq(seq);
+		unsigned long birth = READ_ONCE(lrugen->timestamps[gen]);
+
+		seq_printf(m, " %10lu %10u", seq,
+			   jiffies_to_msecs(jiffies - birth));
+
+		for (type = 0; type < ANON_AND_FILE; type++) {
+			long size = 0;
+
+			if (seq < min_seq[type]) {
+				seq_puts(m, "          -");
+				continue;
+			}
+
+			for (zone = 0; zone < MAX_NR_ZONES; zone++)
+				size += READ_ONCE(lrugen->nr_pages[gen][type][zone]);
+
+			seq_printf(m, " %10ld", max(size, 0L));
+		}
+		seq_putc(m, '\n');
+	}
+}
+
+/*
+ * For each memcg and node: one line per generation with its sequence
+ * number, its age in milliseconds and the number of anon and file pages.
+ */
+static int lru_gen_debugfs_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg;
+	char *path;
+	int nid;
+
+	path = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!path)
+		return -ENOMEM;
+
+	memcg = mem_cgroup_iter(NULL, NULL, NULL);
+	do {
+		if (memcg)
+			cgroup_path(memcg->css.cgroup, path, PATH_MAX);
+		else
+			strcpy(path, "/");
+
+		seq_printf(m, "memcg %5hu %s\n", mem_cgroup_id(memcg), path);
+		for_each_node_state(nid, N_MEMORY) {
+			seq_printf(m, " node %5d\n", nid);
+			lru_gen_show_lruvec(m,
+				mem_cgroup_lruvec(memcg, NODE_DATA(nid)));
+		}
+	} while ((memcg = mem_cgroup_iter(NULL, memcg, NULL)));
+
+	kfree(path);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lru_gen_debugfs);
+#endif /* CONFIG_DEBUG_FS */
+
+void lru_gen_init_lruvec(struct lruvec *lruvec)
+{
+	struct lru_gen_struct *lrugen = &lruvec->lrugen;
+	int gen, type, zone;
+
+	/* start with the two youngest generations, aging makes the third */
+	lrugen->max_seq = MIN_NR_GENS - 1;
+	for (type = 0; type < ANON_AND_FILE; type++)
+		lrugen->min_seq[type] = 0;
+
+	for (gen = 0; gen < MAX_NR_GENS; gen++) {
+		lrugen->timestamps[gen] = jiffies;
+		for (type = 0; type < ANON_AND_FILE; type++)
+			for (zone = 0; zone < MAX_NR_ZONES; zone++)
+				INIT_LIST_HEAD(&lrugen->lists[gen][type][zone]);
+	}
+
+	lrugen->enabled = lru_gen_enabled();
+}
+
+static bool lru_gen_boot_enabled __initdata =
+	IS_ENABLED(CONFIG_LRU_GEN_ENABLED);
+
+static int __init setup_lru_gen(char *str)
+{
+	return !kstrtobool(str, &lru_gen_boot_enabled);
+}
+__setup("lru_gen=", setup_lru_gen);
+
+static int __init init_lru_gen(void)
+{
+	if (sysfs_create_group(mm_kobj, &lru_gen_attr_group))
+		pr_err("lru_gen: failed to create sysfs group\n");
+
+#ifdef CONFIG_DEBUG_FS
+	debugfs_create_file("lru_gen", 0444, NULL, NULL,
+			    &lru_gen_debugfs_fops);
+#endif
+
+	lru_gen_change_state(lru_gen_boot_enabled);
+
+	return 0;
+}
+late_initcall(init_lru_gen);
+#else
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec,
+				  struct scan_control *sc)
+{
+}
+#endif /* CONFIG_LRU_GEN */
+
 static void shrink_lruvec(struct lruvec *lruvec, struct scan_control *sc)
 {
 	unsigned long nr[NR_LRU_LISTS];
@@ -2434,6 +3308,11 @@ static void shrink_lruvec(struct lruvec *lruvec, struct scan_control *sc)
 	struct blk_plug plug;
 	bool scan_adjusted;
 
+	if (lruvec_is_gen(lruvec)) {
+		lru_gen_shrink_lruvec(lruvec, sc);
+		return;
+	}
+
 	get_scan_count(lruvec, sc, nr);
 
 	/* Record the original scan target for proportional adjustments later */
@@ -2532,7 +3411,8 @@ static void shrink_lruvec(struct lruvec *lruvec, struct scan_control *sc)
 	 * Even if we did not try to evict anon pages at all, we want to
 	 * rebalance the anon lru active/inactive ratio.
 	 */
-	if (total_swap_pages && inactive_is_low(lruvec, LRU_INACTIVE_ANON))
+	if ((total_swap_pages || can_demote(lruvec_pgdat(lruvec)->node_id, sc)) &&
+	    inactive_is_low(lruvec, LRU_INACTIVE_ANON))
 		shrink_active_list(SWAP_CLUSTER_MAX, lruvec,
 				   sc, LRU_ACTIVE_ANON);
 }
@@ -2602,7 +3482,7 @@ static inline bool should_continue_reclaim(struct pglist_data *pgdat,
 	 */
 	pages_for_compaction = compact_gap(sc->order);
 	inactive_lru_pages = node_page_state(pgdat, NR_INACTIVE_FILE);
-	if (get_nr_swap_pages() > 0)
+	if (can_reclaim_anon_pages(NULL, pgdat->node_id, sc))
 		inactive_lru_pages += node_page_state(pgdat, NR_INACTIVE_ANON);
 
 	return inactive_lru_pages > pages_for_compaction;
@@ -2685,10 +3565,10 @@ static void shrink_node(pg_data_t *pgdat, struct scan_control *sc)
 	/*
 	 * Determine the scan balance between anon and file LRUs.
 	 */
-	spin_lock_irq(&pgdat->lru_lock);
+	spin_lock_irq(&target_lruvec->lru_lock);
 	sc->anon_cost = target_lruvec->anon_cost;
 	sc->file_cost = target_lruvec->file_cost;
-	spin_unlock_irq(&pgdat->lru_lock);
+	spin_unlock_irq(&target_lruvec->lru_lock);
 
 	/*
 	 * Target desirable inactive:active list ratios for the anon
@@ -3315,7 +4195,8 @@ unsigned long mem_cgroup_shrink_node(struct mem_cgroup *memcg,
 unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *memcg,
 					   unsigned long nr_pages,
 					   gfp_t gfp_mask,
-					   bool may_swap)
+					   bool may_swap,
+					   int *swappiness)
 {
 	unsigned long nr_reclaimed;
 	unsigned long pflags;
@@ -3330,6 +4211,7 @@ unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *memcg,
 		.may_writepage = !laptop_mode,
 		.may_unmap = 1,
 		.may_swap = may_swap,
+		.proactive_swappiness = swappiness,
 	};
 	/*
 	 * Traverse the ZONELIST_FALLBACK zonelist of the current node to put
@@ -3363,7 +4245,9 @@ static void age_active_anon(struct pglist_data *pgdat,
 	struct mem_cgroup *memcg;
 	struct lruvec *lruvec;
 
-	if (!total_swap_pages)
+	/* the multi-gen LRU ages anon pages as part of eviction */
+	if ((!total_swap_pages && !can_demote(pgdat->node_id, sc)) ||
+	    lru_gen_enabled())
 		return;
 
 	lruvec = mem_cgroup_lruvec(NULL, pgdat);
@@ -4264,29 +5148,21 @@ int node_reclaim(struct pglist_data *pgdat, gfp_t gfp_mask, unsigned int order)
  */
 void check_move_unevictable_pages(struct pagevec *pvec)
 {
-	struct lruvec *lruvec;
-	struct pglist_data *pgdat = NULL;
+	struct lruvec *lruvec = NULL;
 	int pgscanned = 0;
 	int pgrescued = 0;
 	int i;
 
 	for (i = 0; i < pvec->nr; i++) {
 		struct page *page = pvec->pages[i];
-		struct pglist_data *pagepgdat = page_pgdat(page);
 
 		pgscanned++;
-		if (pagepgdat != pgdat) {
-			if (pgdat)
-				spin_unlock_irq(&pgdat->lru_lock);
-			pgdat = pagepgdat;
-			spin_lock_irq(&pgdat->lru_lock);
-		}
-		lruvec = mem_cgroup_page_lruvec(page, pgdat);
 
-		if (!PageLRU(page) || !PageUnevictable(page))
+		if (!TestClearPageLRU(page))
 			continue;
 
-		if (page_evictable(page)) {
+		lruvec = relock_page_lruvec_irq(page, lruvec);
+		if (page_evictable(page) && PageUnevictable(page)) {
 			enum lru_list lru = page_lru_base_type(page);
 
 			VM_BUG_ON_PAGE(PageActive(page), page);
@@ -4295,12 +5171,15 @@ void check_move_unevictable_pages(struct pagevec *pvec)
 			add_page_to_lru_list(page, lruvec, lru);
 			pgrescued++;
 		}
+		SetPageLRU(page);
 	}
 
-	if (pgdat) {
+	if (lruvec) {
 		__count_vm_events(UNEVICTABLE_PGRESCUED, pgrescued);
 		__count_vm_events(UNEVICTABLE_PGSCANNED, pgscanned);
-		spin_unlock_irq(&pgdat->lru_lock);
+		unlock_page_lruvec_irq(lruvec);
+	} else if (pgscanned) {
+		count_vm_events(UNEVICTABLE_PGSCANNED, pgscanned);
 	}
 }
 EXPORT_SYMBOL_GPL(check_move_unevictable_pages);
@@ -1234,6 +1234,9 @@ const char * const vmstat_text[] = {
 #ifdef CONFIG_MIGRATION
 	"pgmigrate_success",
 	"pgmigrate_fail",
+	"pgdemote_kswapd",
+	"pgdemote_direct",
+	"pgpromote_success",
 #endif
 #ifdef CONFIG_COMPACTION
 	"compact_migrate_scanned",
@@ -1302,6 +1305,11 @@ const char * const vmstat_text[] = {
 #ifdef CONFIG_SWAP
 	"swap_ra",
 	"swap_ra_hit",
+	"swap_ra_miss",
+#endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	"spf_success",
+	"spf_abort",
 #endif
 #endif /* CONFIG_VM_EVENT_COUNTERS || CONFIG_MEMCG */
 };
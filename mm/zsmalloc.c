@@ -57,6 +57,7 @@
 #include <linux/wait.h>
 #include <linux/pagemap.h>
 #include <linux/fs.h>
+#include <linux/workqueue.h>
 
 #define ZSPAGE_MAGIC	0x58
 
@@ -197,6 +198,19 @@ static struct vfsmount *zsmalloc_mnt;
 static const int fullness_threshold_frac = 4;
 static size_t huge_class_size;
 
+/*
+ * Background compaction of a size class is kicked from zs_free() once
+ * this percentage of its allocated objects is unused; 0 disables it.
+ * Each run migrates at most ZS_COMPACT_BATCH source zspages before
+ * dropping out, so it never holds up allocations in the class for long.
+ */
+static unsigned int bg_compact_ratio = 25;
+module_param(bg_compact_ratio, uint, 0644);
+MODULE_PARM_DESC(bg_compact_ratio,
+		 "Percentage of unused objects that triggers background compaction of a size class (0 to disable)");
+
+#define ZS_COMPACT_BATCH	16
+
 struct size_class {
 	spinlock_t lock;
 	struct list_head fullness_list[NR_ZS_FULLNESS];
@@ -211,6 +225,12 @@ struct size_class {
 
 	unsigned int index;
 	struct zs_size_stat stats;
+
+	struct zs_pool *pool;
+	/* Background compaction of this class */
+	struct work_struct compact_work;
+	/* Pages freed by compacting this class; protected by lock */
+	unsigned long pages_compacted;
 };
 
 /* huge object: pages_per_zspage == 1 && maxobj_per_zspage == 1 */
@@ -258,7 +278,8 @@ struct zs_pool {
 
 	atomic_long_t pages_allocated;
 
-	struct zs_pool_stats stats;
+	/* How many pages were migrated (freed) */
+	atomic_long_t pages_compacted;
 
 	/* Compact classes */
 	struct shrinker shrinker;
@@ -302,6 +323,11 @@ struct mapping_area {
 	enum zs_mapmode vm_mm; /* mapping mode */
 };
 
+static unsigned long zs_can_compact(struct size_class *class);
+static unsigned int zs_frag_ratio(struct size_class *class);
+static bool zs_need_bg_compact(struct size_class *class);
+static void zs_compact_work(struct work_struct *work);
+
 #ifdef CONFIG_COMPACTION
 static int zs_register_migration(struct zs_pool *pool);
 static void zs_unregister_migration(struct zs_pool *pool);
@@ -585,8 +611,6 @@ static void __exit zs_stat_exit(void)
 	debugfs_remove_recursive(zs_stat_root);
 }
 
-static unsigned long zs_can_compact(struct size_class *class);
-
 static int zs_stats_size_show(struct seq_file *s, void *v)
 {
 	int i;
@@ -595,14 +619,17 @@ static int zs_stats_size_show(struct seq_file *s, void *v)
 	int objs_per_zspage;
 	unsigned long class_almost_full, class_almost_empty;
 	unsigned long obj_allocated, obj_used, pages_used, freeable;
+	unsigned long compacted;
+	unsigned int frag;
 	unsigned long total_class_almost_full = 0, total_class_almost_empty = 0;
 	unsigned long total_objs = 0, total_used_objs = 0, total_pages = 0;
-	unsigned long total_freeable = 0;
+	unsigned long total_freeable = 0, total_compacted = 0;
 
-	seq_printf(s, " %5s %5s %11s %12s %13s %10s %10s %16s %8s\n",
+	seq_printf(s, " %5s %5s %11s %12s %13s %10s %10s %16s %8s %5s %10s\n",
 			"class", "size", "almost_full", "almost_empty",
 			"obj_allocated", "obj_used", "pages_used",
-			"pages_per_zspage", "freeable");
+			"pages_per_zspage", "freeable", "frag%",
+			"compacted");
 
 	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
 		class = pool->size_class[i];
@@ -616,6 +643,8 @@ static int zs_stats_size_show(struct seq_file *s, void *v)
 		obj_allocated = zs_stat_get(class, OBJ_ALLOCATED);
 		obj_used = zs_stat_get(class, OBJ_USED);
 		freeable = zs_can_compact(class);
+		frag = zs_frag_ratio(class);
+		compacted = class->pages_compacted;
 		spin_unlock(&class->lock);
 
 		objs_per_zspage = class->objs_per_zspage;
@@ -623,10 +652,10 @@ static int zs_stats_size_show(struct seq_file *s, void *v)
 				class->pages_per_zspage;
 
 		seq_printf(s, " %5u %5u %11lu %12lu %13lu"
-				" %10lu %10lu %16d %8lu\n",
+				" %10lu %10lu %16d %8lu %5u %10lu\n",
 			i, class->size, class_almost_full, class_almost_empty,
 			obj_allocated, obj_used, pages_used,
-			class->pages_per_zspage, freeable);
+			class->pages_per_zspage, freeable, frag, compacted);
 
 		total_class_almost_full += class_almost_full;
 		total_class_almost_empty += class_almost_empty;
@@ -634,13 +663,17 @@ static int zs_stats_size_show(struct seq_file *s, void *v)
 		total_used_objs += obj_used;
 		total_pages += pages_used;
 		total_freeable += freeable;
+		total_compacted += compacted;
 	}
 
 	seq_puts(s, "\n");
-	seq_printf(s, " %5s %5s %11lu %12lu %13lu %10lu %10lu %16s %8lu\n",
+	seq_printf(s, " %5s %5s %11lu %12lu %13lu %10lu %10lu %16s %8lu %5u %10lu\n",
 			"Total", "", total_class_almost_full,
 			total_class_almost_empty, total_objs,
-			total_used_objs, total_pages, "", total_freeable);
+			total_used_objs, total_pages, "", total_freeable,
+			total_objs ? (unsigned int)((total_objs -
+				total_used_objs) * 100 / total_objs) : 0,
+			total_compacted);
 
 	return 0;
 }
@@ -1548,7 +1581,7 @@ void zs_free(struct zs_pool *pool, unsigned long handle)
 	int class_idx;
 	struct size_class *class;
 	enum fullness_group fullness;
-	bool isolated;
+	bool isolated, kick;
 
 	if (unlikely(!handle))
 		return;
@@ -1577,10 +1610,13 @@ void zs_free(struct zs_pool *pool, unsigned long handle)
 	if (likely(!isolated))
 		free_zspage(pool, class, zspage);
 out:
-
+	kick = zs_need_bg_compact(class);
 	spin_unlock(&class->lock);
 	unpin_tag(handle);
 	cache_free_handle(pool, handle);
+
+	if (kick)
+		queue_work(system_unbound_wq, &class->compact_work);
 }
 EXPORT_SYMBOL_GPL(zs_free);
 
@@ -2264,14 +2300,47 @@ static unsigned long zs_can_compact(struct size_class *class)
 	return obj_wasted * class->pages_per_zspage;
 }
 
-static void __zs_compact(struct zs_pool *pool, struct size_class *class)
+/*
+ * Percentage of allocated objects in @class that are unused, i.e. how
+ * much of the class's memory is lost to fragmentation.
+ */
+static unsigned int zs_frag_ratio(struct size_class *class)
+{
+	unsigned long obj_allocated = zs_stat_get(class, OBJ_ALLOCATED);
+	unsigned long obj_used = zs_stat_get(class, OBJ_USED);
+
+	if (!obj_allocated || obj_allocated <= obj_used)
+		return 0;
+
+	return (obj_allocated - obj_used) * 100 / obj_allocated;
+}
+
+/* Caller should hold class->lock */
+static bool zs_need_bg_compact(struct size_class *class)
+{
+	unsigned int ratio = READ_ONCE(bg_compact_ratio);
+
+	if (!ratio || !zs_can_compact(class))
+		return false;
+
+	return zs_frag_ratio(class) >= ratio;
+}
+
+/*
+ * Compact @class, migrating objects out of at most @nr_src source zspages.
+ * Returns the number of pages freed.
+ */
+static unsigned long __zs_compact(struct zs_pool *pool,
+				  struct size_class *class,
+				  unsigned long nr_src)
 {
 	struct zs_compact_control cc;
-	struct zspage *src_zspage;
+	struct zspage *src_zspage = NULL;
 	struct zspage *dst_zspage = NULL;
+	unsigned long pages_freed = 0;
 
 	spin_lock(&class->lock);
-	while ((src_zspage = isolate_zspage(class, true))) {
+	while (nr_src && (src_zspage = isolate_zspage(class, true))) {
 
 		if (!zs_can_compact(class))
 			break;
@@ -2298,8 +2367,11 @@ static void __zs_compact(struct zs_pool *pool, struct size_class *class)
 		putback_zspage(class, dst_zspage);
 		if (putback_zspage(class, src_zspage) == ZS_EMPTY) {
 			free_zspage(pool, class, src_zspage);
-			pool->stats.pages_compacted += class->pages_per_zspage;
+			class->pages_compacted += class->pages_per_zspage;
+			pages_freed += class->pages_per_zspage;
 		}
+		src_zspage = NULL;
+		nr_src--;
 		spin_unlock(&class->lock);
 		cond_resched();
 		spin_lock(&class->lock);
@@ -2309,6 +2381,32 @@ static void __zs_compact(struct zs_pool *pool, struct size_class *class)
 		putback_zspage(class, src_zspage);
 
 	spin_unlock(&class->lock);
+
+	atomic_long_add(pages_freed, &pool->pages_compacted);
+	return pages_freed;
+}
+
+/*
+ * Background compaction of a single size class. Each class has its own
+ * work item on the unbound workqueue, so fragmented classes are compacted
+ * in parallel and only ever contend on their own lock. A run is limited to
+ * ZS_COMPACT_BATCH source zspages and requeues itself while the class is
+ * still above the fragmentation threshold.
+ */
+static void zs_compact_work(struct work_struct *work)
+{
+	struct size_class *class = container_of(work, struct size_class,
+						compact_work);
+	bool again;
+
+	__zs_compact(class->pool, class, ZS_COMPACT_BATCH);
+
+	spin_lock(&class->lock);
+	again = zs_need_bg_compact(class);
+	spin_unlock(&class->lock);
+
+	if (again)
+		queue_work(system_unbound_wq, &class->compact_work);
 }
 
 unsigned long zs_compact(struct zs_pool *pool)
@@ -2322,16 +2420,16 @@ unsigned long zs_compact(struct zs_pool *pool)
 			continue;
 		if (class->index != i)
 			continue;
-		__zs_compact(pool, class);
+		__zs_compact(pool, class, ULONG_MAX);
 	}
 
-	return pool->stats.pages_compacted;
+	return atomic_long_read(&pool->pages_compacted);
 }
 EXPORT_SYMBOL_GPL(zs_compact);
 
 void zs_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
 {
-	memcpy(stats, &pool->stats, sizeof(struct zs_pool_stats));
+	stats->pages_compacted = atomic_long_read(&pool->pages_compacted);
 }
 EXPORT_SYMBOL_GPL(zs_pool_stats);
 
@@ -2342,7 +2440,7 @@ static unsigned long zs_shrinker_scan(struct shrinker *shrinker,
 	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
 			shrinker);
 
-	pages_freed = pool->stats.pages_compacted;
+	pages_freed = atomic_long_read(&pool->pages_compacted);
 	/*
 	 * Compact classes and calculate compaction delta.
 	 * Can run concurrently with a manually triggered
@@ -2485,6 +2583,8 @@ struct zs_pool *zs_create_pool(const char *name)
 		class->index = i;
 		class->pages_per_zspage = pages_per_zspage;
 		class->objs_per_zspage = objs_per_zspage;
+		class->pool = pool;
+		INIT_WORK(&class->compact_work, zs_compact_work);
 		spin_lock_init(&class->lock);
 		pool->size_class[i] = class;
 		for (fullness = ZS_EMPTY; fullness < NR_ZS_FULLNESS;
@@ -2521,6 +2621,12 @@ void zs_destroy_pool(struct zs_pool *pool)
 	int i;
 
 	zs_unregister_shrinker(pool);
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = pool->size_class[i];
+
+		if (class && class->index == i)
+			cancel_work_sync(&class->compact_work);
+	}
 	zs_unregister_migration(pool);
 	zs_pool_stat_destroy(pool);
 
@@ -45,6 +45,7 @@ int __get_compat_msghdr(struct msghdr *kmsg,
 		return -EFAULT;
 
 	kmsg->msg_flags = msg.msg_flags;
+	kmsg->msg_ubuf = NULL;
 	kmsg->msg_namelen = msg.msg_namelen;
 
 	if (!msg.msg_name)
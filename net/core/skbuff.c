@@ -1116,6 +1116,7 @@ struct ubuf_info *sock_zerocopy_alloc(struct sock *sk, size_t size)
 	uarg->len = 1;
 	uarg->bytelen = size;
 	uarg->zerocopy = 1;
+	uarg->flags = UBUF_F_SHARED;
 	refcount_set(&uarg->refcnt, 1);
 	sock_hold(sk);
 
@@ -1135,6 +1136,10 @@ struct ubuf_info *sock_zerocopy_realloc(struct sock *sk, size_t size,
 		const u32 byte_limit = 1 << 19;		/* limit to a few TSO */
 		u32 bytelen, next;
 
+		/* only MSG_ZEROCOPY uargs can be extended, not e.g. io_uring's */
+		if (uarg->callback != sock_zerocopy_callback)
+			goto new_alloc;
+
 		/* realloc only when socket is locked (TCP, UDP cork),
 		 * so uarg->len and sk_zckey access is serialized
 		 */
@@ -1992,6 +1992,7 @@ int __sys_sendto(int fd, void __user *buff, size_t len, unsigned int flags,
 	if (sock->file->f_flags & O_NONBLOCK)
 		flags |= MSG_DONTWAIT;
 	msg.msg_flags = flags;
+	msg.msg_ubuf = NULL;
 	err = sock_sendmsg(sock, &msg);
 
 out_put:
@@ -2238,6 +2239,7 @@ int __copy_msghdr_from_user(struct msghdr *kmsg,
 	kmsg->msg_control_user = msg.msg_control;
 	kmsg->msg_controllen = msg.msg_controllen;
 	kmsg->msg_flags = msg.msg_flags;
+	kmsg->msg_ubuf = NULL;
 
 	kmsg->msg_namelen = msg.msg_namelen;
 	if (!msg.msg_name)
@@ -0,0 +1,278 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Multi-cgroup reclaim benchmark for LRU lock contention.
+ *
+ * A number of "reclaimer" cgroups have a memory.max well below their page
+ * cache working set, so they keep reclaiming their own LRU lists. At the
+ * same time an unlimited "inserter" cgroup adds fresh page cache and
+ * measures how many pages per second it manages to insert.
+ *
+ * With a node-wide LRU lock the inserter is stalled by every reclaimer
+ * on the node. With per-memcg LRU locks the reclaimers only contend with
+ * themselves, and the inserter's throughput should stay close to the
+ * baseline measured without reclaimers.
+ *
+ * The test reports both rates and their ratio; it only fails if the
+ * cgroups can't be set up.
+ */
+#define _GNU_SOURCE
+
+#include <linux/limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../kselftest.h"
+#include "cgroup_util.h"
+
+#define RECLAIMER_MAX		MB(32)
+#define RECLAIMER_FILE		MB(128)
+#define INSERTER_FILE		MB(64)
+#define MAX_RECLAIMERS		16
+#define DEFAULT_DURATION	10
+
+static int duration = DEFAULT_DURATION;
+static int nr_reclaimers;
+
+struct inserter_result {
+	unsigned long pages;
+	double seconds;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int read_file(int fd, size_t size)
+{
+	char buf[PAGE_SIZE];
+	size_t off;
+
+	for (off = 0; off < size; off += sizeof(buf))
+		if (pread(fd, buf, sizeof(buf), off) < 0)
+			return -1;
+
+	return 0;
+}
+
+/* Keep cycling a page cache working set 4x larger than memory.max */
+static int reclaimer_fn(const char *cgroup, void *arg)
+{
+	int fd;
+
+	fd = get_temp_fd();
+	if (fd < 0)
+		return EXIT_FAILURE;
+
+	if (ftruncate(fd, RECLAIMER_FILE))
+		return EXIT_FAILURE;
+
+	for (;;)
+		if (read_file(fd, RECLAIMER_FILE))
+			return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
+
+/* Insert fresh page cache and drop it again, counting the inserts */
+static int inserter_fn(const char *cgroup, void *arg)
+{
+	struct inserter_result *res = arg;
+	double start, end;
+	int fd;
+
+	fd = get_temp_fd();
+	if (fd < 0)
+		return EXIT_FAILURE;
+
+	if (ftruncate(fd, INSERTER_FILE))
+		return EXIT_FAILURE;
+
+	start = now();
+	end = start + duration;
+	res->pages = 0;
+
+	while (now() < end) {
+		if (read_file(fd, INSERTER_FILE))
+			return EXIT_FAILURE;
+		res->pages += INSERTER_FILE / PAGE_SIZE;
+		posix_fadvise(fd, 0, INSERTER_FILE, POSIX_FADV_DONTNEED);
+	}
+
+	res->seconds = now() - start;
+	close(fd);
+
+	return EXIT_SUCCESS;
+}
+
+static int run_inserter(const char *cgroup, struct inserter_result *res)
+{
+	if (cg_run(cgroup, inserter_fn, res))
+		return -1;
+
+	return res->seconds > 0 ? 0 : -1;
+}
+
+static int test_lru_contention(const char *root)
+{
+	char *parent, *inserter = NULL, *reclaimers[MAX_RECLAIMERS] = { NULL };
+	int pids[MAX_RECLAIMERS] = { 0 };
+	struct inserter_result *res;
+	double base_rate, loaded_rate;
+	int ret = KSFT_FAIL;
+	char max[32];
+	int i;
+
+	res = mmap(NULL, sizeof(*res), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (res == MAP_FAILED)
+		return KSFT_FAIL;
+
+	parent = cg_name(root, "lru_contention");
+	if (!parent)
+		goto cleanup_map;
+
+	if (cg_create(parent))
+		goto cleanup_free;
+
+	if (cg_write(parent, "cgroup.subtree_control", "+memory"))
+		goto cleanup;
+
+	inserter = cg_name(parent, "inserter");
+	if (!inserter || cg_create(inserter))
+		goto cleanup;
+
+	snprintf(max, sizeof(max), "%d", RECLAIMER_MAX);
+	for (i = 0; i < nr_reclaimers; i++) {
+		reclaimers[i] = cg_name_indexed(parent, "reclaimer", i);
+		if (!reclaimers[i] || cg_create(reclaimers[i]))
+			goto cleanup;
+		if (cg_write(reclaimers[i], "memory.max", max))
+			goto cleanup;
+		if (cg_write(reclaimers[i], "memory.swap.max", "0") &&
+		    errno != ENOENT)
+			goto cleanup;
+	}
+
+	/* Baseline: page cache inserts on an otherwise idle node */
+	if (run_inserter(inserter, res))
+		goto cleanup;
+	base_rate = res->pages / res->seconds;
+
+	/* Now with every reclaimer cgroup under constant limit reclaim */
+	for (i = 0; i < nr_reclaimers; i++) {
+		pids[i] = cg_run_nowait(reclaimers[i], reclaimer_fn, NULL);
+		if (pids[i] < 0)
+			goto cleanup;
+	}
+
+	/* Let the reclaimers fill up to their limits */
+	sleep(2);
+
+	if (run_inserter(inserter, res))
+		goto cleanup;
+	loaded_rate = res->pages / res->seconds;
+
+	ksft_print_msg("reclaimers: %d, duration: %ds\n",
+		       nr_reclaimers, duration);
+	ksft_print_msg("inserts alone:           %.0f pages/s\n", base_rate);
+	ksft_print_msg("inserts under reclaim:   %.0f pages/s (%.1f%%)\n",
+		       loaded_rate, 100.0 * loaded_rate / base_rate);
+	for (i = 0; i < nr_reclaimers; i++)
+		ksft_print_msg("reclaimer %d pgscan:      %ld\n", i,
+			       cg_read_key_long(reclaimers[i], "memory.stat",
+						"pgscan "));
+
+	ret = KSFT_PASS;
+
+cleanup:
+	for (i = 0; i < nr_reclaimers; i++) {
+		if (pids[i] > 0) {
+			kill(pids[i], SIGKILL);
+			waitpid(pids[i], NULL, 0);
+		}
+		if (reclaimers[i]) {
+			cg_destroy(reclaimers[i]);
+			free(reclaimers[i]);
+		}
+	}
+	if (inserter) {
+		cg_destroy(inserter);
+		free(inserter);
+	}
+	cg_destroy(parent);
+cleanup_free:
+	free(parent);
+cleanup_map:
+	munmap(res, sizeof(*res));
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	char root[PATH_MAX];
+	int ret = EXIT_SUCCESS;
+	int opt;
+
+	nr_reclaimers = sysconf(_SC_NPROCESSORS_ONLN) / 2;
+
+	while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_reclaimers = atoi(optarg);
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n reclaimers] [-t seconds]\n",
+				argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (nr_reclaimers < 1)
+		nr_reclaimers = 1;
+	if (nr_reclaimers > MAX_RECLAIMERS)
+		nr_reclaimers = MAX_RECLAIMERS;
+	if (duration < 1)
+		duration = DEFAULT_DURATION;
+
+	if (cg_find_unified_root(root, sizeof(root)))
+		ksft_exit_skip("cgroup v2 isn't mounted\n");
+
+	if (cg_read_strstr(root, "cgroup.controllers", "memory"))
+		ksft_exit_skip("memory controller isn't available\n");
+
+	if (cg_read_strstr(root, "cgroup.subtree_control", "memory"))
+		if (cg_write(root, "cgroup.subtree_control", "+memory"))
+			ksft_exit_skip("Failed to set memory controller\n");
+
+	switch (test_lru_contention(root)) {
+	case KSFT_PASS:
+		ksft_test_result_pass("test_lru_contention\n");
+		break;
+	case KSFT_SKIP:
+		ksft_test_result_skip("test_lru_contention\n");
+		break;
+	default:
+		ret = EXIT_FAILURE;
+		ksft_test_result_fail("test_lru_contention\n");
+		break;
+	}
+
+	return ret;
+}
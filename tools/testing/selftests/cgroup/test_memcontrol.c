@@ -1170,6 +1170,65 @@ static int test_memcg_oom_group_score_events(const char *root)
 }
 
 
+/*
+ * This test checks that memory.reclaim reclaims the requested amount
+ * of memory from a cgroup that has no limits set, and that it fails
+ * with EAGAIN when the request can't be fully satisfied.
+ */
+static int test_memcg_reclaim(const char *root)
+{
+	int ret = KSFT_FAIL, fd, retries;
+	char *memcg;
+	long current;
+
+	memcg = cg_name(root, "memcg_test");
+	if (!memcg)
+		goto cleanup;
+
+	if (cg_create(memcg))
+		goto cleanup;
+
+	fd = get_temp_fd();
+	if (fd < 0)
+		goto cleanup;
+
+	cg_run_nowait(memcg, alloc_pagecache_50M_noexit, (void *)(long)fd);
+
+	/* Wait until the page cache is charged */
+	for (retries = 10; retries > 0; retries--) {
+		current = cg_read_long(memcg, "memory.current");
+		if (values_close(current, MB(50), 3))
+			break;
+		sleep(1);
+	}
+	if (!retries)
+		goto cleanup_fd;
+
+	if (!cg_write(memcg, "memory.reclaim", "10M swappiness=201"))
+		goto cleanup_fd;
+
+	if (cg_write(memcg, "memory.reclaim", "30M swappiness=0"))
+		goto cleanup_fd;
+
+	current = cg_read_long(memcg, "memory.current");
+	if (!values_close(current, MB(20), 10))
+		goto cleanup_fd;
+
+	/* Only ~20M are left, so this can only partially succeed */
+	if (!cg_write(memcg, "memory.reclaim", "100M") || errno != EAGAIN)
+		goto cleanup_fd;
+
+	ret = KSFT_PASS;
+
+cleanup_fd:
+	close(fd);
+cleanup:
+	cg_destroy(memcg);
+	free(memcg);
+
+	return ret;
+}
+
 #define T(x) { x, #x }
 struct memcg_test {
 	int (*fn)(const char *root);
@@ -1187,6 +1246,7 @@ struct memcg_test {
 	T(test_memcg_oom_group_leaf_events),
 	T(test_memcg_oom_group_parent_events),
 	T(test_memcg_oom_group_score_events),
+	T(test_memcg_reclaim),
 };
 #undef T
 
@@ -0,0 +1,341 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Measure epoll event throughput with many producers and many waiters
+ * sharing a single epoll instance.
+ *
+ * nr_fds eventfds are registered with EPOLLIN | EPOLLET | EPOLLEXCLUSIVE.
+ * Producer threads keep signalling them round-robin, waiter threads sit
+ * in epoll_wait() on the shared epoll fd and drain every eventfd they are
+ * handed. The reported rate is the number of events harvested per second.
+ *
+ * -m picks the ready list: "shared" is the default single ready list, and
+ * "percpu" creates the instance with EPOLL_PERCPU. -W picks the wait call:
+ * "ms" is epoll_wait() with a millisecond timeout, and "ns" is
+ * epoll_pwait2() with a timeout of -T nanoseconds. Usage:
+ *
+ *   epoll_scale_bench [-m shared|percpu] [-W ms|ns] [-w waiters]
+ *                     [-p producers] [-n nr_fds] [-T timeout_ns]
+ *                     [-d seconds]
+ *
+ * Without -m and -W, every combination is run in turn. Combinations the
+ * running kernel doesn't support are reported as skipped.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <error.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/time_types.h>
+
+#ifndef EPOLL_PERCPU
+#define EPOLL_PERCPU		0x00000001
+#endif
+#ifndef __NR_epoll_pwait2
+#define __NR_epoll_pwait2	440
+#endif
+
+#define MAX_THREADS		256
+#define MAX_FDS			65536
+#define MAX_EVENTS		64
+
+enum { MODE_SHARED, MODE_PERCPU, NR_MODES };
+enum { WAIT_MS, WAIT_NS, NR_WAITS };
+
+static const char * const mode_names[NR_MODES] = { "shared", "percpu" };
+static const char * const wait_names[NR_WAITS] = { "ms", "ns" };
+
+static int cfg_mode = -1;
+static int cfg_wait = -1;
+static int cfg_waiters = 64;
+static int cfg_producers;
+static int cfg_nr_fds = 1024;
+static long cfg_timeout_ns = 50000;
+static int cfg_duration = 5;
+
+static volatile bool stop;
+static int epfd;
+static int wait_type;
+static int *fds;
+
+struct thread_data {
+	pthread_t thread;
+	int id;
+	unsigned long count;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int sys_epoll_pwait2(int fd, struct epoll_event *events,
+			    int maxevents, struct __kernel_timespec *timeout)
+{
+	return syscall(__NR_epoll_pwait2, fd, events, maxevents, timeout,
+		       NULL, 0);
+}
+
+static int wait_events(struct epoll_event *events)
+{
+	struct __kernel_timespec ts = {
+		.tv_sec = cfg_timeout_ns / 1000000000L,
+		.tv_nsec = cfg_timeout_ns % 1000000000L,
+	};
+
+	if (wait_type == WAIT_NS)
+		return sys_epoll_pwait2(epfd, events, MAX_EVENTS, &ts);
+	return epoll_wait(epfd, events, MAX_EVENTS, 1);
+}
+
+static void *producer_fn(void *arg)
+{
+	struct thread_data *td = arg;
+	uint64_t val = 1;
+	int i = td->id;
+
+	while (!stop) {
+		if (write(fds[i], &val, sizeof(val)) != sizeof(val) &&
+		    errno != EAGAIN)
+			error(1, errno, "write");
+		td->count++;
+		i = (i + cfg_producers) % cfg_nr_fds;
+	}
+
+	return NULL;
+}
+
+static void *waiter_fn(void *arg)
+{
+	struct epoll_event events[MAX_EVENTS];
+	struct thread_data *td = arg;
+	uint64_t val;
+	int i, ret;
+
+	while (!stop) {
+		ret = wait_events(events);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			error(1, errno, "epoll wait");
+		}
+		for (i = 0; i < ret; i++) {
+			if (read(fds[events[i].data.u32], &val,
+				 sizeof(val)) < 0 && errno != EAGAIN)
+				error(1, errno, "read");
+		}
+		td->count += ret;
+	}
+
+	return NULL;
+}
+
+/* Returns false if the running kernel doesn't support the combination */
+static bool setup(int mode)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLET | EPOLLEXCLUSIVE,
+	};
+	struct epoll_event probe;
+	struct __kernel_timespec ts = { 0 };
+	int i;
+
+	epfd = epoll_create1(mode == MODE_PERCPU ? EPOLL_PERCPU : 0);
+	if (epfd < 0) {
+		if (errno == EINVAL)
+			return false;
+		error(1, errno, "epoll_create1");
+	}
+
+	if (wait_type == WAIT_NS &&
+	    sys_epoll_pwait2(epfd, &probe, 1, &ts) < 0) {
+		if (errno != ENOSYS)
+			error(1, errno, "epoll_pwait2");
+		close(epfd);
+		return false;
+	}
+
+	for (i = 0; i < cfg_nr_fds; i++) {
+		fds[i] = eventfd(0, EFD_NONBLOCK);
+		if (fds[i] < 0)
+			error(1, errno, "eventfd");
+		ev.data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev))
+			error(1, errno, "epoll_ctl");
+	}
+
+	return true;
+}
+
+static void teardown(void)
+{
+	int i;
+
+	for (i = 0; i < cfg_nr_fds; i++)
+		close(fds[i]);
+	close(epfd);
+}
+
+static void start_threads(struct thread_data *td, int nr, void *(*fn)(void *))
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		td[i].id = i;
+		td[i].count = 0;
+		if (pthread_create(&td[i].thread, NULL, fn, &td[i]))
+			error(1, 0, "pthread_create");
+	}
+}
+
+static unsigned long join_threads(struct thread_data *td, int nr)
+{
+	unsigned long count = 0;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		pthread_join(td[i].thread, NULL);
+		count += td[i].count;
+	}
+
+	return count;
+}
+
+static void run(int mode, int wait)
+{
+	static struct thread_data waiters[MAX_THREADS];
+	static struct thread_data producers[MAX_THREADS];
+	unsigned long nr_events, nr_writes;
+	double start, elapsed;
+
+	wait_type = wait;
+	if (!setup(mode)) {
+		fprintf(stderr, "%-7s %-3s %12s\n", mode_names[mode],
+			wait_names[wait], "skipped");
+		return;
+	}
+
+	stop = false;
+	start = now();
+	start_threads(waiters, cfg_waiters, waiter_fn);
+	start_threads(producers, cfg_producers, producer_fn);
+
+	sleep(cfg_duration);
+	stop = true;
+
+	nr_writes = join_threads(producers, cfg_producers);
+	nr_events = join_threads(waiters, cfg_waiters);
+	elapsed = now() - start;
+
+	fprintf(stderr, "%-7s %-3s %12.0f events/s %12.0f writes/s\n",
+		mode_names[mode], wait_names[wait], nr_events / elapsed,
+		nr_writes / elapsed);
+
+	teardown();
+}
+
+static int parse_name(const char * const *names, int nr, const char *arg)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (!strcmp(names[i], arg))
+			return i;
+
+	error(1, 0, "unknown argument: %s", arg);
+	return -1;
+}
+
+static int parse_nr(const char *arg, int max)
+{
+	int nr = atoi(arg);
+
+	if (nr < 1 || nr > max)
+		error(1, 0, "argument out of range [1, %d]: %s", max, arg);
+	return nr;
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c;
+
+	cfg_producers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cfg_producers > MAX_THREADS)
+		cfg_producers = MAX_THREADS;
+
+	while ((c = getopt(argc, argv, "m:W:w:p:n:T:d:")) != -1) {
+		switch (c) {
+		case 'm':
+			cfg_mode = parse_name(mode_names, NR_MODES, optarg);
+			break;
+		case 'W':
+			cfg_wait = parse_name(wait_names, NR_WAITS, optarg);
+			break;
+		case 'w':
+			cfg_waiters = parse_nr(optarg, MAX_THREADS);
+			break;
+		case 'p':
+			cfg_producers = parse_nr(optarg, MAX_THREADS);
+			break;
+		case 'n':
+			cfg_nr_fds = parse_nr(optarg, MAX_FDS);
+			break;
+		case 'T':
+			cfg_timeout_ns = atol(optarg);
+			break;
+		case 'd':
+			cfg_duration = parse_nr(optarg, INT32_MAX);
+			break;
+		default:
+			error(1, 0, "usage: %s [-m shared|percpu] [-W ms|ns] [-w waiters] [-p producers] [-n nr_fds] [-T timeout_ns] [-d seconds]",
+			      argv[0]);
+		}
+	}
+
+	if (cfg_producers > cfg_nr_fds)
+		cfg_producers = cfg_nr_fds;
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit rlim = { .rlim_cur = MAX_FDS + 64, .rlim_max = MAX_FDS + 64 };
+	int mode, wait;
+
+	parse_opts(argc, argv);
+
+	fds = calloc(cfg_nr_fds, sizeof(*fds));
+	if (!fds)
+		error(1, errno, "calloc");
+
+	setrlimit(RLIMIT_NOFILE, &rlim);
+
+	fprintf(stderr, "waiters: %d, producers: %d, fds: %d, duration: %ds\n",
+		cfg_waiters, cfg_producers, cfg_nr_fds, cfg_duration);
+
+	for (mode = 0; mode < NR_MODES; mode++) {
+		if (cfg_mode >= 0 && mode != cfg_mode)
+			continue;
+		for (wait = 0; wait < NR_WAITS; wait++) {
+			if (cfg_wait >= 0 && wait != cfg_wait)
+				continue;
+			run(mode, wait);
+		}
+	}
+
+	free(fds);
+	return 0;
+}
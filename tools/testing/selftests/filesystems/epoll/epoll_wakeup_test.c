@@ -0,0 +1,461 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "../../kselftest_harness.h"
+
+#ifndef EPOLL_PERCPU
+#define EPOLL_PERCPU	0x00000001
+#endif
+
+#define MAX_CPUS	8
+
+struct epoll_mtcontext {
+	int efd[2];
+	int sfd[2];
+	int count;
+
+	pthread_t waiter;
+};
+
+/*
+ * Create an EPOLL_PERCPU instance, or XFAIL the test on kernels that
+ * don't know the flag.
+ */
+#define percpu_epoll_create(_metadata) ({			\
+	int __fd = epoll_create1(EPOLL_PERCPU);			\
+								\
+	if (__fd < 0 && errno == EINVAL)			\
+		XFAIL(return, "EPOLL_PERCPU not supported");	\
+	ASSERT_GE(__fd, 0);					\
+	__fd;							\
+})
+
+static void *waiter_entry(void *data)
+{
+	struct epoll_event e;
+	struct epoll_mtcontext *ctx = data;
+
+	if (epoll_wait(ctx->efd[0], &e, 1, -1) > 0)
+		__sync_fetch_and_add(&ctx->count, 1);
+
+	return NULL;
+}
+
+static void *waiter_entry_second(void *data)
+{
+	struct epoll_event e;
+	struct epoll_mtcontext *ctx = data;
+
+	if (epoll_wait(ctx->efd[1], &e, 1, -1) > 0)
+		__sync_fetch_and_add(&ctx->count, 1);
+
+	return NULL;
+}
+
+static void *emitter_entry(void *data)
+{
+	struct epoll_mtcontext *ctx = data;
+
+	usleep(100000);
+	write(ctx->sfd[1], "w", 1);
+
+	return NULL;
+}
+
+/*
+ *          t0
+ *           | (ew)
+ *          e0 (percpu)
+ *           | (lt)
+ *          s0
+ */
+TEST(epoll_percpu_lt)
+{
+	int efd;
+	int sfd[2];
+	struct epoll_event e;
+
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sfd), 0);
+
+	efd = percpu_epoll_create(_metadata);
+
+	e.events = EPOLLIN;
+	ASSERT_EQ(epoll_ctl(efd, EPOLL_CTL_ADD, sfd[0], &e), 0);
+
+	ASSERT_EQ(write(sfd[1], "w", 1), 1);
+
+	EXPECT_EQ(epoll_wait(efd, &e, 1, 0), 1);
+	EXPECT_EQ(e.events, EPOLLIN);
+	EXPECT_EQ(epoll_wait(efd, &e, 1, 0), 1);
+
+	close(efd);
+	close(sfd[0]);
+	close(sfd[1]);
+}
+
+/*
+ *          t0
+ *           | (ew)
+ *          e0 (percpu)
+ *           | (et)
+ *          s0
+ */
+TEST(epoll_percpu_et)
+{
+	int efd;
+	int sfd[2];
+	struct epoll_event e;
+
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sfd), 0);
+
+	efd = percpu_epoll_create(_metadata);
+
+	e.events = EPOLLIN | EPOLLET;
+	ASSERT_EQ(epoll_ctl(efd, EPOLL_CTL_ADD, sfd[0], &e), 0);
+
+	ASSERT_EQ(write(sfd[1], "w", 1), 1);
+
+	EXPECT_EQ(epoll_wait(efd, &e, 1, 0), 1);
+	EXPECT_EQ(e.events, EPOLLIN);
+	EXPECT_EQ(epoll_wait(efd, &e, 1, 0), 0);
+
+	/* A new edge queues the item again */
+	ASSERT_EQ(write(sfd[1], "w", 1), 1);
+	EXPECT_EQ(epoll_wait(efd, &e, 1, 0), 1);
+
+	close(efd);
+	close(sfd[0]);
+	close(sfd[1]);
+}
+
+/*
+ *        t0    t1
+ *     (ew) \  / (ew)
+ *           e0 (percpu)
+ *            | (lt)
+ *           s0
+ */
+TEST(epoll_percpu_lt_threads)
+{
+	pthread_t emitter;
+	struct epoll_event e;
+	struct epoll_mtcontext ctx = { 0 };
+
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, ctx.sfd), 0);
+
+	ctx.efd[0] = percpu_epoll_create(_metadata);
+
+	e.events = EPOLLIN;
+	ASSERT_EQ(epoll_ctl(ctx.efd[0], EPOLL_CTL_ADD, ctx.sfd[0], &e), 0);
+
+	ASSERT_EQ(pthread_create(&ctx.waiter, NULL, waiter_entry, &ctx), 0);
+	ASSERT_EQ(pthread_create(&emitter, NULL, emitter_entry, &ctx), 0);
+
+	EXPECT_EQ(epoll_wait(ctx.efd[0], &e, 1, -1), 1);
+
+	ASSERT_EQ(pthread_join(ctx.waiter, NULL), 0);
+	ASSERT_EQ(pthread_join(emitter, NULL), 0);
+
+	EXPECT_EQ(ctx.count, 1);
+
+	close(ctx.efd[0]);
+	close(ctx.sfd[0]);
+	close(ctx.sfd[1]);
+}
+
+/*
+ *        t0    t1
+ *     (ew) \  / (ew)
+ *           e0 (percpu)
+ *            | (et)
+ *           s0
+ */
+TEST(epoll_percpu_et_threads)
+{
+	pthread_t emitter;
+	struct epoll_event e;
+	struct epoll_mtcontext ctx = { 0 };
+
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, ctx.sfd), 0);
+
+	ctx.efd[0] = percpu_epoll_create(_metadata);
+
+	e.events = EPOLLIN | EPOLLET;
+	ASSERT_EQ(epoll_ctl(ctx.efd[0], EPOLL_CTL_ADD, ctx.sfd[0], &e), 0);
+
+	ASSERT_EQ(pthread_create(&ctx.waiter, NULL, waiter_entry, &ctx), 0);
+	ASSERT_EQ(pthread_create(&emitter, NULL, emitter_entry, &ctx), 0);
+
+	/* A single edge is reported to exactly one of the two waiters */
+	if (epoll_wait(ctx.efd[0], &e, 1, 500) > 0) {
+		usleep(100000);
+		EXPECT_EQ(ctx.count, 0);
+
+		/* main thread got it, a new edge lets the waiter go */
+		ASSERT_EQ(write(ctx.sfd[1], "w", 1), 1);
+	}
+
+	ASSERT_EQ(pthread_join(emitter, NULL), 0);
+	ASSERT_EQ(pthread_join(ctx.waiter, NULL), 0);
+
+	EXPECT_EQ(ctx.count, 1);
+
+	close(ctx.efd[0]);
+	close(ctx.sfd[0]);
+	close(ctx.sfd[1]);
+}
+
+/*
+ *        t0    t1
+ *     (ew) |    | (ew)
+ *         e0    e1 (percpu)
+ *     (lt) \    / (lt, exclusive)
+ *            s0
+ */
+TEST(epoll_percpu_exclusive)
+{
+	struct epoll_event e;
+	pthread_t waiter_second;
+	struct epoll_mtcontext ctx = { 0 };
+
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, ctx.sfd), 0);
+
+	ctx.efd[0] = percpu_epoll_create(_metadata);
+	ctx.efd[1] = percpu_epoll_create(_metadata);
+
+	e.events = EPOLLIN | EPOLLEXCLUSIVE;
+	ASSERT_EQ(epoll_ctl(ctx.efd[0], EPOLL_CTL_ADD, ctx.sfd[0], &e), 0);
+	ASSERT_EQ(epoll_ctl(ctx.efd[1], EPOLL_CTL_ADD, ctx.sfd[0], &e), 0);
+
+	/* Exclusive items can't be modified */
+	e.events = EPOLLIN;
+	EXPECT_EQ(epoll_ctl(ctx.efd[0], EPOLL_CTL_MOD, ctx.sfd[0], &e), -1);
+	EXPECT_EQ(errno, EINVAL);
+
+	ASSERT_EQ(pthread_create(&ctx.waiter, NULL, waiter_entry, &ctx), 0);
+	ASSERT_EQ(pthread_create(&waiter_second, NULL, waiter_entry_second,
+				 &ctx), 0);
+
+	usleep(100000);
+	ASSERT_EQ(write(ctx.sfd[1], "w", 1), 1);
+	usleep(100000);
+
+	/* At least one instance is woken, the other may keep sleeping */
+	EXPECT_GE(ctx.count, 1);
+
+	if (ctx.count < 2)
+		ASSERT_EQ(write(ctx.sfd[1], "w", 1), 1);
+
+	ASSERT_EQ(pthread_join(ctx.waiter, NULL), 0);
+	ASSERT_EQ(pthread_join(waiter_second, NULL), 0);
+
+	EXPECT_EQ(ctx.count, 2);
+
+	close(ctx.efd[0]);
+	close(ctx.efd[1]);
+	close(ctx.sfd[0]);
+	close(ctx.sfd[1]);
+}
+
+/*
+ *          t0
+ *           | (ew)
+ *          e0
+ *           | (lt)
+ *          e1 (percpu)
+ *           | (et)
+ *          s0
+ */
+TEST(epoll_percpu_nested)
+{
+	int efd[2];
+	int sfd[2];
+	struct epoll_event e;
+
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sfd), 0);
+
+	efd[0] = epoll_create1(0);
+	ASSERT_GE(efd[0], 0);
+
+	efd[1] = percpu_epoll_create(_metadata);
+
+	e.events = EPOLLIN;
+	ASSERT_EQ(epoll_ctl(efd[0], EPOLL_CTL_ADD, efd[1], &e), 0);
+
+	e.events = EPOLLIN | EPOLLET;
+	ASSERT_EQ(epoll_ctl(efd[1], EPOLL_CTL_ADD, sfd[0], &e), 0);
+
+	ASSERT_EQ(write(sfd[1], "w", 1), 1);
+
+	/* The outer instance sees the item queued on the inner's CPU list */
+	EXPECT_EQ(epoll_wait(efd[0], &e, 1, 0), 1);
+	EXPECT_EQ(e.events, EPOLLIN);
+
+	EXPECT_EQ(epoll_wait(efd[1], &e, 1, 0), 1);
+	EXPECT_EQ(epoll_wait(efd[1], &e, 1, 0), 0);
+	EXPECT_EQ(epoll_wait(efd[0], &e, 1, 0), 0);
+
+	close(efd[0]);
+	close(efd[1]);
+	close(sfd[0]);
+	close(sfd[1]);
+}
+
+/*
+ *          t0    t1
+ *       (ew) \  / (ew)
+ *             e0 (percpu)
+ *              | (lt)
+ *             e1 (percpu)
+ *              | (lt)
+ *             s0
+ */
+TEST(epoll_percpu_nested_threads)
+{
+	pthread_t emitter;
+	struct epoll_event e;
+	struct epoll_mtcontext ctx = { 0 };
+
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, ctx.sfd), 0);
+
+	ctx.efd[0] = percpu_epoll_create(_metadata);
+	ctx.efd[1] = percpu_epoll_create(_metadata);
+
+	e.events = EPOLLIN;
+	ASSERT_EQ(epoll_ctl(ctx.efd[0], EPOLL_CTL_ADD, ctx.efd[1], &e), 0);
+	ASSERT_EQ(epoll_ctl(ctx.efd[1], EPOLL_CTL_ADD, ctx.sfd[0], &e), 0);
+
+	ASSERT_EQ(pthread_create(&ctx.waiter, NULL, waiter_entry, &ctx), 0);
+	ASSERT_EQ(pthread_create(&emitter, NULL, emitter_entry, &ctx), 0);
+
+	EXPECT_EQ(epoll_wait(ctx.efd[0], &e, 1, -1), 1);
+
+	ASSERT_EQ(pthread_join(ctx.waiter, NULL), 0);
+	ASSERT_EQ(pthread_join(emitter, NULL), 0);
+
+	EXPECT_EQ(ctx.count, 1);
+
+	close(ctx.efd[0]);
+	close(ctx.efd[1]);
+	close(ctx.sfd[0]);
+	close(ctx.sfd[1]);
+}
+
+/*
+ *          t0
+ *           | (ew)
+ *          e0 (percpu)
+ *           | (et, deleted while queued)
+ *          s0
+ */
+TEST(epoll_percpu_del_queued)
+{
+	int efd;
+	int sfd[2];
+	struct epoll_event e;
+
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sfd), 0);
+
+	efd = percpu_epoll_create(_metadata);
+
+	e.events = EPOLLIN | EPOLLET;
+	ASSERT_EQ(epoll_ctl(efd, EPOLL_CTL_ADD, sfd[0], &e), 0);
+
+	/* Queue the item on this CPU's list, then drop it before a wait */
+	ASSERT_EQ(write(sfd[1], "w", 1), 1);
+	ASSERT_EQ(epoll_ctl(efd, EPOLL_CTL_DEL, sfd[0], NULL), 0);
+
+	EXPECT_EQ(epoll_wait(efd, &e, 1, 0), 0);
+
+	/* The data is still there, so re-adding reports it again */
+	e.events = EPOLLIN;
+	ASSERT_EQ(epoll_ctl(efd, EPOLL_CTL_ADD, sfd[0], &e), 0);
+	EXPECT_EQ(epoll_wait(efd, &e, 1, 0), 1);
+
+	/* Same for an item that goes away with its file */
+	ASSERT_EQ(epoll_ctl(efd, EPOLL_CTL_DEL, sfd[0], NULL), 0);
+	e.events = EPOLLIN | EPOLLET;
+	ASSERT_EQ(epoll_ctl(efd, EPOLL_CTL_ADD, sfd[0], &e), 0);
+	ASSERT_EQ(write(sfd[1], "w", 1), 1);
+	close(sfd[0]);
+
+	EXPECT_EQ(epoll_wait(efd, &e, 1, 0), 0);
+
+	close(efd);
+	close(sfd[1]);
+}
+
+struct cpu_emitter {
+	int cpu;
+	int fd;
+};
+
+static void *cpu_emitter_entry(void *data)
+{
+	struct cpu_emitter *ce = data;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(ce->cpu, &set);
+	sched_setaffinity(0, sizeof(set), &set);
+
+	eventfd_write(ce->fd, 1);
+
+	return NULL;
+}
+
+/*
+ *          t0
+ *           | (ew)
+ *          e0 (percpu)
+ *       / ... \ (et)
+ *     f0  ...  fN, signalled from one CPU each
+ */
+TEST(epoll_percpu_cpus)
+{
+	struct epoll_event events[MAX_CPUS], e;
+	struct cpu_emitter ce[MAX_CPUS];
+	pthread_t emitters[MAX_CPUS];
+	cpu_set_t set;
+	int efd, cpu, i, n = 0;
+
+	ASSERT_EQ(sched_getaffinity(0, sizeof(set), &set), 0);
+
+	efd = percpu_epoll_create(_metadata);
+
+	for (cpu = 0; cpu < CPU_SETSIZE && n < MAX_CPUS; cpu++) {
+		if (!CPU_ISSET(cpu, &set))
+			continue;
+		ce[n].cpu = cpu;
+		ce[n].fd = eventfd(0, EFD_NONBLOCK);
+		ASSERT_GE(ce[n].fd, 0);
+
+		e.events = EPOLLIN | EPOLLET;
+		e.data.u32 = n;
+		ASSERT_EQ(epoll_ctl(efd, EPOLL_CTL_ADD, ce[n].fd, &e), 0);
+		n++;
+	}
+
+	for (i = 0; i < n; i++)
+		ASSERT_EQ(pthread_create(&emitters[i], NULL, cpu_emitter_entry,
+					 &ce[i]), 0);
+	for (i = 0; i < n; i++)
+		ASSERT_EQ(pthread_join(emitters[i], NULL), 0);
+
+	/* One wait collects the items from every CPU's list */
+	EXPECT_EQ(epoll_wait(efd, events, MAX_CPUS, 0), n);
+	EXPECT_EQ(epoll_wait(efd, events, MAX_CPUS, 0), 0);
+
+	for (i = 0; i < n; i++)
+		close(ce[i].fd);
+	close(efd);
+}
+
+TEST_HARNESS_MAIN
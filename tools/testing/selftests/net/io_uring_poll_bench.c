@@ -0,0 +1,608 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Compare socket readiness and accept throughput of epoll, one-shot
+ * io_uring requests and multishot io_uring requests.
+ *
+ * poll:   a writer thread keeps writing single bytes round-robin into
+ *         the peers of nr_fds unix socket pairs. The reader waits for
+ *         readiness with epoll_wait(), with one-shot IORING_OP_POLL_ADD
+ *         requests that are re-submitted after every event, or with
+ *         IORING_POLL_ADD_MULTI requests that stay armed, and drains the
+ *         socket on each event.
+ *
+ * accept: connector threads keep connecting to, and resetting, a TCP
+ *         listener on the loopback. The server accepts with epoll_wait()
+ *         plus accept4(), with one-shot IORING_OP_ACCEPT requests, or with
+ *         a single IORING_ACCEPT_MULTISHOT request.
+ *
+ * Rings are driven with raw syscalls, no liburing is needed. Usage:
+ *
+ *   io_uring_poll_bench [-t poll|accept] [-m epoll|oneshot|multishot]
+ *                       [-n nr_fds] [-c connectors] [-d seconds]
+ *
+ * Without -t and -m, every combination is run in turn.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup	425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter	426
+#endif
+
+#define RING_ENTRIES	4096
+#define MAX_FDS		(RING_ENTRIES / 2)
+#define MAX_CONNECTORS	64
+#define TIMEOUT_DATA	(~0ULL)
+
+enum test_type {
+	TEST_POLL,
+	TEST_ACCEPT,
+	NR_TESTS,
+};
+
+enum test_mode {
+	MODE_EPOLL,
+	MODE_ONESHOT,
+	MODE_MULTISHOT,
+	NR_MODES,
+};
+
+static const char * const test_names[NR_TESTS] = { "poll", "accept" };
+static const char * const mode_names[NR_MODES] = {
+	"epoll", "oneshot", "multishot"
+};
+
+static int cfg_type = -1;
+static int cfg_mode = -1;
+static int cfg_nr_fds = 256;
+static int cfg_connectors = 2;
+static int cfg_duration = 5;
+
+static volatile bool stop;
+
+struct ring {
+	int fd;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned int sq_entries;
+	unsigned int to_submit;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void ring_init(struct ring *r)
+{
+	struct io_uring_params p;
+	size_t sq_size, cq_size;
+	void *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+	if (r->fd < 0)
+		error(1, errno, "io_uring_setup");
+
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_size > sq_size)
+			sq_size = cq_size;
+		cq_size = sq_size;
+	}
+
+	sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		error(1, errno, "mmap sq ring");
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq = sq;
+	} else {
+		cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			error(1, errno, "mmap cq ring");
+	}
+
+	r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		error(1, errno, "mmap sqes");
+
+	r->sq_head = sq + p.sq_off.head;
+	r->sq_tail = sq + p.sq_off.tail;
+	r->sq_mask = sq + p.sq_off.ring_mask;
+	r->sq_array = sq + p.sq_off.array;
+	r->cq_head = cq + p.cq_off.head;
+	r->cq_tail = cq + p.cq_off.tail;
+	r->cq_mask = cq + p.cq_off.ring_mask;
+	r->cqes = cq + p.cq_off.cqes;
+	r->sq_entries = p.sq_entries;
+	r->to_submit = 0;
+}
+
+static struct io_uring_sqe *ring_get_sqe(struct ring *r)
+{
+	unsigned int tail = *r->sq_tail;
+	struct io_uring_sqe *sqe;
+
+	if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) ==
+	    r->sq_entries)
+		return NULL;
+
+	sqe = &r->sqes[tail & *r->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[tail & *r->sq_mask] = tail & *r->sq_mask;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	r->to_submit++;
+	return sqe;
+}
+
+/* Submit everything queued and wait for at least one completion */
+static void ring_submit_and_wait(struct ring *r)
+{
+	int ret;
+
+	ret = syscall(__NR_io_uring_enter, r->fd, r->to_submit, 1,
+		      IORING_ENTER_GETEVENTS, NULL, 0);
+	if (ret < 0 && errno != EINTR)
+		error(1, errno, "io_uring_enter");
+	if (ret > 0)
+		r->to_submit -= ret;
+}
+
+static struct io_uring_cqe *ring_peek_cqe(struct ring *r)
+{
+	unsigned int head = *r->cq_head;
+
+	if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &r->cqes[head & *r->cq_mask];
+}
+
+static void ring_cqe_seen(struct ring *r)
+{
+	__atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static void ring_exit(struct ring *r)
+{
+	close(r->fd);
+}
+
+static void prep_poll(struct ring *r, int fd, int idx, bool multishot)
+{
+	struct io_uring_sqe *sqe = ring_get_sqe(r);
+
+	if (!sqe)
+		error(1, 0, "submission queue full");
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll_events = POLLIN;
+	sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+	sqe->user_data = idx;
+}
+
+static void prep_accept(struct ring *r, int fd, bool multishot)
+{
+	struct io_uring_sqe *sqe = ring_get_sqe(r);
+
+	if (!sqe)
+		error(1, 0, "submission queue full");
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = fd;
+	sqe->ioprio = multishot ? IORING_ACCEPT_MULTISHOT : 0;
+}
+
+/*
+ * Keep a timeout armed, so that waiting for completions returns even when
+ * the load generators have stopped.
+ */
+static void prep_timeout(struct ring *r)
+{
+	static struct __kernel_timespec ts = { .tv_nsec = 100000000 };
+	struct io_uring_sqe *sqe = ring_get_sqe(r);
+
+	if (!sqe)
+		error(1, 0, "submission queue full");
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->addr = (unsigned long)&ts;
+	sqe->len = 1;
+	sqe->user_data = TIMEOUT_DATA;
+}
+
+/* Returns true if @cqe belonged to the timeout, which is re-armed */
+static bool handle_timeout(struct ring *r, struct io_uring_cqe *cqe)
+{
+	if (cqe->user_data != TIMEOUT_DATA)
+		return false;
+
+	prep_timeout(r);
+	ring_cqe_seen(r);
+	return true;
+}
+
+static void drain(int fd)
+{
+	char buf[4096];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+}
+
+static void *writer_fn(void *arg)
+{
+	int *fds = arg;
+	int i;
+
+	while (!stop)
+		for (i = 0; i < cfg_nr_fds && !stop; i++)
+			if (write(fds[i], "x", 1) < 0 && errno != EAGAIN)
+				error(1, errno, "write");
+	return NULL;
+}
+
+static unsigned long poll_epoll(int *fds)
+{
+	struct epoll_event events[64], ev = { .events = EPOLLIN };
+	unsigned long nr_events = 0;
+	int epfd, i, n;
+
+	epfd = epoll_create1(0);
+	if (epfd < 0)
+		error(1, errno, "epoll_create1");
+
+	for (i = 0; i < cfg_nr_fds; i++) {
+		ev.data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev))
+			error(1, errno, "epoll_ctl");
+	}
+
+	while (!stop) {
+		n = epoll_wait(epfd, events, 64, 100);
+		if (n < 0 && errno != EINTR)
+			error(1, errno, "epoll_wait");
+		for (i = 0; i < n; i++)
+			drain(fds[events[i].data.u32]);
+		if (n > 0)
+			nr_events += n;
+	}
+
+	close(epfd);
+	return nr_events;
+}
+
+static unsigned long poll_uring(int *fds, bool multishot)
+{
+	unsigned long nr_events = 0;
+	struct io_uring_cqe *cqe;
+	struct ring r;
+	int i;
+
+	ring_init(&r);
+
+	prep_timeout(&r);
+	for (i = 0; i < cfg_nr_fds; i++)
+		prep_poll(&r, fds[i], i, multishot);
+
+	while (!stop) {
+		ring_submit_and_wait(&r);
+
+		while ((cqe = ring_peek_cqe(&r))) {
+			if (handle_timeout(&r, cqe))
+				continue;
+			i = cqe->user_data;
+			if (cqe->res < 0)
+				error(1, -cqe->res, "poll");
+			drain(fds[i]);
+			nr_events++;
+			/* one-shot, or a multishot poll that was terminated */
+			if (!(cqe->flags & IORING_CQE_F_MORE))
+				prep_poll(&r, fds[i], i, multishot);
+			ring_cqe_seen(&r);
+		}
+	}
+
+	ring_exit(&r);
+	return nr_events;
+}
+
+static unsigned long run_poll(int mode)
+{
+	int pairs[MAX_FDS][2], readers[MAX_FDS], writers[MAX_FDS];
+	unsigned long nr_events;
+	pthread_t writer;
+	int i;
+
+	for (i = 0; i < cfg_nr_fds; i++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0,
+			       pairs[i]))
+			error(1, errno, "socketpair");
+		readers[i] = pairs[i][0];
+		writers[i] = pairs[i][1];
+	}
+
+	stop = false;
+	if (pthread_create(&writer, NULL, writer_fn, writers))
+		error(1, 0, "pthread_create");
+
+	switch (mode) {
+	case MODE_EPOLL:
+		nr_events = poll_epoll(readers);
+		break;
+	default:
+		nr_events = poll_uring(readers, mode == MODE_MULTISHOT);
+		break;
+	}
+
+	pthread_join(writer, NULL);
+	for (i = 0; i < cfg_nr_fds; i++) {
+		close(pairs[i][0]);
+		close(pairs[i][1]);
+	}
+
+	return nr_events;
+}
+
+static struct sockaddr_in listen_addr;
+
+static void *connector_fn(void *arg)
+{
+	struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+	int fd;
+
+	while (!stop) {
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0)
+			error(1, errno, "socket");
+		/* reset on close, so that no ports are held in TIME_WAIT */
+		if (setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger,
+			       sizeof(linger)))
+			error(1, errno, "SO_LINGER");
+		if (connect(fd, (void *)&listen_addr, sizeof(listen_addr)) &&
+		    errno != ECONNREFUSED && errno != EAGAIN)
+			error(1, errno, "connect");
+		close(fd);
+	}
+	return NULL;
+}
+
+static unsigned long accept_epoll(int lfd)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	unsigned long nr_accepts = 0;
+	int epfd, fd, n;
+
+	epfd = epoll_create1(0);
+	if (epfd < 0)
+		error(1, errno, "epoll_create1");
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev))
+		error(1, errno, "epoll_ctl");
+
+	while (!stop) {
+		n = epoll_wait(epfd, &ev, 1, 100);
+		if (n < 0 && errno != EINTR)
+			error(1, errno, "epoll_wait");
+		if (n <= 0)
+			continue;
+		while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+			close(fd);
+			nr_accepts++;
+		}
+		if (errno != EAGAIN && errno != ECONNABORTED)
+			error(1, errno, "accept4");
+	}
+
+	close(epfd);
+	return nr_accepts;
+}
+
+static unsigned long accept_uring(int lfd, bool multishot)
+{
+	unsigned long nr_accepts = 0;
+	struct io_uring_cqe *cqe;
+	struct ring r;
+	int i;
+
+	ring_init(&r);
+
+	prep_timeout(&r);
+	/* a few one-shot requests in flight, so the backlog keeps draining */
+	for (i = 0; i < (multishot ? 1 : 32); i++)
+		prep_accept(&r, lfd, multishot);
+
+	while (!stop) {
+		ring_submit_and_wait(&r);
+
+		while ((cqe = ring_peek_cqe(&r))) {
+			if (handle_timeout(&r, cqe))
+				continue;
+			if (cqe->res >= 0) {
+				close(cqe->res);
+				nr_accepts++;
+			} else if (cqe->res != -ECONNABORTED) {
+				error(1, -cqe->res, "accept");
+			}
+			if (!(cqe->flags & IORING_CQE_F_MORE))
+				prep_accept(&r, lfd, multishot);
+			ring_cqe_seen(&r);
+		}
+	}
+
+	ring_exit(&r);
+	return nr_accepts;
+}
+
+static unsigned long run_accept(int mode)
+{
+	pthread_t connectors[MAX_CONNECTORS];
+	socklen_t len = sizeof(listen_addr);
+	unsigned long nr_accepts;
+	int lfd, i;
+
+	lfd = socket(AF_INET, SOCK_STREAM |
+		     (mode == MODE_EPOLL ? SOCK_NONBLOCK : 0), 0);
+	if (lfd < 0)
+		error(1, errno, "socket");
+
+	memset(&listen_addr, 0, sizeof(listen_addr));
+	listen_addr.sin_family = AF_INET;
+	listen_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(lfd, (void *)&listen_addr, sizeof(listen_addr)))
+		error(1, errno, "bind");
+	if (getsockname(lfd, (void *)&listen_addr, &len))
+		error(1, errno, "getsockname");
+	if (listen(lfd, 4096))
+		error(1, errno, "listen");
+
+	stop = false;
+	for (i = 0; i < cfg_connectors; i++)
+		if (pthread_create(&connectors[i], NULL, connector_fn, NULL))
+			error(1, 0, "pthread_create");
+
+	switch (mode) {
+	case MODE_EPOLL:
+		nr_accepts = accept_epoll(lfd);
+		break;
+	default:
+		nr_accepts = accept_uring(lfd, mode == MODE_MULTISHOT);
+		break;
+	}
+
+	/* unblock connectors that are stuck on a full backlog */
+	shutdown(lfd, SHUT_RDWR);
+	for (i = 0; i < cfg_connectors; i++)
+		pthread_join(connectors[i], NULL);
+	close(lfd);
+
+	return nr_accepts;
+}
+
+static void *timer_fn(void *arg)
+{
+	sleep(cfg_duration);
+	stop = true;
+	return NULL;
+}
+
+static void run(int type, int mode)
+{
+	unsigned long nr;
+	pthread_t timer;
+	double start;
+
+	stop = false;
+	start = now();
+	if (pthread_create(&timer, NULL, timer_fn, NULL))
+		error(1, 0, "pthread_create");
+
+	nr = type == TEST_POLL ? run_poll(mode) : run_accept(mode);
+	pthread_join(timer, NULL);
+
+	fprintf(stderr, "%-7s %-10s %12.0f %s/s\n", test_names[type],
+		mode_names[mode], nr / (now() - start),
+		type == TEST_POLL ? "events" : "accepts");
+}
+
+static int parse_name(const char * const *names, int nr, const char *arg)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (!strcmp(names[i], arg))
+			return i;
+
+	error(1, 0, "unknown argument: %s", arg);
+	return -1;
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "t:m:n:c:d:")) != -1) {
+		switch (c) {
+		case 't':
+			cfg_type = parse_name(test_names, NR_TESTS, optarg);
+			break;
+		case 'm':
+			cfg_mode = parse_name(mode_names, NR_MODES, optarg);
+			break;
+		case 'n':
+			cfg_nr_fds = atoi(optarg);
+			break;
+		case 'c':
+			cfg_connectors = atoi(optarg);
+			break;
+		case 'd':
+			cfg_duration = atoi(optarg);
+			break;
+		default:
+			error(1, 0, "usage: %s [-t poll|accept] [-m epoll|oneshot|multishot] [-n nr_fds] [-c connectors] [-d seconds]",
+			      argv[0]);
+		}
+	}
+
+	if (cfg_nr_fds < 1 || cfg_nr_fds > MAX_FDS)
+		error(1, 0, "nr_fds must be between 1 and %d", MAX_FDS);
+	if (cfg_connectors < 1 || cfg_connectors > MAX_CONNECTORS)
+		error(1, 0, "connectors must be between 1 and %d",
+		      MAX_CONNECTORS);
+	if (cfg_duration < 1)
+		error(1, 0, "duration must be at least one second");
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit rlim = { .rlim_cur = 3 * MAX_FDS, .rlim_max = 3 * MAX_FDS };
+	int type, mode;
+
+	parse_opts(argc, argv);
+
+	/* socket pairs for the poll test, two fds each */
+	setrlimit(RLIMIT_NOFILE, &rlim);
+
+	for (type = 0; type < NR_TESTS; type++) {
+		if (cfg_type >= 0 && type != cfg_type)
+			continue;
+		for (mode = 0; mode < NR_MODES; mode++) {
+			if (cfg_mode >= 0 && mode != cfg_mode)
+				continue;
+			run(type, mode);
+		}
+	}
+
+	return 0;
+}
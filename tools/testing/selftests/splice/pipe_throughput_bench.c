@@ -0,0 +1,260 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Measure pipe throughput from a writer process to a reader process.
+ *
+ * The writer fills a block of memory and pushes it into the pipe, the
+ * reader read()s it back out into its own buffer. The reported rate is the
+ * number of bytes that made it through the pipe per second.
+ *
+ * -m picks how the writer pushes data: "write" is plain write(2),
+ * "vmsplice" maps the block into the pipe without SPLICE_F_GIFT, and
+ * "detach" uses vmsplice() with SPLICE_F_DETACH, which moves the pages
+ * into the pipe and unmaps them from the writer. Pipes of 1MB and up use
+ * large buffers for write(), so compare -s 65536 with the default. Usage:
+ *
+ *   pipe_throughput_bench [-m write|vmsplice|detach] [-s pipe_size]
+ *                         [-b block_size] [-d seconds]
+ *
+ * Without -m, every mode is run in turn. Modes the running kernel doesn't
+ * support are reported as skipped.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SPLICE_F_DETACH
+#define SPLICE_F_DETACH		0x10
+#endif
+
+enum { MODE_WRITE, MODE_VMSPLICE, MODE_DETACH, NR_MODES };
+
+static const char * const mode_names[NR_MODES] = {
+	"write", "vmsplice", "detach"
+};
+
+static int cfg_mode = -1;
+static long cfg_pipe_size = 1 << 20;
+static long cfg_block_size = 1 << 16;
+static int cfg_duration = 5;
+
+static volatile bool stop;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sig_alarm(int sig)
+{
+	stop = true;
+}
+
+static void reader(int fd)
+{
+	char *buf;
+
+	buf = malloc(cfg_block_size);
+	if (!buf)
+		error(1, errno, "malloc");
+
+	while (read(fd, buf, cfg_block_size) > 0)
+		;
+
+	free(buf);
+	exit(0);
+}
+
+/* Push one block into the pipe, returns false on EINTR */
+static bool push(int fd, int mode, char *buf, size_t len)
+{
+	struct iovec iov;
+	ssize_t ret;
+
+	while (len) {
+		if (mode == MODE_WRITE) {
+			ret = write(fd, buf, len);
+		} else {
+			iov.iov_base = buf;
+			iov.iov_len = len;
+			ret = vmsplice(fd, &iov, 1,
+				       mode == MODE_DETACH ? SPLICE_F_DETACH : 0);
+		}
+		if (ret < 0) {
+			if (errno == EINTR)
+				return false;
+			error(1, errno, "%s", mode_names[mode]);
+		}
+		buf += ret;
+		len -= ret;
+	}
+
+	return true;
+}
+
+/* Returns false if the running kernel doesn't support the mode */
+static bool probe(int mode)
+{
+	struct iovec iov;
+	int fds[2];
+	char *buf;
+	bool ret = true;
+
+	if (mode != MODE_DETACH)
+		return true;
+
+	buf = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED)
+		error(1, errno, "mmap");
+	if (pipe(fds))
+		error(1, errno, "pipe");
+
+	buf[0] = 1;
+	iov.iov_base = buf;
+	iov.iov_len = getpagesize();
+	if (vmsplice(fds[1], &iov, 1, SPLICE_F_DETACH) < 0) {
+		if (errno != EINVAL)
+			error(1, errno, "vmsplice");
+		ret = false;
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+	munmap(buf, getpagesize());
+	return ret;
+}
+
+static void run(int mode)
+{
+	struct sigaction sa = { .sa_handler = sig_alarm };
+	unsigned long long bytes = 0;
+	double start, elapsed;
+	long pipe_size;
+	int fds[2];
+	char *buf;
+	pid_t pid;
+
+	if (!probe(mode)) {
+		fprintf(stderr, "%-8s %12s\n", mode_names[mode], "skipped");
+		return;
+	}
+
+	if (pipe(fds))
+		error(1, errno, "pipe");
+
+	pipe_size = fcntl(fds[1], F_SETPIPE_SZ, cfg_pipe_size);
+	if (pipe_size < 0)
+		error(1, errno, "F_SETPIPE_SZ");
+
+	pid = fork();
+	if (pid < 0)
+		error(1, errno, "fork");
+	if (!pid) {
+		close(fds[1]);
+		reader(fds[0]);
+	}
+	close(fds[0]);
+
+	/* vmsplice needs page aligned memory to detach whole pages */
+	buf = mmap(NULL, cfg_block_size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED)
+		error(1, errno, "mmap");
+
+	if (sigaction(SIGALRM, &sa, NULL))
+		error(1, errno, "sigaction");
+
+	stop = false;
+	alarm(cfg_duration);
+	start = now();
+
+	while (!stop) {
+		/* Detached pages are gone, so every mode produces its data */
+		memset(buf, bytes, cfg_block_size);
+		if (!push(fds[1], mode, buf, cfg_block_size))
+			break;
+		bytes += cfg_block_size;
+	}
+
+	elapsed = now() - start;
+	close(fds[1]);
+	waitpid(pid, NULL, 0);
+	munmap(buf, cfg_block_size);
+
+	fprintf(stderr, "%-8s %8ld %12.1f MB/s\n", mode_names[mode],
+		pipe_size, bytes / elapsed / (1 << 20));
+}
+
+static long parse_size(const char *arg)
+{
+	long size = atol(arg);
+
+	if (size < getpagesize() || size % getpagesize())
+		error(1, 0, "size must be a multiple of the page size: %s", arg);
+	return size;
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c, i;
+
+	while ((c = getopt(argc, argv, "m:s:b:d:")) != -1) {
+		switch (c) {
+		case 'm':
+			for (i = 0; i < NR_MODES; i++)
+				if (!strcmp(mode_names[i], optarg))
+					break;
+			if (i == NR_MODES)
+				error(1, 0, "unknown mode: %s", optarg);
+			cfg_mode = i;
+			break;
+		case 's':
+			cfg_pipe_size = parse_size(optarg);
+			break;
+		case 'b':
+			cfg_block_size = parse_size(optarg);
+			break;
+		case 'd':
+			cfg_duration = atoi(optarg);
+			if (cfg_duration < 1)
+				error(1, 0, "invalid duration: %s", optarg);
+			break;
+		default:
+			error(1, 0, "usage: %s [-m write|vmsplice|detach] [-s pipe_size] [-b block_size] [-d seconds]",
+			      argv[0]);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int mode;
+
+	parse_opts(argc, argv);
+
+	fprintf(stderr, "pipe size: %ld, block size: %ld, duration: %ds\n",
+		cfg_pipe_size, cfg_block_size, cfg_duration);
+
+	for (mode = 0; mode < NR_MODES; mode++) {
+		if (cfg_mode >= 0 && mode != cfg_mode)
+			continue;
+		run(mode);
+	}
+
+	return 0;
+}
@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * move_pages() throughput benchmark.
+ *
+ * Faults in an anonymous buffer on one node and moves it back and forth
+ * between two nodes with move_pages(), reporting pages and bytes per second
+ * for each direction. migrate_pages() unmaps pages in batches that share a
+ * single TLB flush, so running this with several threads that keep the mm
+ * active on other CPUs shows how much of the cost is TLB shootdowns.
+ *
+ * Skips on machines with fewer than two memory nodes.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../kselftest.h"
+
+#define MPOL_MF_MOVE		(1 << 1)
+#define DEFAULT_SIZE_MB		256
+#define DEFAULT_ROUNDS		4
+
+static volatile bool stop;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long move_pages(int pid, unsigned long count, void **pages,
+		       const int *nodes, int *status, int flags)
+{
+	return syscall(SYS_move_pages, pid, count, pages, nodes, status,
+		       flags);
+}
+
+/* Find two online nodes with memory by asking where a page can go */
+static int find_nodes(void *page, int *from, int *to)
+{
+	int node, status, found = 0;
+
+	for (node = 0; node < 1024 && found < 2; node++) {
+		if (move_pages(0, 1, &page, &node, &status, MPOL_MF_MOVE))
+			continue;
+		if (status != node)
+			continue;
+		if (!found++)
+			*from = node;
+		else
+			*to = node;
+	}
+
+	return found == 2 ? 0 : -1;
+}
+
+/* Keep the mm active on another CPU, like a multi-threaded application */
+static void *spinner_fn(void *arg)
+{
+	while (!stop)
+		;
+	return NULL;
+}
+
+static int move_all(void **pages, int *nodes, int *status,
+		    unsigned long nr_pages, int node, double *seconds)
+{
+	unsigned long i;
+	double start;
+
+	for (i = 0; i < nr_pages; i++)
+		nodes[i] = node;
+
+	start = now();
+	if (move_pages(0, nr_pages, pages, nodes, status, MPOL_MF_MOVE)) {
+		perror("move_pages");
+		return -1;
+	}
+	*seconds = now() - start;
+
+	for (i = 0; i < nr_pages; i++) {
+		if (status[i] != node) {
+			fprintf(stderr, "page %lu: status %d\n", i, status[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long size = DEFAULT_SIZE_MB << 20, nr_pages, i;
+	int rounds = DEFAULT_ROUNDS, nr_threads = 0;
+	long page_size = sysconf(_SC_PAGESIZE);
+	int from = -1, to = -1, opt, round, ret = KSFT_FAIL;
+	pthread_t *threads = NULL;
+	int *nodes, *status;
+	double seconds;
+	void **pages;
+	char *buf;
+
+	while ((opt = getopt(argc, argv, "m:r:t:")) != -1) {
+		switch (opt) {
+		case 'm':
+			size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-m MB] [-r rounds] [-t spinning threads]\n",
+				argv[0]);
+			return KSFT_FAIL;
+		}
+	}
+
+	nr_pages = size / page_size;
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	pages = calloc(nr_pages, sizeof(*pages));
+	nodes = calloc(nr_pages, sizeof(*nodes));
+	status = calloc(nr_pages, sizeof(*status));
+	if (buf == MAP_FAILED || !pages || !nodes || !status) {
+		perror("alloc");
+		return KSFT_FAIL;
+	}
+
+	memset(buf, 1, size);
+	for (i = 0; i < nr_pages; i++)
+		pages[i] = buf + i * page_size;
+
+	if (find_nodes(pages[0], &from, &to)) {
+		printf("move_pages_benchmark: needs two memory nodes\n");
+		return KSFT_SKIP;
+	}
+
+	if (nr_threads > 0) {
+		threads = calloc(nr_threads, sizeof(*threads));
+		if (!threads)
+			return KSFT_FAIL;
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_create(&threads[i], NULL, spinner_fn, NULL))
+				return KSFT_FAIL;
+	}
+
+	/* Start from a known node */
+	if (move_all(pages, nodes, status, nr_pages, from, &seconds))
+		goto out;
+
+	printf("%lu MB, %lu pages, node %d <-> node %d, %d spinning threads\n",
+	       size >> 20, nr_pages, from, to, nr_threads);
+
+	for (round = 0; round < rounds; round++) {
+		double there, back;
+
+		if (move_all(pages, nodes, status, nr_pages, to, &there) ||
+		    move_all(pages, nodes, status, nr_pages, from, &back))
+			goto out;
+
+		printf("round %d: %d->%d %.0f pages/s %.2f GB/s, %d->%d %.0f pages/s %.2f GB/s\n",
+		       round, from, to, nr_pages / there, size / there / 1e9,
+		       to, from, nr_pages / back, size / back / 1e9);
+	}
+
+	ret = KSFT_PASS;
+out:
+	stop = true;
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	return ret;
+}